@@ -0,0 +1,37 @@
+#!/bin/sh
+# Compares exec-to-exit times of the separately built, dynamically linked
+# open, z and colorpath with the static multi-call file-opener, built the
+# way build.sh builds them.
+#
+#   exec-startup.sh [runs]
+#
+# Run it from inside a git repository to include colorpath's git segments;
+# z is only measured when ZSHZ_LOCATION is set.
+
+set -e
+
+runs=${1:-1000}
+root=$(cd "$(dirname "$0")/.." && pwd)
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+
+cflags="-march=native -flto -Ofast -mtune=native"
+gcc -O2 -o "$out/exec-time" "$root/bench/exec-time.c"
+mkdir "$out/dynamic" "$out/static"
+gcc $cflags -o "$out/dynamic/open" "$root/open.c"
+gcc $cflags -o "$out/dynamic/z" "$root/z.c" "$root/gitrepo.c"
+gcc $cflags -o "$out/dynamic/colorpath" "$root/colorpath.c" "$root/gitrepo.c" \
+    "$root/gitobj.c" "$root/gitindex.c" -lz
+(cd "$root" && gcc $cflags -static -DFILEOPENER_MULTICALL -o "$out/static/file-opener" \
+    multicall.c open.c z.c colorpath.c gitrepo.c gitobj.c gitindex.c -lz 2>/dev/null)
+for name in open z colorpath; do
+    ln -s file-opener "$out/static/$name"
+done
+
+for kind in dynamic static; do
+    "$out/exec-time" -n "$runs" "$out/$kind/colorpath"
+    "$out/exec-time" -n "$runs" "$out/$kind/open" --classify "$PWD"
+    if [ -n "$ZSHZ_LOCATION" ]; then
+        "$out/exec-time" -n "$runs" "$out/$kind/z"
+    fi
+done
@@ -0,0 +1,118 @@
+// Measures how long a program takes from execve to exit, which for the
+// prompt helpers is mostly the dynamic loader and libc start-up.
+//
+//   exec-time [-n runs] [-i input] [-t] program [args...]
+//
+// The program's output goes to /dev/null and its input comes from input or
+// /dev/null. Prints the minimum, median, 99th percentile and mean in
+// microseconds and the largest resident set of any run. With -t only the
+// median and the resident set are printed, tab separated, for scripts.
+// Build with `gcc -O2 -o exec-time exec-time.c` and compare e.g.
+// `exec-time ./colorpath` with `exec-time ./file-opener colorpath`, or run
+// exec-startup.sh.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+extern char **environ;
+
+
+static long long nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+static int compare(const void* a, const void* b) {
+    long long x = *(const long long*)a;
+    long long y = *(const long long*)b;
+    return (x > y) - (x < y);
+}
+
+
+int main(int argc, char **argv) {
+    int runs = 1000;
+    const char *input = "/dev/null";
+    int terse = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "+n:i:t")) != -1) {
+        switch (opt) {
+        case 'n':
+            runs = atoi(optarg);
+            break;
+        case 'i':
+            input = optarg;
+            break;
+        case 't':
+            terse = 1;
+            break;
+        default:
+            runs = 0;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+    if (argc < 2 || runs < 1) {
+        fprintf(stderr, "usage: exec-time [-n runs] [-i input] [-t] program [args...]\n");
+        return 1;
+    }
+
+    int null = open("/dev/null", O_WRONLY);
+    long long *times = malloc(runs * sizeof(long long));
+    if (null == -1 || times == NULL) {
+        perror("exec-time");
+        return 1;
+    }
+
+    long long total = 0;
+    long maxRss = 0;
+    for (int i = 0; i < runs; i++) {
+        int in = open(input, O_RDONLY);
+        if (in == -1) {
+            perror(input);
+            return 1;
+        }
+
+        long long start = nowNs();
+        pid_t pid = fork();
+        if (pid == 0) {
+            dup2(in, 0);
+            dup2(null, 1);
+            execve(argv[1], argv + 1, environ);
+            _exit(127);
+        }
+        int status;
+        struct rusage usage;
+        if (pid == -1 || wait4(pid, &status, 0, &usage) == -1) {
+            perror("exec-time");
+            return 1;
+        }
+        times[i] = nowNs() - start;
+        total += times[i];
+        close(in);
+        if (usage.ru_maxrss > maxRss) {
+            maxRss = usage.ru_maxrss;
+        }
+
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 127) {
+            fprintf(stderr, "exec-time: could not run %s\n", argv[1]);
+            return 1;
+        }
+    }
+
+    qsort(times, runs, sizeof(long long), compare);
+    if (terse) {
+        printf("%.1f\t%ld\n", times[runs / 2] / 1e3, maxRss);
+    } else {
+        printf("%-40s min %8.1f  p50 %8.1f  p99 %8.1f  mean %8.1f us  rss %6ld kB\n", argv[1],
+               times[0] / 1e3, times[runs / 2] / 1e3, times[(runs * 99) / 100] / 1e3,
+               total / 1e3 / runs, maxRss);
+    }
+    return 0;
+}
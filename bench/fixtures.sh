@@ -0,0 +1,91 @@
+#!/bin/sh
+# Generates fixtures for the benchmarks.
+#
+#   fixtures.sh datafile <datafile> <entries> <dir>
+#   fixtures.sh tree <dir> <depth> [repo-every]
+#   fixtures.sh paths <file> <count> <dir>
+#
+# datafile writes a z datafile with <entries> directories and creates them
+# below <dir>, a hundred per level.
+#
+# tree creates a chain of <depth> directories below <dir> with a repository
+# (one commit, one modified and one untracked file) every <repo-every>
+# levels, 8 by default, and prints the innermost directory.
+#
+# paths writes <count> inputs for open to <file> ("-" for stdout): files
+# below <dir> with extensions of every category, file:// URLs, relative
+# names, web URLs, magnet links and <dir> itself.
+
+set -e
+
+usage() {
+    sed -n '4,6s/^# //p' "$0" >&2
+    exit 1
+}
+
+datafile() {
+    file=$1 entries=$2 dir=$3
+    awk -v entries="$entries" -v dir="$dir" -v now="$(date +%s)" '
+    BEGIN {
+        for (i = 0; i < entries; i++)
+            printf "%s/d%02d/d%02d/entry%d|%d|%d\n", dir, int(i / 10000) % 100,
+                   int(i / 100) % 100, i, (i * 7919) % 9973 + 1, now - i
+    }' > "$file"
+    cut -d'|' -f1 "$file" | xargs mkdir -p
+}
+
+tree() {
+    dir=$1 depth=$2 every=${3:-8}
+    path=$dir
+    mkdir -p "$path"
+    level=1
+    while [ "$level" -le "$depth" ]; do
+        path=$(printf '%s/level%02d' "$path" "$level")
+        mkdir -p "$path"
+        if [ $((level % every)) -eq 0 ]; then
+            git init -q "$path"
+            echo tracked > "$path/tracked"
+            git -C "$path" add tracked
+            git -C "$path" -c user.name=Fixture -c user.email=fixture@example.com \
+                commit -q -m initial
+            echo modified > "$path/tracked"
+            : > "$path/untracked"
+        fi
+        level=$((level + 1))
+    done
+    echo "$path"
+}
+
+paths() {
+    file=$1 count=$2 dir=$3
+    [ "$file" = - ] && file=/dev/stdout
+    awk -v count="$count" -v dir="$dir" '
+    BEGIN {
+        n = split("mkv mp4 flac opus pdf epub html svg jpg png webp odt docx xlsx o pyc lock txt c h md JPG Mp4", ext, " ")
+        n_sub = split("src docs build music src/two/alpha docs/one/beta/leaf", sub_, " ")
+        for (i = 0; i < count; i++) {
+            if (i % 50 == 0)
+                printf "https://example.com/watch?v=%d\n", i
+            else if (i % 97 == 0)
+                printf "magnet:?xt=urn:btih:%040d\n", i
+            else if (i % 31 == 0)
+                printf "%s\n", dir
+            else if (i % 13 == 0)
+                printf "file://%s/%s/some%%20file%d.%s\n", dir, sub_[i % n_sub + 1], i, ext[i % n + 1]
+            else if (i % 3 == 0)
+                printf "relative/name %d.%s\n", i, ext[i % n + 1]
+            else
+                printf "%s/%s/file-%d.%s\n", dir, sub_[i % n_sub + 1], i, ext[i % n + 1]
+        }
+    }' > "$file"
+}
+
+[ $# -ge 3 ] || usage
+command=$1
+shift
+case $command in
+    datafile) [ $# -eq 3 ] || usage; datafile "$@" ;;
+    tree) tree "$@" ;;
+    paths) [ $# -eq 3 ] || usage; paths "$@" ;;
+    *) usage ;;
+esac
@@ -0,0 +1,86 @@
+#!/bin/sh
+# Builds a repository for exercising colorpath's git segments.
+#
+#   make-repo.sh <dir> [history] [ahead] [behind]
+#
+# <history> commits are shared by the branch "feature/prompt" and its
+# upstream origin/feature/prompt, every 1000th of them an octopus merge.
+# The shared history is written to the commit-graph. After it the branch
+# has <ahead> and the upstream <behind> commits of their own, which stay
+# loose objects the way fresh commits do. With LOOSE_ONLY=1 no
+# commit-graph is written and the shared history is unpacked as well. With
+# NO_GRAPH=1 no commit-graph is written and everything ends up packed, as
+# in a fresh clone.
+# Prints the expected "ahead behind" when done.
+
+set -e
+
+dir=${1:?usage: make-repo.sh <dir> [history] [ahead] [behind]}
+history=${2:-10000}
+ahead=${3:-3}
+behind=${4:-5}
+
+rm -rf "$dir"
+git init -q "$dir"
+cd "$dir"
+git config user.name Fixture
+git config user.email fixture@example.com
+
+awk -v history="$history" '
+function commit(ref, mark, file, parents) {
+    printf "commit %s\nmark :%d\n", ref, mark
+    printf "committer Fixture <fixture@example.com> %d +0000\n", 1700000000 + mark
+    printf "data %d\ncommit %d\n%s", length("commit " mark), mark, parents
+    printf "M 644 inline %s\ndata %d\n%d\n\n", file, length(mark ""), mark
+}
+BEGIN {
+    mark = 0
+    tip = 0
+    for (i = 1; i <= history; i++) {
+        if (i % 1000 == 0) {
+            merges = ""
+            for (side = 1; side <= 2; side++) {
+                commit("refs/heads/side" side, ++mark, "side" side, "from :" tip "\n")
+                merges = merges "merge :" mark "\n"
+            }
+            commit("refs/heads/shared", ++mark, "file" (i % 100), "from :" tip "\n" merges)
+        } else {
+            commit("refs/heads/shared", ++mark, "file" (i % 100), tip ? "from :" tip "\n" : "")
+        }
+        tip = mark
+    }
+}' | git fast-import --quiet
+
+if [ -n "$LOOSE_ONLY" ]; then
+    for pack in .git/objects/pack/*.pack; do
+        mv "$pack" "$pack.tmp"
+        git unpack-objects -q < "$pack.tmp"
+        rm -f "$pack.tmp" "${pack%.pack}.idx"
+    done
+elif [ -z "$NO_GRAPH" ]; then
+    git commit-graph write --reachable
+fi
+
+# commit-tree writes loose objects
+base=$(git rev-parse shared)
+tree=$(git rev-parse "shared^{tree}")
+local=$base
+for i in $(seq 1 "$ahead"); do
+    local=$(git commit-tree "$tree" -p "$local" -m "ahead $i")
+done
+upstream=$base
+for i in $(seq 1 "$behind"); do
+    upstream=$(git commit-tree "$tree" -p "$upstream" -m "behind $i")
+done
+
+git update-ref refs/heads/feature/prompt "$local"
+git update-ref refs/remotes/origin/feature/prompt "$upstream"
+git symbolic-ref HEAD refs/heads/feature/prompt
+git config branch.feature/prompt.remote origin
+git config branch.feature/prompt.merge refs/heads/feature/prompt
+git reset -q --hard
+if [ -n "$NO_GRAPH" ]; then
+    git repack -q -a -d
+fi
+
+echo "$ahead $behind"
@@ -0,0 +1,95 @@
+#!/bin/sh
+# The workload build.sh's pgo target trains on and times.
+#
+#   pgo-workload.sh <bindir> <fixture>
+#
+# Runs open, z and colorpath from <bindir> against the fixture, which is
+# created on the first run:
+#
+# - a directory tree four levels deep with repositories nested at several
+#   levels, some with staged, modified and untracked files;
+# - a z datafile listing every directory of the tree and a few that are
+#   gone;
+# - 10000 inputs for open, mostly files with extensions of every category
+#   but also URLs, magnet links and directories.
+#
+# colorpath renders a prompt for every directory once per process and ten
+# times through --serve. z lists the datafile ten times. open only classifies
+# its inputs with --classify, so no opener is ever launched.
+
+set -e
+
+bin=${1:?usage: pgo-workload.sh <bindir> <fixture>}
+fixture=${2:?usage: pgo-workload.sh <bindir> <fixture>}
+bench=$(cd "$(dirname "$0")" && pwd)
+
+export HOME="$fixture/tree"
+export XDG_CACHE_HOME="$fixture/cache"
+export ZSHZ_LOCATION="$fixture/z"
+export ZSHZ_PRUNE_AFTER=1000000000
+export _FILE_OPENER_MULTIMEDIA_FORMATS=mkv,mp4,webm,avi,mov,mp3,flac,ogg,opus,wav,m4a
+export _FILE_OPENER_BOOK_FORMATS=pdf,epub,djvu,cbz,mobi
+export _FILE_OPENER_WEB_FORMATS=html,htm,svg
+export _FILE_OPENER_PICTURE_FORMATS=jpg,jpeg,png,gif,webp,bmp,tiff
+export _FILE_OPENER_LIBREOFFICE_FORMATS=odt,ods,odp,doc,docx,xls,xlsx,ppt,pptx
+export _FILE_OPENER_EXCLUDE_SUFFIXES=o,so,a,pyc,class,lock
+unset WAYLAND_DISPLAY GIT_DIR GIT_WORK_TREE
+
+commit() {
+    git -C "$1" -c user.name=Fixture -c user.email=fixture@example.com \
+        commit -q --allow-empty -m "$2"
+}
+
+if [ ! -d "$fixture/tree" ]; then
+    mkdir -p "$fixture/tree" "$fixture/cache"
+    cd "$fixture/tree"
+    for a in src docs build music media notes; do
+        for b in one two three four five six; do
+            for c in alpha beta gamma delta epsilon zeta; do
+                mkdir -p "$a/$b/$c/leaf"
+                : > "$a/$b/$c/leaf/file.txt"
+            done
+        done
+    done
+
+    # repositories at the top, in the middle and nested in each other
+    for repo in src src/two docs/one/beta build/three/gamma/leaf music/five; do
+        git init -q "$repo"
+        git -C "$repo" add -A
+        commit "$repo" initial
+    done
+    echo change > src/one/alpha/leaf/file.txt
+    echo staged > docs/one/beta/new.txt
+    git -C docs/one/beta add new.txt
+    : > build/three/gamma/leaf/untracked.o
+    printf '*.o\n' > build/three/gamma/leaf/.gitignore
+
+    find "$fixture/tree" -name .git -prune -o -type d -print > "$fixture/dirs"
+
+    awk -v now="$(date +%s)" '
+    { printf "%s|%d|%d\n", $0, (NR * 7919) % 500 + 1, now - NR * 60 }
+    END {
+        for (i = 0; i < 20; i++)
+            printf "/nonexistent/gone%d|%d|%d\n", i, i + 1, now - 86400
+    }' "$fixture/dirs" > "$fixture/z"
+
+    mkdir "$fixture/inputs"
+    sh "$bench/fixtures.sh" paths - 10000 "$fixture/tree" | split -l 1000 - "$fixture/inputs/"
+fi
+
+cd "$fixture/tree"
+
+while read -r dir; do
+    PWD=$dir "$bin/colorpath" > /dev/null
+done < "$fixture/dirs"
+for run in 1 2 3 4 5 6 7 8 9 10; do
+    cat "$fixture/dirs"
+done | awk '{ printf "%d %s\n", NR, $0 }' | "$bin/colorpath" --serve > /dev/null
+
+for run in 1 2 3 4 5 6 7 8 9 10; do
+    "$bin/z" > /dev/null
+done
+
+for inputs in "$fixture/inputs/"*; do
+    "$bin/open" --classify < "$inputs" > /dev/null
+done
@@ -0,0 +1,111 @@
+#!/bin/sh
+# Sweeps the size of the input of z, colorpath and open and reports how
+# their run time, throughput and memory grow.
+#
+#   scaling.sh <bindir> <workdir>
+#
+# The sizes can be changed through the environment:
+#
+#   ENTRIES  z datafile entries      (1000 10000 100000, add 1000000 if the
+#                                     disk can take a million directories)
+#   DEPTHS   colorpath directory depth, a repository every 8 levels
+#                                    (1 2 4 8 16 32 64)
+#   INPUTS   open --classify inputs   (10 100 1000 10000 100000)
+#   RUNS     runs per size            (5)
+#
+# Every row holds the median run time, the items (entries, levels or
+# inputs) handled per second and the largest resident set. A row is marked
+# TRUNCATED when the output was cut short: z listing fewer directories
+# than the datafile has, colorpath not ending in the innermost directory or
+# open classifying fewer inputs than it was given. The rows are also
+# written to <workdir>/scaling.tsv, and plotted to <workdir>/scaling.png if
+# gnuplot is installed.
+
+set -e
+
+bin=$(cd "${1:?usage: scaling.sh <bindir> <workdir>}" && pwd)
+work=${2:?usage: scaling.sh <bindir> <workdir>}
+bench=$(cd "$(dirname "$0")" && pwd)
+mkdir -p "$work"
+work=$(cd "$work" && pwd)
+
+ENTRIES=${ENTRIES:-1000 10000 100000}
+DEPTHS=${DEPTHS:-1 2 4 8 16 32 64}
+INPUTS=${INPUTS:-10 100 1000 10000 100000}
+RUNS=${RUNS:-5}
+
+gcc -O2 -o "$work/exec-time" "$bench/exec-time.c"
+
+export HOME="$work"
+export XDG_CACHE_HOME="$work/cache"
+export _FILE_OPENER_MULTIMEDIA_FORMATS=mkv,mp4,webm,avi,mov,mp3,flac,ogg,opus,wav,m4a
+export _FILE_OPENER_BOOK_FORMATS=pdf,epub,djvu,cbz,mobi
+export _FILE_OPENER_WEB_FORMATS=html,htm,svg
+export _FILE_OPENER_PICTURE_FORMATS=jpg,jpeg,png,gif,webp,bmp,tiff
+export _FILE_OPENER_LIBREOFFICE_FORMATS=odt,ods,odp,doc,docx,xls,xlsx,ppt,pptx
+export _FILE_OPENER_EXCLUDE_SUFFIXES=o,so,a,pyc,class,lock
+unset WAYLAND_DISPLAY GIT_DIR GIT_WORK_TREE
+
+results="$work/scaling.tsv"
+printf 'program\tsize\tp50_ms\titems_per_s\tmaxrss_kb\texpected\tgot\n' > "$results"
+printf '%-10s %8s %10s %12s %10s\n' program size "p50 ms" "items/s" "rss kB"
+
+# record <program> <size> <expected> <got> <exec-time -t output>
+record() {
+    echo "$5" | awk -v program="$1" -v size="$2" -v expected="$3" -v got="$4" \
+        -v results="$results" '{
+        items = $1 > 0 ? size / ($1 / 1e6) : 0
+        printf "%s\t%d\t%.3f\t%.0f\t%d\t%d\t%d\n", program, size, $1 / 1e3, items, $2,
+               expected, got >> results
+        printf "%-10s %8d %10.3f %12.0f %10d%s\n", program, size, $1 / 1e3, items, $2,
+               got < expected ? sprintf("  TRUNCATED: %d of %d", got, expected) : ""
+    }'
+}
+
+for entries in $ENTRIES; do
+    dir="$work/z-$entries"
+    [ -f "$dir/datafile" ] || {
+        mkdir -p "$dir"
+        sh "$bench/fixtures.sh" datafile "$dir/datafile" "$entries" "$dir/dirs"
+    }
+    export ZSHZ_LOCATION="$dir/datafile"
+    got=$("$bin/z" | wc -l)
+    record z "$entries" "$entries" "$got" "$("$work/exec-time" -t -n "$RUNS" "$bin/z")"
+done
+
+for depth in $DEPTHS; do
+    dir="$work/colorpath-$depth"
+    [ -f "$dir.leaf" ] || {
+        rm -rf "$dir"
+        sh "$bench/fixtures.sh" tree "$dir" "$depth" > "$dir.leaf"
+    }
+    leaf=$(cat "$dir.leaf")
+    # the prompt ends in the innermost directory unless it was cut short
+    got=$(cd "$leaf" && PWD=$leaf "$bin/colorpath" |
+          sed 's/\x1b\[[0-9;]*m//g' | grep -c "level$(printf %02d "$depth")\( \|$\)" || true)
+    record colorpath "$depth" 1 "$got" \
+        "$(cd "$leaf" && PWD=$leaf "$work/exec-time" -t -n "$RUNS" "$bin/colorpath")"
+done
+
+for inputs in $INPUTS; do
+    file="$work/open-$inputs"
+    [ -f "$file" ] || sh "$bench/fixtures.sh" paths "$file" "$inputs" "$work"
+    got=$("$bin/open" --classify < "$file" | wc -l)
+    record open "$inputs" "$inputs" "$got" \
+        "$("$work/exec-time" -t -n "$RUNS" -i "$file" "$bin/open" --classify)"
+done
+
+command -v gnuplot > /dev/null || exit 0
+gnuplot <<EOF
+set terminal pngcairo size 1200,800
+set output "$work/scaling.png"
+set datafile separator "\t"
+set key autotitle columnhead
+set logscale xy
+set multiplot layout 2,1
+set ylabel "items/s"
+plot for [p in "z colorpath open"] "$results" using 2:(strcol(1) eq p ? \$4 : NaN) with linespoints title p
+set ylabel "max RSS (kB)"
+plot for [p in "z colorpath open"] "$results" using 2:(strcol(1) eq p ? \$5 : NaN) with linespoints title p
+unset multiplot
+EOF
@@ -0,0 +1,595 @@
+// Startup benchmark for open, z and colorpath: runs each of them many times
+// against a fixture and writes what every run cost as JSON.
+//
+//   startup [-c] [-n runs] [-o results.json] <bindir> <fixture>
+//
+// <bindir> holds the programs (or links to the multi-call file-opener) and
+// <fixture> is a tree as bench/pgo-workload.sh creates it. For every case
+// the p50/p99/mean time from exec to exit, the page faults and context
+// switches of the child (from wait4) and, where the kernel lets us count
+// the raw_syscalls:sys_enter tracepoint, the number of system calls are
+// recorded. One extra run under LD_DEBUG=statistics measures what the
+// dynamic loader costs, which is null for static binaries.
+//
+// The depth check counts, with ptrace, the system calls colorpath makes
+// without its caches in a directory 40 levels below $HOME against those at
+// $HOME itself, and the path components the kernel has to look up for the
+// ones that take a path. It fails the run if the walk costs more than
+// three calls (open, probe and close a level) or three lookups per level,
+// which a walk that resolves every prefix from $HOME again exceeds by far.
+// -c runs only the check.
+//
+// Nothing is launched for real. swaymsg and the openers are /bin/true
+// (through PATH and FILE_OPENER_OVERRIDE_COMMAND) and mpv's socket is one
+// this program listens on, so it runs on a headless box. A summary goes to
+// stderr, the JSON to stdout or the -o file.
+//
+// Build with `gcc -O2 -o startup startup.c`.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_ENV 64
+#define PATH_LENGTH 4096
+#define CHECK_DEPTH 40
+#define MAX_SYSCALLS_PER_LEVEL 3.0
+#define MAX_LOOKUPS_PER_LEVEL 3.0
+
+typedef struct Case {
+    const char *name;
+    const char *program;
+    const char *args[4];
+    const char *dir;    // below the fixture tree, becomes $PWD
+    const char *input;  // below the fixture, becomes stdin
+} Case;
+
+static const Case cases[] = {
+    { "colorpath-home",     "colorpath", { NULL }, "", NULL },
+    { "colorpath-deep",     "colorpath", { NULL }, "/notes/six/zeta/leaf", NULL },
+    { "colorpath-dirty",    "colorpath", { NULL }, "/src/one/alpha/leaf", NULL },
+    { "colorpath-staged",   "colorpath", { NULL }, "/docs/one/beta", NULL },
+    { "colorpath-nested",   "colorpath", { NULL }, "/build/three/gamma/leaf", NULL },
+    { "z",                  "z",         { NULL }, "", NULL },
+    { "open-classify-1",    "open",      { "--classify", "movie.mkv", NULL }, "", NULL },
+    { "open-classify-1000", "open",      { "--classify", NULL }, "", "/inputs/aa" },
+    { "open-launch",        "open",      { "movie.mkv", "book.pdf", "https://example.com", "notes.txt" }, "", NULL },
+};
+
+typedef struct Result {
+    double p50, p99, mean;      // microseconds
+    double minflt, majflt;      // per run
+    double nvcsw, nivcsw;
+    double syscalls;            // per run, -1 if they could not be counted
+    long loaderCycles;          // -1 without the dynamic loader
+    long relocations;
+} Result;
+
+static char fixture[PATH_LENGTH];
+static char *env[MAX_ENV];
+static int envCount;
+static int mpvSocket = -1;
+
+
+static void addEnv(const char* name, const char* value) {
+    char *entry = malloc(strlen(name) + strlen(value) + 2);
+    sprintf(entry, "%s=%s", name, value);
+    env[envCount++] = entry;
+    env[envCount] = NULL;
+}
+
+
+static const char* envValue(const char* name) {
+    size_t len = strlen(name);
+    for (int i = 0; i < envCount; i++) {
+        if (strncmp(env[i], name, len) == 0 && env[i][len] == '=') {
+            return env[i] + len + 1;
+        }
+    }
+    return NULL;
+}
+
+
+static void unsetEnv(const char* name) {
+    size_t len = strlen(name);
+    for (int i = 0; i < envCount; i++) {
+        if (strncmp(env[i], name, len) == 0 && env[i][len] == '=') {
+            free(env[i]);
+            env[i] = env[--envCount];
+            env[envCount] = NULL;
+            break;
+        }
+    }
+}
+
+
+static void setEnv(const char* name, const char* value) {
+    unsetEnv(name);
+    addEnv(name, value);
+}
+
+
+// The environment every case runs in: the fixture's home, z datafile and
+// opener formats, and the stand-ins for sway, mpv and the openers.
+static int setupEnvironment(void) {
+    char path[PATH_LENGTH];
+
+    char stubs[PATH_LENGTH];
+    snprintf(stubs, sizeof(stubs), "%s/stubs", fixture);
+    mkdir(stubs, 0755);
+    snprintf(path, sizeof(path), "%s/swaymsg", stubs);
+    if (symlink("/bin/true", path) == -1 && errno != EEXIST) {
+        perror(path);
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s:%s", stubs, getenv("PATH") ? : "/usr/bin:/bin");
+    addEnv("PATH", path);
+
+    snprintf(path, sizeof(path), "%s/tree", fixture);
+    addEnv("HOME", path);
+    addEnv("PWD", path);
+    snprintf(path, sizeof(path), "%s/cache", fixture);
+    addEnv("XDG_CACHE_HOME", path);
+    snprintf(path, sizeof(path), "%s/z", fixture);
+    addEnv("ZSHZ_LOCATION", path);
+    addEnv("ZSHZ_PRUNE_AFTER", "1000000000");
+
+    addEnv("_FILE_OPENER_MULTIMEDIA_FORMATS", "mkv,mp4,webm,avi,mov,mp3,flac,ogg,opus,wav,m4a");
+    addEnv("_FILE_OPENER_BOOK_FORMATS", "pdf,epub,djvu,cbz,mobi");
+    addEnv("_FILE_OPENER_WEB_FORMATS", "html,htm,svg");
+    addEnv("_FILE_OPENER_PICTURE_FORMATS", "jpg,jpeg,png,gif,webp,bmp,tiff");
+    addEnv("_FILE_OPENER_LIBREOFFICE_FORMATS", "odt,ods,odp,doc,docx,xls,xlsx,ppt,pptx");
+    addEnv("_FILE_OPENER_EXCLUDE_SUFFIXES", "o,so,a,pyc,class,lock");
+
+    addEnv("WAYLAND_DISPLAY", "startup-bench");
+    addEnv("FILE_OPENER_OVERRIDE_COMMAND", "/bin/true");
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/mpv.sock", fixture);
+    unlink(addr.sun_path);
+    mpvSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (mpvSocket == -1 || bind(mpvSocket, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+        listen(mpvSocket, 128) == -1) {
+        perror(addr.sun_path);
+        return -1;
+    }
+    addEnv("FILE_OPENER_MPV_SOCKET", addr.sun_path);
+    return 0;
+}
+
+
+// mpv's stand-in: takes whatever open sent and forgets it
+static void drainMpvSocket(void) {
+    int client;
+    while ((client = accept4(mpvSocket, NULL, NULL, SOCK_CLOEXEC)) != -1) {
+        close(client);
+    }
+}
+
+
+static int syscallTracepoint(void) {
+    static const char *paths[] = {
+        "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+        "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id",
+    };
+    for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+        FILE *file = fopen(paths[i], "r");
+        int id;
+        if (file != NULL) {
+            int found = fscanf(file, "%d", &id) == 1;
+            fclose(file);
+            if (found) return id;
+        }
+    }
+    return -1;
+}
+
+
+// Counts the system calls of pid and its children from their exec on.
+static int countSyscalls(int tracepoint, pid_t pid) {
+    if (tracepoint == -1) return -1;
+
+    struct perf_event_attr attr = {
+        .type = PERF_TYPE_TRACEPOINT,
+        .size = sizeof(attr),
+        .config = tracepoint,
+        .disabled = 1,
+        .enable_on_exec = 1,
+        .inherit = 1,
+        .exclude_hv = 1,
+    };
+    return syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+
+static long long nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+// Runs a case once. The child waits for the parent to attach the syscall
+// counter before it execs; the clock starts when it is let go.
+static int runOnce(const Case* c, const char* program, int tracepoint, int errFd,
+                   long long* elapsed, struct rusage* usage, long long* syscalls) {
+    char *argv[8] = { (char*)program };
+    int argc = 1;
+    for (int i = 0; i < 4 && c->args[i] != NULL; i++) {
+        argv[argc++] = (char*)c->args[i];
+    }
+    argv[argc] = NULL;
+
+    int go[2];
+    if (pipe2(go, O_CLOEXEC) == -1) return -1;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        char input[PATH_LENGTH] = "/dev/null";
+        if (c->input != NULL) {
+            snprintf(input, sizeof(input), "%s%s", fixture, c->input);
+        }
+        int in = open(input, O_RDONLY);
+        int out = open("/dev/null", O_WRONLY);
+        if (in == -1 || out == -1) _exit(127);
+        dup2(in, 0);
+        dup2(out, 1);
+        dup2(errFd == -1 ? out : errFd, 2);
+        if (chdir(envValue("PWD")) == -1) _exit(127);
+
+        char byte;
+        close(go[1]);
+        if (read(go[0], &byte, 1) != 1) _exit(127);
+        execve(program, argv, env);
+        _exit(127);
+    }
+    close(go[0]);
+    if (pid == -1) {
+        close(go[1]);
+        return -1;
+    }
+
+    int counter = countSyscalls(tracepoint, pid);
+    long long start = nowNs();
+    write(go[1], "", 1);
+    close(go[1]);
+
+    int status;
+    if (wait4(pid, &status, 0, usage) == -1) return -1;
+    *elapsed = nowNs() - start;
+    drainMpvSocket();
+
+    *syscalls = -1;
+    if (counter != -1) {
+        uint64_t count;
+        if (read(counter, &count, sizeof(count)) == sizeof(count)) {
+            *syscalls = count;
+        }
+        close(counter);
+    }
+
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 127) {
+        fprintf(stderr, "startup: could not run %s\n", program);
+        return -1;
+    }
+    return 0;
+}
+
+
+static long loaderStatistic(const char* output, const char* label) {
+    const char *found = strstr(output, label);
+    return found ? atol(found + strlen(label)) : -1;
+}
+
+
+// Runs a case once under LD_DEBUG=statistics and reads the loader's
+// numbers from the first report in its stderr.
+static int measureLoader(const Case* c, const char* program, Result* result) {
+    result->loaderCycles = -1;
+    result->relocations = -1;
+
+    char path[] = "/tmp/startup-ld-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1) return -1;
+    unlink(path);
+
+    long long elapsed, syscalls;
+    struct rusage usage;
+    addEnv("LD_DEBUG", "statistics");
+    int failed = runOnce(c, program, -1, fd, &elapsed, &usage, &syscalls);
+    env[--envCount] = NULL;
+
+    char output[16384];
+    ssize_t n = pread(fd, output, sizeof(output) - 1, 0);
+    close(fd);
+    if (failed || n < 0) return -1;
+    output[n] = '\0';
+
+    result->loaderCycles = loaderStatistic(output, "total startup time in dynamic loader:");
+    result->relocations = loaderStatistic(output, "number of relocations:");
+    return 0;
+}
+
+
+static int compareTimes(const void* a, const void* b) {
+    long long x = *(const long long*)a;
+    long long y = *(const long long*)b;
+    return (x > y) - (x < y);
+}
+
+
+// The non-empty components of the path at addr in the traced process.
+static long pathComponents(pid_t pid, unsigned long long addr) {
+    char path[PATH_LENGTH];
+    size_t len = 0;
+    while (len + sizeof(long) <= sizeof(path)) {
+        errno = 0;
+        long word = ptrace(PTRACE_PEEKDATA, pid, (void*)(uintptr_t)(addr + len), NULL);
+        if (errno != 0) break;
+        memcpy(path + len, &word, sizeof(word));
+        len += sizeof(word);
+        if (memchr(&word, '\0', sizeof(word)) != NULL) break;
+    }
+    long components = 0;
+    for (size_t i = 0; i < len && path[i] != '\0'; i++) {
+        components += path[i] != '/' && (i == 0 || path[i - 1] == '/');
+    }
+    return components;
+}
+
+// The argument that holds the path of a call that looks one up, or -1.
+static int pathArgument(unsigned long long nr) {
+    switch (nr) {
+    case SYS_open: case SYS_stat: case SYS_lstat: case SYS_access: case SYS_readlink:
+        return 0;
+    case SYS_openat: case SYS_newfstatat: case SYS_statx: case SYS_faccessat:
+    case SYS_readlinkat:
+        return 1;
+    }
+    return -1;
+}
+
+// Counts the system calls of one run of program in dir with ptrace, from
+// its exec on, and the path components they look up. Returns -1 if it
+// could not be traced.
+static long traceSyscalls(const char* program, const char* dir, long* lookups) {
+    setEnv("PWD", dir);
+    pid_t pid = fork();
+    if (pid == 0) {
+        int out = open("/dev/null", O_RDWR);
+        if (out == -1 || chdir(dir) == -1) _exit(127);
+        dup2(out, 0);
+        dup2(out, 1);
+        dup2(out, 2);
+        if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) == -1) _exit(127);
+        char *argv[] = { (char*)program, NULL };
+        execve(program, argv, env);
+        _exit(127);
+    }
+    if (pid == -1) return -1;
+
+    // the first stop is the exec
+    int status;
+    if (waitpid(pid, &status, 0) == -1 || !WIFSTOPPED(status)) return -1;
+    ptrace(PTRACE_SETOPTIONS, pid, NULL, PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL);
+
+    // every call stops on entry and on exit but the last, exit_group
+    long stops = 0;
+    int signal = 0;
+    *lookups = 0;
+    for (;;) {
+        if (ptrace(PTRACE_SYSCALL, pid, NULL, signal) == -1) return -1;
+        if (waitpid(pid, &status, 0) == -1) return -1;
+        if (WIFEXITED(status) || WIFSIGNALED(status)) break;
+        signal = 0;
+        if (WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+            stops++;
+            struct __ptrace_syscall_info info;
+            if (ptrace(PTRACE_GET_SYSCALL_INFO, pid, (void*)sizeof(info), &info) > 0
+                    && info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+                int arg = pathArgument(info.entry.nr);
+                if (arg != -1) *lookups += pathComponents(pid, info.entry.args[arg]);
+            }
+        } else {
+            signal = WSTOPSIG(status);
+        }
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 127 ? -1 : (stops + 1) / 2;
+}
+
+
+// The depth check: colorpath at $HOME and CHECK_DEPTH levels below it, with
+// the prompt and repository caches off so every level is probed. Returns
+// the system calls per level, or -1 if they could not be counted, and
+// leaves the lookups per level in perLevelLookups.
+static double checkDepth(const char* bindir, long* shallow, long* deep, double* perLevelLookups) {
+    char program[PATH_LENGTH], dir[PATH_LENGTH], home[PATH_LENGTH];
+    snprintf(program, sizeof(program), "%s/colorpath", bindir);
+    snprintf(home, sizeof(home), "%s/tree", fixture);
+    int len = snprintf(dir, sizeof(dir), "%s", home);
+    for (int i = 1; i <= CHECK_DEPTH; i++) {
+        len += snprintf(dir + len, sizeof(dir) - len, "/d%02d", i);
+        if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
+            perror(dir);
+            return -1;
+        }
+    }
+
+    setEnv("FILE_OPENER_PROMPT_CACHE", "");
+    setEnv("FILE_OPENER_REPO_CACHE", "");
+    long shallowLookups, deepLookups;
+    *shallow = traceSyscalls(program, home, &shallowLookups);
+    *deep = traceSyscalls(program, dir, &deepLookups);
+    unsetEnv("FILE_OPENER_PROMPT_CACHE");
+    unsetEnv("FILE_OPENER_REPO_CACHE");
+
+    if (*shallow == -1 || *deep == -1) return -1;
+    *perLevelLookups = (double)(deepLookups - shallowLookups) / CHECK_DEPTH;
+    return (double)(*deep - *shallow) / CHECK_DEPTH;
+}
+
+
+static int runCase(const Case* c, const char* bindir, int runs, int tracepoint, Result* result) {
+    char program[PATH_LENGTH];
+    snprintf(program, sizeof(program), "%s/%s", bindir, c->program);
+    char pwd[PATH_LENGTH];
+    snprintf(pwd, sizeof(pwd), "%s/tree%s", fixture, c->dir);
+    setEnv("PWD", pwd);
+
+    long long *times = malloc(runs * sizeof(long long));
+    long long total = 0, syscalls = 0;
+    struct rusage sum = { 0 };
+
+    // one run to warm the page cache and colorpath's caches
+    long long elapsed, count;
+    struct rusage usage;
+    if (runOnce(c, program, -1, -1, &elapsed, &usage, &count) == -1) {
+        free(times);
+        return -1;
+    }
+
+    for (int i = 0; i < runs; i++) {
+        if (runOnce(c, program, tracepoint, -1, &times[i], &usage, &count) == -1) {
+            free(times);
+            return -1;
+        }
+        total += times[i];
+        sum.ru_minflt += usage.ru_minflt;
+        sum.ru_majflt += usage.ru_majflt;
+        sum.ru_nvcsw += usage.ru_nvcsw;
+        sum.ru_nivcsw += usage.ru_nivcsw;
+        syscalls = (count == -1 || syscalls == -1) ? -1 : syscalls + count;
+    }
+
+    qsort(times, runs, sizeof(long long), compareTimes);
+    result->p50 = times[runs / 2] / 1e3;
+    result->p99 = times[(runs * 99) / 100] / 1e3;
+    result->mean = total / 1e3 / runs;
+    result->minflt = (double)sum.ru_minflt / runs;
+    result->majflt = (double)sum.ru_majflt / runs;
+    result->nvcsw = (double)sum.ru_nvcsw / runs;
+    result->nivcsw = (double)sum.ru_nivcsw / runs;
+    result->syscalls = syscalls == -1 ? -1 : (double)syscalls / runs;
+    free(times);
+
+    return measureLoader(c, program, result);
+}
+
+
+static void printJsonNumber(FILE* out, const char* name, double value, int decimals, int last) {
+    if (value < 0) {
+        fprintf(out, "\"%s\": null%s", name, last ? "" : ", ");
+    } else {
+        fprintf(out, "\"%s\": %.*f%s", name, decimals, value, last ? "" : ", ");
+    }
+}
+
+
+int main(int argc, char **argv) {
+    int runs = 200;
+    const char *jsonPath = NULL;
+    int onlyCheck = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "cn:o:")) != -1) {
+        switch (opt) {
+        case 'c':
+            onlyCheck = 1;
+            break;
+        case 'n':
+            runs = atoi(optarg);
+            break;
+        case 'o':
+            jsonPath = optarg;
+            break;
+        default:
+            runs = 0;
+        }
+    }
+    if (argc - optind != 2 || runs < 1) {
+        fprintf(stderr, "usage: startup [-c] [-n runs] [-o results.json] <bindir> <fixture>\n");
+        return 1;
+    }
+
+    char bindir[PATH_LENGTH];
+    if (realpath(argv[optind], bindir) == NULL || realpath(argv[optind + 1], fixture) == NULL) {
+        perror("startup");
+        return 1;
+    }
+    if (setupEnvironment() == -1) {
+        return 1;
+    }
+
+    long shallow, deep;
+    double lookupsPerLevel = -1;
+    double perLevel = checkDepth(bindir, &shallow, &deep, &lookupsPerLevel);
+    int checkFailed = perLevel > MAX_SYSCALLS_PER_LEVEL || lookupsPerLevel > MAX_LOOKUPS_PER_LEVEL;
+    if (perLevel < 0) {
+        fprintf(stderr, "depth check: could not trace colorpath\n");
+    } else {
+        fprintf(stderr, "depth check: colorpath makes %ld calls at $HOME, %ld %d levels below (%.2f per level, at most %.1f; "
+                "%.2f lookups per level, at most %.1f)%s\n",
+                shallow, deep, CHECK_DEPTH, perLevel, MAX_SYSCALLS_PER_LEVEL,
+                lookupsPerLevel, MAX_LOOKUPS_PER_LEVEL, checkFailed ? ": FAILED" : "");
+    }
+    if (onlyCheck) return checkFailed || perLevel < 0;
+
+    int tracepoint = syscallTracepoint();
+    size_t caseCount = sizeof(cases) / sizeof(cases[0]);
+    Result results[sizeof(cases) / sizeof(cases[0])];
+
+    fprintf(stderr, "%-20s %9s %9s %9s %8s %6s %7s %10s\n",
+            "case", "p50 us", "p99 us", "mean us", "minflt", "csw", "calls", "ld cycles");
+    for (size_t i = 0; i < caseCount; i++) {
+        Result *r = &results[i];
+        if (runCase(&cases[i], bindir, runs, tracepoint, r) == -1) {
+            return 1;
+        }
+        fprintf(stderr, "%-20s %9.1f %9.1f %9.1f %8.1f %6.1f %7.1f %10ld\n", cases[i].name,
+                r->p50, r->p99, r->mean, r->minflt, r->nvcsw + r->nivcsw, r->syscalls,
+                r->loaderCycles);
+    }
+
+    FILE *out = jsonPath ? fopen(jsonPath, "w") : stdout;
+    if (out == NULL) {
+        perror(jsonPath);
+        return 1;
+    }
+    fprintf(out, "{\n  \"bindir\": \"%s\",\n  \"runs\": %d,\n  \"cases\": [\n", bindir, runs);
+    for (size_t i = 0; i < caseCount; i++) {
+        Result *r = &results[i];
+        fprintf(out, "    {\"name\": \"%s\", ", cases[i].name);
+        printJsonNumber(out, "p50_us", r->p50, 2, 0);
+        printJsonNumber(out, "p99_us", r->p99, 2, 0);
+        printJsonNumber(out, "mean_us", r->mean, 2, 0);
+        printJsonNumber(out, "minor_faults", r->minflt, 2, 0);
+        printJsonNumber(out, "major_faults", r->majflt, 2, 0);
+        printJsonNumber(out, "voluntary_switches", r->nvcsw, 2, 0);
+        printJsonNumber(out, "involuntary_switches", r->nivcsw, 2, 0);
+        printJsonNumber(out, "syscalls", r->syscalls, 2, 0);
+        printJsonNumber(out, "loader_cycles", r->loaderCycles, 0, 0);
+        printJsonNumber(out, "relocations", r->relocations, 0, 1);
+        fprintf(out, "}%s\n", i + 1 < caseCount ? "," : "");
+    }
+    fprintf(out, "  ],\n  \"depth_check\": {\"depth\": %d, ", CHECK_DEPTH);
+    printJsonNumber(out, "syscalls_home", perLevel < 0 ? -1 : shallow, 0, 0);
+    printJsonNumber(out, "syscalls_deep", perLevel < 0 ? -1 : deep, 0, 0);
+    printJsonNumber(out, "per_level", perLevel, 2, 0);
+    printJsonNumber(out, "lookups_per_level", perLevel < 0 ? -1 : lookupsPerLevel, 2, 1);
+    fprintf(out, "}\n}\n");
+    return (fclose(out) != 0) | checkFailed;
+}
@@ -0,0 +1,100 @@
+#!/bin/sh
+# Checks colorpath's staged (+), modified (*) and untracked (%) markers
+# against `git status --porcelain` after the index and work tree changes
+# that leave git's cache-tree in different states.
+#
+#   status-check.sh <bindir> <workdir>
+#
+# Every case starts from a fresh copy of a small repository with files at
+# the top and two levels down, makes its change and compares the markers
+# of colorpath at the top of the work tree with the ones git's status
+# implies. Each case is rendered twice through a prompt cache of its own,
+# so the second render shows what the cached status gives. Prints a line
+# per case and fails if any of them differ.
+
+set -e
+
+bin=$(cd "${1:?usage: status-check.sh <bindir> <workdir>}" && pwd)
+work=${2:?usage: status-check.sh <bindir> <workdir>}
+mkdir -p "$work"
+work=$(cd "$work" && pwd)
+
+export HOME="$work"
+export XDG_CACHE_HOME="$work/cache"
+export FILE_OPENER_REPO_CACHE=""
+export FILE_OPENER_STATUS_BUDGET=5000
+export GIT_AUTHOR_NAME=Fixture GIT_AUTHOR_EMAIL=fixture@example.com
+export GIT_COMMITTER_NAME=Fixture GIT_COMMITTER_EMAIL=fixture@example.com
+
+base="$work/base"
+rm -rf "$base"
+git init -q "$base"
+mkdir -p "$base/sub/deep" "$base/other"
+for file in a b sub/c sub/deep/d sub/deep/e other/f; do
+    echo "$file" > "$base/$file"
+done
+git -C "$base" add .
+git -C "$base" commit -q -m first
+echo a2 > "$base/a"
+git -C "$base" commit -q -am second
+
+# the markers git status implies, in colorpath's order
+expected() {
+    git status --porcelain | awk '
+        /^\?\?/ { untracked = 1; next }
+        { x = substr($0, 1, 1); y = substr($0, 2, 1) }
+        x != " " { staged = 1 }
+        y != " " { dirty = 1 }
+        END { printf "%s%s%s", staged ? "+" : "", dirty ? "*" : "", untracked ? "%" : "" }'
+}
+
+# the markers colorpath shows, the last field of its prompt if made of them
+shown() {
+    PWD=$1 FILE_OPENER_PROMPT_CACHE=$2 "$bin/colorpath" | sed 's/\x1b\[[0-9;]*m//g' |
+        awk '{ print ($NF ~ /^[+*%?]+$/) ? $NF : "" }'
+}
+
+failed=0
+number=0
+check() {
+    name=$1
+    shift
+    number=$((number + 1))
+    repo="$work/case$number"
+    rm -rf "$repo"
+    cp -R "$base" "$repo"
+    (cd "$repo" && eval "$@") > /dev/null 2>&1
+    want=$(cd "$repo" && expected)
+    cache="status-check-$$-$number"
+    first=$(shown "$repo" "$cache")
+    second=$(shown "$repo" "$cache")
+    rm -f "/dev/shm/$cache"
+    if [ "$first" = "$want" ] && [ "$second" = "$want" ]; then
+        printf 'ok     %-32s %s\n' "$name" "${want:--}"
+    else
+        printf 'FAILED %-32s git %s, colorpath %s then %s\n' "$name" "${want:--}" "${first:--}" "${second:--}"
+        failed=1
+    fi
+}
+
+check "clean" true
+check "add, reset, checkout" "echo x >> a; git add a; git reset -q a; git checkout a"
+check "deep add, reset, checkout" "echo x >> sub/deep/d; git add sub/deep/d; git reset -q sub/deep/d; git checkout sub/deep/d"
+check "add new, reset" "echo n > sub/new; git add sub/new; git reset -q sub/new; rm sub/new"
+check "modified" "echo x >> sub/c"
+check "modified, added" "echo x >> sub/c; git add sub/c"
+check "new file added" "echo n > sub/deep/n; git add sub/deep/n"
+check "new file before a directory" "echo n > sub.txt; git add sub.txt"
+check "untracked" "echo n > other/n"
+check "rm" "git rm -q sub/deep/e"
+check "rm --cached" "git rm -q --cached b"
+check "rm a whole directory" "git rm -q -r sub/deep"
+check "rename" "git mv sub/c other/c"
+check "rename a directory" "git mv sub/deep sub/moved"
+check "file becomes a directory" "git rm -q b; mkdir b; echo n > b/n; git add b/n"
+check "mode change" "chmod +x a; git add a"
+check "intent to add" "echo n > n; git add -N n"
+check "reset --soft" "git reset -q --soft HEAD~"
+check "staged then reverted" "echo x >> a; git add a; git checkout HEAD -- a"
+
+exit $failed
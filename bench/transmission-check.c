@@ -0,0 +1,390 @@
+// Stand-in for Transmission's RPC server that checks how open hands it
+// magnet links: the X-Transmission-Session-Id handshake, pipelining on one
+// keep-alive connection, links Transmission turns down, a session id that
+// changes halfway and a server that refuses the links.
+//
+//   transmission-check <bindir>
+//
+// Every case runs <bindir>/open with its magnets and
+// FILE_OPENER_TRANSMISSION_RPC pointing at a port this program listens on,
+// answers it from one poll loop and compares what the server saw and what
+// open wrote to stderr, which file_opener reads back as names, with what
+// the case expects. Prints a line per case and fails if any of them differ.
+// Nothing is launched: transmission.sh, which open falls back to when the
+// server cannot be used at all, is /bin/true through PATH.
+//
+// Build with `gcc -O2 -o transmission-check transmission-check.c`.
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PATH_LENGTH 4096
+#define MAX_MAGNETS 200
+#define MAX_CONNECTIONS 8
+#define CONNECTION_BUFFER 65536
+#define STDERR_BUFFER 65536
+#define TIMEOUT_MS 10000
+#define DIAGNOSTIC "transmission: "
+
+typedef struct Case {
+    const char *name;
+    int magnets;
+    int badEvery;       // every nth link is turned down, 0 for none
+    int rotateAfter;    // the session id changes after this many adds, 0 for never
+    int refuseAfter;    // every request after this many adds gets 401, -1 for never
+    // what open should do
+    int adds;           // links the server takes, each once
+    int conflicts;      // 409 answers, pipelined requests after the
+    int maxConflicts;   // first one get one as well
+    int maxConnections;
+    int pipelines;      // whether requests have to arrive back to back
+    int diagnostics;    // lines starting with DIAGNOSTIC
+    int namesFrom;      // links open reports back from this one on, besides the bad ones
+} Case;
+
+static const Case cases[] = {
+    { "handshake",              1,   0, 0,  -1, 1,   1, 1,  1, 0, 0, 1 },
+    { "pipelined",              100, 0, 0,  -1, 100, 1, 1,  1, 1, 0, 100 },
+    { "rejected links",         20,  4, 0,  -1, 20,  1, 1,  1, 1, 0, 20 },
+    { "session id changes",     100, 0, 40, -1, 100, 2, 64, 2, 1, 0, 100 },
+    { "refused",                10,  0, 0,  0,  0,   1, 1,  1, 0, 1, 10 },
+    { "refused halfway",        50,  0, 0,  10, 10,  1, 1,  1, 1, 1, 10 },
+};
+
+typedef struct Connection {
+    int fd;
+    char buffer[CONNECTION_BUFFER];
+    size_t filled;
+} Connection;
+
+typedef struct Server {
+    const Case *c;
+    int session;
+    int added[MAX_MAGNETS];
+    int adds, duplicates, conflicts, connections, maxBatch, malformed;
+} Server;
+
+static void magnetFor(int i, int bad, char* out, size_t size) {
+    snprintf(out, size, "magnet:?xt=urn:btih:%040x&dn=%s-%d", i + 1, bad ? "bad" : "ok", i);
+}
+
+static int isBad(const Case* c, int i) {
+    return c->badEvery && i % c->badEvery == c->badEvery - 1;
+}
+
+static int writeAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        data += n;
+        size -= n;
+    }
+    return 0;
+}
+
+static void respond(int fd, int status, const char* session, const char* body) {
+    char response[1024];
+    int len = snprintf(response, sizeof(response),
+        "HTTP/1.1 %d %s\r\n%s%s%sContent-Type: application/json\r\nContent-Length: %zu\r\n\r\n%s",
+        status, status == 200 ? "OK" : status == 409 ? "Conflict" : "Unauthorized",
+        session ? "X-Transmission-Session-Id: " : "", session ? session : "", session ? "\r\n" : "",
+        strlen(body), body);
+    writeAll(fd, response, len);
+}
+
+// The value of a header in [headers, end), copied into out. Returns 0 if
+// it is there.
+static int header(const char* headers, const char* end, const char* name, char* out, size_t size) {
+    size_t nameLen = strlen(name);
+    for (const char *line = headers; line < end; ) {
+        const char *next = memmem(line, end - line, "\r\n", 2);
+        if (next == NULL) next = end;
+        if ((size_t)(next - line) > nameLen && line[nameLen] == ':' && strncasecmp(line, name, nameLen) == 0) {
+            const char *value = line + nameLen + 1;
+            while (value < next && *value == ' ') value++;
+            snprintf(out, size, "%.*s", (int)(next - value), value);
+            return 0;
+        }
+        line = next + 2;
+    }
+    return -1;
+}
+
+// Answers one torrent-add the way Transmission does.
+static void answer(Server* server, int fd, const char* headers, const char* headersEnd, const char* body) {
+    char session[64], sent[128] = "", length[32];
+    snprintf(session, sizeof(session), "session-%d", server->session);
+    header(headers, headersEnd, "X-Transmission-Session-Id", sent, sizeof(sent));
+    if (strcmp(sent, session) != 0) {
+        server->conflicts++;
+        respond(fd, 409, session, "");
+        return;
+    }
+    if (server->c->refuseAfter >= 0 && server->adds >= server->c->refuseAfter) {
+        respond(fd, 401, NULL, "");
+        return;
+    }
+
+    // {"method":"torrent-add","arguments":{"filename":"magnet:...&dn=ok-<i>"},"tag":<i>}
+    const char *name = strstr(body, "&dn=");
+    const char *index = name ? strchr(name, '-') : NULL;
+    int i = index ? atoi(index + 1) : -1;
+    if (strstr(body, "\"torrent-add\"") == NULL || i < 0 || i >= server->c->magnets
+            || header(headers, headersEnd, "Content-Length", length, sizeof(length)) != 0) {
+        server->malformed++;
+        respond(fd, 200, NULL, "{\"result\":\"invalid request\",\"arguments\":{}}");
+        return;
+    }
+    if (server->added[i]++) server->duplicates++;
+    server->adds++;
+    if (server->c->rotateAfter && server->adds == server->c->rotateAfter) server->session++;
+
+    char reply[256];
+    snprintf(reply, sizeof(reply), "{\"result\":\"%s\",\"arguments\":{},\"tag\":%d}",
+             isBad(server->c, i) ? "invalid or corrupt torrent file" : "success", i);
+    respond(fd, 200, NULL, reply);
+}
+
+// Answers every complete request in the connection's buffer. Returns -1 if
+// the connection is to be closed.
+static int serveConnection(Server* server, Connection* connection) {
+    ssize_t n = read(connection->fd, connection->buffer + connection->filled,
+                     sizeof(connection->buffer) - 1 - connection->filled);
+    if (n <= 0) return -1;
+    connection->filled += n;
+
+    int batch = 0;
+    for (;;) {
+        connection->buffer[connection->filled] = '\0';
+        char *headersEnd = memmem(connection->buffer, connection->filled, "\r\n\r\n", 4);
+        if (headersEnd == NULL) break;
+        char length[32];
+        size_t bodyLen = header(connection->buffer, headersEnd, "Content-Length", length, sizeof(length)) == 0
+            ? strtoul(length, NULL, 10) : 0;
+        char *body = headersEnd + 4;
+        size_t total = body + bodyLen - connection->buffer;
+        if (total > connection->filled) break;
+
+        char saved = body[bodyLen];
+        body[bodyLen] = '\0';
+        answer(server, connection->fd, connection->buffer, headersEnd, body);
+        body[bodyLen] = saved;
+        batch++;
+        memmove(connection->buffer, connection->buffer + total, connection->filled - total);
+        connection->filled -= total;
+    }
+    if (batch > server->maxBatch) server->maxBatch = batch;
+    return connection->filled == sizeof(connection->buffer) - 1 ? -1 : 0;
+}
+
+static long long nowMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Runs open against the server until it exits. Returns its stderr or NULL.
+static char* runCase(const Case* c, const char* bindir, const char* fakeBin, Server* server) {
+    int listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_in address = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t addressLen = sizeof(address);
+    if (listener == -1 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0
+            || listen(listener, MAX_CONNECTIONS) != 0
+            || getsockname(listener, (struct sockaddr*)&address, &addressLen) != 0) {
+        perror("transmission-check: listen");
+        return NULL;
+    }
+
+    int errPipe[2];
+    if (pipe2(errPipe, O_CLOEXEC) != 0) {
+        perror("transmission-check: pipe");
+        return NULL;
+    }
+    char program[PATH_LENGTH], rpc[128], path[PATH_LENGTH];
+    snprintf(program, sizeof(program), "%s/open", bindir);
+    snprintf(rpc, sizeof(rpc), "http://127.0.0.1:%d/transmission/rpc", ntohs(address.sin_port));
+    snprintf(path, sizeof(path), "%s:/usr/bin:/bin", fakeBin);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(errPipe[1], STDERR_FILENO);
+        int devNull = open("/dev/null", O_RDWR);
+        dup2(devNull, STDIN_FILENO);
+        dup2(devNull, STDOUT_FILENO);
+        setenv("FILE_OPENER_TRANSMISSION_RPC", rpc, 1);
+        setenv("PATH", path, 1);
+        unsetenv("FILE_OPENER_OVERRIDE_COMMAND");
+        unsetenv("WAYLAND_DISPLAY");
+
+        char *args[MAX_MAGNETS + 2];
+        args[0] = program;
+        for (int i = 0; i < c->magnets; i++) {
+            args[i + 1] = malloc(128);
+            magnetFor(i, isBad(c, i), args[i + 1], 128);
+        }
+        args[c->magnets + 1] = NULL;
+        execv(program, args);
+        _exit(127);
+    }
+    close(errPipe[1]);
+
+    Connection *connections = calloc(MAX_CONNECTIONS, sizeof(Connection));
+    char *errors = calloc(1, STDERR_BUFFER);
+    size_t errorsLen = 0;
+    int errOpen = 1;
+    long long deadline = nowMs() + TIMEOUT_MS;
+    for (int i = 0; i < MAX_CONNECTIONS; i++) connections[i].fd = -1;
+
+    while (errOpen && nowMs() < deadline) {
+        struct pollfd fds[MAX_CONNECTIONS + 2];
+        int count = 0;
+        fds[count++] = (struct pollfd){ listener, POLLIN, 0 };
+        fds[count++] = (struct pollfd){ errPipe[0], POLLIN, 0 };
+        for (int i = 0; i < MAX_CONNECTIONS; i++) {
+            fds[count++] = (struct pollfd){ connections[i].fd, POLLIN, 0 };
+        }
+        if (poll(fds, count, 100) < 0 && errno != EINTR) break;
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+            for (int i = 0; fd != -1 && i < MAX_CONNECTIONS; i++) {
+                if (connections[i].fd != -1) continue;
+                connections[i].fd = fd;
+                connections[i].filled = 0;
+                server->connections++;
+                fd = -1;
+            }
+            if (fd != -1) close(fd);
+        }
+        if (fds[1].revents & (POLLIN | POLLHUP)) {
+            ssize_t n = read(errPipe[0], errors + errorsLen, STDERR_BUFFER - 1 - errorsLen);
+            if (n <= 0) errOpen = 0;
+            else errorsLen += n;
+        }
+        for (int i = 0; i < MAX_CONNECTIONS; i++) {
+            if (!(fds[i + 2].revents & (POLLIN | POLLHUP))) continue;
+            if (serveConnection(server, &connections[i]) != 0) {
+                close(connections[i].fd);
+                connections[i].fd = -1;
+            }
+        }
+    }
+
+    if (errOpen) kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        if (connections[i].fd != -1) close(connections[i].fd);
+    }
+    free(connections);
+    close(errPipe[0]);
+    close(listener);
+    if (errOpen) {
+        free(errors);
+        return NULL;
+    }
+    return errors;
+}
+
+// Compares a finished case with what it expects, describing the first
+// difference in problem. Returns 0 if there is none.
+static int checkCase(const Case* c, const Server* server, char* errors, char* problem, size_t size) {
+    int reported[MAX_MAGNETS] = { 0 };
+    int diagnostics = 0, strays = 0;
+    for (char *line = strtok(errors, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+        if (strncmp(line, DIAGNOSTIC, strlen(DIAGNOSTIC)) == 0) {
+            diagnostics++;
+            continue;
+        }
+        int found = 0;
+        for (int i = 0; i < c->magnets && !found; i++) {
+            char magnet[128];
+            magnetFor(i, isBad(c, i), magnet, sizeof(magnet));
+            if (strcmp(line, magnet) == 0) {
+                reported[i]++;
+                found = 1;
+            }
+        }
+        if (!found) strays++;
+    }
+
+    for (int i = 0; i < c->magnets; i++) {
+        int want = i >= c->namesFrom || isBad(c, i);
+        if (reported[i] != want) {
+            snprintf(problem, size, "link %d reported %d times, expected %d", i, reported[i], want);
+            return -1;
+        }
+    }
+    if (strays) snprintf(problem, size, "%d lines on stderr that are no link", strays);
+    else if (diagnostics != c->diagnostics) snprintf(problem, size, "%d diagnostics, expected %d", diagnostics, c->diagnostics);
+    else if (server->malformed) snprintf(problem, size, "%d malformed requests", server->malformed);
+    else if (server->duplicates) snprintf(problem, size, "%d links added twice", server->duplicates);
+    else if (server->adds != c->adds) snprintf(problem, size, "%d links added, expected %d", server->adds, c->adds);
+    else if (server->conflicts < c->conflicts || server->conflicts > c->maxConflicts) {
+        snprintf(problem, size, "%d 409s, expected %d to %d", server->conflicts, c->conflicts, c->maxConflicts);
+    }
+    else if (server->connections > c->maxConnections) snprintf(problem, size, "%d connections, expected at most %d", server->connections, c->maxConnections);
+    else if (c->pipelines && server->maxBatch < 2) snprintf(problem, size, "requests never arrived back to back");
+    else return 0;
+    return -1;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: transmission-check <bindir>\n");
+        return 1;
+    }
+    char bindir[PATH_LENGTH];
+    if (realpath(argv[1], bindir) == NULL) {
+        perror("transmission-check");
+        return 1;
+    }
+
+    char fakeBin[] = "/tmp/transmission-check-XXXXXX";
+    char fakeScript[PATH_LENGTH];
+    if (mkdtemp(fakeBin) == NULL) {
+        perror("transmission-check: mkdtemp");
+        return 1;
+    }
+    snprintf(fakeScript, sizeof(fakeScript), "%s/transmission.sh", fakeBin);
+    if (symlink("/bin/true", fakeScript) != 0) {
+        perror("transmission-check: symlink");
+        return 1;
+    }
+
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        const Case *c = &cases[i];
+        Server server;
+        memset(&server, 0, sizeof(server));
+        server.c = c;
+        char *errors = runCase(c, bindir, fakeBin, &server);
+        char problem[256] = "open did not finish";
+        if (errors != NULL && checkCase(c, &server, errors, problem, sizeof(problem)) == 0) {
+            printf("ok     %-24s %d added, %d 409s, %d connections, up to %d requests at once\n",
+                   c->name, server.adds, server.conflicts, server.connections, server.maxBatch);
+        } else {
+            printf("FAILED %-24s %s\n", c->name, problem);
+            failed = 1;
+        }
+        free(errors);
+    }
+
+    unlink(fakeScript);
+    rmdir(fakeBin);
+    return failed;
+}
@@ -2,16 +2,128 @@
 
 dirname="${${0:A:h}##*/}"
 output=${1:-$dirname}
-input=${2:-main.c}
+input=(${@[2,-1]})
 
-gcc $(pkg-config --cflags glib-2.0) \
--march=native \
--flto \
--Ofast \
--mtune=native \
--o $output $input $(pkg-config --libs glib-2.0)
+# programs that are built from more than one source file
+typeset -A sources=(
+    open        "open.c transmission.c extract.c trace.c"
+    z           "z.c gitrepo.c trace.c"
+    colorpath   "colorpath.c gitrepo.c gitobj.c gitindex.c trace.c"
+    gitstatus   "gitstatus.c gitrepo.c gitobj.c gitindex.c trace.c"
+    gitlog      "gitlog.c gitrepo.c gitobj.c trace.c"
+    fzymux      "fzymux.c trace.c"
+    lsdir       "lsdir.c lscolors.c trace.c"
+    histidx     "histidx.c trace.c"
+    dlindex     "dlindex.c lscolors.c open.c trace.c"
+    file-opener "multicall.c open.c transmission.c extract.c z.c colorpath.c gitstatus.c gitlog.c fzymux.c lsdir.c histidx.c dlindex.c lscolors.c gitrepo.c gitobj.c gitindex.c trace.c"
+)
+typeset -A libs=(
+    open        "-lz -llzma -pthread"
+    colorpath   "-lz"
+    gitstatus   "-lz"
+    gitlog      "-lz"
+    file-opener "-lz -llzma -pthread"
+)
+# dlindex takes only open's classification from open.c, as the module does
+typeset -A flags=(
+    dlindex     "-DFILEOPENER_MODULE"
+    file-opener "-static -DFILEOPENER_MULTICALL -DFILEOPENER_STATIC"
+)
+# file-opener is one static binary that runs open, z, colorpath, gitstatus,
+# gitlog, fzymux, lsdir, histidx or dlindex depending on the name it is
+# called as, which saves each of them the dynamic loader. FILEOPENER_STATIC
+# keeps it off glibc's NSS (getpwnam, getaddrinfo), which a static binary
+# could only load from the libc version it was linked against.
+typeset -A names=(
+    file-opener "open z colorpath gitstatus gitlog fzymux lsdir histidx dlindex"
+)
+# open extracts zstd compressed tars itself only when libzstd is there
+if pkg-config --exists libzstd 2>/dev/null; then
+    for program in open file-opener; do
+        flags[$program]+=" -DFILEOPENER_ZSTD"
+        libs[$program]+=" -lzstd"
+    done
+fi
+(( #input )) || input=(${=sources[$output]:-main.c})
+cflags=(-march=native -flto -Ofast -mtune=native)
+# TRACE=1 compiles in the timings and counters of trace.h
+[[ -n $TRACE ]] && cflags+=(-DFILEOPENER_TRACE)
+
+# The zsh/fileopener module is built by zsh's own build system: its files
+# are linked into the Src/Modules directory of a configured and built zsh
+# source tree in $ZSH_SRC and picked up by `make prep`.
+if [[ $output == fileopener.so ]]; then
+    root=${0:A:h}
+    modules=${ZSH_SRC:?set ZSH_SRC to a built zsh source tree}/Src/Modules
+    for file in $root/module/*.(c|mdd) $root/(colorpath|z|open|gitrepo|gitobj|gitindex|trace).(c|h) $root/(transmission|extract).h; do
+        ln -fs $file $modules/${file:t}
+    done
+    make -C $ZSH_SRC prep &&
+    make -C $modules fileopener.so LIBS=-lz || exit 1
+
+    libdir="$HOME/.local/lib/zsh/zsh"
+    [[ -d $libdir ]] || mkdir -p $libdir
+    cp $modules/fileopener.so $libdir/
+    exit 0
+fi
+
+# A profile-guided build of file-opener: an instrumented build runs
+# bench/pgo-workload.sh, the profiles it leaves are used for the final
+# build, and the workload is timed with and without them.
+if [[ $output == pgo ]]; then
+    zmodload zsh/datetime
+    root=${0:A:h}
+    output=file-opener
+    input=($root/${^=sources[$output]})
+    work=$(mktemp -d) || exit 1
+    trap "rm -rf $work" EXIT
+
+    # the profiles are named after the output, so every stage is built
+    # as $work/$output and moved into a directory of its own;
+    # -Wmissing-profile tells if the names ever stop matching
+    stage() {
+        local name=$1
+        shift
+        gcc ${=flags[$output]} $cflags "$@" -o $work/$output $input ${=libs[$output]} || exit 1
+        mkdir $work/$name
+        mv $work/$output $work/$name/
+        for program in ${=names[$output]}; do
+            ln -s $output $work/$name/$program
+        done
+    }
+
+    # sets REPLY to the best of three runs of the workload in milliseconds
+    measure() {
+        float start elapsed
+        REPLY=0
+        repeat 3; do
+            start=$EPOCHREALTIME
+            sh $root/bench/pgo-workload.sh $work/$1 $work/fixture || exit 1
+            (( elapsed = (EPOCHREALTIME - start) * 1000 ))
+            (( REPLY == 0 || elapsed < REPLY )) && REPLY=$elapsed
+        done
+    }
+
+    stage plain
+    stage instrumented -fprofile-generate=$work/profile
+    sh $root/bench/pgo-workload.sh $work/instrumented $work/fixture || exit 1
+    stage optimized -fprofile-use=$work/profile -fprofile-partial-training -Wmissing-profile
+
+    measure plain
+    float plain=$REPLY
+    measure optimized
+    float optimized=$REPLY
+    printf 'workload: %.1f ms without profiles, %.1f ms with them (%.2fx)\n' \
+        $plain $optimized $(( plain / optimized ))
+
+    cp $work/optimized/$output $root/$output
+    cd $root
+else
+    gcc ${=flags[$output]} $cflags -o $output $input ${=libs[$output]} || exit 1
+fi
 
 bindir="$HOME/.local/bin"
 [[ -d $bindir ]] || mkdir -p $bindir
-destination="${bindir}/${output}"
-ln -fs "${${${(%):-%N}:A}%/*}/$output" "$destination"
+for name in ${=names[$output]:-$output}; do
+    ln -fs "${${${(%):-%N}:A}%/*}/$output" "${bindir}/${name}"
+done
@@ -1,187 +1,692 @@
+#define _GNU_SOURCE
+#include <errno.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <time.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <poll.h>
+
+#include "gitrepo.h"
+#include "gitindex.h"
+#include "trace.h"
+#include "colorpath.h"
 
 
-#define MAX_PATH_DEPTH 64
 #define MAX_STR_LENGTH 1024
+#define MAX_OUTPUT_LENGTH COLORPATH_MAX_OUTPUT
+#define MAX_BRANCH_LENGTH 256
+
+#define PROMPT_CACHE_SLOTS 256
+#define PROMPT_CACHE_DATA 2048
+#define PROMPT_CACHE_TTL 300
+
+// milliseconds the work tree status may take, FILE_OPENER_STATUS_BUDGET;
+// --serve answers after the prompt is drawn and can afford more
+#define STATUS_BUDGET 20
+#define SERVE_STATUS_BUDGET 1000
+
+static const char resetColor[] = "\x1b[0m";
+static const size_t resetColorLen = sizeof(resetColor) - 1;
+
+static const char pathString[] = "\x1b[0m/\x1b[36m";
+static const size_t pathStringLen = sizeof(pathString) - 1;
+
+static const char gitpathString[] = "\x1b[0m/\x1b[1;36m";
+static const size_t gitpathStringLen = sizeof(gitpathString) - 1;
+
+static const char Nbranch[] = "\x1b[0;32m";
+static const char Obranch[] = "\x1b[0;34m";
+static const size_t branchLen = sizeof(Obranch) - 1;
+
+static const char homePathString[] = "\x1b[36m~";
+static const size_t homePathStringLen = sizeof(homePathString) - 1;
+
+static const char stagedString[] = "\x1b[0;32m+";
+static const char dirtyString[] = "\x1b[0;31m*";
+static const char untrackedString[] = "\x1b[0;35m%";
+static const char unknownString[] = "\x1b[0;33m?";
+static const size_t markerLen = sizeof(stagedString) - 1;
+
+static const char aheadString[] = "\xe2\x86\x91";
+static const char behindString[] = "\xe2\x86\x93";
+static const size_t arrowLen = sizeof(aheadString) - 1;
+
+static const int RECENT_FETCH = 60;
+
+
+// The work tree status and the ahead/behind counts, which are cached for as
+// long as the index and the two commits they were counted between stay
+// the same. Changes to the work tree that no git command has written to the
+// index yet are picked up by the next --serve answer, which always reads
+// them again.
+typedef struct PromptState {
+    uint32_t valid;
+    uint32_t hasUpstream;
+    int64_t indexMtime;     // -1 without an index
+    int64_t indexSize;
+    GitOid local;
+    GitOid upstream;
+    uint32_t known;
+    uint32_t flags;
+    uint32_t ahead;
+    uint32_t behind;
+} PromptState;
+
+typedef struct Prompt {
+    char path[MAX_OUTPUT_LENGTH];   // the colorized path without the branch
+    unsigned int pathLen;
+    unsigned int gitIndex;          // length of the $PWD prefix up to the innermost repository
+    char branch[MAX_BRANCH_LENGTH]; // not colorized, the color depends on the fetch time
+    unsigned int branchLen;
+    char gitDir[MAX_STR_LENGTH];    // absolute
+    char commonDir[MAX_STR_LENGTH];
+    int hasWorkTree;
+    struct stat head;
+    struct stat fetchHead;
+    int hasFetchHead;
+    GitStatus status;               // these are cached apart from the rest, the work
+    unsigned int ahead;             // tree and refs change without $PWD's mtime
+    unsigned int behind;            // changing
+    PromptState state;              // as the cache had it
+} Prompt;
+
+
+// One slot of the prompt cache that all shells share, guarded by a seqlock:
+// the sequence number is odd while a writer is updating the slot, and
+// readers retry nothing, they just treat a torn read as a miss.
+typedef struct PromptSlot {
+    _Atomic uint32_t seq;
+    uint32_t pathLen;
+    uint32_t branchLen;
+    uint32_t gitIndex;
+    uint32_t hasWorkTree;
+    time_t created;
+    int64_t pwdMtime;
+    int64_t headMtime;
+    int64_t fetchMtime;     // 0 without FETCH_HEAD
+    int64_t fetchSize;
+    char key[MAX_STR_LENGTH];   // $HOME NUL $PWD
+    char gitDir[MAX_STR_LENGTH];
+    char commonDir[MAX_STR_LENGTH];
+    char data[PROMPT_CACHE_DATA];  // path followed by the branch
+    PromptState state;
+} PromptSlot;
+
+
+static int64_t mtimeNs(const struct stat* sb) {
+    return (int64_t)sb->st_mtim.tv_sec * 1000000000 + sb->st_mtim.tv_nsec;
+}
 
-const char resetColor[] = "\x1b[0m";
-const size_t resetColorLen = sizeof(resetColor) - 1;
+static void append(char* output, unsigned int* written, const char* bytes, size_t length) {
+    if (*written + length > MAX_OUTPUT_LENGTH) {
+        length = MAX_OUTPUT_LENGTH - *written;
+    }
+    memcpy(output + *written, bytes, length);
+    *written += length;
+}
 
-const char pathString[] = "\x1b[0m/\x1b[36m";
-const size_t pathStringLen = sizeof(pathString) - 1;
 
-const char gitpathString[] = "\x1b[0m/\x1b[1;36m";
-const size_t gitpathStringLen = sizeof(gitpathString) - 1;
+static void getCurrentGitBranchOrCommit(int dirfd, const GitRepo* repo, Prompt* prompt) {
+    char line[MAX_BRANCH_LENGTH];
+    if (gitReadHead(dirfd, repo, line, sizeof(line)) <= 0) {
+        return;
+    }
+    gitStatAt(dirfd, repo, "HEAD", &prompt->head);
 
-const char Nbranch[] = "\x1b[0;32m";
-const char Obranch[] = "\x1b[0;34m";
-const size_t branchLen = sizeof(Obranch) - 1;
+    // Check the last git fetch time
+    prompt->hasFetchHead = gitStatAt(dirfd, repo, "FETCH_HEAD", &prompt->fetchHead) == 0;
 
-const char homePathString[] = "\x1b[36m~";
-const size_t homePathStringLen = sizeof(homePathString) - 1;
+    // Check if line starts with "ref: "
+    if (strncmp(line, "ref: ", 5) == 0) {
 
-const int RECENT_FETCH = 60;
+        // Extract branch name, which may contain slashes itself
+        char* branch = line + 5;
+        if (strncmp(branch, "refs/heads/", 11) == 0) branch += 11;
 
+        prompt->branchLen = strlen(branch);
+        memcpy(prompt->branch, branch, prompt->branchLen);
+    } else {
+        memcpy(prompt->branch, line, 8);
+        prompt->branchLen = 8;
+    }
+}
 
-static int getCurrentGitBranchOrCommit(const char* path, char* result) {
-    char headFilePath[MAX_STR_LENGTH];
-    snprintf(headFilePath, sizeof(headFilePath), "%s/.git/HEAD", path);
-    FILE* file = fopen(headFilePath, "r");
-    if (file == NULL) {
-        return 0;
+
+static void absoluteGitPath(char* out, const char* pwd, unsigned int gitIndex, const char* path) {
+    if (path[0] == '/') {
+        snprintf(out, MAX_STR_LENGTH, "%s", path);
+    } else {
+        snprintf(out, MAX_STR_LENGTH, "%.*s/%s", gitIndex, pwd, path);
     }
+}
 
-    char line[256];
-    if (fgets(line, sizeof(line), file) == NULL) {
-        fclose(file);
-        return 0;
+// Remembers where the repository lives so cached prompts can be validated
+// and the work tree status read without walking $PWD again.
+static void setGitPaths(Prompt* prompt, const char* pwd, const GitRepo* repo) {
+    absoluteGitPath(prompt->gitDir, pwd, prompt->gitIndex, repo->gitDir);
+    absoluteGitPath(prompt->commonDir, pwd, prompt->gitIndex, repo->commonDir);
+    prompt->hasWorkTree = repo->kind != GIT_REPO_BARE;
+}
+
+
+// Without probe the path is colorized without touching the filesystem.
+static void renderPrompt(const char* pwd, const char* home, Prompt* prompt, int probe) {
+    unsigned int written = 0;
+    char *outputPath = prompt->path;
+
+    unsigned int pathOffset = 0;
+    int homelength=strlen(home);
+
+    prompt->gitIndex = 0;
+    prompt->branchLen = 0;
+    prompt->hasFetchHead = 0;
+    prompt->hasWorkTree = 0;
+    prompt->status.known = 0;
+    prompt->status.flags = 0;
+    prompt->ahead = 0;
+    prompt->behind = 0;
+
+    // The walk starts at $HOME or the root and holds an O_PATH descriptor
+    // of the level it is at, so every probe is one fstatat of
+    // <component>/.git relative to the level above and no lookup resolves
+    // more than two names. Only the innermost repository is opened, to
+    // read its HEAD.
+    int dirfd;
+    if (strncmp(pwd, home, homelength) == 0 && (pwd[homelength] == '/' || pwd[homelength] == '\0')) {
+        pathOffset += homelength;
+        append(outputPath, &written, homePathString, homePathStringLen);
+        dirfd = probe ? open(home, O_PATH | O_DIRECTORY | O_CLOEXEC) : -1;
+    } else {
+        dirfd = probe ? open("/", O_PATH | O_DIRECTORY | O_CLOEXEC) : -1;
     }
-    fclose(file);
-    int factor;
 
-    // Check the last git fetch time
-    struct stat fileInfo;
-    char fetchHeadPath[1024];
-    snprintf(fetchHeadPath, sizeof(fetchHeadPath), "%s/.git/FETCH_HEAD", path);
-    if (stat(fetchHeadPath, &fileInfo) == 0) {
-        time_t currentTime;
-        time(&currentTime);
-        double seconds = difftime(currentTime, fileInfo.st_mtime);
+    // the repository found last is lastGit, relative to lastGitFd
+    char lastGit[MAX_STR_LENGTH];
+    int lastGitFd = -1;
+    char component[MAX_STR_LENGTH];
+
+    for (size_t i = pathOffset; pwd[i] != '\0';) {
+        while (pwd[i] == '/') i++;
+        size_t length = strcspn(pwd + i, "/");
+        if (length == 0) break;
+        if (length >= MAX_STR_LENGTH) length = MAX_STR_LENGTH - 1;
+        memcpy(component, pwd + i, length);
+        component[length] = '\0';
+        i += length;
+
+        int hasGit = 0;
+        if (dirfd != -1) {
+            if (gitIsRepoAt(dirfd, component) > 0) {
+                hasGit = 1;
+                prompt->gitIndex = i;
+                memcpy(lastGit, component, length + 1);
+                if (lastGitFd != -1 && lastGitFd != dirfd) close(lastGitFd);
+                lastGitFd = dirfd;
+            }
+
+            // the innermost level is never descended from
+            int nextfd = -1;
+            if (pwd[i + strspn(pwd + i, "/")] != '\0') {
+                TRACE_COUNT(TRACE_OPEN);
+                nextfd = openat(dirfd, component, O_PATH | O_DIRECTORY | O_CLOEXEC);
+            }
+            if (dirfd != lastGitFd) close(dirfd);
+            dirfd = nextfd;
+        }
 
-        if (fileInfo.st_size > 0 && seconds < RECENT_FETCH) {
-            factor = 1;
+        if (hasGit) {
+            append(outputPath, &written, gitpathString, gitpathStringLen);
         } else {
-            factor = -1;
+            append(outputPath, &written, pathString, pathStringLen);
         }
-    } else {
-        factor = 1;
+        append(outputPath, &written, component, length);
     }
+    if (dirfd != -1 && dirfd != lastGitFd) close(dirfd);
 
-    // Check if line starts with "ref: "
-    if (strncmp(line, "ref: ", 5) == 0) {
+    // the root itself
+    if (written == 0) {
+        append(outputPath, &written, pathString, pathStringLen);
+    }
+    prompt->pathLen = written;
+
+    if (lastGitFd != -1) {
+        GitRepo repo;
+        int repoFd;
+        if (gitProbeAt(lastGitFd, lastGit, &repoFd, &repo) > 0) {
+            getCurrentGitBranchOrCommit(repoFd, &repo, prompt);
+            setGitPaths(prompt, pwd, &repo);
+            close(repoFd);
+        }
+        close(lastGitFd);
+    }
+}
 
-        // Extract branch name
-        char* branch = strrchr(line, '/') + 1; // Find the last '/' to get the branch name
 
-        int length = strlen(branch) - 1; // remove newline
-        memcpy(result, branch, length);
-        return factor * length;
+static unsigned int formatPrompt(const Prompt* prompt, char* outputPath) {
+    unsigned int written = 0;
+    append(outputPath, &written, prompt->path, prompt->pathLen);
+
+    if (prompt->branchLen == 0) {
+        append(outputPath, &written, resetColor, resetColorLen);
+        return written;
+    }
+
+    int recent = 1;
+    if (prompt->hasFetchHead) {
+        time_t currentTime;
+        time(&currentTime);
+        double seconds = difftime(currentTime, prompt->fetchHead.st_mtime);
+        recent = prompt->fetchHead.st_size > 0 && seconds < RECENT_FETCH;
+    }
+
+    append(outputPath, &written, " ", 1);
+
+    if (recent) {
+        append(outputPath, &written, Nbranch, branchLen);
     } else {
-        memcpy(result, line, 8);
-        return factor * 8;
+        append(outputPath, &written, Obranch, branchLen);
     }
-}
 
+    append(outputPath, &written, prompt->branch, prompt->branchLen);
 
+    char count[16];
+    if (prompt->ahead) {
+        append(outputPath, &written, aheadString, arrowLen);
+        append(outputPath, &written, count, snprintf(count, sizeof(count), "%u", prompt->ahead));
+    }
+    if (prompt->behind) {
+        append(outputPath, &written, behindString, arrowLen);
+        append(outputPath, &written, count, snprintf(count, sizeof(count), "%u", prompt->behind));
+    }
 
-int main(int argc, char **argv) {
-    char* pwd = getenv("PWD");
-    if (pwd == NULL) {
-        exit(1);
+    // a check that ran out of time before it found anything is shown as unknown
+    const GitStatus *status = &prompt->status;
+    int unknown = status->known && (status->known | status->flags) != GIT_STATUS_ALL;
+    if (status->flags || unknown) {
+        append(outputPath, &written, " ", 1);
+        if (status->flags & GIT_STATUS_STAGED) append(outputPath, &written, stagedString, markerLen);
+        if (status->flags & GIT_STATUS_DIRTY) append(outputPath, &written, dirtyString, markerLen);
+        if (status->flags & GIT_STATUS_UNTRACKED) append(outputPath, &written, untrackedString, markerLen);
+        if (unknown) append(outputPath, &written, unknownString, markerLen);
     }
-    char* home = getenv("HOME");
-    if (home == NULL) {
-        exit(1);
+    append(outputPath, &written, resetColor, resetColorLen);
+    return written;
+}
+
+
+// Resolves HEAD and the upstream of its branch into state: the staged
+// changes depend on the one, the ahead/behind counts on both.
+static void readUpstream(const Prompt* prompt, PromptState* state) {
+    char branch[MAX_STR_LENGTH];
+    char upstreamRef[MAX_STR_LENGTH];
+    if (gitResolveRef(prompt->gitDir, prompt->commonDir, "HEAD", &state->local, branch, sizeof(branch)) != 0) {
+        return;
     }
+    state->hasUpstream = strncmp(branch, "refs/heads/", 11) == 0
+        && gitBranchUpstream(prompt->commonDir, branch + 11, upstreamRef, sizeof(upstreamRef)) == 0
+        && gitResolveRef(prompt->gitDir, prompt->commonDir, upstreamRef, &state->upstream, NULL, 0) == 0;
+}
 
-    int gitpath = 0;
-    if (argc > 1 && strcmp(argv[1], "--git-path") == 0) {
-        gitpath = 1;
-        argc--;
-        argv++;
+
+static PromptSlot* openPromptCache(void) {
+    char name[64];
+    char *override = getenv("FILE_OPENER_PROMPT_CACHE");
+    if (override != NULL) {
+        if (override[0] == '\0') return NULL;
+        snprintf(name, sizeof(name), "/%s", override);
+    } else {
+        // named after the layout of PromptSlot, which older builds read differently
+        snprintf(name, sizeof(name), "/colorpath-2-%d", (int)getuid());
     }
 
+    // /dev/shm is shared by every user, so a segment someone else made
+    // first, or could write to, is not used
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd != -1) {
+        fchmod(fd, 0600);
+    } else if (errno == EEXIST) {
+        fd = shm_open(name, O_RDWR | O_CLOEXEC, 0);
+    }
+    if (fd == -1) return NULL;
+
+    size_t size = sizeof(PromptSlot) * PROMPT_CACHE_SLOTS;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || sb.st_uid != getuid() || (sb.st_mode & 07777) != 0600
+            || ((size_t)sb.st_size != size && ftruncate(fd, size) != 0)) {
+        close(fd);
+        return NULL;
+    }
 
-    unsigned int written = 0;
-    char outputPath[1024];
+    PromptSlot *slots = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return slots == MAP_FAILED ? NULL : slots;
+}
 
-    unsigned int pathOffset = 0;
-    int homelength=strlen(home);
+static size_t promptKey(char* key, const char* home, const char* pwd) {
+    int length = snprintf(key, MAX_STR_LENGTH, "%s%c%s", home, '\0', pwd);
+    return length < MAX_STR_LENGTH ? (size_t)length : 0;
+}
 
-    if (strncmp(pwd, home, homelength) == 0) {
-        pathOffset += homelength;
-        memcpy(outputPath, homePathString, homePathStringLen);
-        written+=homePathStringLen;
+static PromptSlot* promptSlot(PromptSlot* slots, const char* key, size_t keyLen) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < keyLen; i++) {
+        hash = (hash ^ (unsigned char)key[i]) * 16777619u;
     }
+    return &slots[hash % PROMPT_CACHE_SLOTS];
+}
 
-    size_t hasGit[MAX_PATH_DEPTH];
-    for (int i = 0; i < MAX_PATH_DEPTH; i++) {
-        hasGit[i] = 0;
+// Returns 1 and fills in prompt if the slot holds a prompt for key that is
+// still valid: $PWD, HEAD and FETCH_HEAD have not changed since.
+static int readCachedPrompt(PromptSlot* slot, const char* key, size_t keyLen, const char* pwd, Prompt* prompt) {
+    uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    if (seq == 0 || seq & 1) return 0;
+
+    PromptSlot copy;
+    memcpy(&copy, slot, sizeof(PromptSlot));
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq) return 0;
+
+    // the lengths are checked one by one, their sum could wrap
+    if (memcmp(copy.key, key, keyLen + 1) != 0 || time(NULL) - copy.created > PROMPT_CACHE_TTL
+            || copy.pathLen > MAX_OUTPUT_LENGTH || copy.pathLen > PROMPT_CACHE_DATA
+            || copy.branchLen >= MAX_BRANCH_LENGTH || copy.branchLen > PROMPT_CACHE_DATA - copy.pathLen
+            || copy.gitIndex > strlen(pwd)) {
+        return 0;
+    }
+    copy.gitDir[MAX_STR_LENGTH - 1] = '\0';
+    copy.commonDir[MAX_STR_LENGTH - 1] = '\0';
+
+    struct stat sb;
+    TRACE_COUNT(TRACE_STAT);
+    if (stat(pwd, &sb) != 0 || mtimeNs(&sb) != copy.pwdMtime) return 0;
+
+    prompt->hasFetchHead = 0;
+    if (copy.headMtime != 0) {
+        char headPath[MAX_STR_LENGTH + 16];
+        char fetchHeadPath[MAX_STR_LENGTH + 16];
+        snprintf(headPath, sizeof(headPath), "%s/HEAD", copy.gitDir);
+        snprintf(fetchHeadPath, sizeof(fetchHeadPath), "%s/FETCH_HEAD", copy.gitDir);
+
+        TRACE_COUNT(TRACE_STAT);
+        if (stat(headPath, &prompt->head) != 0 || mtimeNs(&prompt->head) != copy.headMtime) return 0;
+        TRACE_COUNT(TRACE_STAT);
+        prompt->hasFetchHead = stat(fetchHeadPath, &prompt->fetchHead) == 0;
+        if (prompt->hasFetchHead != (copy.fetchMtime != 0)) return 0;
+        if (prompt->hasFetchHead && (mtimeNs(&prompt->fetchHead) != copy.fetchMtime
+                || prompt->fetchHead.st_size != copy.fetchSize)) return 0;
     }
 
-    char directories[MAX_PATH_DEPTH][MAX_STR_LENGTH];
-    char substring[1024];
-    int lastGit = 0;
-    int gitLength = 0;
-    char gitBranch[64];
-    int lastindex = 0;
+    memcpy(prompt->path, copy.data, copy.pathLen);
+    prompt->pathLen = copy.pathLen;
+    memcpy(prompt->branch, copy.data + copy.pathLen, copy.branchLen);
+    prompt->branchLen = copy.branchLen;
+    prompt->gitIndex = copy.gitIndex;
+    prompt->hasWorkTree = copy.hasWorkTree;
+    memcpy(prompt->gitDir, copy.gitDir, MAX_STR_LENGTH);
+    memcpy(prompt->commonDir, copy.commonDir, MAX_STR_LENGTH);
+    prompt->state = copy.state;
+    return 1;
+}
+
+static void writeCachedPrompt(PromptSlot* slot, const char* key, size_t keyLen, const char* pwd, const Prompt* prompt) {
+    struct stat sb;
+    if (prompt->pathLen + prompt->branchLen > PROMPT_CACHE_DATA || stat(pwd, &sb) != 0) return;
+
+    // another shell is writing this slot, ours can wait for the next prompt.
+    // A writer killed half-way leaves it odd for good, so once what it held
+    // would have expired anyway the slot is taken over.
+    uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+    time_t now = time(NULL);
+    if (seq & 1 && now - slot->created <= PROMPT_CACHE_TTL) return;
+    uint32_t claimed = seq + 1 + (seq & 1);
+    if (!atomic_compare_exchange_strong(&slot->seq, &seq, claimed)) return;
+    atomic_thread_fence(memory_order_release);
+
+    slot->created = now;
+    memcpy(slot->key, key, keyLen + 1);
+    slot->pwdMtime = mtimeNs(&sb);
+    slot->pathLen = prompt->pathLen;
+    slot->branchLen = prompt->branchLen;
+    slot->gitIndex = prompt->gitIndex;
+    slot->hasWorkTree = prompt->branchLen ? prompt->hasWorkTree : 0;
+    slot->headMtime = prompt->branchLen ? mtimeNs(&prompt->head) : 0;
+    slot->fetchMtime = prompt->hasFetchHead ? mtimeNs(&prompt->fetchHead) : 0;
+    slot->fetchSize = prompt->hasFetchHead ? prompt->fetchHead.st_size : 0;
+    snprintf(slot->gitDir, MAX_STR_LENGTH, "%s", prompt->branchLen ? prompt->gitDir : "");
+    snprintf(slot->commonDir, MAX_STR_LENGTH, "%s", prompt->branchLen ? prompt->commonDir : "");
+    memcpy(slot->data, prompt->path, prompt->pathLen);
+    memcpy(slot->data + prompt->pathLen, prompt->branch, prompt->branchLen);
+    memset(&slot->state, 0, sizeof(slot->state));
+
+    atomic_store_explicit(&slot->seq, claimed + 1, memory_order_release);
+}
+
+// Stores the status and counts in the slot if it still holds key.
+static void writeCachedState(PromptSlot* slot, const char* key, size_t keyLen, const PromptState* state) {
+    uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+    if (seq == 0 || seq & 1) return;
+    if (!atomic_compare_exchange_strong(&slot->seq, &seq, seq + 1)) return;
+    atomic_thread_fence(memory_order_release);
+    if (memcmp(slot->key, key, keyLen + 1) == 0) slot->state = *state;
+    atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+}
 
-    size_t depth = 0;
-    for (size_t i=pathOffset, j=1; pwd[i] != '\0'; i++, j++) {
-        if (pwd[i+1] != '/' && pwd[i+1] != '\0')
-            continue;
 
-        memcpy(directories[depth], pwd+i-j+2, j-1);
-        directories[depth][j] = '\0';
-        j=0; // reset path separator
-        memcpy(substring, pwd, i+1);
-        substring[i+1] = '\0';
-        gitLength = getCurrentGitBranchOrCommit(substring, gitBranch);
-        if (gitLength) {
-            hasGit[depth] = 1;
-            lastindex = i+1;
-            lastGit = gitLength;
+// The shared cache, opened on first use.
+static PromptSlot* promptCache(void) {
+    static PromptSlot *slots = NULL;
+    static int opened = 0;
+    if (!opened) {
+        slots = openPromptCache();
+        opened = 1;
+    }
+    return slots;
+}
+
+// Fills in prompt from the shared cache or by walking $PWD.
+static void buildPrompt(const char* pwd, const char* home, PromptSlot* slots, Prompt* prompt) {
+    char key[MAX_STR_LENGTH];
+    size_t keyLen = promptKey(key, home, pwd);
+    PromptSlot *slot = slots && keyLen ? promptSlot(slots, key, keyLen) : NULL;
+
+    prompt->status.known = 0;
+    prompt->status.flags = 0;
+    prompt->ahead = 0;
+    prompt->behind = 0;
+    memset(&prompt->state, 0, sizeof(prompt->state));
+    TRACE_BEGIN("cache");
+    int cached = slot != NULL && readCachedPrompt(slot, key, keyLen, pwd, prompt);
+    TRACE_END("cache");
+    if (!cached) {
+        TRACE_BEGIN("render");
+        renderPrompt(pwd, home, prompt, 1);
+        TRACE_END("render");
+        if (slot != NULL) {
+            writeCachedPrompt(slot, key, keyLen, pwd, prompt);
         }
-        depth++;
     }
+}
 
-    if (gitpath) {
-        write(1, pwd, lastindex);
-        if (lastindex)
-            return 0;
-        return 1;
+// The status and the ahead/behind counts: taken from the cache when the
+// index and both commits are the ones it has them for, unless fresh is set,
+// and read and stored in the cache otherwise.
+static void readGitState(const char* pwd, const char* home, PromptSlot* slots, Prompt* prompt,
+                         long budget, int fresh) {
+    if (!prompt->branchLen) return;
+    char *budgetEnv = getenv("FILE_OPENER_STATUS_BUDGET");
+    if (budgetEnv != NULL && budgetEnv[0] != '\0') {
+        budget = strtol(budgetEnv, NULL, 10);
     }
 
-    for (size_t j = 0; j < depth; j++) {
-        if (hasGit[j]) {
-            memcpy(outputPath + written, gitpathString, gitpathStringLen);
-            written+=gitpathStringLen;
-        } else {
-            memcpy(outputPath + written, pathString, pathStringLen);
-            written+=pathStringLen;
-        }
-        written+=snprintf(outputPath + written, MAX_STR_LENGTH - written, directories[j]);
+    PromptState state;
+    memset(&state, 0, sizeof(state));
+    state.valid = 1;
+    TRACE_BEGIN("upstream");
+    readUpstream(prompt, &state);
+    TRACE_END("upstream");
+
+    char indexPath[MAX_STR_LENGTH + 16];
+    struct stat sb;
+    snprintf(indexPath, sizeof(indexPath), "%s/index", prompt->gitDir);
+    TRACE_COUNT(TRACE_STAT);
+    int hasIndex = stat(indexPath, &sb) == 0;
+    state.indexMtime = hasIndex ? mtimeNs(&sb) : -1;
+    state.indexSize = hasIndex ? sb.st_size : 0;
+
+    const PromptState *cached = &prompt->state;
+    if (!fresh && cached->valid && cached->hasUpstream == state.hasUpstream
+            && cached->indexMtime == state.indexMtime && cached->indexSize == state.indexSize
+            && memcmp(&cached->local, &state.local, sizeof(GitOid)) == 0
+            && memcmp(&cached->upstream, &state.upstream, sizeof(GitOid)) == 0) {
+        prompt->ahead = cached->ahead;
+        prompt->behind = cached->behind;
+        prompt->status.known = cached->known;
+        prompt->status.flags = cached->flags;
+        return;
+    }
 
+    if (state.hasUpstream) {
+        TRACE_BEGIN("counts");
+        gitAheadBehind(prompt->commonDir, &state.local, &state.upstream, &prompt->ahead, &prompt->behind);
+        TRACE_END("counts");
+    }
+    if (prompt->hasWorkTree && budget > 0) {
+        char workTree[MAX_STR_LENGTH];
+        snprintf(workTree, sizeof(workTree), "%.*s", prompt->gitIndex, pwd);
+        TRACE_BEGIN("status");
+        gitWorktreeStatus(workTree, prompt->gitDir, prompt->commonDir, budget * 1000, &prompt->status);
+        TRACE_END("status");
     }
 
-    if (!lastGit) {
-        memcpy(outputPath + written, resetColor, resetColorLen);
-        written += resetColorLen;
-        write(1, outputPath, written);
-        return 0;
+    state.ahead = prompt->ahead;
+    state.behind = prompt->behind;
+    state.known = prompt->status.known;
+    state.flags = prompt->status.flags;
+    prompt->state = state;
+    char key[MAX_STR_LENGTH];
+    size_t keyLen = promptKey(key, home, pwd);
+    if (slots != NULL && keyLen) writeCachedState(promptSlot(slots, key, keyLen), key, keyLen, &state);
+}
+
+size_t colorpathRender(const char* pwd, const char* home, char* output) {
+    static Prompt prompt;
+    buildPrompt(pwd, home, promptCache(), &prompt);
+    readGitState(pwd, home, promptCache(), &prompt, STATUS_BUDGET, 0);
+    gitRepoCacheReset();
+    return formatPrompt(&prompt, output);
+}
+
+
+#ifndef FILEOPENER_MODULE
+// ids are the shell's request counters, anything longer is not a request
+#define MAX_ID_LENGTH 32
+
+static void reply(const char* id, int final, const Prompt* prompt) {
+    char output[MAX_ID_LENGTH + 4 + MAX_OUTPUT_LENGTH + 1];
+    int written = snprintf(output, sizeof(output), "%s %d ", id, final);
+    written += formatPrompt(prompt, output + written);
+    output[written++] = '\n';
+    write(1, output, written);
+}
+
+// --serve: answers requests of the form "<id> <pwd>" on stdin, one per
+// line. Each gets "<id> 0 <prompt>" with just the path right away, then
+// "<id> 1 <prompt>" with the git segments once they are read. A request
+// that is already followed by another one gets no second answer. Lines
+// that do not fit the buffer are dropped whole.
+static int serve(const char* home, PromptSlot* slots) {
+    static Prompt prompt;
+    char buffer[2 * MAX_STR_LENGTH];
+    size_t filled = 0;
+    int overlong = 0;
+
+    for (;;) {
+        char *newline = memchr(buffer, '\n', filled);
+        if (newline == NULL) {
+            if (filled == sizeof(buffer)) {
+                filled = 0;
+                overlong = 1;
+            }
+            ssize_t n = read(0, buffer + filled, sizeof(buffer) - filled);
+            if (n <= 0) return 0;
+            filled += n;
+            continue;
+        }
+
+        *newline = '\0';
+        char *pwd = overlong ? NULL : strchr(buffer, ' ');
+        overlong = 0;
+        if (pwd != NULL && pwd - buffer <= MAX_ID_LENGTH && pwd[1] == '/') {
+            *pwd++ = '\0';
+            renderPrompt(pwd, home, &prompt, 0);
+            reply(buffer, 0, &prompt);
+
+            struct pollfd next = { 0, POLLIN, 0 };
+            if (memchr(newline + 1, '\n', buffer + filled - newline - 1) == NULL
+                    && (poll(&next, 1, 0) == 0 || !(next.revents & POLLIN))) {
+                // directories may have changed since the last request, and
+                // a relative $GIT_DIR or work tree means the request's one
+                if (chdir(pwd) != 0) chdir("/");
+                gitRepoCacheReset();
+                buildPrompt(pwd, home, slots, &prompt);
+                readGitState(pwd, home, slots, &prompt, SERVE_STATUS_BUDGET, 1);
+                reply(buffer, 1, &prompt);
+            }
+        }
+
+        filled -= newline + 1 - buffer;
+        memmove(buffer, newline + 1, filled);
     }
+}
 
-    uint absLastGit = abs(lastGit);
-    outputPath[written++] = ' ';
 
-    if (lastGit > 0) {
-        memcpy(outputPath + written, Nbranch, branchLen);
-    } else {
-        memcpy(outputPath + written, Obranch, branchLen);
+int colorpathMain(int argc, char **argv) {
+    TRACE_INIT("colorpath");
+    atexit(gitRepoCacheSave);
+
+    char* pwd = getenv("PWD");
+    if (pwd == NULL) {
+        exit(1);
+    }
+    char* home = getenv("HOME");
+    if (home == NULL) {
+        exit(1);
+    }
+
+    int gitpath = 0;
+    if (argc > 1 && strcmp(argv[1], "--git-path") == 0) {
+        gitpath = 1;
+        argc--;
+        argv++;
     }
-    written += branchLen;
 
-    memcpy(outputPath + written, gitBranch, absLastGit);
-    written += absLastGit;
+    if (argc > 1 && strcmp(argv[1], "--serve") == 0) {
+        return serve(home, promptCache());
+    }
 
-    memcpy(outputPath + written, resetColor, resetColorLen);
-    written += resetColorLen;
+    if (gitpath) {
+        static Prompt prompt;
+        buildPrompt(pwd, home, promptCache(), &prompt);
+        write(1, pwd, prompt.gitIndex);
+        if (prompt.gitIndex)
+            return 0;
+        return 1;
+    }
 
-    write(1, outputPath, written);
+    char output[MAX_OUTPUT_LENGTH];
+    write(1, output, colorpathRender(pwd, home, output));
     return 0;
 }
+
+#ifndef FILEOPENER_MULTICALL
+int main(int argc, char **argv) {
+    return colorpathMain(argc, argv);
+}
+#endif
+#endif
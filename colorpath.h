@@ -0,0 +1,16 @@
+#ifndef COLORPATH_H
+#define COLORPATH_H
+
+#include <stddef.h>
+
+#define COLORPATH_MAX_OUTPUT 16384
+
+// Renders the prompt for pwd the way colorpath prints it into output, which
+// holds COLORPATH_MAX_OUTPUT bytes, and returns its length. Probes are not
+// remembered from one call to the next.
+size_t colorpathRender(const char* pwd, const char* home, char* output);
+
+// The colorpath program itself, called by main or by the multi-call binary.
+int colorpathMain(int argc, char** argv);
+
+#endif
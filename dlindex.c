@@ -0,0 +1,512 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <locale.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "lscolors.h"
+#include "open.h"
+#include "trace.h"
+#include "dlindex.h"
+
+// Lists a downloads directory the way
+//
+//   ls --color=always -ct1 ~/dl | awk '{print "~/dl/" $0}'
+//
+// does, with what open --only-files would make of each file after a tab:
+//
+//   ~/dl/<colored name>\t<multimedia|book|web|picture|...>
+//
+// The listing is kept in $XDG_CACHE_HOME/zsh-file-opener/dlindex (or
+// $FILE_OPENER_DLINDEX_CACHE, empty to disable it) and written out from
+// there for as long as the directory's mtime does not change.
+//
+//   dlindex [--prefix prefix] [dir]
+//   dlindex --watch [--prefix prefix] [dir]
+//
+// With --watch it stays in the background with a single inotify watch on
+// the directory and brings the listing up to date as files arrive, leave
+// or are written, coloring and classifying only those, so the widget never
+// walks the directory. One watcher runs per listing; others exit at once.
+
+#define MAX_PATH_LENGTH 4096
+#define DENTS_BUFFER (64 * 1024)
+#define INDEX_MAGIC "ZFODLIX1"
+#define WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | \
+                      IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+typedef struct Download {
+    char *name;
+    const char *color;
+    int64_t ctime;
+    int category;
+} Download;
+
+typedef struct Downloads {
+    Download *entries;
+    size_t count, capacity;
+    const LsColors *table;
+    int dirfd;
+    const char *dir;    // absolute, for open's classification
+} Downloads;
+
+typedef struct Buffer {
+    char *data;
+    size_t size, capacity;
+} Buffer;
+
+typedef struct IndexHeader {
+    char magic[8];
+    int64_t mtime;      // of the directory when the listing was last brought up to date
+    int64_t taken;      // CLOCK_REALTIME in ns at that time
+    uint64_t dev;
+    uint64_t ino;
+    uint32_t keyLen;
+    uint32_t unused;
+    uint64_t dataSize;
+} IndexHeader;
+
+
+static int compareDownloads(const void* a, const void* b) {
+    const Download *x = a, *y = b;
+    if (x->ctime != y->ctime) return x->ctime < y->ctime ? 1 : -1;
+    return strcoll(x->name, y->name);
+}
+
+static int classify(const Downloads* downloads, const char* name) {
+    char path[MAX_PATH_LENGTH];
+    snprintf(path, sizeof(path), "%s/%s", downloads->dir, name);
+    char *resolved;
+    int category = openClassify(path, 1, &resolved);
+    free(resolved);
+    return category;
+}
+
+// Colors, dates and classifies an entry. Returns 0 if it is to be listed.
+static int readDownload(const Downloads* downloads, const char* name, unsigned char dtype, Download* download) {
+    // like ls without -A
+    if (name[0] == '.') return -1;
+    LsFile file;
+    if (lsColorsFile(downloads->table, downloads->dirfd, name, dtype, 1, &file) != 0) return -1;
+    download->name = strdup(name);
+    if (download->name == NULL) return -1;
+    TRACE_COUNT(TRACE_ALLOC);
+    download->color = file.color;
+    download->ctime = file.ctime;
+    download->category = classify(downloads, name);
+    return 0;
+}
+
+static Download* appendDownload(Downloads* downloads) {
+    if (downloads->count == downloads->capacity) {
+        size_t capacity = downloads->capacity ? downloads->capacity * 2 : 256;
+        Download *entries = realloc(downloads->entries, capacity * sizeof(Download));
+        if (entries == NULL) return NULL;
+        TRACE_COUNT(TRACE_ALLOC);
+        downloads->entries = entries;
+        downloads->capacity = capacity;
+    }
+    return &downloads->entries[downloads->count];
+}
+
+static void clearDownloads(Downloads* downloads) {
+    for (size_t i = 0; i < downloads->count; i++) free(downloads->entries[i].name);
+    downloads->count = 0;
+}
+
+static int scanDownloads(Downloads* downloads) {
+    clearDownloads(downloads);
+    lseek(downloads->dirfd, 0, SEEK_SET);
+    char *buffer = malloc(DENTS_BUFFER);
+    if (buffer == NULL) return -1;
+    for (;;) {
+        ssize_t n = getdents64(downloads->dirfd, buffer, DENTS_BUFFER);
+        if (n < 0) {
+            free(buffer);
+            return -1;
+        }
+        if (n == 0) break;
+        for (ssize_t offset = 0; offset < n; ) {
+            struct dirent64 *entry = (struct dirent64 *)(buffer + offset);
+            offset += entry->d_reclen;
+            Download *download = appendDownload(downloads);
+            if (download == NULL) {
+                free(buffer);
+                return -1;
+            }
+            if (readDownload(downloads, entry->d_name, entry->d_type, download) == 0) downloads->count++;
+        }
+    }
+    free(buffer);
+    qsort(downloads->entries, downloads->count, sizeof(Download), compareDownloads);
+    return 0;
+}
+
+static void removeDownload(Downloads* downloads, const char* name) {
+    for (size_t i = 0; i < downloads->count; i++) {
+        if (strcmp(downloads->entries[i].name, name) == 0) {
+            free(downloads->entries[i].name);
+            memmove(&downloads->entries[i], &downloads->entries[i + 1],
+                    (downloads->count - i - 1) * sizeof(Download));
+            downloads->count--;
+            return;
+        }
+    }
+}
+
+// Rereads an entry something happened to, keeping the list sorted.
+static void updateDownload(Downloads* downloads, const char* name) {
+    removeDownload(downloads, name);
+    Download *slot = appendDownload(downloads);
+    Download download;
+    if (slot == NULL || readDownload(downloads, name, DT_UNKNOWN, &download) != 0) return;
+
+    size_t low = 0, high = downloads->count;
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        if (compareDownloads(&downloads->entries[middle], &download) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    memmove(&downloads->entries[low + 1], &downloads->entries[low], (downloads->count - low) * sizeof(Download));
+    downloads->entries[low] = download;
+    downloads->count++;
+}
+
+
+static int bufferAdd(Buffer* buffer, const char* data, size_t len) {
+    if (buffer->size + len > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity * 2 : 65536;
+        while (capacity < buffer->size + len) capacity *= 2;
+        char *grown = realloc(buffer->data, capacity);
+        if (grown == NULL) return -1;
+        TRACE_COUNT(TRACE_ALLOC);
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->size, data, len);
+    buffer->size += len;
+    return 0;
+}
+
+static void bufferColor(Buffer* buffer, const LsColors* table, const char* color) {
+    bufferAdd(buffer, table->colors[LS_COLOR_LEFT], strlen(table->colors[LS_COLOR_LEFT]));
+    bufferAdd(buffer, color, strlen(color));
+    bufferAdd(buffer, table->colors[LS_COLOR_RIGHT], strlen(table->colors[LS_COLOR_RIGHT]));
+}
+
+static void bufferReset(Buffer* buffer, const LsColors* table) {
+    if (table->colors[LS_COLOR_END] != NULL) {
+        bufferAdd(buffer, table->colors[LS_COLOR_END], strlen(table->colors[LS_COLOR_END]));
+    } else {
+        bufferColor(buffer, table, table->colors[LS_COLOR_RESET]);
+    }
+}
+
+// Renders the list like lsdir -c, each name followed by its category.
+static void render(Buffer* out, const Downloads* downloads, const char* prefix) {
+    const LsColors *table = downloads->table;
+    size_t prefixLen = strlen(prefix);
+    int reset = 0;
+    out->size = 0;
+    for (size_t i = 0; i < downloads->count; i++) {
+        const Download *download = &downloads->entries[i];
+        if (download->color != NULL && !reset) {
+            bufferReset(out, table);
+            reset = 1;
+        }
+        bufferAdd(out, prefix, prefixLen);
+        if (download->color != NULL) {
+            bufferColor(out, table, download->color);
+            bufferAdd(out, download->name, strlen(download->name));
+            bufferReset(out, table);
+        } else {
+            bufferAdd(out, download->name, strlen(download->name));
+        }
+        const char *category = openCategoryName(download->category);
+        bufferAdd(out, "\t", 1);
+        bufferAdd(out, category, strlen(category));
+        bufferAdd(out, "\n", 1);
+    }
+}
+
+
+static int64_t timeNs(const struct timespec* ts) {
+    return (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+static int64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return timeNs(&ts);
+}
+
+static void mkdirParents(char* path) {
+    for (char *slash = strchr(path + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(path, 0700);
+        *slash = '/';
+    }
+}
+
+// Everything the listing depends on besides the directory's content.
+static size_t indexKey(char* key, size_t size, const char* dir, const char* prefix) {
+    static const char *formats[] = {
+        "_FILE_OPENER_MULTIMEDIA_FORMATS", "_FILE_OPENER_BOOK_FORMATS", "_FILE_OPENER_WEB_FORMATS",
+        "_FILE_OPENER_PICTURE_FORMATS", "_FILE_OPENER_LIBREOFFICE_FORMATS", "_FILE_OPENER_EXCLUDE_SUFFIXES",
+    };
+    const char *colors = getenv("LS_COLORS");
+    const char *collate = setlocale(LC_COLLATE, NULL);
+    int len = snprintf(key, size, "%s%c%s%c%s%c%s", dir, '\0', prefix, '\0', colors ? colors : "", '\0',
+                       collate ? collate : "");
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]) && len > 0 && (size_t)len < size; i++) {
+        const char *value = getenv(formats[i]);
+        len += snprintf(key + len + 1, size - len - 1, "%s", value ? value : "") + 1;
+    }
+    return len > 0 && (size_t)len < size ? (size_t)len : 0;
+}
+
+// The index file of a listing, named after its key. Returns 0 on success.
+static int indexPath(char* path, size_t size, const char* key, size_t keyLen) {
+    char *override = getenv("FILE_OPENER_DLINDEX_CACHE");
+    char *cacheHome = getenv("XDG_CACHE_HOME");
+    char *home = getenv("HOME");
+    char dir[MAX_PATH_LENGTH];
+    if (override != NULL) {
+        if (override[0] == '\0') return -1;
+        snprintf(dir, sizeof(dir), "%s", override);
+    } else if (cacheHome != NULL && cacheHome[0] != '\0') {
+        snprintf(dir, sizeof(dir), "%s/zsh-file-opener/dlindex", cacheHome);
+    } else if (home != NULL) {
+        snprintf(dir, sizeof(dir), "%s/.cache/zsh-file-opener/dlindex", home);
+    } else {
+        return -1;
+    }
+
+    uint64_t hash = 14695981039346656037u;
+    for (size_t i = 0; i < keyLen; i++) hash = (hash ^ (unsigned char)key[i]) * 1099511628211u;
+    int len = snprintf(path, size, "%s/%016llx", dir, (unsigned long long)hash);
+    return len > 0 && (size_t)len < size ? 0 : -1;
+}
+
+// Writes the indexed listing to stdout if it is as new as the directory.
+// Returns 0 if it did.
+static int writeIndexed(const char* path, const char* key, size_t keyLen, const struct stat* sb) {
+    TRACE_COUNT(TRACE_OPEN);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+    struct stat indexSb;
+    if (fstat(fd, &indexSb) != 0 || (size_t)indexSb.st_size < sizeof(IndexHeader)) {
+        close(fd);
+        return -1;
+    }
+    const char *map = mmap(NULL, indexSb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    IndexHeader header;
+    memcpy(&header, map, sizeof(header));
+    int64_t mtime = timeNs(&sb->st_mtim);
+    int valid = memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) == 0
+        && header.mtime == mtime && mtime < header.taken
+        && header.dev == (uint64_t)sb->st_dev && header.ino == (uint64_t)sb->st_ino
+        && header.keyLen == keyLen
+        && sizeof(header) + keyLen + header.dataSize == (uint64_t)indexSb.st_size
+        && memcmp(map + sizeof(header), key, keyLen) == 0;
+    if (valid) fwrite(map + sizeof(header) + keyLen, 1, header.dataSize, stdout);
+    munmap((void *)map, indexSb.st_size);
+    return valid ? 0 : -1;
+}
+
+// Replaces the index, so that readers only ever map a complete one.
+static void saveIndex(const char* path, const char* key, size_t keyLen, const struct stat* sb,
+                      int64_t taken, const Buffer* data) {
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.mtime = timeNs(&sb->st_mtim);
+    header.taken = taken;
+    header.dev = sb->st_dev;
+    header.ino = sb->st_ino;
+    header.keyLen = keyLen;
+    header.dataSize = data->size;
+
+    char tempPath[MAX_PATH_LENGTH + 8];
+    snprintf(tempPath, sizeof(tempPath), "%s.XXXXXX", path);
+    mkdirParents(tempPath);
+    int fd = mkstemp(tempPath);
+    if (fd == -1) return;
+    FILE *file = fdopen(fd, "w");
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(key, 1, keyLen, file);
+    if (data->size) fwrite(data->data, 1, data->size, file);
+    if (fclose(file) != 0 || rename(tempPath, path) != 0) {
+        unlink(tempPath);
+    }
+}
+
+
+// Applies a batch of events. Returns -1 once the directory is gone.
+static int applyEvents(Downloads* downloads, const char* events, ssize_t size) {
+    for (ssize_t offset = 0; offset < size; ) {
+        const struct inotify_event *event = (const struct inotify_event *)(events + offset);
+        offset += sizeof(struct inotify_event) + event->len;
+        if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT)) return -1;
+        if (event->mask & IN_Q_OVERFLOW) {
+            if (scanDownloads(downloads) != 0) return -1;
+        } else if (event->len > 0) {
+            if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                removeDownload(downloads, event->name);
+            } else {
+                updateDownload(downloads, event->name);
+            }
+        }
+    }
+    return 0;
+}
+
+static int watch(Downloads* downloads, const char* path, const char* key, size_t keyLen, const char* prefix) {
+    char lockPath[MAX_PATH_LENGTH + 8];
+    snprintf(lockPath, sizeof(lockPath), "%s.lock", path);
+    mkdirParents(lockPath);
+    int lock = open(lockPath, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lock == -1 || flock(lock, LOCK_EX | LOCK_NB) != 0) return lock == -1 ? 2 : 0;
+
+    int events = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (events == -1 || inotify_add_watch(events, downloads->dir, WATCH_EVENTS) == -1) {
+        fprintf(stderr, "dlindex: %s: %s\n", downloads->dir, strerror(errno));
+        return 2;
+    }
+
+    // from here on nothing is said, and the shell that started it may go
+    setsid();
+    signal(SIGHUP, SIG_IGN);
+    int devNull = open("/dev/null", O_RDWR);
+    for (int fd = 0; fd < 3 && devNull != -1; fd++) dup2(devNull, fd);
+    if (devNull > 2) close(devNull);
+
+    // The directory's mtime is read before the events that led up to it are
+    // applied, so a listing is never stamped with a change it misses.
+    struct stat sb;
+    int64_t taken = now();
+    if (fstat(downloads->dirfd, &sb) != 0 || scanDownloads(downloads) != 0) return 2;
+    Buffer out = { NULL, 0, 0 };
+    static char buffer[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        render(&out, downloads, prefix);
+        saveIndex(path, key, keyLen, &sb, taken, &out);
+
+        struct pollfd pfd = { events, POLLIN, 0 };
+        while (poll(&pfd, 1, -1) == -1 && errno == EINTR);
+        taken = now();
+        if (fstat(downloads->dirfd, &sb) != 0) break;
+        ssize_t n;
+        int gone = 0;
+        while (!gone && (n = read(events, buffer, sizeof(buffer))) > 0) {
+            gone = applyEvents(downloads, buffer, n) != 0;
+        }
+        if (gone) break;
+    }
+    free(out.data);
+    return 0;
+}
+
+int dlindexMain(int argc, char** argv) {
+    TRACE_INIT("dlindex");
+    setlocale(LC_COLLATE, "");
+
+    int watching = 0;
+    const char *prefix = "";
+    const char *dir = ".";
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--watch") == 0) {
+            watching = 1;
+        } else if (strcmp(argv[i], "--prefix") == 0 && i + 1 < argc) {
+            prefix = argv[++i];
+        } else if (argv[i][0] != '-' || strcmp(argv[i], "-") == 0) {
+            dir = argv[i];
+        } else {
+            fprintf(stderr, "usage: dlindex [--watch] [--prefix prefix] [dir]\n");
+            return 2;
+        }
+    }
+
+    char absolute[PATH_MAX];
+    TRACE_COUNT(TRACE_OPEN);
+    int dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    struct stat sb;
+    if (dirfd == -1 || fstat(dirfd, &sb) != 0 || realpath(dir, absolute) == NULL) {
+        fprintf(stderr, "dlindex: %s: %s\n", dir, strerror(errno));
+        return 2;
+    }
+
+    static char key[2 * MAX_PATH_LENGTH + 32768];
+    char path[MAX_PATH_LENGTH];
+    size_t keyLen = indexKey(key, sizeof(key), absolute, prefix);
+    int indexed = keyLen > 0 && indexPath(path, sizeof(path), key, keyLen) == 0;
+    if (!watching && indexed && writeIndexed(path, key, keyLen, &sb) == 0) {
+        close(dirfd);
+        return fflush(stdout) == 0 ? 0 : 1;
+    }
+
+    LsColors table;
+    lsColorsCompile(&table, getenv("LS_COLORS"));
+    Downloads downloads;
+    memset(&downloads, 0, sizeof(downloads));
+    downloads.table = &table;
+    downloads.dirfd = dirfd;
+    downloads.dir = absolute;
+
+    if (watching) {
+        if (!indexed) {
+            fprintf(stderr, "dlindex: no index to keep\n");
+            return 2;
+        }
+        return watch(&downloads, path, key, keyLen, prefix);
+    }
+
+    int64_t taken = now();
+    TRACE_BEGIN("read");
+    int failed = scanDownloads(&downloads);
+    TRACE_END("read");
+    close(dirfd);
+    if (failed) {
+        fprintf(stderr, "dlindex: %s: %s\n", dir, strerror(errno));
+        return 2;
+    }
+
+    Buffer out = { NULL, 0, 0 };
+    render(&out, &downloads, prefix);
+    fwrite(out.data, 1, out.size, stdout);
+    if (indexed) {
+        TRACE_BEGIN("index");
+        saveIndex(path, key, keyLen, &sb, taken, &out);
+        TRACE_END("index");
+    }
+
+    clearDownloads(&downloads);
+    free(downloads.entries);
+    free(out.data);
+    return fflush(stdout) == 0 ? 0 : 1;
+}
+
+#ifndef FILEOPENER_MULTICALL
+int main(int argc, char **argv) {
+    return dlindexMain(argc, argv);
+}
+#endif
@@ -0,0 +1,9 @@
+#ifndef DLINDEX_H
+#define DLINDEX_H
+
+// The dlindex program, called by main or by the multi-call binary. It keeps
+// the downloads directory listed newest first, colored and classified, for
+// fzy-downloads-widget.
+int dlindexMain(int argc, char** argv);
+
+#endif
@@ -0,0 +1,1000 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <lzma.h>
+#ifdef FILEOPENER_ZSTD
+#include <zstd.h>
+#endif
+
+#include "trace.h"
+#include "extract.h"
+
+// Tar archives, plain or compressed with gzip, xz or (when build.sh found
+// libzstd) zstd, and zip archives of stored and deflated members. Anything
+// else is left to extract.sh. xz streams written in blocks (xz -T) decode on
+// several threads and zip members are inflated in parallel; zstd frames and
+// gzip members decode on one.
+//
+// Members are created below the destination by walking their paths with
+// openat without following symlinks, and never leave it: absolute paths
+// lose their leading slashes, members with a ".." component are skipped, and
+// so are symlinks that would point outside it. Setuid bits, owners, devices
+// and fifos are not restored.
+
+#define IO_BUFFER (256 * 1024)
+#define TAR_BLOCK 512
+#define MAX_DESTINATION_TRIES 1000
+
+enum { STREAM_PLAIN, STREAM_GZIP, STREAM_XZ, STREAM_ZSTD };
+
+typedef struct Stream {
+    int fd;
+    int kind;
+    int inEof;
+    int finished;
+    int frameDone;      // zstd: the last frame was complete
+    unsigned char *in;
+    size_t inPos, inSize;
+    z_stream gzip;
+    lzma_stream xz;
+#ifdef FILEOPENER_ZSTD
+    ZSTD_DStream *zstd;
+#endif
+} Stream;
+
+// Where members go: the destination and the directory the last one was
+// created in, as most follow their siblings.
+typedef struct Target {
+    int root;
+    int parentFd;
+    char parent[PATH_MAX];
+} Target;
+
+typedef struct ZipMember {
+    const char *name;
+    size_t nameLen;
+    uint64_t localOffset, compressedSize, size;
+    uint32_t crc;
+    uint16_t method, flags;
+    mode_t mode;
+    time_t mtime;
+} ZipMember;
+
+typedef struct Zip {
+    const unsigned char *map;
+    size_t mapSize;
+    ZipMember *members;
+    size_t count;
+    size_t next;
+    int root;
+    int failed;
+} Zip;
+
+typedef struct Batch {
+    char **archives;
+    char **destinations;
+    const char *into;
+    int count;
+    int next;
+    int threads;        // for each archive
+} Batch;
+
+
+static uint16_t le16(const unsigned char* p) {
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t le32(const unsigned char* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t le64(const unsigned char* p) {
+    return (uint64_t)le32(p) | (uint64_t)le32(p + 4) << 32;
+}
+
+static int writeAll(int fd, const unsigned char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        size -= n;
+    }
+    return 0;
+}
+
+// Members
+
+// Copies path's parent into parent and its last component into name,
+// dropping leading slashes and "." or empty components. Returns -1 if a
+// component is "..", nothing is left or it does not fit.
+static int splitPath(const char* path, char* parent, char* name) {
+    size_t parentLen = 0;
+    const char *last = NULL;
+    size_t lastLen = 0;
+    parent[0] = '\0';
+
+    for (const char *p = path; *p != '\0'; ) {
+        while (*p == '/') p++;
+        const char *end = strchrnul(p, '/');
+        size_t len = end - p;
+        if (len == 2 && p[0] == '.' && p[1] == '.') return -1;
+        if (len > 0 && !(len == 1 && p[0] == '.')) {
+            if (last != NULL) {
+                if (parentLen + lastLen + 2 > PATH_MAX) return -1;
+                if (parentLen > 0) parent[parentLen++] = '/';
+                memcpy(parent + parentLen, last, lastLen);
+                parentLen += lastLen;
+                parent[parentLen] = '\0';
+            }
+            last = p;
+            lastLen = len;
+        }
+        p = end;
+    }
+    if (last == NULL || lastLen > NAME_MAX) return -1;
+    memcpy(name, last, lastLen);
+    name[lastLen] = '\0';
+    return 0;
+}
+
+// Opens the directory at path below root, creating what is missing, without
+// following symlinks. Returns the descriptor, root itself for "", or -1.
+static int walkTo(int root, const char* path) {
+    char component[NAME_MAX + 1];
+    int fd = root;
+    for (const char *p = path; *p != '\0'; ) {
+        const char *end = strchrnul(p, '/');
+        memcpy(component, p, end - p);
+        component[end - p] = '\0';
+        p = *end ? end + 1 : end;
+
+        if (mkdirat(fd, component, 0755) != 0 && errno != EEXIST) goto fail;
+        int next = openat(fd, component, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        TRACE_COUNT(TRACE_OPEN);
+        if (next < 0) goto fail;
+        if (fd != root) close(fd);
+        fd = next;
+    }
+    return fd;
+
+fail:
+    if (fd != root) close(fd);
+    return -1;
+}
+
+// The directory a member goes in, from the cache when it is its sibling's.
+static int targetParent(Target* target, const char* parent) {
+    if (target->parentFd >= 0 && strcmp(target->parent, parent) == 0) return target->parentFd;
+    if (target->parentFd >= 0 && target->parentFd != target->root) close(target->parentFd);
+    target->parentFd = walkTo(target->root, parent);
+    snprintf(target->parent, sizeof(target->parent), "%s", target->parentFd >= 0 ? parent : "");
+    return target->parentFd;
+}
+
+static void targetInit(Target* target, int root) {
+    target->root = root;
+    target->parentFd = -1;
+    target->parent[0] = '\0';
+}
+
+static void targetClose(Target* target) {
+    if (target->parentFd >= 0 && target->parentFd != target->root) close(target->parentFd);
+    target->parentFd = -1;
+}
+
+#define MEMBER_SKIPPED -2
+
+static int makeDirectory(Target* target, const char* path) {
+    char parent[PATH_MAX], name[NAME_MAX + 1];
+    if (splitPath(path, parent, name) != 0) return MEMBER_SKIPPED;
+    int dir = targetParent(target, parent);
+    if (dir < 0) return -1;
+    if (mkdirat(dir, name, 0755) != 0 && errno != EEXIST) return -1;
+    return 0;
+}
+
+// Returns a descriptor to write the member to, MEMBER_SKIPPED or -1. A
+// member stored twice replaces the earlier one, as tar does.
+static int createFile(Target* target, const char* path, mode_t mode) {
+    char parent[PATH_MAX], name[NAME_MAX + 1];
+    if (splitPath(path, parent, name) != 0) return MEMBER_SKIPPED;
+    int dir = targetParent(target, parent);
+    if (dir < 0) return -1;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int fd = openat(dir, name, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, mode & 0777);
+        TRACE_COUNT(TRACE_OPEN);
+        if (fd >= 0 || errno != EEXIST) return fd;
+        if (unlinkat(dir, name, 0) != 0) return -1;
+    }
+    return -1;
+}
+
+static int makeSymlink(Target* target, const char* path, const char* destination) {
+    char parent[PATH_MAX], name[NAME_MAX + 1];
+    if (splitPath(path, parent, name) != 0) return MEMBER_SKIPPED;
+    // A link must not lead out of the destination either. Its own parent
+    // is a real directory, walkTo follows no links, so the ".." it starts
+    // with are counted against that; one after a name could go up from
+    // wherever an earlier or later link member of that name points.
+    if (destination[0] == '/') return MEMBER_SKIPPED;
+    int depth = parent[0] != '\0', descended = 0;
+    for (const char *p = parent; *p != '\0'; p++) depth += *p == '/';
+    for (const char *p = destination; *p != '\0'; ) {
+        const char *end = strchrnul(p, '/');
+        if (end - p == 2 && p[0] == '.' && p[1] == '.') {
+            if (descended || --depth < 0) return MEMBER_SKIPPED;
+        } else if (end - p > 0 && !(end - p == 1 && p[0] == '.')) {
+            descended = 1;
+        }
+        p = *end ? end + 1 : end;
+    }
+    int dir = targetParent(target, parent);
+    if (dir < 0) return -1;
+    if (symlinkat(destination, dir, name) == 0) return 0;
+    if (errno != EEXIST || unlinkat(dir, name, 0) != 0) return -1;
+    return symlinkat(destination, dir, name);
+}
+
+static int makeHardlink(Target* target, const char* path, const char* existing) {
+    char parent[PATH_MAX], name[NAME_MAX + 1];
+    char existingParent[PATH_MAX], existingName[NAME_MAX + 1];
+    if (splitPath(path, parent, name) != 0) return MEMBER_SKIPPED;
+    if (splitPath(existing, existingParent, existingName) != 0) return MEMBER_SKIPPED;
+    int from = walkTo(target->root, existingParent);
+    if (from < 0) return -1;
+    int dir = targetParent(target, parent);
+    int result = dir < 0 ? -1 : linkat(from, existingName, dir, name, 0);
+    if (result != 0 && dir >= 0 && errno == EEXIST && unlinkat(dir, name, 0) == 0) {
+        result = linkat(from, existingName, dir, name, 0);
+    }
+    if (from != target->root) close(from);
+    return result;
+}
+
+static void setMtime(int fd, time_t mtime) {
+    struct timespec times[2] = { { .tv_nsec = UTIME_OMIT }, { .tv_sec = mtime } };
+    futimens(fd, times);
+}
+
+// Streams
+
+static int streamOpen(Stream* stream, int fd, int threads) {
+    memset(stream, 0, sizeof(Stream));
+    stream->fd = fd;
+    stream->in = malloc(IO_BUFFER);
+    if (stream->in == NULL) return -1;
+    TRACE_COUNT(TRACE_ALLOC);
+
+    ssize_t n = read(fd, stream->in, IO_BUFFER);
+    if (n < 0) return -1;
+    stream->inSize = n;
+    stream->inEof = n == 0;
+
+    const unsigned char *magic = stream->in;
+    if (n >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+        stream->kind = STREAM_GZIP;
+        // gzip headers only; zlib ones never start a file
+        return inflateInit2(&stream->gzip, 16 + MAX_WBITS) == Z_OK ? 0 : -1;
+    }
+    if (n >= 6 && memcmp(magic, "\xfd" "7zXZ\0", 6) == 0) {
+        stream->kind = STREAM_XZ;
+        lzma_stream init = LZMA_STREAM_INIT;
+        stream->xz = init;
+#if LZMA_VERSION >= 50040002
+        if (threads > 1) {
+            lzma_mt options = {
+                .flags = LZMA_CONCATENATED,
+                .threads = threads,
+                .memlimit_threading = lzma_physmem() / 4,
+                .memlimit_stop = UINT64_MAX,
+            };
+            if (lzma_stream_decoder_mt(&stream->xz, &options) == LZMA_OK) return 0;
+        }
+#endif
+        (void)threads;
+        return lzma_stream_decoder(&stream->xz, UINT64_MAX, LZMA_CONCATENATED) == LZMA_OK ? 0 : -1;
+    }
+    if (n >= 4 && le32(magic) == 0xfd2fb528) {
+#ifdef FILEOPENER_ZSTD
+        stream->kind = STREAM_ZSTD;
+        stream->zstd = ZSTD_createDStream();
+        return stream->zstd != NULL ? 0 : -1;
+#else
+        return -1;
+#endif
+    }
+    stream->kind = STREAM_PLAIN;
+    return 0;
+}
+
+static void streamClose(Stream* stream) {
+    if (stream->kind == STREAM_GZIP) inflateEnd(&stream->gzip);
+    if (stream->kind == STREAM_XZ) lzma_end(&stream->xz);
+#ifdef FILEOPENER_ZSTD
+    if (stream->kind == STREAM_ZSTD) ZSTD_freeDStream(stream->zstd);
+#endif
+    free(stream->in);
+}
+
+static int streamRefill(Stream* stream) {
+    if (stream->inPos < stream->inSize || stream->inEof) return 0;
+    ssize_t n;
+    do n = read(stream->fd, stream->in, IO_BUFFER); while (n < 0 && errno == EINTR);
+    if (n < 0) return -1;
+    stream->inPos = 0;
+    stream->inSize = n;
+    stream->inEof = n == 0;
+    return 0;
+}
+
+// Reads up to size decompressed bytes, fewer only at the end of the data.
+// Returns how many, or -1 if the archive is unreadable or cut short.
+static ssize_t streamRead(Stream* stream, unsigned char* out, size_t size) {
+    size_t produced = 0;
+    while (produced < size && !stream->finished) {
+        if (streamRefill(stream) != 0) return -1;
+        unsigned char *in = stream->in + stream->inPos;
+        size_t available = stream->inSize - stream->inPos;
+
+        switch (stream->kind) {
+        case STREAM_PLAIN: {
+            if (available == 0) {
+                stream->finished = 1;
+                break;
+            }
+            size_t len = available < size - produced ? available : size - produced;
+            memcpy(out + produced, in, len);
+            stream->inPos += len;
+            produced += len;
+            break;
+        }
+        case STREAM_GZIP: {
+            if (available == 0) return -1;
+            z_stream *z = &stream->gzip;
+            z->next_in = in;
+            z->avail_in = available;
+            z->next_out = out + produced;
+            z->avail_out = size - produced;
+            int ret = inflate(z, Z_NO_FLUSH);
+            stream->inPos += available - z->avail_in;
+            produced = size - z->avail_out;
+            if (ret == Z_STREAM_END) {
+                // gzip files may hold several members, one after another
+                if (streamRefill(stream) != 0) return -1;
+                if (stream->inPos == stream->inSize) stream->finished = 1;
+                else inflateReset(z);
+            } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+                return -1;
+            }
+            break;
+        }
+        case STREAM_XZ: {
+            lzma_stream *x = &stream->xz;
+            x->next_in = in;
+            x->avail_in = available;
+            x->next_out = out + produced;
+            x->avail_out = size - produced;
+            lzma_ret ret = lzma_code(x, stream->inEof ? LZMA_FINISH : LZMA_RUN);
+            stream->inPos += available - x->avail_in;
+            produced = size - x->avail_out;
+            if (ret == LZMA_STREAM_END) stream->finished = 1;
+            else if (ret != LZMA_OK) return -1;
+            break;
+        }
+#ifdef FILEOPENER_ZSTD
+        case STREAM_ZSTD: {
+            if (available == 0) {
+                if (!stream->frameDone) return -1;
+                stream->finished = 1;
+                break;
+            }
+            ZSTD_inBuffer input = { in, available, 0 };
+            ZSTD_outBuffer output = { out, size, produced };
+            size_t ret = ZSTD_decompressStream(stream->zstd, &output, &input);
+            if (ZSTD_isError(ret)) return -1;
+            stream->inPos += input.pos;
+            produced = output.pos;
+            stream->frameDone = ret == 0;
+            break;
+        }
+#endif
+        }
+    }
+    return produced;
+}
+
+static int streamSkip(Stream* stream, uint64_t size, unsigned char* buffer) {
+    while (size > 0) {
+        size_t chunk = size < IO_BUFFER ? size : IO_BUFFER;
+        if (streamRead(stream, buffer, chunk) != (ssize_t)chunk) return -1;
+        size -= chunk;
+    }
+    return 0;
+}
+
+// Tar
+
+// Octal, space or NUL terminated, or base-256 when the top bit is set.
+static uint64_t tarNumber(const unsigned char* field, size_t size) {
+    uint64_t value = 0;
+    if (field[0] & 0x80) {
+        value = field[0] & 0x3f;
+        for (size_t i = 1; i < size; i++) value = value << 8 | field[i];
+        return value;
+    }
+    for (size_t i = 0; i < size && (field[i] == ' ' || field[i] == '0' + (field[i] & 7)); i++) {
+        if (field[i] != ' ') value = value << 3 | (field[i] - '0');
+    }
+    return value;
+}
+
+static int tarChecksumValid(const unsigned char* block) {
+    unsigned int sum = 0;
+    for (int i = 0; i < TAR_BLOCK; i++) sum += i >= 148 && i < 156 ? ' ' : block[i];
+    return sum == tarNumber(block + 148, 8);
+}
+
+static int tarBlockEmpty(const unsigned char* block) {
+    for (int i = 0; i < TAR_BLOCK; i++) {
+        if (block[i] != 0) return 0;
+    }
+    return 1;
+}
+
+// Reads a member's data as a string, for long names and pax headers.
+static char* tarReadString(Stream* stream, uint64_t size, unsigned char* buffer) {
+    if (size >= PATH_MAX * 16) return NULL;
+    char *data = malloc(size + 1);
+    if (data == NULL) return NULL;
+    TRACE_COUNT(TRACE_ALLOC);
+    uint64_t padded = (size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+    if (streamRead(stream, (unsigned char*)data, size) != (ssize_t)size
+        || streamSkip(stream, padded - size, buffer) != 0) {
+        free(data);
+        return NULL;
+    }
+    data[size] = '\0';
+    return data;
+}
+
+// Takes path, linkpath and size from "length key=value\n" records.
+static void tarPax(const char* data, char** path, char** link, int64_t* size) {
+    const char *end = data + strlen(data);
+    for (const char *record = data; record < end; ) {
+        char *key;
+        unsigned long length = strtoul(record, &key, 10);
+        if (length == 0 || *key != ' ' || record + length > end) return;
+        key++;
+        const char *value = strchr(key, '=');
+        const char *next = record + length;
+        if (value != NULL && value < next) {
+            size_t keyLen = value - key;
+            size_t valueLen = next - 1 - (value + 1);
+            value++;
+            if (keyLen == 4 && memcmp(key, "path", 4) == 0) {
+                free(*path);
+                *path = strndup(value, valueLen);
+            } else if (keyLen == 8 && memcmp(key, "linkpath", 8) == 0) {
+                free(*link);
+                *link = strndup(value, valueLen);
+            } else if (keyLen == 4 && memcmp(key, "size", 4) == 0) {
+                *size = strtoll(value, NULL, 10);
+            }
+        }
+        record = next;
+    }
+}
+
+// Extracts the tar read from stream, whose first block is in block.
+static int extractTar(Stream* stream, Target* target, unsigned char* block) {
+    unsigned char *buffer = malloc(IO_BUFFER);
+    if (buffer == NULL) return -1;
+    TRACE_COUNT(TRACE_ALLOC);
+    char *longName = NULL, *longLink = NULL;
+    int64_t paxSize = -1;
+    int result = 0;
+
+    for (int first = 1; ; first = 0) {
+        if (!first && streamRead(stream, block, TAR_BLOCK) != TAR_BLOCK) {
+            result = -1;
+            break;
+        }
+        if (tarBlockEmpty(block)) break;
+        if (!tarChecksumValid(block)) {
+            result = -1;
+            break;
+        }
+
+        char type = block[156];
+        uint64_t size = paxSize >= 0 ? (uint64_t)paxSize : tarNumber(block + 124, 12);
+        uint64_t padding = (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK;
+
+        if (type == 'L' || type == 'K' || type == 'x') {
+            char *data = tarReadString(stream, size, buffer);
+            if (data == NULL) {
+                result = -1;
+                break;
+            }
+            if (type == 'x') {
+                tarPax(data, &longName, &longLink, &paxSize);
+                free(data);
+            } else {
+                char **slot = type == 'L' ? &longName : &longLink;
+                free(*slot);
+                *slot = data;
+            }
+            continue;
+        }
+
+        char name[PATH_MAX], link[PATH_MAX];
+        if (longName != NULL) {
+            snprintf(name, sizeof(name), "%s", longName);
+        } else if (memcmp(block + 257, "ustar", 5) == 0 && block[345] != '\0') {
+            snprintf(name, sizeof(name), "%.*s/%.*s",
+                     (int)strnlen((char*)block + 345, 155), block + 345,
+                     (int)strnlen((char*)block, 100), block);
+        } else {
+            snprintf(name, sizeof(name), "%.*s", (int)strnlen((char*)block, 100), block);
+        }
+        if (longLink != NULL) snprintf(link, sizeof(link), "%s", longLink);
+        else snprintf(link, sizeof(link), "%.*s", (int)strnlen((char*)block + 157, 100), block + 157);
+        free(longName);
+        free(longLink);
+        longName = longLink = NULL;
+        paxSize = -1;
+
+        int status = 0;
+        uint64_t unread = size;
+        switch (type) {
+        case '5':
+            status = makeDirectory(target, name);
+            break;
+        case '2':
+            status = makeSymlink(target, name, link);
+            break;
+        case '1':
+            status = makeHardlink(target, name, link);
+            break;
+        case '0':
+        case '7':
+        case '\0': {
+            int fd = createFile(target, name, tarNumber(block + 100, 8));
+            if (fd < 0) {
+                status = fd;
+                break;
+            }
+            while (unread > 0 && status == 0) {
+                size_t chunk = unread < IO_BUFFER ? unread : IO_BUFFER;
+                if (streamRead(stream, buffer, chunk) != (ssize_t)chunk) status = -1;
+                else status = writeAll(fd, buffer, chunk);
+                unread -= chunk;
+            }
+            setMtime(fd, tarNumber(block + 136, 12));
+            close(fd);
+            break;
+        }
+        }
+        if (status == -1 || streamSkip(stream, unread + padding, buffer) != 0) {
+            result = -1;
+            break;
+        }
+    }
+
+    free(longName);
+    free(longLink);
+    free(buffer);
+    return result;
+}
+
+// Zip
+
+// Reads the central directory. Returns -1 unless it is a zip it can extract.
+static int zipRead(Zip* zip) {
+    const unsigned char *map = zip->map;
+    size_t size = zip->mapSize;
+    if (size < 22) return -1;
+
+    // the end record, before a comment of up to 64k
+    size_t end = size - 22;
+    size_t lowest = size > 22 + 65535 ? size - 22 - 65535 : 0;
+    while (le32(map + end) != 0x06054b50) {
+        if (end == lowest) return -1;
+        end--;
+    }
+    uint64_t count = le16(map + end + 10);
+    uint64_t directory = le32(map + end + 16);
+
+    if (end >= 20 && le32(map + end - 20) == 0x07064b50) {
+        uint64_t record = le64(map + end - 20 + 8);
+        if (size < 56 || record > size - 56 || le32(map + record) != 0x06064b50) return -1;
+        count = le64(map + record + 32);
+        directory = le64(map + record + 48);
+    }
+    if (directory > size || count > (size - directory) / 46) return -1;
+
+    zip->members = calloc(count ? count : 1, sizeof(ZipMember));
+    if (zip->members == NULL) return -1;
+    TRACE_COUNT(TRACE_ALLOC);
+    zip->count = count;
+
+    const unsigned char *p = map + directory;
+    const unsigned char *limit = map + size;
+    for (uint64_t i = 0; i < count; i++) {
+        if (limit - p < 46 || le32(p) != 0x02014b50) return -1;
+        ZipMember *member = &zip->members[i];
+        uint16_t madeBy = le16(p + 4);
+        member->flags = le16(p + 8);
+        member->method = le16(p + 10);
+        member->crc = le32(p + 16);
+        member->compressedSize = le32(p + 20);
+        member->size = le32(p + 24);
+        size_t nameLen = le16(p + 28), extraLen = le16(p + 30), commentLen = le16(p + 32);
+        uint32_t attributes = le32(p + 38);
+        member->localOffset = le32(p + 42);
+        if ((size_t)(limit - p) < 46 + nameLen + extraLen + commentLen) return -1;
+        member->name = (const char*)p + 46;
+        member->nameLen = nameLen;
+
+        int directoryEntry = nameLen > 0 && member->name[nameLen - 1] == '/';
+        member->mode = directoryEntry ? S_IFDIR | 0755 : S_IFREG | 0644;
+        if (madeBy >> 8 == 3 && (attributes >> 16 & S_IFMT) != 0) member->mode = attributes >> 16;
+
+        uint16_t date = le16(p + 14), time = le16(p + 12);
+        struct tm tm = {
+            .tm_year = (date >> 9) + 80, .tm_mon = ((date >> 5) & 15) - 1, .tm_mday = date & 31,
+            .tm_hour = time >> 11, .tm_min = (time >> 5) & 63, .tm_sec = (time & 31) * 2,
+            .tm_isdst = -1,
+        };
+        member->mtime = mktime(&tm);
+
+        // zip64 sizes and offsets, and unix mtimes
+        const unsigned char *extra = p + 46 + nameLen;
+        const unsigned char *extraEnd = extra + extraLen;
+        while (extraEnd - extra >= 4) {
+            uint16_t id = le16(extra), len = le16(extra + 2);
+            const unsigned char *field = extra + 4;
+            if (len > extraEnd - field) break;
+            if (id == 0x0001) {
+                const unsigned char *fieldEnd = field + len;
+                if (member->size == 0xffffffff && fieldEnd - field >= 8) {
+                    member->size = le64(field);
+                    field += 8;
+                }
+                if (member->compressedSize == 0xffffffff && fieldEnd - field >= 8) {
+                    member->compressedSize = le64(field);
+                    field += 8;
+                }
+                if (member->localOffset == 0xffffffff && fieldEnd - field >= 8) {
+                    member->localOffset = le64(field);
+                }
+            } else if (id == 0x5455 && len >= 5 && (field[0] & 1)) {
+                member->mtime = (int32_t)le32(field + 1);
+            }
+            extra = field + len;
+        }
+        p += 46 + nameLen + extraLen + commentLen;
+    }
+    return 0;
+}
+
+// Where a member's data starts in the map, or NULL if it lies outside.
+static const unsigned char* zipData(Zip* zip, ZipMember* member) {
+    uint64_t offset = member->localOffset;
+    if (zip->mapSize < 30 || offset > zip->mapSize - 30 || le32(zip->map + offset) != 0x04034b50) return NULL;
+    offset += 30 + le16(zip->map + offset + 26) + le16(zip->map + offset + 28);
+    if (offset > zip->mapSize || member->compressedSize > zip->mapSize - offset) return NULL;
+    return zip->map + offset;
+}
+
+// Writes a member's data to fd, or into out (of size bytes) when fd is -1.
+static int zipInflate(ZipMember* member, const unsigned char* data, int fd, unsigned char* out,
+                      unsigned char* buffer) {
+    uint32_t crc = crc32(0, NULL, 0);
+    if (member->method == 0) {
+        if (member->compressedSize != member->size) return -1;
+        crc = crc32_z(crc, data, member->size);
+        if (fd < 0) memcpy(out, data, member->size);
+        else if (writeAll(fd, data, member->size) != 0) return -1;
+        return crc == member->crc ? 0 : -1;
+    }
+    if (member->method != 8) return -1;
+
+    z_stream z = { 0 };
+    if (inflateInit2(&z, -MAX_WBITS) != Z_OK) return -1;
+    const unsigned char *in = data;
+    uint64_t inLeft = member->compressedSize;
+    uint64_t written = 0;
+    int ret = Z_OK;
+    while (ret != Z_STREAM_END) {
+        if (z.avail_in == 0) {
+            z.next_in = (unsigned char*)in;
+            z.avail_in = inLeft < UINT32_MAX ? inLeft : UINT32_MAX;
+            in += z.avail_in;
+            inLeft -= z.avail_in;
+        }
+        z.next_out = buffer;
+        z.avail_out = IO_BUFFER;
+        ret = inflate(&z, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END) break;
+        size_t len = IO_BUFFER - z.avail_out;
+        if (written + len > member->size) break;
+        crc = crc32_z(crc, buffer, len);
+        if (fd < 0) memcpy(out + written, buffer, len);
+        else if (writeAll(fd, buffer, len) != 0) break;
+        written += len;
+    }
+    inflateEnd(&z);
+    return ret == Z_STREAM_END && written == member->size && crc == member->crc ? 0 : -1;
+}
+
+static int zipExtractMember(Zip* zip, ZipMember* member, Target* target, unsigned char* buffer) {
+    char name[PATH_MAX];
+    if (member->nameLen >= sizeof(name) || memchr(member->name, '\0', member->nameLen)) return -1;
+    memcpy(name, member->name, member->nameLen);
+    name[member->nameLen] = '\0';
+    if (member->flags & 1) return -1;   // encrypted
+
+    if (S_ISDIR(member->mode)) return makeDirectory(target, name) == -1 ? -1 : 0;
+
+    const unsigned char *data = zipData(zip, member);
+    if (data == NULL) return -1;
+
+    if (S_ISLNK(member->mode)) {
+        char link[PATH_MAX];
+        if (member->size >= sizeof(link) || zipInflate(member, data, -1, (unsigned char*)link, buffer) != 0) return -1;
+        link[member->size] = '\0';
+        return makeSymlink(target, name, link) == -1 ? -1 : 0;
+    }
+    if (!S_ISREG(member->mode)) return 0;
+
+    int fd = createFile(target, name, member->mode);
+    if (fd == MEMBER_SKIPPED) return 0;
+    if (fd < 0) return -1;
+    int result = zipInflate(member, data, fd, NULL, buffer);
+    setMtime(fd, member->mtime);
+    close(fd);
+    return result;
+}
+
+static void* zipWorker(void* arg) {
+    Zip *zip = arg;
+    unsigned char *buffer = malloc(IO_BUFFER);
+    if (buffer == NULL) {
+        __atomic_store_n(&zip->failed, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    TRACE_COUNT(TRACE_ALLOC);
+    Target target;
+    targetInit(&target, zip->root);
+    for (;;) {
+        size_t i = __atomic_fetch_add(&zip->next, 1, __ATOMIC_RELAXED);
+        if (i >= zip->count || __atomic_load_n(&zip->failed, __ATOMIC_RELAXED)) break;
+        if (zipExtractMember(zip, &zip->members[i], &target, buffer) != 0) {
+            __atomic_store_n(&zip->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+    targetClose(&target);
+    free(buffer);
+    return NULL;
+}
+
+// Members go to threads one at a time, so a large one does not hold up the
+// rest.
+static int extractZip(Zip* zip, int threads) {
+    if ((size_t)threads > zip->count) threads = zip->count ? zip->count : 1;
+    pthread_t workers[threads];
+    int started = 0;
+    for (; started < threads - 1; started++) {
+        if (pthread_create(&workers[started], NULL, zipWorker, zip) != 0) break;
+    }
+    zipWorker(zip);
+    for (int i = 0; i < started; i++) pthread_join(workers[i], NULL);
+    return zip->failed ? -1 : 0;
+}
+
+// Archives
+
+// name without .tar.gz and the like, or "archive" if nothing is left.
+static void destinationName(const char* archive, char* name, size_t size) {
+    static const char *suffixes[] = {
+        ".tar.gz", ".tar.xz", ".tar.zst", ".tgz", ".txz", ".tzst", ".tar", ".zip", ".gz", ".xz", ".zst", NULL
+    };
+    const char *base = strrchr(archive, '/');
+    base = base ? base + 1 : archive;
+    size_t len = strlen(base);
+    for (const char **suffix = suffixes; *suffix != NULL; suffix++) {
+        size_t suffixLen = strlen(*suffix);
+        if (len > suffixLen && strcasecmp(base + len - suffixLen, *suffix) == 0) {
+            len -= suffixLen;
+            break;
+        }
+    }
+    if (len == 0) snprintf(name, size, "archive");
+    else snprintf(name, size, "%.*s", (int)len, base);
+}
+
+// Makes the directory archive goes to, with -1, -2 and so on added if the
+// name is taken. Returns it opened, or -1, and its path in path.
+static int createDestination(const char* archive, const char* into, char* path, size_t size) {
+    char name[NAME_MAX + 1];
+    destinationName(archive, name, sizeof(name));
+    int dirLen;
+    if (into != NULL) {
+        dirLen = strlen(into);
+    } else {
+        const char *slash = strrchr(archive, '/');
+        into = archive;
+        dirLen = slash == NULL ? 0 : slash == archive ? 1 : slash - archive;
+    }
+
+    for (int attempt = 0; attempt < MAX_DESTINATION_TRIES; attempt++) {
+        int len = dirLen == 0
+            ? snprintf(path, size, "%s", name)
+            : snprintf(path, size, "%.*s%s%s", dirLen, into, into[dirLen - 1] == '/' ? "" : "/", name);
+        if (attempt > 0 && len >= 0 && (size_t)len < size) len += snprintf(path + len, size - len, "-%d", attempt);
+        if (len < 0 || (size_t)len >= size) return -1;
+        if (mkdir(path, 0755) == 0) {
+            int fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            TRACE_COUNT(TRACE_OPEN);
+            return fd;
+        }
+        if (errno != EEXIST) return -1;
+    }
+    return -1;
+}
+
+// The destination to report: the directory it holds if that is all it holds.
+static char* reportedDestination(const char* path, int root) {
+    char *reported = realpath(path, NULL);
+    if (reported == NULL) return NULL;
+    int fd = dup(root);
+    DIR *dir = fd >= 0 ? fdopendir(fd) : NULL;
+    if (dir == NULL) {
+        if (fd >= 0) close(fd);
+        return reported;
+    }
+    char only[NAME_MAX + 1] = "";
+    int entries = 0, isDir = 0;
+    for (struct dirent *entry; entries < 2 && (entry = readdir(dir)) != NULL; ) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        entries++;
+        snprintf(only, sizeof(only), "%s", entry->d_name);
+        struct stat st;
+        isDir = fstatat(root, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+    }
+    closedir(dir);
+    if (entries == 1 && isDir) {
+        char *inner;
+        if (asprintf(&inner, "%s/%s", reported, only) >= 0) {
+            free(reported);
+            reported = inner;
+        }
+    }
+    return reported;
+}
+
+// Empties the directory dir without following links. Returns 0 if it is.
+static int removeContents(int dir) {
+    int fd = dup(dir);
+    DIR *entries = fd >= 0 ? fdopendir(fd) : NULL;
+    if (entries == NULL) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    int failed = 0;
+    for (struct dirent *entry; (entry = readdir(entries)) != NULL; ) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        if (unlinkat(dir, entry->d_name, 0) == 0) continue;
+        int child = openat(dir, entry->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        TRACE_COUNT(TRACE_OPEN);
+        if (child < 0) {
+            failed = 1;
+            continue;
+        }
+        failed |= removeContents(child) != 0;
+        close(child);
+        failed |= unlinkat(dir, entry->d_name, AT_REMOVEDIR) != 0;
+    }
+    closedir(entries);
+    return failed ? -1 : 0;
+}
+
+// Extracts one archive. Returns where it went, or NULL; the destination is
+// only made once the archive turned out to be one it reads, and is removed
+// again if extraction fails half-way, so extract.sh starts from nothing.
+static char* extractArchive(const char* archive, const char* into, int threads) {
+    int fd = open(archive, O_RDONLY | O_CLOEXEC);
+    TRACE_COUNT(TRACE_OPEN);
+    if (fd < 0) return NULL;
+
+    char path[PATH_MAX];
+    char *reported = NULL;
+    int root = -1, result = -1;
+    unsigned char magic[4];
+
+    if (pread(fd, magic, 4, 0) == 4 && memcmp(magic, "PK", 2) == 0 && (magic[2] == 3 || magic[2] == 5)) {
+        Zip zip = { 0 };
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            TRACE_COUNT(TRACE_STAT);
+            zip.mapSize = st.st_size;
+            zip.map = mmap(NULL, zip.mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (zip.map == MAP_FAILED) zip.map = NULL;
+        }
+        if (zip.map != NULL && zipRead(&zip) == 0
+            && (root = createDestination(archive, into, path, sizeof(path))) >= 0) {
+            zip.root = root;
+            result = extractZip(&zip, threads);
+        }
+        free(zip.members);
+        if (zip.map != NULL) munmap((void*)zip.map, zip.mapSize);
+    } else {
+        Stream stream;
+        unsigned char block[TAR_BLOCK];
+        if (streamOpen(&stream, fd, threads) == 0
+            && streamRead(&stream, block, TAR_BLOCK) == TAR_BLOCK && tarChecksumValid(block)
+            && (root = createDestination(archive, into, path, sizeof(path))) >= 0) {
+            Target target;
+            targetInit(&target, root);
+            result = extractTar(&stream, &target, block);
+            targetClose(&target);
+        }
+        streamClose(&stream);
+    }
+
+    if (result == 0) reported = reportedDestination(path, root);
+    else if (root >= 0 && removeContents(root) == 0) rmdir(path);
+    if (root >= 0) close(root);
+    close(fd);
+    return reported;
+}
+
+static void* extractWorker(void* arg) {
+    Batch *batch = arg;
+    for (;;) {
+        int i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED);
+        if (i >= batch->count) break;
+        batch->destinations[i] = extractArchive(batch->archives[i], batch->into, batch->threads);
+    }
+    return NULL;
+}
+
+int extractArchives(char** archives, int count, const char* into, char** destinations) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1) cores = 1;
+    int workers = count < cores ? count : cores;
+    if (workers < 1) return 0;
+
+    // the cores are split between the archives extracted at once
+    Batch batch = {
+        .archives = archives, .destinations = destinations, .into = into,
+        .count = count, .threads = cores / workers,
+    };
+    pthread_t threads[workers];
+    int started = 0;
+    for (; started < workers - 1; started++) {
+        if (pthread_create(&threads[started], NULL, extractWorker, &batch) != 0) break;
+    }
+    extractWorker(&batch);
+    for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+
+    int failed = 0;
+    for (int i = 0; i < count; i++) failed += destinations[i] == NULL;
+    return failed;
+}
@@ -0,0 +1,11 @@
+#ifndef EXTRACT_H
+#define EXTRACT_H
+
+// Extracts archives into new directories next to them, or in into if it is
+// not NULL, several at a time. destinations[i] receives the malloc'd
+// absolute path of what archives[i] was extracted to (its only directory if
+// it holds nothing else), or NULL if it is not an archive extractArchives
+// reads. Returns how many it could not extract.
+int extractArchives(char** archives, int count, const char* into, char** destinations);
+
+#endif
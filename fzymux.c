@@ -0,0 +1,166 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "trace.h"
+#include "fzymux.h"
+
+// Runs a command, usually fzy, with each of the given descriptors connected
+// to a pipe of its own and, once it exits, writes every line it left on
+// them to stdout as a "<fd> <line>\0" record, the descriptors in the order
+// given. The widgets read that with a single loop instead of opening a
+// temporary file for each descriptor:
+//
+//   producer | fzymux 1,3,4 fzy --keep-output ... |
+//       while IFS= read -r -d '' record; do ... ${record%% *} ${record#* } ... done
+//
+// fzymux exits with the command's status, so the widget finds fzy's in
+// $pipestatus.
+
+#define MAX_OUTPUTS 16
+#define MAX_OUTPUT_FD 63
+// where the write ends wait until they are moved into place, above any
+// descriptor the command is given
+#define PRIVATE_FD_BASE (MAX_OUTPUT_FD + 1)
+
+typedef struct Output {
+    int fd;         // the command's descriptor
+    int readEnd;
+    int writeEnd;
+    char *data;
+    size_t size, capacity;
+} Output;
+
+
+static int parseOutputs(const char* list, Output* outputs) {
+    int count = 0;
+    for (const char *p = list; *p; ) {
+        char *end;
+        long fd = strtol(p, &end, 10);
+        if (end == p || fd < 1 || fd > MAX_OUTPUT_FD || count == MAX_OUTPUTS || (*end && *end != ',')) return -1;
+        for (int i = 0; i < count; i++) {
+            if (outputs[i].fd == fd) return -1;
+        }
+        outputs[count++].fd = fd;
+        p = *end ? end + 1 : end;
+    }
+    return count;
+}
+
+static int openPipes(Output* outputs, int count) {
+    for (int i = 0; i < count; i++) {
+        int ends[2];
+        if (pipe2(ends, O_CLOEXEC) != 0) return -1;
+        outputs[i].readEnd = ends[0];
+        outputs[i].writeEnd = fcntl(ends[1], F_DUPFD_CLOEXEC, PRIVATE_FD_BASE);
+        close(ends[1]);
+        if (outputs[i].writeEnd == -1) return -1;
+    }
+    return 0;
+}
+
+static int readOutput(Output* output) {
+    if (output->capacity - output->size < 4096) {
+        size_t capacity = output->capacity ? output->capacity * 2 : 16384;
+        char *data = realloc(output->data, capacity);
+        if (data == NULL) return -1;
+        TRACE_COUNT(TRACE_ALLOC);
+        output->data = data;
+        output->capacity = capacity;
+    }
+    ssize_t n = read(output->readEnd, output->data + output->size, output->capacity - output->size);
+    if (n > 0) output->size += n;
+    return n;
+}
+
+// Reads all outputs until the command and whatever it started closed them.
+static void collect(Output* outputs, int count) {
+    struct pollfd fds[MAX_OUTPUTS];
+    int open = count;
+    for (int i = 0; i < count; i++) fds[i] = (struct pollfd){ outputs[i].readEnd, POLLIN, 0 };
+
+    while (open > 0) {
+        if (poll(fds, count, -1) == -1) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        for (int i = 0; i < count; i++) {
+            if (fds[i].fd == -1 || !fds[i].revents) continue;
+            ssize_t n = readOutput(&outputs[i]);
+            if (n > 0 || (n == -1 && errno == EINTR)) continue;
+            close(fds[i].fd);
+            fds[i].fd = -1;
+            open--;
+        }
+    }
+}
+
+static void writeRecords(const Output* output) {
+    for (size_t start = 0; start < output->size; ) {
+        const char *line = output->data + start;
+        const char *newline = memchr(line, '\n', output->size - start);
+        size_t len = newline ? (size_t)(newline - line) : output->size - start;
+        printf("%d %.*s", output->fd, (int)len, line);
+        putchar('\0');
+        start += len + 1;
+    }
+}
+
+int fzymuxMain(int argc, char** argv) {
+    TRACE_INIT("fzymux");
+
+    Output outputs[MAX_OUTPUTS];
+    memset(outputs, 0, sizeof(outputs));
+    int count = argc > 2 ? parseOutputs(argv[1], outputs) : -1;
+    if (count <= 0) {
+        fprintf(stderr, "usage: fzymux fd[,fd...] command [args]\n");
+        return 2;
+    }
+    if (openPipes(outputs, count) != 0) {
+        perror("fzymux: pipe");
+        return 2;
+    }
+
+    TRACE_COUNT(TRACE_FORK);
+    pid_t pid = fork();
+    if (pid == 0) {
+        // dup2 leaves the copies open across exec
+        for (int i = 0; i < count; i++) {
+            if (dup2(outputs[i].writeEnd, outputs[i].fd) == -1) _exit(127);
+        }
+        execvp(argv[2], argv + 2);
+        fprintf(stderr, "fzymux: %s: %s\n", argv[2], strerror(errno));
+        _exit(127);
+    }
+    if (pid == -1) {
+        perror("fzymux: fork");
+        return 2;
+    }
+    for (int i = 0; i < count; i++) close(outputs[i].writeEnd);
+
+    TRACE_BEGIN("collect");
+    collect(outputs, count);
+    TRACE_END("collect");
+
+    int status;
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR);
+
+    for (int i = 0; i < count; i++) {
+        writeRecords(&outputs[i]);
+        free(outputs[i].data);
+    }
+    fflush(stdout);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+#ifndef FILEOPENER_MULTICALL
+int main(int argc, char **argv) {
+    return fzymuxMain(argc, argv);
+}
+#endif
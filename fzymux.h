@@ -0,0 +1,9 @@
+#ifndef FZYMUX_H
+#define FZYMUX_H
+
+// The fzymux program, called by main or by the multi-call binary. It runs
+// fzy with its numbered outputs on pipes and writes what fzy left on each
+// as one stream of "<fd> <line>\0" records.
+int fzymuxMain(int argc, char** argv);
+
+#endif
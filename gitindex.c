@@ -0,0 +1,1354 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/utsname.h>
+
+#include "gitindex.h"
+#include "trace.h"
+
+#define MAX_PATH_LENGTH 4096
+#define DEADLINE_INTERVAL 64
+#define FSMONITOR_TIMEOUT_MS 200
+
+
+uint64_t gitMonotonicNs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static uint32_t getBe32(const unsigned char* p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint64_t getBe64(const unsigned char* p) {
+    return (uint64_t)getBe32(p) << 32 | getBe32(p + 4);
+}
+
+// git's variable length integers, used by version 4 indexes and the
+// untracked cache
+static uint64_t decodeVarint(const unsigned char** p, const unsigned char* end) {
+    const unsigned char *q = *p;
+    if (q >= end) return 0;
+    unsigned char c = *q++;
+    uint64_t value = c & 127;
+    while (c & 128 && q < end) {
+        value += 1;
+        c = *q++;
+        value = (value << 7) + (c & 127);
+    }
+    *p = q;
+    return value;
+}
+
+// Reads an EWAH compressed bitmap into one byte per bit. Returns the
+// position after the bitmap or NULL if it is malformed.
+static const unsigned char* ewahRead(const unsigned char* p, const unsigned char* end,
+                                     unsigned char* bits, size_t nbits) {
+    if (p + 8 > end) return NULL;
+    uint32_t words = getBe32(p + 4);
+    p += 8;
+    if ((size_t)(end - p) < (size_t)words * 8 + 4) return NULL;
+
+    uint64_t pos = 0;
+    for (uint32_t i = 0; i < words;) {
+        uint64_t rlw = getBe64(p + (size_t)i++ * 8);
+        uint64_t running = (rlw >> 1) & 0xFFFFFFFFULL;
+        uint64_t literals = rlw >> 33;
+
+        if (rlw & 1) {
+            for (uint64_t bit = pos; bit < pos + running * 64 && bit < nbits; bit++) {
+                bits[bit] = 1;
+            }
+        }
+        pos += running * 64;
+
+        for (uint64_t k = 0; k < literals && i < words; k++) {
+            uint64_t word = getBe64(p + (size_t)i++ * 8);
+            for (int bit = 0; bit < 64; bit++) {
+                if (word >> bit & 1 && pos + bit < nbits) bits[pos + bit] = 1;
+            }
+            pos += 64;
+        }
+    }
+    return p + (size_t)words * 8 + 4;
+}
+
+
+static void parseCacheTree(GitIndex* index, const unsigned char* data, size_t size) {
+    // the root comes first: "" NUL entry_count SP subtrees LF [oid]
+    const unsigned char *end = data + size;
+    if (size < 4 || data[0] != '\0') return;
+
+    char *after;
+    long entries = strtol((const char *)data + 1, &after, 10);
+    const unsigned char *newline = memchr(after, '\n', end - (const unsigned char *)after);
+    if (newline == NULL || entries < 0 || newline + 1 + GIT_OID_RAWSZ > end) return;
+
+    memcpy(index->tree.hash, newline + 1, GIT_OID_RAWSZ);
+    index->treeValid = 1;
+}
+// Parses the header of a cache-tree node, "name NUL entries SP subtrees LF"
+// and the oid if entries is not -1. Returns the position after it or NULL.
+static const unsigned char* cacheTreeNode(const unsigned char* p, const unsigned char* end, const char** name,
+                                          long* entries, long* subtrees, const unsigned char** oid) {
+    const unsigned char *nul = memchr(p, '\0', end - p);
+    const unsigned char *newline = nul ? memchr(nul, '\n', end - nul) : NULL;
+    if (newline == NULL) return NULL;
+    *name = (const char *)p;
+
+    char *after;
+    *entries = strtol((const char *)nul + 1, &after, 10);
+    *subtrees = strtol(after, NULL, 10);
+    p = newline + 1;
+    *oid = NULL;
+    if (*entries >= 0) {
+        if (end - p < GIT_OID_RAWSZ) return NULL;
+        *oid = p;
+        p += GIT_OID_RAWSZ;
+    }
+    return *subtrees >= 0 ? p : NULL;
+}
+
+// Returns the position after a node and all of its subtrees or NULL.
+static const unsigned char* skipCacheTree(const unsigned char* p, const unsigned char* end) {
+    const char *name;
+    long entries, subtrees;
+    const unsigned char *oid;
+    p = cacheTreeNode(p, end, &name, &entries, &subtrees, &oid);
+    for (long i = 0; p != NULL && i < subtrees; i++) {
+        p = skipCacheTree(p, end);
+    }
+    return p;
+}
+
+int gitIndexCacheTree(const GitIndex* index, const char* dir, size_t len, GitOid* oid) {
+    const unsigned char *p = index->cacheTree;
+    const unsigned char *end = p + index->cacheTreeSize;
+    if (p == NULL) return -1;
+
+    const char *name;
+    long entries, subtrees;
+    const unsigned char *nodeOid;
+    if ((p = cacheTreeNode(p, end, &name, &entries, &subtrees, &nodeOid)) == NULL) return -1;
+
+    // descend one component at a time, skipping the siblings on the way
+    while (len > 0) {
+        const char *slash = memchr(dir, '/', len);
+        size_t componentLen = slash ? (size_t)(slash - dir) : len;
+        long i;
+        for (i = 0; i < subtrees; i++) {
+            const unsigned char *child = p;
+            long childSubtrees;
+            p = cacheTreeNode(child, end, &name, &entries, &childSubtrees, &nodeOid);
+            if (p == NULL) return -1;
+            if (strlen(name) == componentLen && memcmp(name, dir, componentLen) == 0) {
+                subtrees = childSubtrees;
+                break;
+            }
+            if ((p = skipCacheTree(child, end)) == NULL) return -1;
+        }
+        if (i == subtrees) return -1;
+        if (slash == NULL) break;
+        len -= componentLen + 1;
+        dir += componentLen + 1;
+    }
+
+    if (nodeOid == NULL) return -1;
+    memcpy(oid->hash, nodeOid, GIT_OID_RAWSZ);
+    return 0;
+}
+
+int gitIndexLoad(const char* gitDir, GitIndex* index) {
+    memset(index, 0, sizeof(GitIndex));
+
+    char path[MAX_PATH_LENGTH];
+    snprintf(path, sizeof(path), "%s/index", gitDir);
+    TRACE_COUNT(TRACE_OPEN);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return errno == ENOENT ? 0 : -1;
+
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || sb.st_size < 12 + GIT_OID_RAWSZ) {
+        close(fd);
+        return -1;
+    }
+    index->mapSize = sb.st_size;
+    index->mtime = sb.st_mtim;
+    index->map = mmap(NULL, index->mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (index->map == MAP_FAILED) {
+        index->map = NULL;
+        return -1;
+    }
+
+    const unsigned char *map = index->map;
+    const unsigned char *end = map + index->mapSize - GIT_OID_RAWSZ;
+    index->version = getBe32(map + 4);
+    index->count = getBe32(map + 8);
+    if (memcmp(map, "DIRC", 4) != 0 || index->version < 2 || index->version > 4
+            || index->count > index->mapSize / 40) {
+        gitIndexFree(index);
+        return -1;
+    }
+
+    index->entries = calloc(index->count ? index->count : 1, sizeof(GitIndexEntry));
+    size_t namesSize = 0, namesCapacity = 0;
+    size_t previous = 0, previousLen = 0;
+
+    const unsigned char *p = map + 12;
+    for (size_t i = 0; i < index->count; i++) {
+        GitIndexEntry *entry = &index->entries[i];
+        if (end - p < 62) goto invalid;
+
+        entry->ctimeSec = getBe32(p);
+        entry->ctimeNsec = getBe32(p + 4);
+        entry->mtimeSec = getBe32(p + 8);
+        entry->mtimeNsec = getBe32(p + 12);
+        entry->dev = getBe32(p + 16);
+        entry->ino = getBe32(p + 20);
+        entry->mode = getBe32(p + 24);
+        entry->uid = getBe32(p + 28);
+        entry->gid = getBe32(p + 32);
+        entry->size = getBe32(p + 36);
+        memcpy(entry->oid.hash, p + 40, GIT_OID_RAWSZ);
+        entry->flags = p[60] << 8 | p[61];
+        entry->stage = (entry->flags >> 12) & 3;
+
+        const unsigned char *name = p + 62;
+        if (entry->flags & GIT_INDEX_EXTENDED) {
+            if (index->version < 3 || end - name < 2) goto invalid;
+            entry->flags |= (uint32_t)(name[0] << 8 | name[1]) << 16;
+            name += 2;
+        }
+
+        if (index->version == 4) {
+            // the name shares a prefix with the previous one
+            uint64_t strip = decodeVarint(&name, end);
+            const unsigned char *nul = memchr(name, '\0', end - name);
+            if (nul == NULL || strip > previousLen) goto invalid;
+            size_t suffixLen = nul - name;
+            size_t nameLen = previousLen - strip + suffixLen;
+
+            if (namesSize + nameLen + 1 > namesCapacity) {
+                namesCapacity = (namesCapacity + nameLen + 1) * 2;
+                char *grown = realloc(index->names, namesCapacity);
+                if (grown == NULL) goto invalid;
+                index->names = grown;
+            }
+            memmove(index->names + namesSize, index->names + previous, previousLen - strip);
+            memcpy(index->names + namesSize + previousLen - strip, name, suffixLen);
+            index->names[namesSize + nameLen] = '\0';
+
+            // an offset until the buffer stops moving
+            entry->name = (const char *)(uintptr_t)namesSize;
+            entry->nameLen = nameLen;
+            previous = namesSize;
+            previousLen = nameLen;
+            namesSize += nameLen + 1;
+            p = nul + 1;
+        } else {
+            const unsigned char *nul = memchr(name, '\0', end - name);
+            if (nul == NULL) goto invalid;
+            entry->name = (const char *)name;
+            entry->nameLen = nul - name;
+            p += ((name - p) + entry->nameLen + 8) & ~7;
+        }
+    }
+
+    if (index->version == 4) {
+        for (size_t i = 0; i < index->count; i++) {
+            index->entries[i].name = index->names + (uintptr_t)index->entries[i].name;
+        }
+    }
+
+    while (end - p >= 8) {
+        uint32_t size = getBe32(p + 4);
+        const unsigned char *data = p + 8;
+        if ((size_t)(end - data) < size) break;
+
+        if (memcmp(p, "TREE", 4) == 0) {
+            parseCacheTree(index, data, size);
+            index->cacheTree = data;
+            index->cacheTreeSize = size;
+        } else if (memcmp(p, "UNTR", 4) == 0) {
+            index->untracked = data;
+            index->untrackedSize = size;
+        } else if (memcmp(p, "FSMN", 4) == 0) {
+            index->fsmonitor = data;
+            index->fsmonitorSize = size;
+        } else if (memcmp(p, "link", 4) == 0) {
+            index->split = 1;
+        }
+        p = data + size;
+    }
+    return 0;
+
+invalid:
+    gitIndexFree(index);
+    return -1;
+}
+
+void gitIndexFree(GitIndex* index) {
+    if (index->map != NULL) munmap(index->map, index->mapSize);
+    free(index->entries);
+    free(index->names);
+    memset(index, 0, sizeof(GitIndex));
+}
+
+
+static int compareNames(const char* a, size_t aLen, const char* b, size_t bLen) {
+    int cmp = memcmp(a, b, aLen < bLen ? aLen : bLen);
+    if (cmp != 0) return cmp;
+    return aLen < bLen ? -1 : aLen > bLen;
+}
+
+size_t gitIndexLowerBound(const GitIndex* index, const char* name, size_t len) {
+    size_t low = 0, high = index->count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        const GitIndexEntry *entry = &index->entries[mid];
+        if (compareNames(entry->name, entry->nameLen, name, len) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+int gitIndexIsTracked(const GitIndex* index, const char* name, size_t len) {
+    size_t i = gitIndexLowerBound(index, name, len);
+    return i < index->count && index->entries[i].nameLen == len
+        && memcmp(index->entries[i].name, name, len) == 0;
+}
+
+static int hasTrackedBelow(const GitIndex* index, const char* dir, size_t len) {
+    size_t i = gitIndexLowerBound(index, dir, len);
+    return i < index->count && index->entries[i].nameLen > len
+        && memcmp(index->entries[i].name, dir, len) == 0;
+}
+
+
+static int contentMatches(int workTreeFd, const GitIndexEntry* entry, const struct stat* sb) {
+    GitOid oid;
+    if (S_ISLNK(sb->st_mode)) {
+        char target[MAX_PATH_LENGTH];
+        ssize_t len = readlinkat(workTreeFd, entry->name, target, sizeof(target));
+        if (len < 0) return 0;
+        gitHashBlob(target, len, &oid);
+        return memcmp(oid.hash, entry->oid.hash, GIT_OID_RAWSZ) == 0;
+    }
+
+    TRACE_COUNT(TRACE_OPEN);
+    int fd = openat(workTreeFd, entry->name, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd == -1) return 0;
+    void *data = sb->st_size ? mmap(NULL, sb->st_size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if (data == MAP_FAILED) return 0;
+
+    gitHashBlob(data, sb->st_size, &oid);
+    if (data != NULL) munmap(data, sb->st_size);
+    return memcmp(oid.hash, entry->oid.hash, GIT_OID_RAWSZ) == 0;
+}
+
+int gitIndexEntryStat(const GitIndex* index, const GitIndexEntry* entry, int trustFilemode,
+                      const struct stat* sb) {
+    switch (entry->mode & S_IFMT) {
+    case 0160000: // submodules are not looked into
+        return S_ISDIR(sb->st_mode) ? GIT_ENTRY_CLEAN : GIT_ENTRY_TYPE;
+    case S_IFLNK:
+        if (!S_ISLNK(sb->st_mode)) return GIT_ENTRY_TYPE;
+        break;
+    default:
+        if (!S_ISREG(sb->st_mode)) return GIT_ENTRY_TYPE;
+        if (trustFilemode && (entry->mode & 0100) != (sb->st_mode & 0100)) return GIT_ENTRY_MODIFIED;
+    }
+
+    if ((uint32_t)sb->st_size != entry->size) return GIT_ENTRY_MODIFIED;
+
+    int statMatches = (uint32_t)sb->st_mtim.tv_sec == entry->mtimeSec
+        && (uint32_t)sb->st_mtim.tv_nsec == entry->mtimeNsec
+        && (uint32_t)sb->st_ctim.tv_sec == entry->ctimeSec
+        && (uint32_t)sb->st_ctim.tv_nsec == entry->ctimeNsec
+        && (uint32_t)sb->st_ino == entry->ino;
+
+    // files written in the same instant as the index may have changed
+    // without their stat data showing it
+    int racy = entry->mtimeSec > (uint32_t)index->mtime.tv_sec
+        || (entry->mtimeSec == (uint32_t)index->mtime.tv_sec
+            && entry->mtimeNsec >= (uint32_t)index->mtime.tv_nsec);
+
+    return statMatches && !racy ? GIT_ENTRY_CLEAN : GIT_ENTRY_UNSURE;
+}
+
+int gitIndexEntryChanged(int workTreeFd, const GitIndex* index, const GitIndexEntry* entry,
+                         int trustFilemode, struct stat* sb) {
+    TRACE_COUNT(TRACE_STAT);
+    if (fstatat(workTreeFd, entry->name, sb, AT_SYMLINK_NOFOLLOW) != 0) {
+        return errno == ENOENT || errno == ENOTDIR ? GIT_ENTRY_DELETED : GIT_ENTRY_MODIFIED;
+    }
+    int result = gitIndexEntryStat(index, entry, trustFilemode, sb);
+    if (result != GIT_ENTRY_UNSURE) return result;
+    return contentMatches(workTreeFd, entry, sb) ? GIT_ENTRY_CLEAN : GIT_ENTRY_MODIFIED;
+}
+
+
+// Sends token to the builtin fsmonitor daemon using git's pkt-line based
+// simple-ipc protocol. Returns the malloc'd response or NULL.
+static char* fsmonitorQuery(const char* gitDir, const char* token, size_t* len) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if ((size_t)snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/fsmonitor--daemon.ipc", gitDir)
+            >= sizeof(addr.sun_path)) {
+        return NULL;
+    }
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1) return NULL;
+    struct timeval timeout = { 0, FSMONITOR_TIMEOUT_MS * 1000 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    TRACE_COUNT(TRACE_IPC);
+    char request[1024];
+    size_t tokenLen = strlen(token);
+    int requestLen = snprintf(request, sizeof(request), "%04zx%s0000", tokenLen + 4, token);
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0
+            || requestLen >= (int)sizeof(request) || write(sock, request, requestLen) != requestLen) {
+        close(sock);
+        return NULL;
+    }
+
+    FILE *in = fdopen(sock, "r");
+    char *response = NULL;
+    size_t size = 0;
+    for (;;) {
+        char header[5] = { 0 };
+        if (fread(header, 1, 4, in) != 4) break;
+        size_t packet = strtoul(header, NULL, 16);
+        if (packet == 0) {
+            fclose(in);
+            *len = size;
+            return response ? response : calloc(1, 1);
+        }
+        if (packet < 4) break;
+        packet -= 4;
+
+        char *grown = realloc(response, size + packet + 1);
+        if (grown == NULL) break;
+        response = grown;
+        if (fread(response + size, 1, packet, in) != packet) break;
+        size += packet;
+        response[size] = '\0';
+    }
+    fclose(in);
+    free(response);
+    return NULL;
+}
+
+static void markPrefix(const GitIndex* index, unsigned char* check, const char* path, size_t len) {
+    for (size_t i = gitIndexLowerBound(index, path, len); i < index->count; i++) {
+        const GitIndexEntry *entry = &index->entries[i];
+        if (entry->nameLen < len || memcmp(entry->name, path, len) != 0) break;
+        // "dir" also stands for everything below it
+        if (entry->nameLen == len || path[len - 1] == '/' || entry->name[len] == '/') check[i] = 1;
+    }
+}
+
+unsigned char* gitIndexFsmonitor(const GitIndex* index, const char* gitDir, const char* commonDir) {
+    char value[64];
+    if (index->fsmonitor == NULL || index->fsmonitorSize < 8
+            || gitConfigGet(commonDir, "core", NULL, "fsmonitor", value, sizeof(value)) < 0
+            || strcasecmp(value, "true") != 0) {
+        return NULL;
+    }
+
+    // only the token based version 2 is spoken by the builtin daemon
+    const unsigned char *p = index->fsmonitor;
+    const unsigned char *end = p + index->fsmonitorSize;
+    if (getBe32(p) != 2) return NULL;
+    const char *token = (const char *)p + 4;
+    const unsigned char *nul = memchr(token, '\0', end - (const unsigned char *)token);
+    if (nul == NULL || end - nul < 5) return NULL;
+
+    unsigned char *check = calloc(index->count ? index->count : 1, 1);
+    uint32_t ewahSize = getBe32(nul + 1);
+    if (check == NULL || (size_t)(end - (nul + 5)) < ewahSize
+            || ewahRead(nul + 5, nul + 5 + ewahSize, check, index->count) == NULL) {
+        free(check);
+        return NULL;
+    }
+
+    size_t len;
+    char *response = fsmonitorQuery(gitDir, token, &len);
+    char *responseEnd = response + len;
+    char *path = response ? memchr(response, '\0', len) : NULL;
+    if (path == NULL || (path + 1 < responseEnd && strcmp(path + 1, "/") == 0)) {
+        // the daemon could not tell what changed
+        free(response);
+        free(check);
+        return NULL;
+    }
+
+    for (path++; path < responseEnd; path += strlen(path) + 1) {
+        if (*path) markPrefix(index, check, path, strlen(path));
+    }
+    free(response);
+    return check;
+}
+
+
+typedef struct IgnorePattern {
+    char *pattern;
+    int negate;
+    int dirOnly;
+    int anchored;   // contains a slash, so it matches the path below the base
+} IgnorePattern;
+
+typedef struct IgnoreList {
+    IgnorePattern *patterns;
+    int count;
+    size_t baseLen;     // the directory prefix the patterns are relative to
+    char *text;
+} IgnoreList;
+
+typedef struct UntrackedDir {
+    const char *name;
+    const unsigned char *untracked;  // NUL separated names
+    uint64_t untrackedCount;
+    uint64_t dirCount;
+    size_t next;                     // index of the next sibling
+    int valid;
+    const unsigned char *stat;       // ctime, mtime, dev, ino, uid, gid, size
+    const unsigned char *excludeOid; // of .gitignore, NULL if it does not exist
+} UntrackedDir;
+
+typedef struct Walk {
+    const GitIndex *index;
+    uint64_t deadline;
+    unsigned long steps;
+    GitUntrackedFn fn;
+    void *ctx;
+    const GitWalkCache *cache;
+    const char *prefix;
+    size_t prefixLen;
+    IgnoreList *lists;
+    int listCount;
+    int listCapacity;
+    IgnoreList global[2];
+    UntrackedDir *dirs;
+    size_t dirCount;
+    char path[MAX_PATH_LENGTH];
+    size_t pathLen;
+} Walk;
+
+
+static void parseIgnore(IgnoreList* list, char* text, size_t baseLen) {
+    memset(list, 0, sizeof(IgnoreList));
+    list->text = text;
+    list->baseLen = baseLen;
+    if (text == NULL) return;
+
+    int capacity = 0;
+    for (char *line = strtok(text, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+        size_t len = strlen(line);
+        while (len > 0 && (line[len-1] == '\r' || (line[len-1] == ' ' && (len < 2 || line[len-2] != '\\')))) {
+            line[--len] = '\0';
+        }
+        if (len == 0 || line[0] == '#') continue;
+
+        IgnorePattern pattern = { line, 0, 0, 0 };
+        if (line[0] == '!') {
+            pattern.negate = 1;
+            pattern.pattern++;
+        } else if (line[0] == '\\' && (line[1] == '!' || line[1] == '#')) {
+            pattern.pattern++;
+        }
+
+        len = strlen(pattern.pattern);
+        if (len > 0 && pattern.pattern[len-1] == '/') {
+            pattern.dirOnly = 1;
+            pattern.pattern[--len] = '\0';
+        }
+        if (pattern.pattern[0] == '/') {
+            pattern.anchored = 1;
+            pattern.pattern++;
+        } else if (strchr(pattern.pattern, '/') != NULL) {
+            pattern.anchored = 1;
+        }
+        if (pattern.pattern[0] == '\0') continue;
+
+        if (list->count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            list->patterns = realloc(list->patterns, capacity * sizeof(IgnorePattern));
+        }
+        list->patterns[list->count++] = pattern;
+    }
+}
+
+static void freeIgnore(IgnoreList* list) {
+    free(list->patterns);
+    free(list->text);
+    memset(list, 0, sizeof(IgnoreList));
+}
+
+static char* readWholeFile(int dirfd, const char* path, size_t* len) {
+    TRACE_COUNT(TRACE_OPEN);
+    int fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return NULL;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+    char *text = malloc(sb.st_size + 1);
+    ssize_t n = text ? read(fd, text, sb.st_size) : -1;
+    close(fd);
+    if (n < 0) {
+        free(text);
+        return NULL;
+    }
+    text[n] = '\0';
+    if (len) *len = n;
+    return text;
+}
+
+static int matchPattern(const IgnorePattern* pattern, const char* path, const char* base) {
+    if (!pattern->anchored) {
+        return fnmatch(pattern->pattern, base, 0) == 0;
+    }
+    if (strstr(pattern->pattern, "**") == NULL) {
+        return fnmatch(pattern->pattern, path, FNM_PATHNAME) == 0;
+    }
+    // "**/" also matches nothing, the rest of "**" matches across slashes
+    if (strncmp(pattern->pattern, "**/", 3) == 0) {
+        for (const char *p = path; p != NULL; p = strchr(p, '/') ? strchr(p, '/') + 1 : NULL) {
+            if (fnmatch(pattern->pattern + 3, p, 0) == 0) return 1;
+        }
+        return 0;
+    }
+    return fnmatch(pattern->pattern, path, 0) == 0;
+}
+
+// Returns 1 if ignored, -1 if explicitly not ignored and 0 if undecided.
+static int matchList(const IgnoreList* list, const char* path, const char* base, int isDir) {
+    for (int i = list->count - 1; i >= 0; i--) {
+        const IgnorePattern *pattern = &list->patterns[i];
+        if (pattern->dirOnly && !isDir) continue;
+        if (matchPattern(pattern, path + list->baseLen, base)) {
+            return pattern->negate ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+static int isIgnored(const Walk* walk, const char* path, const char* base, int isDir) {
+    for (int i = walk->listCount - 1; i >= 0; i--) {
+        int result = matchList(&walk->lists[i], path, base, isDir);
+        if (result) return result > 0;
+    }
+    for (int i = 0; i < 2; i++) {
+        int result = matchList(&walk->global[i], path, base, isDir);
+        if (result) return result > 0;
+    }
+    return 0;
+}
+
+static void pushIgnore(Walk* walk, char* text) {
+    if (walk->listCount == walk->listCapacity) {
+        walk->listCapacity = walk->listCapacity ? walk->listCapacity * 2 : 16;
+        walk->lists = realloc(walk->lists, walk->listCapacity * sizeof(IgnoreList));
+    }
+    parseIgnore(&walk->lists[walk->listCount++], text, walk->pathLen);
+}
+
+static void popIgnore(Walk* walk) {
+    freeIgnore(&walk->lists[--walk->listCount]);
+}
+
+static int pastDeadline(Walk* walk) {
+    return walk->deadline && ++walk->steps % DEADLINE_INTERVAL == 0 && gitMonotonicNs() > walk->deadline;
+}
+
+// Whether path (ending in a slash) may contain something below the prefix.
+static int overlapsPrefix(const Walk* walk, const char* path, size_t len) {
+    size_t n = len < walk->prefixLen ? len : walk->prefixLen;
+    return memcmp(path, walk->prefix, n) == 0;
+}
+
+static int report(Walk* walk, size_t len) {
+    if (len < walk->prefixLen || memcmp(walk->path, walk->prefix, walk->prefixLen) != 0) return 0;
+    return walk->fn(walk->ctx, walk->path, len);
+}
+
+
+static int scanDir(Walk* walk, int fd, int pushed);
+
+// Handles the entry name of the directory in walk->path, whose descriptor
+// is fd: reports it if it is untracked or scans it if it is a directory
+// that may hold untracked files. Returns like gitUntrackedWalk.
+static int visitEntry(Walk* walk, int fd, const char* name, int isDir) {
+    size_t dirLen = walk->pathLen;
+    size_t nameLen = strlen(name);
+    if (dirLen + nameLen + 2 > sizeof(walk->path)) return 0;
+    memcpy(walk->path + dirLen, name, nameLen + 1);
+    size_t len = dirLen + nameLen;
+
+    if (!isDir) {
+        if (!gitIndexIsTracked(walk->index, walk->path, len)
+                && !isIgnored(walk, walk->path, walk->path + dirLen, 0)) {
+            return report(walk, len);
+        }
+        return 0;
+    }
+
+    // a submodule
+    if (gitIndexIsTracked(walk->index, walk->path, len)) return 0;
+    if (isIgnored(walk, walk->path, walk->path + dirLen, 1)) return 0;
+
+    walk->path[len++] = '/';
+    walk->path[len] = '\0';
+    if (!overlapsPrefix(walk, walk->path, len)) return 0;
+
+    TRACE_COUNT(TRACE_OPEN);
+    int subfd = openat(fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (subfd == -1) return 0;
+
+    // nested repositories are reported as a whole
+    struct stat sb;
+    TRACE_COUNT(TRACE_STAT);
+    if (!hasTrackedBelow(walk->index, walk->path, len) && fstatat(subfd, ".git", &sb, 0) == 0) {
+        close(subfd);
+        return report(walk, len);
+    }
+
+    walk->pathLen = len;
+    int result = scanDir(walk, subfd, 0);
+    walk->pathLen = dirLen;
+    return result;
+}
+
+// Reads the directory fd into a listing for the walk cache.
+static char* listDir(DIR* dir, int fd, size_t* size) {
+    size_t used = 0, capacity = 4096;
+    char *listing = malloc(capacity);
+    struct dirent *entry;
+    while (listing != NULL && (entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || strcmp(name, ".git") == 0) continue;
+
+        int isDir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN) {
+            struct stat sb;
+            TRACE_COUNT(TRACE_STAT);
+            isDir = fstatat(fd, name, &sb, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(sb.st_mode);
+        }
+
+        size_t nameLen = strlen(name);
+        if (used + nameLen + 2 > capacity) {
+            capacity = (used + nameLen + 2) * 2;
+            char *grown = realloc(listing, capacity);
+            if (grown == NULL) free(listing);
+            listing = grown;
+            if (listing == NULL) break;
+        }
+        listing[used++] = isDir ? 'd' : 'f';
+        memcpy(listing + used, name, nameLen + 1);
+        used += nameLen + 1;
+    }
+    *size = used;
+    return listing;
+}
+
+// Scans the directory through the walk cache: its listing is read from the
+// cache, or from the directory and then stored.
+static int scanListing(Walk* walk, DIR* dir, int fd) {
+    struct stat sb;
+    size_t size = 0;
+    const char *listing = NULL;
+    char *read = NULL;
+    int haveStat = fstat(fd, &sb) == 0;
+    if (haveStat) {
+        listing = walk->cache->lookup(walk->cache->ctx, walk->path, walk->pathLen, &sb, &size);
+    }
+    if (listing == NULL) {
+        listing = read = listDir(dir, fd, &size);
+        if (read == NULL) return 0;
+        if (haveStat) walk->cache->store(walk->cache->ctx, walk->path, walk->pathLen, &sb, read, size);
+    }
+
+    int result = 0;
+    for (const char *p = listing; p < listing + size && result == 0; p += strlen(p) + 1) {
+        if (pastDeadline(walk)) {
+            result = -1;
+            break;
+        }
+        result = visitEntry(walk, fd, p + 1, p[0] == 'd');
+    }
+    free(read);
+    return result;
+}
+
+// Scans the directory in walk->path, whose descriptor is fd, and everything
+// below it. Returns like gitUntrackedWalk.
+static int scanDir(Walk* walk, int fd, int pushed) {
+    DIR *dir = fdopendir(fd);
+    if (dir == NULL) {
+        close(fd);
+        return 0;
+    }
+    if (!pushed) pushIgnore(walk, readWholeFile(fd, ".gitignore", NULL));
+
+    size_t dirLen = walk->pathLen;
+    int result = 0;
+    if (walk->cache != NULL) {
+        result = scanListing(walk, dir, fd);
+    } else {
+        struct dirent *entry;
+        while (result == 0 && (entry = readdir(dir)) != NULL) {
+            const char *name = entry->d_name;
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || strcmp(name, ".git") == 0) continue;
+            if (pastDeadline(walk)) {
+                result = -1;
+                break;
+            }
+
+            int isDir = entry->d_type == DT_DIR;
+            if (entry->d_type == DT_UNKNOWN) {
+                struct stat sb;
+                TRACE_COUNT(TRACE_STAT);
+                isDir = fstatat(fd, name, &sb, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(sb.st_mode);
+            }
+            result = visitEntry(walk, fd, name, isDir);
+        }
+    }
+
+    walk->path[dirLen] = '\0';
+    closedir(dir);
+    popIgnore(walk);
+    return result;
+}
+
+
+// Parses the directory blocks of the untracked cache in depth first order.
+static int parseUntrackedDir(Walk* walk, const unsigned char** p, const unsigned char* end, size_t* count) {
+    if (*count >= walk->dirCount) return -1;
+    size_t i = (*count)++;
+    UntrackedDir *dir = &walk->dirs[i];
+
+    dir->untrackedCount = decodeVarint(p, end);
+    dir->dirCount = decodeVarint(p, end);
+    const unsigned char *nul = memchr(*p, '\0', end - *p);
+    if (nul == NULL) return -1;
+    dir->name = (const char *)*p;
+    *p = nul + 1;
+
+    dir->untracked = *p;
+    for (uint64_t k = 0; k < dir->untrackedCount; k++) {
+        nul = memchr(*p, '\0', end - *p);
+        if (nul == NULL) return -1;
+        *p = nul + 1;
+    }
+
+    for (uint64_t k = 0; k < dir->dirCount; k++) {
+        if (parseUntrackedDir(walk, p, end, count) != 0) return -1;
+    }
+    dir->next = *count;
+    return 0;
+}
+
+// Loads the untracked cache if it was written for this work tree and the
+// global exclude files have not changed since.
+static int loadUntrackedCache(Walk* walk, const char* workTree, const struct stat* excludeSb,
+                              const struct stat* excludesFileSb) {
+    const unsigned char *p = walk->index->untracked;
+    if (p == NULL || walk->index->untrackedSize < 2) return -1;
+    const unsigned char *end = p + walk->index->untrackedSize - 1;
+
+    char resolved[MAX_PATH_LENGTH];
+    char ident[MAX_PATH_LENGTH + 64];
+    struct utsname uts;
+    if (realpath(workTree, resolved) == NULL || uname(&uts) != 0) return -1;
+    int identLen = snprintf(ident, sizeof(ident), "Location %s, system %s", resolved, uts.sysname) + 1;
+
+    uint64_t len = decodeVarint(&p, end);
+    if ((uint64_t)(end - p) < len || len != (uint64_t)identLen || memcmp(p, ident, identLen) != 0) return -1;
+    p += len;
+
+    // info/exclude and core.excludesFile stat data, dir flags, their oids
+    const size_t headerSize = 36 + 36 + 4 + 2 * GIT_OID_RAWSZ;
+    if ((size_t)(end - p) < headerSize + 1) return -1;
+    const struct stat *sbs[2] = { excludeSb, excludesFileSb };
+    for (int i = 0; i < 2; i++) {
+        const unsigned char *sd = p + i * 36;
+        if (sbs[i] == NULL ? getBe32(sd + 8) != 0
+                : getBe32(sd + 8) != (uint32_t)sbs[i]->st_mtim.tv_sec
+                  || getBe32(sd + 12) != (uint32_t)sbs[i]->st_mtim.tv_nsec
+                  || getBe32(sd + 32) != (uint32_t)sbs[i]->st_size) {
+            return -1;
+        }
+    }
+    p += headerSize;
+    if (strcmp((const char *)p, ".gitignore") != 0) return -1;
+    p += strlen(".gitignore") + 1;
+
+    len = decodeVarint(&p, end);
+    if (len == 0 || len > walk->index->untrackedSize) return -1;
+    walk->dirCount = len;
+    walk->dirs = calloc(len, sizeof(UntrackedDir));
+
+    size_t count = 0;
+    if (parseUntrackedDir(walk, &p, end, &count) != 0 || count != len) goto invalid;
+
+    unsigned char *valid = calloc(len, 1);
+    unsigned char *checkOnly = calloc(len, 1);
+    unsigned char *oidValid = calloc(len, 1);
+    if ((p = ewahRead(p, end, valid, len)) == NULL
+            || (p = ewahRead(p, end, checkOnly, len)) == NULL
+            || (p = ewahRead(p, end, oidValid, len)) == NULL) {
+        free(valid);
+        free(checkOnly);
+        free(oidValid);
+        goto invalid;
+    }
+
+    for (size_t i = 0; i < len && p; i++) {
+        if (!valid[i]) continue;
+        if (end - p < 36) p = NULL;
+        else {
+            walk->dirs[i].valid = 1;
+            walk->dirs[i].stat = p;
+            p += 36;
+        }
+    }
+    for (size_t i = 0; i < len && p; i++) {
+        if (!oidValid[i]) continue;
+        if (end - p < GIT_OID_RAWSZ) p = NULL;
+        else {
+            walk->dirs[i].excludeOid = p;
+            p += GIT_OID_RAWSZ;
+        }
+    }
+    free(valid);
+    free(checkOnly);
+    free(oidValid);
+    if (p != NULL) return 0;
+
+invalid:
+    free(walk->dirs);
+    walk->dirs = NULL;
+    walk->dirCount = 0;
+    return -1;
+}
+
+static int untrackedDirValid(const Walk* walk, const UntrackedDir* dir, int fd, const char* gitignore, size_t len) {
+    struct stat sb;
+    if (!dir->valid || fstat(fd, &sb) != 0) return 0;
+
+    const unsigned char *sd = dir->stat;
+    if (getBe32(sd) != (uint32_t)sb.st_ctim.tv_sec || getBe32(sd + 4) != (uint32_t)sb.st_ctim.tv_nsec
+            || getBe32(sd + 8) != (uint32_t)sb.st_mtim.tv_sec || getBe32(sd + 12) != (uint32_t)sb.st_mtim.tv_nsec
+            || getBe32(sd + 20) != (uint32_t)sb.st_ino || getBe32(sd + 32) != (uint32_t)sb.st_size) {
+        return 0;
+    }
+
+    // a directory changed in the same instant as the index was written
+    const struct timespec *indexMtime = &walk->index->mtime;
+    if (sb.st_mtim.tv_sec > indexMtime->tv_sec
+            || (sb.st_mtim.tv_sec == indexMtime->tv_sec && sb.st_mtim.tv_nsec >= indexMtime->tv_nsec)) {
+        return 0;
+    }
+
+    if (gitignore == NULL) return dir->excludeOid == NULL;
+    GitOid oid;
+    gitHashBlob(gitignore, len, &oid);
+    return dir->excludeOid != NULL && memcmp(oid.hash, dir->excludeOid, GIT_OID_RAWSZ) == 0;
+}
+
+// Walks the directory in walk->path using the untracked cache block i.
+static int walkCached(Walk* walk, size_t i, int fd) {
+    const UntrackedDir *dir = &walk->dirs[i];
+    size_t gitignoreLen = 0;
+    char *gitignore = readWholeFile(fd, ".gitignore", &gitignoreLen);
+    int valid = untrackedDirValid(walk, dir, fd, gitignore, gitignoreLen);
+
+    // parseIgnore modifies the text, so it is hashed first
+    pushIgnore(walk, gitignore);
+    if (!valid) return scanDir(walk, fd, 1);
+
+    size_t dirLen = walk->pathLen;
+    int result = 0;
+    const char *name = (const char *)dir->untracked;
+    for (uint64_t k = 0; k < dir->untrackedCount && result == 0; k++, name += strlen(name) + 1) {
+        size_t nameLen = strlen(name);
+        if (dirLen + nameLen + 1 > sizeof(walk->path)) continue;
+        memcpy(walk->path + dirLen, name, nameLen + 1);
+        result = report(walk, dirLen + nameLen);
+    }
+
+    for (size_t child = i + 1; child < dir->next && result == 0; child = walk->dirs[child].next) {
+        if (pastDeadline(walk)) {
+            result = -1;
+            break;
+        }
+        const char *childName = walk->dirs[child].name;
+        size_t nameLen = strlen(childName);
+        if (dirLen + nameLen + 2 > sizeof(walk->path)) continue;
+        memcpy(walk->path + dirLen, childName, nameLen);
+        walk->path[dirLen + nameLen] = '/';
+        walk->path[dirLen + nameLen + 1] = '\0';
+        if (!overlapsPrefix(walk, walk->path, dirLen + nameLen + 1)) continue;
+
+        walk->path[dirLen + nameLen] = '\0';
+        TRACE_COUNT(TRACE_OPEN);
+        int subfd = openat(fd, walk->path + dirLen, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        walk->path[dirLen + nameLen] = '/';
+        if (subfd == -1) continue;
+
+        walk->pathLen = dirLen + nameLen + 1;
+        result = walkCached(walk, child, subfd);
+        walk->pathLen = dirLen;
+    }
+
+    walk->path[dirLen] = '\0';
+    close(fd);
+    popIgnore(walk);
+    return result;
+}
+
+
+int gitUntrackedWalk(int workTreeFd, const char* workTree, const GitIndex* index,
+                     const char* commonDir, const char* prefix, uint64_t deadline,
+                     const GitWalkCache* cache, GitUntrackedFn fn, void* ctx) {
+    Walk walk;
+    memset(&walk, 0, sizeof(walk));
+    walk.index = index;
+    walk.deadline = deadline;
+    walk.cache = cache;
+    walk.fn = fn;
+    walk.ctx = ctx;
+    walk.prefix = prefix;
+    walk.prefixLen = strlen(prefix);
+
+    // $GIT_DIR/info/exclude, then core.excludesFile
+    char path[MAX_PATH_LENGTH];
+    struct stat excludeSb, excludesFileSb;
+    int haveExclude = 0, haveExcludesFile = 0;
+    snprintf(path, sizeof(path), "%s/info/exclude", commonDir);
+    parseIgnore(&walk.global[0], readWholeFile(AT_FDCWD, path, NULL), 0);
+    haveExclude = stat(path, &excludeSb) == 0;
+
+    char excludesFile[MAX_PATH_LENGTH];
+    char *home = getenv("HOME");
+    char *configHome = getenv("XDG_CONFIG_HOME");
+    if (gitConfigGetGlobal(commonDir, "core", NULL, "excludesfile", excludesFile, sizeof(excludesFile)) > 0) {
+        if (excludesFile[0] == '~' && home != NULL) {
+            snprintf(path, sizeof(path), "%s%s", home, excludesFile + 1);
+        } else {
+            snprintf(path, sizeof(path), "%s", excludesFile);
+        }
+    } else if (configHome != NULL && configHome[0] != '\0') {
+        snprintf(path, sizeof(path), "%s/git/ignore", configHome);
+    } else {
+        snprintf(path, sizeof(path), "%s/.config/git/ignore", home ? home : "");
+    }
+    parseIgnore(&walk.global[1], readWholeFile(AT_FDCWD, path, NULL), 0);
+    haveExcludesFile = stat(path, &excludesFileSb) == 0;
+
+    int result = 0;
+    int fd = openat(workTreeFd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        result = -1;
+    } else if (cache == NULL && loadUntrackedCache(&walk, workTree, haveExclude ? &excludeSb : NULL,
+                                  haveExcludesFile ? &excludesFileSb : NULL) == 0) {
+        result = walkCached(&walk, 0, fd);
+    } else {
+        result = scanDir(&walk, fd, 0);
+    }
+
+    while (walk.listCount > 0) popIgnore(&walk);
+    free(walk.lists);
+    freeIgnore(&walk.global[0]);
+    freeIgnore(&walk.global[1]);
+    free(walk.dirs);
+    return result;
+}
+
+
+// A directory of the cache-tree extension: its tree if it is valid, NULL
+// otherwise, and its subtrees, which start at first.
+typedef struct CacheTreeDir {
+    const unsigned char *first;
+    long subtrees;
+    const unsigned char *oid;
+} CacheTreeDir;
+
+typedef struct CacheTreeChild {
+    const char *name;
+    CacheTreeDir dir;
+} CacheTreeChild;
+
+// Lists the subtrees of dir. Returns how many or -1.
+static long cacheTreeChildren(const CacheTreeDir* dir, const unsigned char* end, CacheTreeChild** children) {
+    *children = NULL;
+    if (dir->first == NULL || dir->subtrees == 0) return 0;
+    *children = malloc(dir->subtrees * sizeof(CacheTreeChild));
+    if (*children == NULL) return -1;
+    const unsigned char *p = dir->first;
+    for (long i = 0; i < dir->subtrees; i++) {
+        long entries;
+        CacheTreeChild *child = &(*children)[i];
+        child->dir.first = cacheTreeNode(p, end, &child->name, &entries, &child->dir.subtrees, &child->dir.oid);
+        if (child->dir.first == NULL || (p = skipCacheTree(p, end)) == NULL) {
+            free(*children);
+            *children = NULL;
+            return -1;
+        }
+    }
+    return dir->subtrees;
+}
+
+// Regular files are only told apart by their executable bit.
+static uint32_t canonicalMode(uint32_t mode) {
+    if (S_ISREG(mode)) return mode & 0100 ? 0100755 : 0100644;
+    return mode;
+}
+
+typedef struct TreeDiff {
+    const char *commonDir;
+    const GitIndex *index;
+    const unsigned char *cacheTreeEnd;
+    size_t position;    // the next index entry to compare
+    uint64_t deadline;
+    unsigned long steps;
+} TreeDiff;
+
+static int entryHasPrefix(const GitIndexEntry* entry, const char* prefix, size_t len) {
+    return entry->nameLen >= len && memcmp(entry->name, prefix, len) == 0;
+}
+
+// The index entries the tree of a commit leaves out.
+static int skippedEntry(const GitIndexEntry* entry) {
+    return entry->stage == 0 && entry->flags & GIT_INDEX_INTENT_TO_ADD;
+}
+
+// Compares the tree oid, at prefix (empty or ending in a slash), with the
+// index entries from diff->position on that start with prefix, and moves
+// past them. Subtrees the cache-tree still holds are compared by their oid
+// alone. Returns 0 if they match, 1 if they differ and -1 if that could not
+// be told in time.
+static int diffTree(TreeDiff* diff, const GitOid* oid, char* prefix, size_t len, const CacheTreeDir* cached) {
+    const GitIndex *index = diff->index;
+    if (++diff->steps % DEADLINE_INTERVAL == 0 && gitMonotonicNs() > diff->deadline) return -1;
+
+    int type;
+    size_t size;
+    unsigned char *tree = gitReadObject(diff->commonDir, oid, &type, &size);
+    if (tree == NULL || type != GIT_OBJ_TREE) {
+        free(tree);
+        return -1;
+    }
+    CacheTreeChild *children = NULL;
+    long childCount = cached ? cacheTreeChildren(cached, diff->cacheTreeEnd, &children) : 0;
+    if (childCount < 0) childCount = 0;
+
+    int result = 0;
+    const unsigned char *p = tree, *end = tree + size;
+    while (result == 0 && p < end) {
+        // "<octal mode> <name>\0<oid>"
+        const unsigned char *space = memchr(p, ' ', end - p);
+        const unsigned char *nul = space ? memchr(space, '\0', end - space) : NULL;
+        if (nul == NULL || end - nul - 1 < GIT_OID_RAWSZ) {
+            result = -1;
+            break;
+        }
+        uint32_t mode = strtoul((const char *)p, NULL, 8);
+        const char *name = (const char *)space + 1;
+        size_t nameLen = (const char *)nul - name;
+        GitOid entryOid;
+        memcpy(entryOid.hash, nul + 1, GIT_OID_RAWSZ);
+        p = nul + 1 + GIT_OID_RAWSZ;
+        if (len + nameLen + 2 > MAX_PATH_LENGTH) {
+            result = -1;
+            break;
+        }
+        memcpy(prefix + len, name, nameLen);
+        size_t pathLen = len + nameLen;
+        prefix[pathLen] = '/';
+
+        while (diff->position < index->count && skippedEntry(&index->entries[diff->position])) {
+            diff->position++;
+        }
+        const GitIndexEntry *entry = diff->position < index->count ? &index->entries[diff->position] : NULL;
+
+        // an entry that sorts first was added, as in a merge of two sorted lists
+        if (entry != NULL && entryHasPrefix(entry, prefix, len)
+                && compareNames(entry->name, entry->nameLen, prefix, pathLen + S_ISDIR(mode)) < 0) {
+            result = 1;
+            break;
+        }
+
+        if (S_ISDIR(mode)) {
+            pathLen++;
+            if (entry == NULL || !entryHasPrefix(entry, prefix, pathLen)) {
+                result = 1;
+            } else if (entry->nameLen == pathLen) {
+                // a sparse directory entry holds the tree itself
+                result = entry->stage != 0 || memcmp(entry->oid.hash, entryOid.hash, GIT_OID_RAWSZ) != 0;
+                diff->position++;
+            } else {
+                const CacheTreeDir *child = NULL;
+                for (long i = 0; i < childCount && child == NULL; i++) {
+                    if (strlen(children[i].name) == nameLen && memcmp(children[i].name, name, nameLen) == 0) {
+                        child = &children[i].dir;
+                    }
+                }
+                if (child != NULL && child->oid != NULL) {
+                    result = memcmp(child->oid, entryOid.hash, GIT_OID_RAWSZ) != 0;
+                    while (result == 0 && diff->position < index->count
+                            && entryHasPrefix(&index->entries[diff->position], prefix, pathLen)) {
+                        diff->position++;
+                    }
+                } else {
+                    result = diffTree(diff, &entryOid, prefix, pathLen, child);
+                }
+            }
+        } else if (entry == NULL || entry->nameLen != pathLen || memcmp(entry->name, prefix, pathLen) != 0
+                || entry->stage != 0 || canonicalMode(entry->mode) != canonicalMode(mode)
+                || memcmp(entry->oid.hash, entryOid.hash, GIT_OID_RAWSZ) != 0) {
+            result = 1;
+        } else {
+            diff->position++;
+        }
+    }
+
+    // whatever is left below prefix was added
+    while (result == 0 && diff->position < index->count
+            && entryHasPrefix(&index->entries[diff->position], prefix, len)) {
+        result = !skippedEntry(&index->entries[diff->position++]);
+    }
+    free(children);
+    free(tree);
+    return result;
+}
+
+static int stopAtFirst(void* ctx, const char* path, size_t len) {
+    (void)path;
+    (void)len;
+    *(int *)ctx = 1;
+    return 1;
+}
+
+void gitWorktreeStatus(const char* workTree, const char* gitDir, const char* commonDir,
+                       long budget, GitStatus* status) {
+    status->known = 0;
+    status->flags = 0;
+
+    char value[64];
+    if (gitConfigGet(commonDir, "extensions", NULL, "objectformat", value, sizeof(value)) > 0
+            && strcasecmp(value, "sha256") == 0) {
+        return;
+    }
+
+    uint64_t deadline = gitMonotonicNs() + (uint64_t)budget * 1000;
+    GitIndex index;
+    TRACE_BEGIN("index");
+    int loaded = gitIndexLoad(gitDir, &index);
+    TRACE_END("index");
+    if (loaded != 0) return;
+    int workTreeFd = open(workTree, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (workTreeFd == -1) {
+        gitIndexFree(&index);
+        return;
+    }
+
+    // Staged changes: the cache-tree's root is the tree the index would be
+    // committed as. Once git invalidates it, e.g. for a path that was added
+    // and reset again, the index is compared with HEAD's tree, skipping the
+    // subtrees the cache-tree still holds.
+    GitOid head, tree;
+    TRACE_BEGIN("staged");
+    if (gitResolveRef(gitDir, commonDir, "HEAD", &head, NULL, 0) != 0) {
+        // an unborn branch
+        status->known |= GIT_STATUS_STAGED;
+        if (index.count > 0) status->flags |= GIT_STATUS_STAGED;
+    } else if (gitCommitTree(commonDir, &head, &tree) != 0) {
+        // not known
+    } else if (index.treeValid) {
+        status->known |= GIT_STATUS_STAGED;
+        if (memcmp(tree.hash, index.tree.hash, GIT_OID_RAWSZ) != 0) status->flags |= GIT_STATUS_STAGED;
+    } else if (!index.split) {
+        char prefix[MAX_PATH_LENGTH];
+        CacheTreeDir root = { NULL, 0, NULL };
+        const unsigned char *end = index.cacheTree + index.cacheTreeSize;
+        const char *name;
+        long entries;
+        if (index.cacheTree != NULL) {
+            root.first = cacheTreeNode(index.cacheTree, end, &name, &entries, &root.subtrees, &root.oid);
+        }
+        TreeDiff diff = { commonDir, &index, end, 0, deadline, 0 };
+        int differs = diffTree(&diff, &tree, prefix, 0, root.first ? &root : NULL);
+        if (differs >= 0) {
+            status->known |= GIT_STATUS_STAGED;
+            if (differs) status->flags |= GIT_STATUS_STAGED;
+        }
+    }
+    TRACE_END("staged");
+
+    // Unstaged changes, skipping what fsmonitor knows to be unchanged
+    if (!index.split) {
+        TRACE_BEGIN("dirty");
+        unsigned char *check = gitIndexFsmonitor(&index, gitDir, commonDir);
+        int trustFilemode = gitConfigBool(commonDir, "core", "filemode", 1);
+        size_t i;
+        for (i = 0; i < index.count; i++) {
+            const GitIndexEntry *entry = &index.entries[i];
+            if (i % DEADLINE_INTERVAL == 0 && gitMonotonicNs() > deadline) break;
+            if (entry->stage != 0) {
+                status->flags |= GIT_STATUS_DIRTY;
+                break;
+            }
+            if (entry->flags & (GIT_INDEX_ASSUME_VALID | GIT_INDEX_SKIP_WORKTREE)) continue;
+            if (check != NULL && !check[i]) continue;
+
+            struct stat sb;
+            if (entry->flags & GIT_INDEX_INTENT_TO_ADD
+                    || gitIndexEntryChanged(workTreeFd, &index, entry, trustFilemode, &sb) != GIT_ENTRY_CLEAN) {
+                status->flags |= GIT_STATUS_DIRTY;
+                break;
+            }
+        }
+        if (i == index.count || status->flags & GIT_STATUS_DIRTY) status->known |= GIT_STATUS_DIRTY;
+        free(check);
+        TRACE_END("dirty");
+    }
+
+    if (gitConfigGet(commonDir, "status", NULL, "showuntrackedfiles", value, sizeof(value)) > 0
+            && strcasecmp(value, "no") == 0) {
+        status->known |= GIT_STATUS_UNTRACKED;
+    } else {
+        int found = 0;
+        TRACE_BEGIN("untracked");
+        if (gitUntrackedWalk(workTreeFd, workTree, &index, commonDir, "", deadline, NULL, stopAtFirst, &found) >= 0) {
+            status->known |= GIT_STATUS_UNTRACKED;
+            if (found) status->flags |= GIT_STATUS_UNTRACKED;
+        }
+        TRACE_END("untracked");
+    }
+
+    close(workTreeFd);
+    gitIndexFree(&index);
+}
@@ -0,0 +1,128 @@
+#ifndef GITINDEX_H
+#define GITINDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+#include "gitobj.h"
+
+#define GIT_STATUS_STAGED    1
+#define GIT_STATUS_DIRTY     2
+#define GIT_STATUS_UNTRACKED 4
+#define GIT_STATUS_ALL       7
+
+// flags of an index entry
+#define GIT_INDEX_ASSUME_VALID  0x8000
+#define GIT_INDEX_EXTENDED      0x4000
+#define GIT_INDEX_SKIP_WORKTREE 0x40000000
+#define GIT_INDEX_INTENT_TO_ADD 0x20000000
+
+// results of gitIndexEntryChanged
+#define GIT_ENTRY_CLEAN    0
+#define GIT_ENTRY_MODIFIED 1
+#define GIT_ENTRY_DELETED  2
+#define GIT_ENTRY_TYPE     3
+#define GIT_ENTRY_UNSURE   4    // only the content can tell
+
+typedef struct GitIndexEntry {
+    const char *name;
+    uint32_t nameLen;
+    uint32_t ctimeSec, ctimeNsec;
+    uint32_t mtimeSec, mtimeNsec;
+    uint32_t dev, ino, mode, uid, gid, size;
+    GitOid oid;
+    uint32_t flags;     // 16 bit flags, extended flags in the upper half
+    int stage;
+} GitIndexEntry;
+
+typedef struct GitIndex {
+    void *map;
+    size_t mapSize;
+    uint32_t version;
+    struct timespec mtime;  // of the index file, entries at least as new are racy
+    GitIndexEntry *entries;
+    size_t count;
+    char *names;            // name storage for prefix compressed version 4 indexes
+    int split;              // a split index, entries live in a shared index too
+
+    int treeValid;          // cache-tree extension with a valid root
+    GitOid tree;
+    const unsigned char *cacheTree;   // the TREE extension
+    size_t cacheTreeSize;
+
+    const unsigned char *untracked;   // the UNTR extension
+    size_t untrackedSize;
+    const unsigned char *fsmonitor;   // the FSMN extension
+    size_t fsmonitorSize;
+} GitIndex;
+
+// Keeps the directory listings of a walk so that later walks do not read
+// the directories whose stat data is unchanged. A listing is a series of
+// NUL-terminated names, each preceded by 'd' for a directory or 'f'.
+typedef struct GitWalkCache {
+    // Returns the listing kept for path (ending in a slash, "" for the top
+    // of the work tree) if it was stored for the stat data sb, else NULL.
+    const char* (*lookup)(void* ctx, const char* path, size_t len, const struct stat* sb, size_t* size);
+    void (*store)(void* ctx, const char* path, size_t len, const struct stat* sb,
+                  const char* listing, size_t size);
+    void* ctx;
+} GitWalkCache;
+
+// Called for every untracked file, and for untracked directories the walk
+// does not descend into (with a trailing slash). Return non-zero to stop.
+typedef int (*GitUntrackedFn)(void* ctx, const char* path, size_t len);
+
+// Loads <gitDir>/index. A missing index loads as an empty one. Returns 0 on
+// success.
+int gitIndexLoad(const char* gitDir, GitIndex* index);
+void gitIndexFree(GitIndex* index);
+
+// Returns the position of the first entry whose name is not smaller than
+// name, which for a directory "dir/" is its first tracked file.
+size_t gitIndexLowerBound(const GitIndex* index, const char* name, size_t len);
+int gitIndexIsTracked(const GitIndex* index, const char* name, size_t len);
+
+// Looks up the tree the cache-tree extension holds for dir ("" for the
+// top, "a/b" or "a/b/" below it). Returns 0 if it has a valid one.
+int gitIndexCacheTree(const GitIndex* index, const char* dir, size_t len, GitOid* oid);
+
+// Compares an entry's cached stat data with sb, the work tree's, without
+// looking at the content: GIT_ENTRY_UNSURE when that would be needed.
+int gitIndexEntryStat(const GitIndex* index, const GitIndexEntry* entry, int trustFilemode,
+                      const struct stat* sb);
+
+// Compares an entry's cached stat data with the work tree, hashing the
+// content when the stat data alone is not conclusive.
+int gitIndexEntryChanged(int workTreeFd, const GitIndex* index, const GitIndexEntry* entry,
+                         int trustFilemode, struct stat* sb);
+
+// Asks fsmonitor which entries may have changed since the index was
+// written. Returns a malloc'd array with one byte per entry that is set for
+// entries that need to be checked, or NULL if every entry does.
+unsigned char* gitIndexFsmonitor(const GitIndex* index, const char* gitDir, const char* commonDir);
+
+// Walks the work tree below prefix ("" for all of it, otherwise ending in
+// a slash) and reports untracked, not ignored files, using cache if it is
+// not NULL and otherwise the untracked cache where it is still valid. Stops
+// at deadline (CLOCK_MONOTONIC in nanoseconds, 0 for none). Returns 0 when
+// done, 1 when fn stopped the walk and -1 when the deadline passed or the
+// walk failed.
+int gitUntrackedWalk(int workTreeFd, const char* workTree, const GitIndex* index,
+                     const char* commonDir, const char* prefix, uint64_t deadline,
+                     const GitWalkCache* cache, GitUntrackedFn fn, void* ctx);
+
+typedef struct GitStatus {
+    int known;  // the GIT_STATUS_* questions that could be answered
+    int flags;  // the GIT_STATUS_* that are true
+} GitStatus;
+
+// Works out whether the work tree has staged, unstaged or untracked changes,
+// stopping each check at the first hit. Checks that have not finished after
+// budget microseconds are left out of status->known.
+void gitWorktreeStatus(const char* workTree, const char* gitDir, const char* commonDir,
+                       long budget, GitStatus* status);
+
+uint64_t gitMonotonicNs(void);
+
+#endif
@@ -0,0 +1,230 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+
+#include "gitrepo.h"
+#include "gitobj.h"
+#include "trace.h"
+#include "gitlog.h"
+
+// Lists the history of HEAD for glo the way
+//
+//   git log --date=format-local:"%Y-%m-%d %H:%M" --abbrev-commit --color=always
+//       --pretty=format:"%C(red)%h %C(green)%cd%C(reset) %C(cyan)●%C(reset) %C(yellow)%an%C(reset) %C(cyan)●%C(reset) %s"
+//
+// does, preceded by a line with the length of the abbreviated ids so glo
+// can hide them without waiting for the first commit. Like git, ids that
+// would be ambiguous at that length are written longer. Commits are written
+// as they are walked and the first screenful is flushed right away, so fzy
+// has something to show while the rest of the history is still read.
+// Repositories that rewrite their history with replace refs or grafts, or
+// want it in another encoding, are left to git itself.
+
+#define MAX_PATH_LENGTH 4096
+#define DEFAULT_SCREEN_LINES 64
+
+static const char hashColor[] = "\x1b[31m";
+static const char dateColor[] = "\x1b[32m";
+static const char separator[] = "\x1b[36m●\x1b[m";
+static const char authorColor[] = "\x1b[33m";
+static const char resetColor[] = "\x1b[m";
+
+
+static int runGit(int abbrev) {
+    if (abbrev > 0) printf("%d\n", abbrev);
+    fflush(stdout);
+    execlp("git", "git", "log", "--date=format-local:%Y-%m-%d %H:%M",
+           "--pretty=format:%C(red)%h %C(green)%cd%C(reset) %C(cyan)●%C(reset) "
+           "%C(yellow)%an%C(reset) %C(cyan)●%C(reset) %s",
+           "--abbrev-commit", "--color=always", (char *)NULL);
+    perror("gitlog: git");
+    return 127;
+}
+
+// Finds the repository holding cwd and makes its directories absolute.
+static int findRepo(const char* cwd, char* gitDir, char* commonDir) {
+    char dir[MAX_PATH_LENGTH];
+    size_t len = strlen(cwd);
+    if (len >= sizeof(dir)) return -1;
+    memcpy(dir, cwd, len + 1);
+
+    GitRepo repo;
+    for (;;) {
+        int kind = gitProbeAt(AT_FDCWD, dir, NULL, &repo);
+        if (kind == GIT_REPO_DIR || kind == GIT_REPO_FILE || kind == GIT_REPO_BARE) break;
+        if (kind != GIT_REPO_NONE || len == 0) return -1;
+        char *slash = strrchr(dir, '/');
+        if (slash == NULL) return -1;
+        len = slash - dir;
+        dir[len] = '\0';
+    }
+
+    const char *base = len ? dir : "";
+    snprintf(gitDir, MAX_PATH_LENGTH, "%s%s%s", repo.gitDir[0] == '/' ? "" : base,
+             repo.gitDir[0] == '/' ? "" : "/", repo.gitDir);
+    snprintf(commonDir, MAX_PATH_LENGTH, "%s%s%s", repo.commonDir[0] == '/' ? "" : base,
+             repo.commonDir[0] == '/' ? "" : "/", repo.commonDir);
+    return 0;
+}
+
+// Whether the history git shows is not the one the objects tell.
+static int rewritesHistory(const char* commonDir) {
+    char path[MAX_PATH_LENGTH];
+    snprintf(path, sizeof(path), "%s/info/grafts", commonDir);
+    if (access(path, F_OK) == 0) return 1;
+
+    snprintf(path, sizeof(path), "%s/refs/replace", commonDir);
+    TRACE_COUNT(TRACE_OPEN);
+    DIR *dir = opendir(path);
+    if (dir != NULL) {
+        struct dirent *entry;
+        int found = 0;
+        while (!found && (entry = readdir(dir)) != NULL) found = entry->d_name[0] != '.';
+        closedir(dir);
+        if (found) return 1;
+    }
+
+    snprintf(path, sizeof(path), "%s/packed-refs", commonDir);
+    TRACE_COUNT(TRACE_OPEN);
+    FILE *packed = fopen(path, "re");
+    if (packed == NULL) return 0;
+    char line[1024];
+    int found = 0;
+    while (!found && fgets(line, sizeof(line), packed)) found = strstr(line, " refs/replace/") != NULL;
+    fclose(packed);
+    return found;
+}
+
+static int screenLines(void) {
+    struct winsize size;
+    if (ioctl(STDERR_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_row > 0) return size.ws_row;
+    return DEFAULT_SCREEN_LINES;
+}
+
+// The value of a header line of a commit, e.g. "author", up to its newline.
+static const char* header(const char* body, const char* name, const char** end) {
+    size_t len = strlen(name);
+    for (const char *line = body; *line != '\0' && *line != '\n'; ) {
+        const char *next = strchr(line, '\n');
+        if (next == NULL) return NULL;
+        if (strncmp(line, name, len) == 0 && line[len] == ' ') {
+            *end = next;
+            return line + len + 1;
+        }
+        line = next + 1;
+    }
+    return NULL;
+}
+
+// The length of a line without its trailing whitespace, 0 for blank ones.
+static size_t lineLength(const char* line, const char* end) {
+    while (end > line && isspace((unsigned char)end[-1])) end--;
+    return end - line;
+}
+
+static void writeCommit(const char* commonDir, const GitOid* oid, const char* body, int abbrev) {
+    char hex[GIT_OID_HEXSZ + 1];
+    gitOidToHex(oid, hex);
+
+    char date[32] = "";
+    const char *end;
+    const char *committer = header(body, "committer", &end);
+    const char *email = committer ? memrchr(committer, '>', end - committer) : NULL;
+    if (email != NULL) {
+        time_t time = strtoll(email + 1, NULL, 10);
+        struct tm tm;
+        if (localtime_r(&time, &tm)) strftime(date, sizeof(date), "%Y-%m-%d %H:%M", &tm);
+    }
+
+    // the name ends before the email, without the space before it
+    const char *author = header(body, "author", &end);
+    size_t authorLen = 0;
+    if (author != NULL) {
+        const char *open = memchr(author, '<', end - author);
+        authorLen = lineLength(author, open ? open : end);
+    }
+
+    printf("%s%.*s %s%s%s %s %s%.*s%s %s ", hashColor, gitUniqueAbbrev(commonDir, oid, abbrev), hex, dateColor, date, resetColor,
+           separator, authorColor, (int)authorLen, author ? author : "", resetColor, separator);
+
+    // the subject is the first paragraph of the message, its lines joined
+    const char *message = strstr(body, "\n\n");
+    message = message ? message + 2 : "";
+    int first = 1;
+    for (const char *line = message; *line != '\0'; ) {
+        const char *next = strchrnul(line, '\n');
+        size_t len = lineLength(line, next);
+        if (len > 0) {
+            if (!first) putchar(' ');
+            fwrite(line, 1, len, stdout);
+            first = 0;
+        } else if (!first) {
+            break;
+        }
+        line = *next ? next + 1 : next;
+    }
+    putchar('\n');
+}
+
+int gitlogMain(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    TRACE_INIT("gitlog");
+
+    // the environment can point git elsewhere
+    if (getenv("GIT_DIR") || getenv("GIT_OBJECT_DIRECTORY") || getenv("GIT_CONFIG_PARAMETERS")) {
+        return runGit(0);
+    }
+
+    char cwd[MAX_PATH_LENGTH];
+    char gitDir[MAX_PATH_LENGTH];
+    char commonDir[MAX_PATH_LENGTH];
+    if (getcwd(cwd, sizeof(cwd)) == NULL || findRepo(cwd, gitDir, commonDir) != 0) return runGit(0);
+
+    TRACE_BEGIN("setup");
+    int abbrev = gitAbbrevLength(commonDir);
+    char value[64];
+    GitOid head;
+    GitLog *log = NULL;
+    if (!rewritesHistory(commonDir)
+            && gitConfigGetGlobal(commonDir, "i18n", NULL, "logOutputEncoding", value, sizeof(value)) < 0
+            && gitResolveRef(gitDir, commonDir, "HEAD", &head, NULL, 0) == 0) {
+        log = gitLogStart(commonDir, &head);
+    }
+    TRACE_END("setup");
+    if (log == NULL) return runGit(abbrev);
+
+    static char buffer[1 << 16];
+    setvbuf(stdout, buffer, _IOFBF, sizeof(buffer));
+    printf("%d\n", abbrev);
+    fflush(stdout);
+
+    TRACE_BEGIN("walk");
+    int unflushed = screenLines();
+    GitOid oid;
+    size_t size;
+    char *body;
+    while ((body = gitLogNext(log, &oid, &size)) != NULL) {
+        writeCommit(commonDir, &oid, body, abbrev);
+        free(body);
+        if (unflushed > 0 && --unflushed == 0 && fflush(stdout) != 0) break;
+        if (ferror(stdout)) break;
+    }
+    TRACE_END("walk");
+
+    gitLogFree(log);
+    return fflush(stdout) == 0 ? 0 : 1;
+}
+
+#ifndef FILEOPENER_MULTICALL
+int main(int argc, char **argv) {
+    return gitlogMain(argc, argv);
+}
+#endif
@@ -0,0 +1,9 @@
+#ifndef GITLOG_H
+#define GITLOG_H
+
+// The gitlog program, called by main or by the multi-call binary. It
+// prints the length of the abbreviated commit ids on a line of its own and
+// then the history of HEAD as glo shows it, one colored line a commit.
+int gitlogMain(int argc, char** argv);
+
+#endif
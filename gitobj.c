@@ -0,0 +1,1567 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <zlib.h>
+
+#include "gitobj.h"
+#include "trace.h"
+
+#define MAX_SYMREF_DEPTH 5
+#define MAX_GRAPH_LAYERS 64
+#define MAX_PACKS 256
+#define MAX_DELTA_DEPTH 64
+
+// pack entry types besides the GIT_OBJ_* ones
+#define PACK_OFS_DELTA 6
+#define PACK_REF_DELTA 7
+
+
+#define ROL(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
+
+static void sha1Block(GitSha1* ctx, const unsigned char* block) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)block[i*4] << 24 | (uint32_t)block[i*4+1] << 16
+             | (uint32_t)block[i*4+2] << 8 | block[i*4+3];
+    }
+    for (int i = 16; i < 80; i++) {
+        w[i] = ROL(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+    }
+
+    uint32_t a = ctx->state[0], b = ctx->state[1], c = ctx->state[2], d = ctx->state[3], e = ctx->state[4];
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        uint32_t temp = ROL(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = ROL(b, 30);
+        b = a;
+        a = temp;
+    }
+
+    ctx->state[0] += a;
+    ctx->state[1] += b;
+    ctx->state[2] += c;
+    ctx->state[3] += d;
+    ctx->state[4] += e;
+}
+
+void gitSha1Init(GitSha1* ctx) {
+    ctx->state[0] = 0x67452301;
+    ctx->state[1] = 0xEFCDAB89;
+    ctx->state[2] = 0x98BADCFE;
+    ctx->state[3] = 0x10325476;
+    ctx->state[4] = 0xC3D2E1F0;
+    ctx->length = 0;
+}
+
+void gitSha1Update(GitSha1* ctx, const void* data, size_t len) {
+    const unsigned char *bytes = data;
+    size_t used = ctx->length % 64;
+    ctx->length += len;
+
+    if (used) {
+        size_t fill = 64 - used < len ? 64 - used : len;
+        memcpy(ctx->buffer + used, bytes, fill);
+        bytes += fill;
+        len -= fill;
+        if (used + fill < 64) return;
+        sha1Block(ctx, ctx->buffer);
+    }
+    for (; len >= 64; bytes += 64, len -= 64) {
+        sha1Block(ctx, bytes);
+    }
+    memcpy(ctx->buffer, bytes, len);
+}
+
+void gitSha1Final(GitSha1* ctx, unsigned char* out) {
+    uint64_t bits = ctx->length * 8;
+    unsigned char pad = 0x80;
+    gitSha1Update(ctx, &pad, 1);
+    pad = 0;
+    while (ctx->length % 64 != 56) {
+        gitSha1Update(ctx, &pad, 1);
+    }
+    unsigned char length[8];
+    for (int i = 0; i < 8; i++) {
+        length[i] = bits >> (56 - i * 8);
+    }
+    gitSha1Update(ctx, length, 8);
+
+    for (int i = 0; i < 5; i++) {
+        out[i*4] = ctx->state[i] >> 24;
+        out[i*4+1] = ctx->state[i] >> 16;
+        out[i*4+2] = ctx->state[i] >> 8;
+        out[i*4+3] = ctx->state[i];
+    }
+}
+
+
+static int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+int gitOidFromHex(const char* hex, GitOid* oid) {
+    for (int i = 0; i < GIT_OID_RAWSZ; i++) {
+        int high = hexValue(hex[i*2]);
+        int low = high < 0 ? -1 : hexValue(hex[i*2+1]);
+        if (low < 0) return -1;
+        oid->hash[i] = high << 4 | low;
+    }
+    return 0;
+}
+
+void gitOidToHex(const GitOid* oid, char* hex) {
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < GIT_OID_RAWSZ; i++) {
+        hex[i*2] = digits[oid->hash[i] >> 4];
+        hex[i*2+1] = digits[oid->hash[i] & 15];
+    }
+    hex[GIT_OID_HEXSZ] = '\0';
+}
+
+int gitOidIsNull(const GitOid* oid) {
+    for (int i = 0; i < GIT_OID_RAWSZ; i++) {
+        if (oid->hash[i]) return 0;
+    }
+    return 1;
+}
+
+void gitHashBlob(const void* data, size_t len, GitOid* oid) {
+    char header[32];
+    int headerLen = snprintf(header, sizeof(header), "blob %zu", len) + 1;
+    GitSha1 ctx;
+    gitSha1Init(&ctx);
+    gitSha1Update(&ctx, header, headerLen);
+    gitSha1Update(&ctx, data, len);
+    gitSha1Final(&ctx, oid->hash);
+}
+
+
+static char* trim(char* str) {
+    while (isspace((unsigned char)*str)) str++;
+    char *end = str + strlen(str);
+    while (end > str && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+    return str;
+}
+
+static int configGet(const char* path, const char* section, const char* subsection,
+                     const char* key, char* value, size_t size) {
+    TRACE_COUNT(TRACE_OPEN);
+    FILE *file = fopen(path, "re");
+    if (file == NULL) return -1;
+
+    char line[1024];
+    int inSection = 0;
+    int found = -1;
+    while (fgets(line, sizeof(line), file)) {
+        char *str = trim(line);
+        if (*str == '#' || *str == ';' || *str == '\0') continue;
+
+        if (*str == '[') {
+            char *close = strrchr(str, ']');
+            if (close == NULL) continue;
+            *close = '\0';
+            str++;
+
+            char *quote = strchr(str, '"');
+            char *name = trim(str);
+            const char *sub = NULL;
+            if (quote != NULL) {
+                *quote = '\0';
+                name = trim(str);
+                sub = quote + 1;
+                char *endQuote = strrchr(quote + 1, '"');
+                if (endQuote) *endQuote = '\0';
+            } else if ((quote = strchr(str, '.')) != NULL) {
+                // deprecated [section.subsection] syntax
+                *quote = '\0';
+                sub = quote + 1;
+            }
+
+            inSection = strcasecmp(name, section) == 0
+                && (subsection == NULL ? sub == NULL : sub != NULL && strcmp(sub, subsection) == 0);
+            continue;
+        }
+        if (!inSection) continue;
+
+        char *equals = strchr(str, '=');
+        char *name = str;
+        char *val = "true"; // a bare key is a true boolean
+        if (equals != NULL) {
+            *equals = '\0';
+            val = trim(equals + 1);
+            name = trim(str);
+        }
+        if (strcasecmp(name, key) != 0) continue;
+
+        // strip surrounding quotes, later values win
+        size_t len = strlen(val);
+        if (len >= 2 && val[0] == '"' && val[len-1] == '"') {
+            val[len-1] = '\0';
+            val++;
+        }
+        found = snprintf(value, size, "%s", val);
+    }
+    fclose(file);
+    return found;
+}
+
+int gitConfigGet(const char* commonDir, const char* section, const char* subsection,
+                 const char* key, char* value, size_t size) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/config", commonDir);
+    return configGet(path, section, subsection, key, value, size);
+}
+
+int gitConfigGetGlobal(const char* commonDir, const char* section, const char* subsection,
+                       const char* key, char* value, size_t size) {
+    int len = gitConfigGet(commonDir, section, subsection, key, value, size);
+    if (len >= 0) return len;
+
+    char path[1024];
+    char *home = getenv("HOME");
+    char *configHome = getenv("XDG_CONFIG_HOME");
+    if (home != NULL) {
+        snprintf(path, sizeof(path), "%s/.gitconfig", home);
+        if ((len = configGet(path, section, subsection, key, value, size)) >= 0) return len;
+    }
+    if (configHome != NULL && configHome[0] != '\0') {
+        snprintf(path, sizeof(path), "%s/git/config", configHome);
+    } else {
+        snprintf(path, sizeof(path), "%s/.config/git/config", home ? home : "");
+    }
+    return configGet(path, section, subsection, key, value, size);
+}
+
+int gitConfigBool(const char* commonDir, const char* section, const char* key, int fallback) {
+    char value[64];
+    if (gitConfigGet(commonDir, section, NULL, key, value, sizeof(value)) < 0) return fallback;
+    return strcasecmp(value, "true") == 0 || strcasecmp(value, "yes") == 0
+        || strcasecmp(value, "on") == 0 || atoi(value) != 0;
+}
+
+static int isSha256(const char* commonDir) {
+    char value[32];
+    return gitConfigGet(commonDir, "extensions", NULL, "objectformat", value, sizeof(value)) > 0
+        && strcasecmp(value, "sha256") == 0;
+}
+
+
+static int readLooseRef(const char* dir, const char* ref, char* line, size_t size) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", dir, ref);
+    TRACE_COUNT(TRACE_OPEN);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+    ssize_t n = read(fd, line, size - 1);
+    close(fd);
+    if (n <= 0) return -1;
+    line[n] = '\0';
+    line[strcspn(line, "\n")] = '\0';
+    return 0;
+}
+
+static int readPackedRef(const char* commonDir, const char* ref, GitOid* oid) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/packed-refs", commonDir);
+    TRACE_COUNT(TRACE_OPEN);
+    FILE *file = fopen(path, "re");
+    if (file == NULL) return -1;
+
+    char line[1024];
+    size_t refLen = strlen(ref);
+    int found = -1;
+    while (fgets(line, sizeof(line), file)) {
+        if (line[0] == '#' || line[0] == '^' || strlen(line) < GIT_OID_HEXSZ + 2) continue;
+        char *name = line + GIT_OID_HEXSZ + 1;
+        if (strncmp(name, ref, refLen) == 0 && (name[refLen] == '\n' || name[refLen] == '\0')) {
+            found = gitOidFromHex(line, oid);
+            break;
+        }
+    }
+    fclose(file);
+    return found;
+}
+
+int gitResolveRef(const char* gitDir, const char* commonDir, const char* ref,
+                  GitOid* oid, char* target, size_t targetSize) {
+    if (isSha256(commonDir)) return -1;
+
+    char name[1024];
+    char line[1024];
+    snprintf(name, sizeof(name), "%s", ref);
+
+    for (int depth = 0; depth < MAX_SYMREF_DEPTH; depth++) {
+        if (target != NULL) snprintf(target, targetSize, "%s", name);
+
+        // HEAD and other pseudorefs are per worktree, branches are shared
+        int loose = readLooseRef(gitDir, name, line, sizeof(line));
+        if (loose != 0 && strcmp(gitDir, commonDir) != 0) {
+            loose = readLooseRef(commonDir, name, line, sizeof(line));
+        }
+
+        if (loose != 0) {
+            return readPackedRef(commonDir, name, oid);
+        }
+        if (strncmp(line, "ref: ", 5) != 0) {
+            return gitOidFromHex(line, oid);
+        }
+        snprintf(name, sizeof(name), "%s", line + 5);
+    }
+    return -1;
+}
+
+
+// Inflates the beginning of an object into out. Returns the number of
+// bytes produced or -1.
+static long inflatePrefix(const unsigned char* data, size_t size, char* out, size_t outSize) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit(&stream) != Z_OK) return -1;
+
+    stream.next_in = (unsigned char *)data;
+    stream.avail_in = size;
+    stream.next_out = (unsigned char *)out;
+    stream.avail_out = outSize;
+    int status = inflate(&stream, Z_SYNC_FLUSH);
+    long produced = outSize - stream.avail_out;
+    inflateEnd(&stream);
+    return status == Z_OK || status == Z_STREAM_END ? produced : -1;
+}
+
+// Inflates the start of a loose commit, enough for its tree and parent
+// lines, into body. Returns the length of the body or -1.
+static long readLooseCommit(const char* commonDir, const GitOid* commit, char* body, size_t size) {
+    char hex[GIT_OID_HEXSZ + 1];
+    char path[1024];
+    gitOidToHex(commit, hex);
+    snprintf(path, sizeof(path), "%s/objects/%.2s/%s", commonDir, hex, hex + 2);
+
+    TRACE_COUNT(TRACE_OPEN);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+    unsigned char compressed[2048];
+    ssize_t n = read(fd, compressed, sizeof(compressed));
+    close(fd);
+    if (n <= 0) return -1;
+
+    // "commit <size>\0tree <hex>\nparent <hex>\n..."
+    char header[4096];
+    long len = inflatePrefix(compressed, n, header, sizeof(header));
+    if (len <= 0 || strncmp(header, "commit ", 7) != 0) return -1;
+
+    char *nul = memchr(header, '\0', len);
+    if (nul == NULL) return -1;
+    len -= nul + 1 - header;
+    if ((size_t)len >= size) len = size - 1;
+    memcpy(body, nul + 1, len);
+    body[len] = '\0';
+    return len;
+}
+
+static int looseCommitTree(const char* commonDir, const GitOid* commit, GitOid* tree) {
+    char body[128];
+    long len = readLooseCommit(commonDir, commit, body, sizeof(body));
+    if (len < 5 + GIT_OID_HEXSZ || strncmp(body, "tree ", 5) != 0) {
+        return -1;
+    }
+    return gitOidFromHex(body + 5, tree);
+}
+
+
+typedef struct GraphLayer {
+    const unsigned char *map;
+    size_t size;
+    uint32_t count;
+    uint32_t base;  // position of the first commit of this layer
+    const unsigned char *fanout;
+    const unsigned char *oids;
+    const unsigned char *data;
+    const unsigned char *edges;     // parents of octopus merges
+    uint32_t edgeCount;
+} GraphLayer;
+
+typedef struct CommitGraph {
+    GraphLayer layers[MAX_GRAPH_LAYERS];
+    int layerCount;
+    uint32_t total;
+} CommitGraph;
+
+static uint32_t getBe32(const unsigned char* p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint64_t getBe64(const unsigned char* p) {
+    return (uint64_t)getBe32(p) << 32 | getBe32(p + 4);
+}
+
+static int loadGraphLayer(const char* path, GraphLayer* layer) {
+    TRACE_COUNT(TRACE_OPEN);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || sb.st_size < 8 + 12) {
+        close(fd);
+        return -1;
+    }
+    const unsigned char *map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    memset(layer, 0, sizeof(GraphLayer));
+    layer->map = map;
+    layer->size = sb.st_size;
+    if (memcmp(map, "CGPH", 4) != 0 || map[4] != 1 || map[5] != 1) goto invalid;
+
+    int chunks = map[6];
+    if (8 + (size_t)(chunks + 1) * 12 > layer->size) goto invalid;
+    for (int i = 0; i < chunks; i++) {
+        const unsigned char *entry = map + 8 + i * 12;
+        uint64_t offset = getBe64(entry + 4);
+        if (offset >= layer->size) goto invalid;
+        if (memcmp(entry, "OIDF", 4) == 0) layer->fanout = map + offset;
+        if (memcmp(entry, "OIDL", 4) == 0) layer->oids = map + offset;
+        if (memcmp(entry, "CDAT", 4) == 0) layer->data = map + offset;
+        if (memcmp(entry, "EDGE", 4) == 0) {
+            // the next entry's offset ends the chunk
+            uint64_t next = getBe64(entry + 12 + 4);
+            if (next < offset || next > layer->size) goto invalid;
+            layer->edges = map + offset;
+            layer->edgeCount = (next - offset) / 4;
+        }
+    }
+    if (!layer->fanout || !layer->oids || !layer->data) goto invalid;
+
+    layer->count = getBe32(layer->fanout + 255 * 4);
+    if (layer->data + (size_t)layer->count * (GIT_OID_RAWSZ + 16) > map + layer->size
+            || layer->oids + (size_t)layer->count * GIT_OID_RAWSZ > map + layer->size) {
+        goto invalid;
+    }
+    return 0;
+
+invalid:
+    munmap((void *)map, sb.st_size);
+    return -1;
+}
+
+// Identifies the commit-graph file or chain that is current, so a graph
+// loaded by a long running program is reloaded after git rewrote it.
+static void graphIdentity(const char* commonDir, struct stat* identity) {
+    char path[1024];
+    memset(identity, 0, sizeof(struct stat));
+    snprintf(path, sizeof(path), "%s/objects/info/commit-graph", commonDir);
+    if (stat(path, identity) == 0) return;
+    snprintf(path, sizeof(path), "%s/objects/info/commit-graphs/commit-graph-chain", commonDir);
+    if (stat(path, identity) != 0) memset(identity, 0, sizeof(struct stat));
+}
+
+static CommitGraph* loadCommitGraph(const char* commonDir) {
+    static CommitGraph graph;
+    static char loadedFor[1024];
+    static struct stat loadedIdentity;
+    static int loaded = 0;
+
+    struct stat identity;
+    graphIdentity(commonDir, &identity);
+    if (loaded && strcmp(loadedFor, commonDir) == 0 && identity.st_ino == loadedIdentity.st_ino
+            && identity.st_mtim.tv_sec == loadedIdentity.st_mtim.tv_sec
+            && identity.st_mtim.tv_nsec == loadedIdentity.st_mtim.tv_nsec) {
+        return graph.layerCount ? &graph : NULL;
+    }
+    loadedIdentity = identity;
+
+    for (int i = 0; i < graph.layerCount; i++) {
+        munmap((void *)graph.layers[i].map, graph.layers[i].size);
+    }
+    memset(&graph, 0, sizeof(graph));
+    snprintf(loadedFor, sizeof(loadedFor), "%s", commonDir);
+    loaded = 1;
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/objects/info/commit-graph", commonDir);
+    if (loadGraphLayer(path, &graph.layers[0]) == 0) {
+        graph.layerCount = 1;
+    } else {
+        snprintf(path, sizeof(path), "%s/objects/info/commit-graphs/commit-graph-chain", commonDir);
+        FILE *chain = fopen(path, "re");
+        if (chain == NULL) return NULL;
+
+        char line[128];
+        while (fgets(line, sizeof(line), chain) && graph.layerCount < MAX_GRAPH_LAYERS) {
+            line[strcspn(line, "\n")] = '\0';
+            snprintf(path, sizeof(path), "%s/objects/info/commit-graphs/graph-%s.graph", commonDir, line);
+            if (loadGraphLayer(path, &graph.layers[graph.layerCount]) != 0) break;
+            graph.layerCount++;
+        }
+        fclose(chain);
+    }
+
+    for (int i = 0; i < graph.layerCount; i++) {
+        graph.layers[i].base = graph.total;
+        graph.total += graph.layers[i].count;
+    }
+    return graph.layerCount ? &graph : NULL;
+}
+
+// Returns the position of a commit in the graph or -1.
+static long graphFind(const CommitGraph* graph, const GitOid* oid) {
+    for (int i = graph->layerCount - 1; i >= 0; i--) {
+        const GraphLayer *layer = &graph->layers[i];
+        uint32_t low = oid->hash[0] ? getBe32(layer->fanout + (oid->hash[0] - 1) * 4) : 0;
+        uint32_t high = getBe32(layer->fanout + oid->hash[0] * 4);
+        while (low < high) {
+            uint32_t mid = low + (high - low) / 2;
+            int cmp = memcmp(oid->hash, layer->oids + (size_t)mid * GIT_OID_RAWSZ, GIT_OID_RAWSZ);
+            if (cmp == 0) return layer->base + mid;
+            if (cmp < 0) {
+                high = mid;
+            } else {
+                low = mid + 1;
+            }
+        }
+    }
+    return -1;
+}
+
+static const unsigned char* graphData(const CommitGraph* graph, uint32_t position) {
+    for (int i = graph->layerCount - 1; i >= 0; i--) {
+        const GraphLayer *layer = &graph->layers[i];
+        if (position >= layer->base) {
+            return layer->data + (size_t)(position - layer->base) * (GIT_OID_RAWSZ + 16);
+        }
+    }
+    return NULL;
+}
+
+typedef struct Pack {
+    const unsigned char *idx;
+    size_t idxSize;
+    const unsigned char *pack;
+    size_t packSize;
+    uint32_t count;
+    const unsigned char *fanout;
+    const unsigned char *oids;
+    const unsigned char *offsets;   // 32 bit, with the high bit pointing into large offsets
+    const unsigned char *largeOffsets;
+} Pack;
+
+typedef struct PackSet {
+    Pack packs[MAX_PACKS];
+    int count;
+} PackSet;
+
+static int loadPack(const char* idxPath, Pack* pack) {
+    memset(pack, 0, sizeof(Pack));
+    TRACE_COUNT(TRACE_OPEN);
+    int fd = open(idxPath, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || sb.st_size < 8 + 256 * 4 + 2 * GIT_OID_RAWSZ) {
+        close(fd);
+        return -1;
+    }
+    pack->idxSize = sb.st_size;
+    pack->idx = mmap(NULL, pack->idxSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (pack->idx == MAP_FAILED) return -1;
+
+    // version 2: magic, version, fanout, oids, crcs, offsets, large offsets
+    const unsigned char *map = pack->idx;
+    if (memcmp(map, "\377tOc", 4) != 0 || getBe32(map + 4) != 2) goto invalid;
+    pack->fanout = map + 8;
+    pack->count = getBe32(pack->fanout + 255 * 4);
+    pack->oids = pack->fanout + 256 * 4;
+    pack->offsets = pack->oids + (size_t)pack->count * (GIT_OID_RAWSZ + 4);
+    pack->largeOffsets = pack->offsets + (size_t)pack->count * 4;
+    if (pack->largeOffsets + 2 * GIT_OID_RAWSZ > map + pack->idxSize) goto invalid;
+
+    char packPath[1024];
+    size_t len = strlen(idxPath);
+    if (len < 4 || len >= sizeof(packPath)) goto invalid;
+    memcpy(packPath, idxPath, len - 4);
+    memcpy(packPath + len - 4, ".pack", 6);
+    TRACE_COUNT(TRACE_OPEN);
+    fd = open(packPath, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) goto invalid;
+    if (fstat(fd, &sb) != 0 || sb.st_size < 12 + GIT_OID_RAWSZ) {
+        close(fd);
+        goto invalid;
+    }
+    pack->packSize = sb.st_size;
+    pack->pack = mmap(NULL, pack->packSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (pack->pack == MAP_FAILED || memcmp(pack->pack, "PACK", 4) != 0) {
+        if (pack->pack != MAP_FAILED) munmap((void *)pack->pack, pack->packSize);
+        goto invalid;
+    }
+    return 0;
+
+invalid:
+    munmap((void *)pack->idx, pack->idxSize);
+    return -1;
+}
+
+// The packs of commonDir, reloaded when objects/pack changes.
+static PackSet* loadPacks(const char* commonDir) {
+    static PackSet packs;
+    static char loadedFor[1024];
+    static struct stat loadedIdentity;
+    static int loaded = 0;
+
+    char path[1024];
+    struct stat identity;
+    snprintf(path, sizeof(path), "%s/objects/pack", commonDir);
+    if (stat(path, &identity) != 0) memset(&identity, 0, sizeof(identity));
+    if (loaded && strcmp(loadedFor, commonDir) == 0 && identity.st_ino == loadedIdentity.st_ino
+            && identity.st_mtim.tv_sec == loadedIdentity.st_mtim.tv_sec
+            && identity.st_mtim.tv_nsec == loadedIdentity.st_mtim.tv_nsec) {
+        return &packs;
+    }
+    loadedIdentity = identity;
+
+    for (int i = 0; i < packs.count; i++) {
+        munmap((void *)packs.packs[i].idx, packs.packs[i].idxSize);
+        munmap((void *)packs.packs[i].pack, packs.packs[i].packSize);
+    }
+    memset(&packs, 0, sizeof(packs));
+    snprintf(loadedFor, sizeof(loadedFor), "%s", commonDir);
+    loaded = 1;
+
+    TRACE_COUNT(TRACE_OPEN);
+    DIR *dir = opendir(path);
+    if (dir == NULL) return &packs;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL && packs.count < MAX_PACKS) {
+        size_t len = strlen(entry->d_name);
+        if (len < 4 || strcmp(entry->d_name + len - 4, ".idx") != 0) continue;
+        char idxPath[1024];
+        snprintf(idxPath, sizeof(idxPath), "%s/%s", path, entry->d_name);
+        if (loadPack(idxPath, &packs.packs[packs.count]) == 0) packs.count++;
+    }
+    closedir(dir);
+    return &packs;
+}
+
+// Returns the offset of an object in the pack or 0.
+static uint64_t packFind(const Pack* pack, const GitOid* oid) {
+    uint32_t low = oid->hash[0] ? getBe32(pack->fanout + (oid->hash[0] - 1) * 4) : 0;
+    uint32_t high = getBe32(pack->fanout + oid->hash[0] * 4);
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        int cmp = memcmp(oid->hash, pack->oids + (size_t)mid * GIT_OID_RAWSZ, GIT_OID_RAWSZ);
+        if (cmp < 0) {
+            high = mid;
+        } else if (cmp > 0) {
+            low = mid + 1;
+        } else {
+            uint32_t offset = getBe32(pack->offsets + (size_t)mid * 4);
+            if (!(offset & 0x80000000)) return offset;
+            const unsigned char *large = pack->largeOffsets + (size_t)(offset & 0x7fffffff) * 8;
+            return large + 8 <= pack->idx + pack->idxSize ? getBe64(large) : 0;
+        }
+    }
+    return 0;
+}
+
+// Inflates a zlib stream into a buffer of exactly size bytes plus a NUL.
+static unsigned char* inflateAll(const unsigned char* data, size_t avail, size_t size) {
+    unsigned char *out = malloc(size + 1);
+    if (out == NULL) return NULL;
+    TRACE_COUNT(TRACE_ALLOC);
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit(&stream) != Z_OK) {
+        free(out);
+        return NULL;
+    }
+    stream.next_in = (unsigned char *)data;
+    stream.avail_in = avail;
+    stream.next_out = out;
+    stream.avail_out = size;
+    int status = inflate(&stream, Z_FINISH);
+    inflateEnd(&stream);
+    if (status != Z_STREAM_END || stream.avail_out != 0) {
+        free(out);
+        return NULL;
+    }
+    out[size] = '\0';
+    return out;
+}
+
+static size_t deltaSize(const unsigned char** p, const unsigned char* end) {
+    size_t size = 0;
+    int shift = 0;
+    while (*p < end) {
+        unsigned char c = *(*p)++;
+        size |= (size_t)(c & 127) << shift;
+        shift += 7;
+        if (!(c & 128)) break;
+    }
+    return size;
+}
+
+// Applies a delta to its base. Returns the malloc'd result or NULL.
+static unsigned char* applyDelta(const unsigned char* base, size_t baseSize,
+                                 const unsigned char* delta, size_t size, size_t* resultSize) {
+    const unsigned char *p = delta, *end = delta + size;
+    if (deltaSize(&p, end) != baseSize) return NULL;
+    size_t outSize = deltaSize(&p, end);
+    unsigned char *out = malloc(outSize + 1);
+    if (out == NULL) return NULL;
+    TRACE_COUNT(TRACE_ALLOC);
+
+    size_t written = 0;
+    while (p < end) {
+        unsigned char op = *p++;
+        if (op & 0x80) {
+            // copy from the base: up to four offset and three size bytes
+            size_t offset = 0, length = 0;
+            for (int i = 0; i < 4; i++) {
+                if (op & (1 << i) && p < end) offset |= (size_t)*p++ << (i * 8);
+            }
+            for (int i = 0; i < 3; i++) {
+                if (op & (0x10 << i) && p < end) length |= (size_t)*p++ << (i * 8);
+            }
+            if (length == 0) length = 0x10000;
+            if (offset + length > baseSize || written + length > outSize) break;
+            memcpy(out + written, base + offset, length);
+            written += length;
+        } else if (op != 0) {
+            if ((size_t)(end - p) < op || written + op > outSize) break;
+            memcpy(out + written, p, op);
+            written += op;
+            p += op;
+        } else {
+            break;
+        }
+    }
+    if (p != end || written != outSize) {
+        free(out);
+        return NULL;
+    }
+    out[outSize] = '\0';
+    *resultSize = outSize;
+    return out;
+}
+
+static unsigned char* readPacked(const char* commonDir, const PackSet* packs, const GitOid* oid,
+                                 int* type, size_t* size, int depth);
+
+// Reads the object at offset, resolving deltas against bases in any pack.
+static unsigned char* packObject(const char* commonDir, const PackSet* packs, const Pack* pack,
+                                 uint64_t offset, int* type, size_t* size, int depth) {
+    if (depth > MAX_DELTA_DEPTH || offset < 12 || offset >= pack->packSize - GIT_OID_RAWSZ) return NULL;
+    const unsigned char *p = pack->pack + offset;
+    const unsigned char *end = pack->pack + pack->packSize - GIT_OID_RAWSZ;
+
+    // type and size: 3 bits and 4 bits, then 7 bits a byte
+    unsigned char c = *p++;
+    int objectType = (c >> 4) & 7;
+    size_t objectSize = c & 15;
+    int shift = 4;
+    while (c & 0x80 && p < end) {
+        c = *p++;
+        objectSize |= (size_t)(c & 127) << shift;
+        shift += 7;
+    }
+
+    unsigned char *base = NULL;
+    size_t baseSize = 0;
+    if (objectType == PACK_OFS_DELTA) {
+        // the base's offset back from this one, in git's varint
+        uint64_t back = 0;
+        if (p < end) {
+            c = *p++;
+            back = c & 127;
+            while (c & 128 && p < end) {
+                c = *p++;
+                back = ((back + 1) << 7) | (c & 127);
+            }
+        }
+        if (back == 0 || back > offset) return NULL;
+        base = packObject(commonDir, packs, pack, offset - back, type, &baseSize, depth + 1);
+    } else if (objectType == PACK_REF_DELTA) {
+        if (end - p < GIT_OID_RAWSZ) return NULL;
+        GitOid baseOid;
+        memcpy(baseOid.hash, p, GIT_OID_RAWSZ);
+        p += GIT_OID_RAWSZ;
+        base = readPacked(commonDir, packs, &baseOid, type, &baseSize, depth + 1);
+    } else if (objectType >= GIT_OBJ_COMMIT && objectType <= GIT_OBJ_TAG) {
+        *type = objectType;
+        *size = objectSize;
+        return inflateAll(p, end - p, objectSize);
+    } else {
+        return NULL;
+    }
+
+    if (base == NULL) return NULL;
+    unsigned char *delta = inflateAll(p, end - p, objectSize);
+    unsigned char *result = delta ? applyDelta(base, baseSize, delta, objectSize, size) : NULL;
+    free(base);
+    free(delta);
+    return result;
+}
+
+static unsigned char* readPacked(const char* commonDir, const PackSet* packs, const GitOid* oid,
+                                 int* type, size_t* size, int depth) {
+    for (int i = 0; i < packs->count; i++) {
+        uint64_t offset = packFind(&packs->packs[i], oid);
+        if (offset != 0) return packObject(commonDir, packs, &packs->packs[i], offset, type, size, depth);
+    }
+    return NULL;
+}
+
+static unsigned char* readLoose(const char* commonDir, const GitOid* oid, int* type, size_t* size) {
+    char hex[GIT_OID_HEXSZ + 1];
+    char path[1024];
+    gitOidToHex(oid, hex);
+    snprintf(path, sizeof(path), "%s/objects/%.2s/%s", commonDir, hex, hex + 2);
+
+    TRACE_COUNT(TRACE_OPEN);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return NULL;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || sb.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    const unsigned char *map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    // "<type> <size>\0" comes first and tells how much to inflate
+    static const char *types[] = { NULL, "commit", "tree", "blob", "tag" };
+    char header[64];
+    unsigned char *data = NULL;
+    long len = inflatePrefix(map, sb.st_size, header, sizeof(header));
+    char *nul = len > 0 ? memchr(header, '\0', len) : NULL;
+    for (int t = GIT_OBJ_COMMIT; nul != NULL && t <= GIT_OBJ_TAG; t++) {
+        size_t typeLen = strlen(types[t]);
+        if (strncmp(header, types[t], typeLen) != 0 || header[typeLen] != ' ') continue;
+
+        size_t headerLen = nul + 1 - header;
+        size_t objectSize = strtoull(header + typeLen + 1, NULL, 10);
+        unsigned char *whole = inflateAll(map, sb.st_size, headerLen + objectSize);
+        if (whole != NULL) {
+            data = malloc(objectSize + 1);
+            if (data != NULL) {
+                memcpy(data, whole + headerLen, objectSize + 1);
+                *type = t;
+                *size = objectSize;
+            }
+            free(whole);
+        }
+        break;
+    }
+    munmap((void *)map, sb.st_size);
+    return data;
+}
+
+// Packs first: most objects are there, and a miss costs no system call.
+static unsigned char* readObject(const char* commonDir, const PackSet* packs, const GitOid* oid,
+                                 int* type, size_t* size) {
+    unsigned char *data = readPacked(commonDir, packs, oid, type, size, 0);
+    if (data != NULL) return data;
+    return readLoose(commonDir, oid, type, size);
+}
+
+void* gitReadObject(const char* commonDir, const GitOid* oid, int* type, size_t* size) {
+    if (isSha256(commonDir)) return NULL;
+    return readObject(commonDir, loadPacks(commonDir), oid, type, size);
+}
+
+
+int gitCommitTree(const char* commonDir, const GitOid* commit, GitOid* tree) {
+    if (isSha256(commonDir)) return -1;
+
+    CommitGraph *graph = loadCommitGraph(commonDir);
+    long position = graph ? graphFind(graph, commit) : -1;
+    if (position >= 0) {
+        memcpy(tree->hash, graphData(graph, position), GIT_OID_RAWSZ);
+        return 0;
+    }
+    if (looseCommitTree(commonDir, commit, tree) == 0) return 0;
+
+    // a packed commit the commit-graph does not know yet
+    int type;
+    size_t size;
+    char *body = gitReadObject(commonDir, commit, &type, &size);
+    int found = body != NULL && type == GIT_OBJ_COMMIT && size >= 5 + GIT_OID_HEXSZ
+        && strncmp(body, "tree ", 5) == 0 && gitOidFromHex(body + 5, tree) == 0;
+    free(body);
+    return found ? 0 : -1;
+}
+
+
+#define GRAPH_NO_PARENT 0x70000000
+#define GRAPH_EXTRA_EDGES 0x80000000
+#define MAX_PARENTS 64
+
+// Commits that are not in the commit-graph, packed as after a fetch or
+// loose as after a commit, numbered after it as the walk reaches them.
+// Their parents are ids in CommitWalk.parentIds.
+typedef struct UngraphedCommit {
+    GitOid oid;
+    int64_t time;
+    int read;
+    unsigned char flags;
+    uint32_t parentCount;
+    uint32_t firstParent;
+} UngraphedCommit;
+
+typedef struct CommitWalk {
+    const char *commonDir;
+    CommitGraph *graph;
+    const PackSet *packs;
+    uint32_t total;
+    unsigned char *flags;       // of the commits in the graph
+    UngraphedCommit *ungraphed;
+    uint32_t ungraphedCount, ungraphedCapacity;
+    uint32_t *ungraphedIndex;   // open addressing, ids past the graph + 1
+    size_t ungraphedIndexSize;
+    uint32_t *parentIds;
+    size_t parentCount, parentCapacity;
+} CommitWalk;
+
+static const GraphLayer* graphLayer(const CommitGraph* graph, uint32_t position) {
+    for (int i = graph->layerCount - 1; i >= 0; i--) {
+        if (position >= graph->layers[i].base) return &graph->layers[i];
+    }
+    return NULL;
+}
+
+static uint32_t commitGeneration(const CommitWalk* walk, uint32_t id) {
+    // the topological level, the upper 30 bits next to the commit time
+    return getBe32(graphData(walk->graph, id) + GIT_OID_RAWSZ + 8) >> 2;
+}
+
+// The commit-graph holds every ancestor of the commits in it, so commits
+// outside it come before all of those in it. Among themselves they go by
+// committer time, as git does without generation numbers.
+static int commitBefore(const CommitWalk* walk, uint32_t a, uint32_t b) {
+    if (a >= walk->total || b >= walk->total) {
+        if (a < walk->total || b < walk->total) return a >= walk->total;
+        const UngraphedCommit *first = &walk->ungraphed[a - walk->total];
+        const UngraphedCommit *second = &walk->ungraphed[b - walk->total];
+        // children are numbered before their parents
+        return first->time != second->time ? first->time > second->time : a < b;
+    }
+    return commitGeneration(walk, a) > commitGeneration(walk, b);
+}
+
+static uint32_t commitParents(const CommitWalk* walk, uint32_t id, uint32_t* parents) {
+    if (id >= walk->total) {
+        const UngraphedCommit *commit = &walk->ungraphed[id - walk->total];
+        memcpy(parents, walk->parentIds + commit->firstParent, commit->parentCount * sizeof(uint32_t));
+        return commit->parentCount;
+    }
+
+    const unsigned char *data = graphData(walk->graph, id) + GIT_OID_RAWSZ;
+    uint32_t first = getBe32(data);
+    uint32_t second = getBe32(data + 4);
+    if (first == GRAPH_NO_PARENT) return 0;
+    parents[0] = first;
+    if (second == GRAPH_NO_PARENT) return 1;
+    if (!(second & GRAPH_EXTRA_EDGES)) {
+        parents[1] = second;
+        return 2;
+    }
+
+    // the remaining parents of an octopus merge are listed in EDGE, the
+    // last one marked by its high bit
+    const GraphLayer *layer = graphLayer(walk->graph, id);
+    uint32_t count = 1;
+    for (uint32_t edge = second & ~GRAPH_EXTRA_EDGES; layer->edges && edge < layer->edgeCount
+            && count < MAX_PARENTS; edge++) {
+        uint32_t parent = getBe32(layer->edges + (size_t)edge * 4);
+        parents[count++] = parent & ~GRAPH_EXTRA_EDGES;
+        if (parent & GRAPH_EXTRA_EDGES) break;
+    }
+    return count;
+}
+
+static size_t ungraphedSlot(const CommitWalk* walk, const uint32_t* index, size_t size, const GitOid* oid) {
+    size_t i = getBe32(oid->hash) & (size - 1);
+    while (index[i] != 0 && memcmp(walk->ungraphed[index[i] - 1].oid.hash, oid->hash, GIT_OID_RAWSZ) != 0) {
+        i = (i + 1) & (size - 1);
+    }
+    return i;
+}
+
+// The id of a commit in the graph or outside it, numbering commits not
+// seen before. Returns -1 if out of memory.
+static long commitId(CommitWalk* walk, const GitOid* oid) {
+    long position = walk->graph ? graphFind(walk->graph, oid) : -1;
+    if (position >= 0) return position;
+
+    if (walk->ungraphedIndexSize) {
+        uint32_t found = walk->ungraphedIndex[ungraphedSlot(walk, walk->ungraphedIndex, walk->ungraphedIndexSize, oid)];
+        if (found != 0) return walk->total + found - 1;
+    }
+
+    // the index stays at most half full
+    if (2 * ((size_t)walk->ungraphedCount + 1) > walk->ungraphedIndexSize) {
+        size_t size = walk->ungraphedIndexSize ? 2 * walk->ungraphedIndexSize : 1024;
+        uint32_t *index = calloc(size, sizeof(uint32_t));
+        if (index == NULL) return -1;
+        for (uint32_t i = 0; i < walk->ungraphedCount; i++) {
+            index[ungraphedSlot(walk, index, size, &walk->ungraphed[i].oid)] = i + 1;
+        }
+        free(walk->ungraphedIndex);
+        walk->ungraphedIndex = index;
+        walk->ungraphedIndexSize = size;
+    }
+    if (walk->ungraphedCount == walk->ungraphedCapacity) {
+        uint32_t capacity = walk->ungraphedCapacity ? walk->ungraphedCapacity * 2 : 256;
+        UngraphedCommit *grown = realloc(walk->ungraphed, capacity * sizeof(UngraphedCommit));
+        if (grown == NULL) return -1;
+        walk->ungraphed = grown;
+        walk->ungraphedCapacity = capacity;
+    }
+
+    UngraphedCommit *commit = &walk->ungraphed[walk->ungraphedCount++];
+    memset(commit, 0, sizeof(UngraphedCommit));
+    commit->oid = *oid;
+    walk->ungraphedIndex[ungraphedSlot(walk, walk->ungraphedIndex, walk->ungraphedIndexSize, oid)] = walk->ungraphedCount;
+    return walk->total + walk->ungraphedCount - 1;
+}
+
+// The committer time of a commit object, or 0.
+static int64_t commitTime(const char* body) {
+    const char *line = strstr(body, "\ncommitter ");
+    const char *end = line ? strchr(line + 1, '\n') : NULL;
+    if (end == NULL) return 0;
+    const char *email = memrchr(line, '>', end - line);
+    return email ? strtoll(email + 1, NULL, 10) : 0;
+}
+
+// Reads the time and parents of a commit outside the graph once, from a
+// pack or a loose object, numbering the parents not seen yet.
+static int readUngraphed(CommitWalk* walk, uint32_t id) {
+    if (id < walk->total || walk->ungraphed[id - walk->total].read) return 0;
+
+    char loose[GIT_OID_HEXSZ * MAX_PARENTS];
+    int type;
+    size_t size;
+    GitOid oid = walk->ungraphed[id - walk->total].oid;
+    char *packed = (char *)readPacked(walk->commonDir, walk->packs, &oid, &type, &size, 0);
+    if (packed != NULL && type != GIT_OBJ_COMMIT) {
+        free(packed);
+        return -1;
+    }
+    if (packed == NULL && readLooseCommit(walk->commonDir, &oid, loose, sizeof(loose)) < 0) return -1;
+    char *body = packed ? packed : loose;
+
+    uint32_t first = walk->parentCount;
+    uint32_t count = 0;
+    int status = 0;
+    for (char *line = strchr(body, '\n'); line != NULL && strncmp(line + 1, "parent ", 7) == 0
+            && count < MAX_PARENTS; line = strchr(line + 1, '\n')) {
+        GitOid parent;
+        long parentId = gitOidFromHex(line + 8, &parent) == 0 ? commitId(walk, &parent) : -1;
+        if (parentId < 0) {
+            status = -1;
+            break;
+        }
+        if (walk->parentCount == walk->parentCapacity) {
+            size_t capacity = walk->parentCapacity ? walk->parentCapacity * 2 : 1024;
+            uint32_t *grown = realloc(walk->parentIds, capacity * sizeof(uint32_t));
+            if (grown == NULL) {
+                status = -1;
+                break;
+            }
+            walk->parentIds = grown;
+            walk->parentCapacity = capacity;
+        }
+        walk->parentIds[walk->parentCount++] = parentId;
+        count++;
+    }
+
+    UngraphedCommit *commit = &walk->ungraphed[id - walk->total];
+    commit->time = commitTime(body);
+    commit->firstParent = first;
+    commit->parentCount = status == 0 ? count : 0;
+    commit->read = status == 0;
+    free(packed);
+    return status;
+}
+
+// Finds a commit in the commit-graph or reads it from the objects. Returns
+// its id or -1.
+static long findCommit(CommitWalk* walk, const GitOid* oid) {
+    long id = commitId(walk, oid);
+    if (id < 0 || readUngraphed(walk, id) != 0) return -1;
+    return id;
+}
+
+static void freeCommitWalk(CommitWalk* walk) {
+    free(walk->flags);
+    free(walk->ungraphed);
+    free(walk->ungraphedIndex);
+    free(walk->parentIds);
+}
+
+#define FROM_LOCAL 1
+#define FROM_UPSTREAM 2
+#define FROM_BOTH 3
+#define QUEUED 4
+#define DONE 8
+
+// The walk's flags of a commit, valid until the next commit is numbered.
+static unsigned char* commitFlags(CommitWalk* walk, uint32_t id) {
+    return id >= walk->total ? &walk->ungraphed[id - walk->total].flags : &walk->flags[id];
+}
+
+typedef struct CommitQueue {
+    uint32_t *ids;
+    size_t count;
+    size_t capacity;
+    size_t active;      // queued commits that are not reachable from both sides yet
+} CommitQueue;
+
+static void queueSwap(CommitQueue* queue, size_t a, size_t b) {
+    uint32_t id = queue->ids[a];
+    queue->ids[a] = queue->ids[b];
+    queue->ids[b] = id;
+}
+
+// A max-heap in commitBefore's order: a commit is only taken after all of
+// its descendants that are part of the walk.
+static void queuePush(CommitQueue* queue, CommitWalk* walk, uint32_t id, int from) {
+    unsigned char *flags = commitFlags(walk, id);
+    unsigned char old = *flags;
+    if ((old | from) == old || old & DONE) return;
+    *flags |= from;
+
+    if (old & QUEUED) {
+        if ((old & FROM_BOTH) != FROM_BOTH && (*flags & FROM_BOTH) == FROM_BOTH) queue->active--;
+        return;
+    }
+    if (queue->count == queue->capacity) {
+        queue->capacity = queue->capacity ? queue->capacity * 2 : 256;
+        queue->ids = realloc(queue->ids, queue->capacity * sizeof(uint32_t));
+    }
+    *flags |= QUEUED;
+    if ((*flags & FROM_BOTH) != FROM_BOTH) queue->active++;
+
+    size_t i = queue->count++;
+    queue->ids[i] = id;
+    while (i > 0 && commitBefore(walk, id, queue->ids[(i - 1) / 2])) {
+        queueSwap(queue, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static uint32_t queuePop(CommitQueue* queue, const CommitWalk* walk) {
+    uint32_t top = queue->ids[0];
+    queue->ids[0] = queue->ids[--queue->count];
+    for (size_t i = 0;;) {
+        size_t largest = i;
+        for (size_t child = 2 * i + 1; child <= 2 * i + 2 && child < queue->count; child++) {
+            if (commitBefore(walk, queue->ids[child], queue->ids[largest])) largest = child;
+        }
+        if (largest == i) break;
+        queueSwap(queue, i, largest);
+        i = largest;
+    }
+    return top;
+}
+
+int gitAheadBehind(const char* commonDir, const GitOid* local, const GitOid* upstream,
+                   unsigned int* ahead, unsigned int* behind) {
+    *ahead = 0;
+    *behind = 0;
+    if (isSha256(commonDir)) return -1;
+    if (memcmp(local->hash, upstream->hash, GIT_OID_RAWSZ) == 0) return 0;
+
+    CommitWalk walk;
+    memset(&walk, 0, sizeof(walk));
+    walk.commonDir = commonDir;
+    walk.graph = loadCommitGraph(commonDir);
+    walk.packs = loadPacks(commonDir);
+    walk.total = walk.graph ? walk.graph->total : 0;
+    walk.flags = calloc(walk.total + 1, 1);
+    long localId = walk.flags ? findCommit(&walk, local) : -1;
+    long upstreamId = localId >= 0 ? findCommit(&walk, upstream) : -1;
+    if (upstreamId < 0) {
+        freeCommitWalk(&walk);
+        return -1;
+    }
+
+    // Walk both sides newest first until everything left in the queue is
+    // reachable from both, which is where the histories meet.
+    CommitQueue queue = { NULL, 0, 0, 0 };
+    queuePush(&queue, &walk, localId, FROM_LOCAL);
+    queuePush(&queue, &walk, upstreamId, FROM_UPSTREAM);
+
+    uint32_t parents[MAX_PARENTS];
+    while (queue.active > 0) {
+        uint32_t id = queuePop(&queue, &walk);
+        unsigned char *flags = commitFlags(&walk, id);
+        int from = *flags & FROM_BOTH;
+        *flags = (*flags & ~QUEUED) | DONE;
+        if (from != FROM_BOTH) queue.active--;
+
+        if (from == FROM_LOCAL) (*ahead)++;
+        if (from == FROM_UPSTREAM) (*behind)++;
+
+        // missing parents, as in shallow clones, end the history there
+        uint32_t count = commitParents(&walk, id, parents);
+        for (uint32_t i = 0; i < count; i++) {
+            if (readUngraphed(&walk, parents[i]) == 0) queuePush(&queue, &walk, parents[i], from);
+        }
+    }
+
+    free(queue.ids);
+    freeCommitWalk(&walk);
+    return 0;
+}
+
+int gitBranchUpstream(const char* commonDir, const char* branch, char* upstream, size_t size) {
+    char remote[256];
+    char merge[1024];
+    if (gitConfigGet(commonDir, "branch", branch, "remote", remote, sizeof(remote)) <= 0
+            || gitConfigGet(commonDir, "branch", branch, "merge", merge, sizeof(merge)) <= 0) {
+        return -1;
+    }
+
+    // "." tracks another local branch
+    if (strcmp(remote, ".") == 0) {
+        snprintf(upstream, size, "%s", merge);
+    } else if (strncmp(merge, "refs/heads/", 11) == 0) {
+        snprintf(upstream, size, "refs/remotes/%s/%s", remote, merge + 11);
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+
+int gitAbbrevLength(const char* commonDir) {
+    char value[32];
+    if (gitConfigGetGlobal(commonDir, "core", NULL, "abbrev", value, sizeof(value)) > 0
+            && strcasecmp(value, "auto") != 0) {
+        if (strcasecmp(value, "no") == 0 || strcasecmp(value, "false") == 0) return GIT_OID_HEXSZ;
+        int len = atoi(value);
+        return len < 4 ? 4 : len > GIT_OID_HEXSZ ? GIT_OID_HEXSZ : len;
+    }
+
+    // git expects a collision among 2^n objects at 2^(n/2), four bits a
+    // hex digit, and never goes below 7; loose objects are not counted
+    const PackSet *packs = loadPacks(commonDir);
+    unsigned long count = 0;
+    for (int i = 0; i < packs->count; i++) count += packs->packs[i].count;
+    int bits = 0;
+    while (count >>= 1) bits++;
+    int len = (bits + 2) / 2;
+    return len < 7 ? 7 : len;
+}
+
+// The number of leading hex digits two ids share.
+static int sharedHexDigits(const unsigned char* a, const unsigned char* b) {
+    int digits = 0;
+    for (int i = 0; i < GIT_OID_RAWSZ; i++) {
+        if (a[i] != b[i]) return digits + ((a[i] ^ b[i]) < 0x10);
+        digits += 2;
+    }
+    return digits;
+}
+
+// The ids of the loose objects in objects/<xx>, each directory read the
+// first time an id starting with xx is abbreviated.
+typedef struct LooseDir {
+    GitOid *oids;
+    size_t count;
+    int loaded;
+} LooseDir;
+
+static const LooseDir* looseDir(const char* commonDir, unsigned char first) {
+    static LooseDir dirs[256];
+    static char loadedFor[1024];
+
+    if (strcmp(loadedFor, commonDir) != 0) {
+        for (int i = 0; i < 256; i++) free(dirs[i].oids);
+        memset(dirs, 0, sizeof(dirs));
+        snprintf(loadedFor, sizeof(loadedFor), "%s", commonDir);
+    }
+    LooseDir *loose = &dirs[first];
+    if (loose->loaded) return loose;
+    loose->loaded = 1;
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/objects/%02x", commonDir, first);
+    TRACE_COUNT(TRACE_OPEN);
+    DIR *dir = opendir(path);
+    if (dir == NULL) return loose;
+    size_t capacity = 0;
+    struct dirent *entry;
+    char hex[GIT_OID_HEXSZ + 1];
+    while ((entry = readdir(dir)) != NULL) {
+        if (strlen(entry->d_name) != GIT_OID_HEXSZ - 2) continue;
+        snprintf(hex, sizeof(hex), "%02x%s", first, entry->d_name);
+        GitOid oid;
+        if (gitOidFromHex(hex, &oid) != 0) continue;
+        if (loose->count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            GitOid *grown = realloc(loose->oids, capacity * sizeof(GitOid));
+            if (grown == NULL) break;
+            loose->oids = grown;
+        }
+        loose->oids[loose->count++] = oid;
+    }
+    closedir(dir);
+    return loose;
+}
+
+int gitUniqueAbbrev(const char* commonDir, const GitOid* oid, int len) {
+    int shared = 0;
+
+    // in a pack only the ids sorted next to it can share more digits
+    const PackSet *packs = loadPacks(commonDir);
+    for (int i = 0; i < packs->count; i++) {
+        const Pack *pack = &packs->packs[i];
+        uint32_t low = oid->hash[0] ? getBe32(pack->fanout + (oid->hash[0] - 1) * 4) : 0;
+        uint32_t high = getBe32(pack->fanout + oid->hash[0] * 4);
+        while (low < high) {
+            uint32_t mid = low + (high - low) / 2;
+            if (memcmp(pack->oids + (size_t)mid * GIT_OID_RAWSZ, oid->hash, GIT_OID_RAWSZ) < 0) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        uint32_t next = low;
+        if (next < pack->count && memcmp(pack->oids + (size_t)next * GIT_OID_RAWSZ, oid->hash, GIT_OID_RAWSZ) == 0) {
+            next++;
+        }
+        if (low > 0) {
+            int digits = sharedHexDigits(oid->hash, pack->oids + (size_t)(low - 1) * GIT_OID_RAWSZ);
+            if (digits > shared) shared = digits;
+        }
+        if (next < pack->count) {
+            int digits = sharedHexDigits(oid->hash, pack->oids + (size_t)next * GIT_OID_RAWSZ);
+            if (digits > shared) shared = digits;
+        }
+    }
+
+    const LooseDir *loose = looseDir(commonDir, oid->hash[0]);
+    for (size_t i = 0; i < loose->count; i++) {
+        int digits = sharedHexDigits(oid->hash, loose->oids[i].hash);
+        if (digits < GIT_OID_HEXSZ && digits > shared) shared = digits;
+    }
+
+    if (shared + 1 > len) len = shared + 1;
+    return len > GIT_OID_HEXSZ ? GIT_OID_HEXSZ : len;
+}
+
+
+// A commit queued by the log walk. Those in the commit-graph are only read
+// when they are taken, the others had to be read to learn their time.
+typedef struct LogEntry {
+    GitOid oid;
+    int64_t time;
+    uint64_t order;     // commits of the same time come out first in, first out
+    long position;      // in the commit-graph or -1
+    char *body;
+    size_t size;
+} LogEntry;
+
+struct GitLog {
+    char commonDir[1024];
+    CommitGraph *graph;
+    const PackSet *packs;
+    unsigned char *seen;    // a bit for every commit in the graph
+    GitOid *seenLoose;      // an open addressing set of the commits outside it
+    size_t seenLooseCount, seenLooseCapacity;
+    LogEntry *queue;
+    size_t count, capacity;
+    uint64_t order;
+};
+
+static int logBefore(const LogEntry* a, const LogEntry* b) {
+    return a->time != b->time ? a->time > b->time : a->order < b->order;
+}
+
+// Marks a commit outside the graph as seen. Returns 0 if it already was.
+static int markLoose(GitLog* log, const GitOid* oid) {
+    if (2 * (log->seenLooseCount + 1) > log->seenLooseCapacity) {
+        size_t capacity = log->seenLooseCapacity ? 2 * log->seenLooseCapacity : 1024;
+        GitOid *set = calloc(capacity, sizeof(GitOid));
+        if (set == NULL) return 0;
+        for (size_t i = 0; i < log->seenLooseCapacity; i++) {
+            if (gitOidIsNull(&log->seenLoose[i])) continue;
+            size_t slot = getBe32(log->seenLoose[i].hash) & (capacity - 1);
+            while (!gitOidIsNull(&set[slot])) slot = (slot + 1) & (capacity - 1);
+            set[slot] = log->seenLoose[i];
+        }
+        free(log->seenLoose);
+        log->seenLoose = set;
+        log->seenLooseCapacity = capacity;
+    }
+    size_t slot = getBe32(oid->hash) & (log->seenLooseCapacity - 1);
+    while (!gitOidIsNull(&log->seenLoose[slot])) {
+        if (memcmp(log->seenLoose[slot].hash, oid->hash, GIT_OID_RAWSZ) == 0) return 0;
+        slot = (slot + 1) & (log->seenLooseCapacity - 1);
+    }
+    log->seenLoose[slot] = *oid;
+    log->seenLooseCount++;
+    return 1;
+}
+
+static void logPush(GitLog* log, const GitOid* oid, long position) {
+    if (position < 0 && log->graph) position = graphFind(log->graph, oid);
+    if (position >= 0) {
+        if (log->seen[position / 8] & (1 << (position % 8))) return;
+        log->seen[position / 8] |= 1 << (position % 8);
+    } else if (!markLoose(log, oid)) {
+        return;
+    }
+
+    LogEntry entry = { *oid, 0, log->order++, position, NULL, 0 };
+    if (position >= 0) {
+        // 34 bits of commit time after the parents, below the generation
+        const unsigned char *data = graphData(log->graph, position) + GIT_OID_RAWSZ + 8;
+        entry.time = (int64_t)(getBe32(data) & 3) << 32 | getBe32(data + 4);
+    } else {
+        // missing parents, as in shallow clones, end the history there
+        int type;
+        entry.body = (char *)readObject(log->commonDir, log->packs, oid, &type, &entry.size);
+        if (entry.body == NULL) return;
+        if (type != GIT_OBJ_COMMIT) {
+            free(entry.body);
+            return;
+        }
+        entry.time = commitTime(entry.body);
+    }
+
+    if (log->count == log->capacity) {
+        size_t capacity = log->capacity ? log->capacity * 2 : 256;
+        LogEntry *queue = realloc(log->queue, capacity * sizeof(LogEntry));
+        if (queue == NULL) {
+            free(entry.body);
+            return;
+        }
+        log->queue = queue;
+        log->capacity = capacity;
+    }
+    size_t i = log->count++;
+    while (i > 0 && logBefore(&entry, &log->queue[(i - 1) / 2])) {
+        log->queue[i] = log->queue[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    log->queue[i] = entry;
+}
+
+static LogEntry logPop(GitLog* log) {
+    LogEntry top = log->queue[0];
+    LogEntry last = log->queue[--log->count];
+    size_t i = 0;
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= log->count) break;
+        if (child + 1 < log->count && logBefore(&log->queue[child + 1], &log->queue[child])) child++;
+        if (!logBefore(&log->queue[child], &last)) break;
+        log->queue[i] = log->queue[child];
+        i = child;
+    }
+    if (log->count > 0) log->queue[i] = last;
+    return top;
+}
+
+GitLog* gitLogStart(const char* commonDir, const GitOid* tip) {
+    if (isSha256(commonDir)) return NULL;
+    GitLog *log = calloc(1, sizeof(GitLog));
+    if (log == NULL) return NULL;
+    snprintf(log->commonDir, sizeof(log->commonDir), "%s", commonDir);
+    log->graph = loadCommitGraph(commonDir);
+    log->packs = loadPacks(commonDir);
+    if (log->graph) log->seen = calloc(log->graph->total / 8 + 1, 1);
+    if (log->graph && log->seen == NULL) log->graph = NULL;
+
+    logPush(log, tip, -1);
+    if (log->count == 0) {
+        gitLogFree(log);
+        return NULL;
+    }
+    return log;
+}
+
+char* gitLogNext(GitLog* log, GitOid* oid, size_t* size) {
+    while (log->count > 0) {
+        LogEntry entry = logPop(log);
+        if (entry.body == NULL) {
+            int type;
+            entry.body = (char *)readObject(log->commonDir, log->packs, &entry.oid, &type, &entry.size);
+            if (entry.body != NULL && type != GIT_OBJ_COMMIT) {
+                free(entry.body);
+                entry.body = NULL;
+            }
+        }
+
+        if (entry.position >= 0) {
+            // the graph's parents, in the order the commit lists them
+            CommitWalk walk;
+            memset(&walk, 0, sizeof(walk));
+            walk.graph = log->graph;
+            walk.total = log->graph->total;
+            uint32_t parents[MAX_PARENTS];
+            uint32_t count = commitParents(&walk, entry.position, parents);
+            for (uint32_t i = 0; i < count; i++) {
+                if (parents[i] >= log->graph->total) continue;
+                GitOid parent;
+                const GraphLayer *layer = graphLayer(log->graph, parents[i]);
+                memcpy(parent.hash, layer->oids + (size_t)(parents[i] - layer->base) * GIT_OID_RAWSZ,
+                       GIT_OID_RAWSZ);
+                logPush(log, &parent, parents[i]);
+            }
+        } else if (entry.body != NULL) {
+            for (char *line = strchr(entry.body, '\n'); line != NULL && strncmp(line + 1, "parent ", 7) == 0;
+                    line = strchr(line + 1, '\n')) {
+                GitOid parent;
+                if (gitOidFromHex(line + 8, &parent) == 0) logPush(log, &parent, -1);
+            }
+        }
+
+        // an unreadable commit is left out but its history is not
+        if (entry.body == NULL) continue;
+        *oid = entry.oid;
+        *size = entry.size;
+        return entry.body;
+    }
+    return NULL;
+}
+
+void gitLogFree(GitLog* log) {
+    for (size_t i = 0; i < log->count; i++) free(log->queue[i].body);
+    free(log->queue);
+    free(log->seen);
+    free(log->seenLoose);
+    free(log);
+}
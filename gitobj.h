@@ -0,0 +1,103 @@
+#ifndef GITOBJ_H
+#define GITOBJ_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Only SHA-1 repositories are understood; objectformat = sha256 makes the
+// readers below report failure.
+#define GIT_OID_RAWSZ 20
+#define GIT_OID_HEXSZ 40
+
+typedef struct GitOid {
+    unsigned char hash[GIT_OID_RAWSZ];
+} GitOid;
+
+typedef struct GitSha1 {
+    uint32_t state[5];
+    uint64_t length;
+    unsigned char buffer[64];
+} GitSha1;
+
+void gitSha1Init(GitSha1* ctx);
+void gitSha1Update(GitSha1* ctx, const void* data, size_t len);
+void gitSha1Final(GitSha1* ctx, unsigned char* out);
+
+int gitOidFromHex(const char* hex, GitOid* oid);
+void gitOidToHex(const GitOid* oid, char* hex);
+int gitOidIsNull(const GitOid* oid);
+
+// Hashes len bytes as a blob the way `git hash-object` does.
+void gitHashBlob(const void* data, size_t len, GitOid* oid);
+
+// Reads a value from <commonDir>/config, e.g. ("core", NULL, "filemode") or
+// ("branch", "main", "merge"). Sections and keys are matched without case,
+// subsections exactly. Includes are not followed. Returns the length or -1.
+int gitConfigGet(const char* commonDir, const char* section, const char* subsection,
+                 const char* key, char* value, size_t size);
+
+// Like gitConfigGet, but keys the repository does not set are looked up in
+// the user's ~/.gitconfig and then $XDG_CONFIG_HOME/git/config.
+int gitConfigGetGlobal(const char* commonDir, const char* section, const char* subsection,
+                       const char* key, char* value, size_t size);
+
+// Returns the boolean value of a config key or fallback if it is not set.
+int gitConfigBool(const char* commonDir, const char* section, const char* key, int fallback);
+
+// Resolves a ref such as "HEAD" or "refs/heads/main" through symbolic refs,
+// loose refs in gitDir and commonDir and packed-refs. If target is not NULL
+// it receives the last symbolic ref that was followed. Returns 0 if the ref
+// points to a commit, -1 otherwise (including unborn branches).
+int gitResolveRef(const char* gitDir, const char* commonDir, const char* ref,
+                  GitOid* oid, char* target, size_t targetSize);
+
+#define GIT_OBJ_COMMIT 1
+#define GIT_OBJ_TREE   2
+#define GIT_OBJ_BLOB   3
+#define GIT_OBJ_TAG    4
+
+// Reads an object from a pack, resolving deltas, or from its loose file.
+// Alternates are not followed. Returns the malloc'd content, NUL-terminated
+// past *size, and its GIT_OBJ_* type, or NULL.
+void* gitReadObject(const char* commonDir, const GitOid* oid, int* type, size_t* size);
+
+// Reads the tree of a commit from the commit-graph or, failing that, from
+// the object itself. Returns 0 on success.
+int gitCommitTree(const char* commonDir, const GitOid* commit, GitOid* tree);
+
+// Finds the remote-tracking ref a local branch pulls from, using
+// branch.<branch>.remote and .merge and assuming the default fetch refspec,
+// e.g. "refs/remotes/origin/main". Returns 0 on success.
+int gitBranchUpstream(const char* commonDir, const char* branch, char* upstream, size_t size);
+
+// Counts the commits only reachable from local (ahead) and only reachable
+// from upstream (behind). Commits are read from the commit-graph, ordered
+// by generation so the walk stops where the histories meet; the ones
+// written since the graph was must be loose objects. Returns 0 on success.
+int gitAheadBehind(const char* commonDir, const GitOid* local, const GitOid* upstream,
+                   unsigned int* ahead, unsigned int* behind);
+
+// The length `git log --abbrev-commit` shortens ids to: core.abbrev, or by
+// default one that grows with the number of packed objects.
+int gitAbbrevLength(const char* commonDir);
+
+// Lengthens an abbreviation of len hex digits until no other object in the
+// packs or loose in objects/ starts with it, as git does before printing
+// one. Alternates are not looked at.
+int gitUniqueAbbrev(const char* commonDir, const GitOid* oid, int len);
+
+typedef struct GitLog GitLog;
+
+// Walks the history of tip newest first, in the order of a plain `git log`:
+// by commit time, each commit's parents queued once it is taken. Times and
+// parents come from the commit-graph where it has them, so a commit there
+// is only read when its turn comes. Returns NULL if tip cannot be read.
+GitLog* gitLogStart(const char* commonDir, const GitOid* tip);
+
+// Returns the next commit object, malloc'd and NUL-terminated past *size,
+// and its id, or NULL once the history is exhausted.
+char* gitLogNext(GitLog* log, GitOid* oid, size_t* size);
+
+void gitLogFree(GitLog* log);
+
+#endif
@@ -0,0 +1,688 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "gitrepo.h"
+#include "trace.h"
+
+#define INITIAL_CACHE_SIZE 1024
+
+#define DISK_CACHE_MAGIC "ZFOREPO1"
+#define DISK_CACHE_MAX_RECORDS 65536
+#define HEAD_MAX 256
+
+
+// The on-disk cache is a header followed by records sorted by (dev, ino)
+// and a table of NUL-terminated strings the records point into. Offset 0
+// is always the empty string.
+typedef struct DiskCacheHeader {
+    char magic[8];
+    uint32_t count;
+    uint32_t stringsSize;
+} DiskCacheHeader;
+
+typedef struct DiskCacheRecord {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t dirMtime;   // the directory itself, changes when .git appears
+    int64_t gitMtime;   // the .git file of GIT_REPO_FILE
+    int64_t headMtime;  // 0 if head is not cached
+    uint32_t kind;
+    uint32_t gitDir;
+    uint32_t commonDir;
+    uint32_t head;
+} DiskCacheRecord;
+
+typedef struct PendingRecord {
+    DiskCacheRecord record;
+    char *gitDir;
+    char *commonDir;
+    char *head;
+} PendingRecord;
+
+static int diskLoaded = 0;
+static const DiskCacheHeader *diskHeader = NULL;
+static const DiskCacheRecord *diskRecords = NULL;
+static const char *diskStrings = NULL;
+static size_t diskSize = 0;
+static char diskPath[GIT_PATH_MAX];
+
+static PendingRecord *pending = NULL;
+static size_t pendingCount = 0;
+static size_t pendingCapacity = 0;
+static size_t *pendingIndex = NULL;     // positions in pending + 1, by (dev, ino)
+static size_t pendingIndexSize = 0;
+
+static struct {
+    unsigned long dirHits, dirStale, dirMisses;
+    unsigned long headHits, headStale, headMisses;
+} diskStats;
+
+
+typedef struct RepoCacheEntry {
+    dev_t dev;
+    ino_t ino;
+    int kind; // 0 marks an empty slot, otherwise GIT_REPO_* + 1
+    char *gitDir;
+    char *commonDir;
+} RepoCacheEntry;
+
+static RepoCacheEntry *repoCache = NULL;
+static size_t repoCacheSize = 0;
+static size_t repoCacheUsed = 0;
+
+static int envLoaded = 0;
+static dev_t envDev;
+static ino_t envIno;
+static GitRepo envRepo;
+
+
+static size_t repoCacheSlot(RepoCacheEntry *table, size_t size, dev_t dev, ino_t ino) {
+    size_t i = ((size_t)ino * 0x9E3779B97F4A7C15ULL ^ (size_t)dev) & (size - 1);
+    while (table[i].kind != 0 && (table[i].dev != dev || table[i].ino != ino)) {
+        i = (i + 1) & (size - 1);
+    }
+    return i;
+}
+
+static RepoCacheEntry* repoCacheLookup(dev_t dev, ino_t ino) {
+    if (repoCache == NULL) return NULL;
+    RepoCacheEntry *entry = &repoCache[repoCacheSlot(repoCache, repoCacheSize, dev, ino)];
+    return entry->kind ? entry : NULL;
+}
+
+static void repoCacheInsert(dev_t dev, ino_t ino, const GitRepo* repo) {
+    if (repoCacheUsed * 2 >= repoCacheSize) {
+        size_t newSize = repoCacheSize ? repoCacheSize * 2 : INITIAL_CACHE_SIZE;
+        RepoCacheEntry *table = calloc(newSize, sizeof(RepoCacheEntry));
+        if (table == NULL) return;
+        for (size_t i = 0; i < repoCacheSize; i++) {
+            if (repoCache[i].kind) {
+                table[repoCacheSlot(table, newSize, repoCache[i].dev, repoCache[i].ino)] = repoCache[i];
+            }
+        }
+        free(repoCache);
+        repoCache = table;
+        repoCacheSize = newSize;
+    }
+
+    RepoCacheEntry *entry = &repoCache[repoCacheSlot(repoCache, repoCacheSize, dev, ino)];
+    entry->dev = dev;
+    entry->ino = ino;
+    entry->kind = repo->kind + 1;
+    if (repo->kind != GIT_REPO_NONE) {
+        entry->gitDir = strdup(repo->gitDir);
+        entry->commonDir = strdup(repo->commonDir);
+    }
+    repoCacheUsed++;
+}
+
+
+// Reads a small file relative to dirfd into buf, stripping the trailing
+// newline. Returns the length or -1.
+static int readSmallFile(int dirfd, const char* path, char* buf, size_t size) {
+    TRACE_COUNT(TRACE_OPEN);
+    int fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+    ssize_t n = read(fd, buf, size - 1);
+    close(fd);
+    if (n < 0) return -1;
+    while (n > 0 && (buf[n-1] == '\n' || buf[n-1] == '\r')) n--;
+    buf[n] = '\0';
+    return n;
+}
+
+// Joins dir and path unless path is absolute.
+static void joinPath(char* out, const char* dir, const char* path) {
+    if (path[0] == '/' || dir[0] == '\0') {
+        snprintf(out, GIT_PATH_MAX, "%s", path);
+    } else {
+        snprintf(out, GIT_PATH_MAX, "%s/%s", dir, path);
+    }
+}
+
+// Fills in commonDir from <gitDir>/commondir, used by linked worktrees.
+static void resolveCommonDir(int dirfd, GitRepo* repo) {
+    char path[GIT_PATH_MAX];
+    char commondir[GIT_PATH_MAX];
+    joinPath(path, repo->gitDir, "commondir");
+    if (readSmallFile(dirfd, path, commondir, sizeof(commondir)) > 0) {
+        joinPath(repo->commonDir, repo->gitDir, commondir);
+    } else {
+        memcpy(repo->commonDir, repo->gitDir, GIT_PATH_MAX);
+    }
+}
+
+static void loadGitDirEnv(void) {
+    envLoaded = 1;
+    envRepo.kind = GIT_REPO_NONE;
+
+    char *gitDir = getenv("GIT_DIR");
+    if (gitDir == NULL || gitDir[0] == '\0') return;
+
+    char *workTree = getenv("GIT_WORK_TREE");
+    struct stat sb;
+    if (stat(workTree ? workTree : ".", &sb) != 0) return;
+
+    // relative GIT_DIR is relative to the current directory, not to the
+    // directories we are going to probe
+    char cwd[GIT_PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) return;
+    joinPath(envRepo.gitDir, cwd, gitDir);
+
+    char *commonDir = getenv("GIT_COMMON_DIR");
+    if (commonDir != NULL) {
+        joinPath(envRepo.commonDir, cwd, commonDir);
+    } else {
+        resolveCommonDir(AT_FDCWD, &envRepo);
+    }
+
+    envRepo.kind = GIT_REPO_ENV;
+    envDev = sb.st_dev;
+    envIno = sb.st_ino;
+}
+
+static int endsWithGit(const char* name) {
+    size_t len = strlen(name);
+    const char *base = strrchr(name, '/');
+    base = base ? base + 1 : name;
+    return len > 4 && strcmp(name + len - 4, ".git") == 0 && strcmp(base, ".git") != 0;
+}
+
+static int64_t mtimeNs(const struct stat* sb) {
+    return (int64_t)sb->st_mtim.tv_sec * 1000000000 + sb->st_mtim.tv_nsec;
+}
+
+
+static void loadDiskCache(void) {
+    diskLoaded = 1;
+
+    char *path = getenv("FILE_OPENER_REPO_CACHE");
+    if (path != NULL) {
+        snprintf(diskPath, sizeof(diskPath), "%s", path);
+    } else {
+        char *cacheHome = getenv("XDG_CACHE_HOME");
+        char *home = getenv("HOME");
+        if (cacheHome != NULL && cacheHome[0] != '\0') {
+            snprintf(diskPath, sizeof(diskPath), "%s/zsh-file-opener/repos", cacheHome);
+        } else if (home != NULL) {
+            snprintf(diskPath, sizeof(diskPath), "%s/.cache/zsh-file-opener/repos", home);
+        }
+    }
+    if (diskPath[0] == '\0') return;
+
+    TRACE_COUNT(TRACE_OPEN);
+    int fd = open(diskPath, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return;
+
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || (size_t)sb.st_size < sizeof(DiskCacheHeader)) {
+        close(fd);
+        return;
+    }
+
+    void *map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return;
+
+    const DiskCacheHeader *header = map;
+    size_t expected = sizeof(DiskCacheHeader) + (size_t)header->count * sizeof(DiskCacheRecord) + header->stringsSize;
+    if (memcmp(header->magic, DISK_CACHE_MAGIC, sizeof(header->magic)) != 0
+            || header->count > DISK_CACHE_MAX_RECORDS || expected != (size_t)sb.st_size
+            || header->stringsSize == 0 || ((const char *)map)[sb.st_size - 1] != '\0') {
+        munmap(map, sb.st_size);
+        return;
+    }
+
+    diskHeader = header;
+    diskRecords = (const DiskCacheRecord *)(header + 1);
+    diskStrings = (const char *)(diskRecords + header->count);
+    diskSize = sb.st_size;
+}
+
+static int compareKeys(uint64_t devA, uint64_t inoA, uint64_t devB, uint64_t inoB) {
+    if (devA != devB) return devA < devB ? -1 : 1;
+    if (inoA != inoB) return inoA < inoB ? -1 : 1;
+    return 0;
+}
+
+static const DiskCacheRecord* diskLookup(dev_t dev, ino_t ino) {
+    if (!diskLoaded) loadDiskCache();
+    if (diskHeader == NULL) return NULL;
+
+    size_t low = 0, high = diskHeader->count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        int cmp = compareKeys(dev, ino, diskRecords[mid].dev, diskRecords[mid].ino);
+        if (cmp == 0) return &diskRecords[mid];
+        if (cmp < 0) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+    return NULL;
+}
+
+static const char* diskString(uint32_t offset) {
+    return offset < diskHeader->stringsSize ? diskStrings + offset : "";
+}
+
+static size_t pendingSlot(const size_t* table, size_t size, dev_t dev, ino_t ino) {
+    size_t i = ((size_t)ino * 0x9E3779B97F4A7C15ULL ^ (size_t)dev) & (size - 1);
+    while (table[i] != 0 && (pending[table[i] - 1].record.dev != dev || pending[table[i] - 1].record.ino != ino)) {
+        i = (i + 1) & (size - 1);
+    }
+    return i;
+}
+
+// Indexes every pending record again, into a table of at least size slots.
+static void reindexPending(size_t size) {
+    if (size > pendingIndexSize) {
+        size_t *table = realloc(pendingIndex, size * sizeof(size_t));
+        if (table == NULL) return;
+        pendingIndex = table;
+        pendingIndexSize = size;
+    }
+    if (pendingIndex == NULL) return;
+    memset(pendingIndex, 0, pendingIndexSize * sizeof(size_t));
+    for (size_t i = 0; i < pendingCount; i++) {
+        pendingIndex[pendingSlot(pendingIndex, pendingIndexSize, pending[i].record.dev, pending[i].record.ino)] = i + 1;
+    }
+}
+
+static PendingRecord* pendingLookup(dev_t dev, ino_t ino) {
+    if (pendingIndex == NULL) return NULL;
+    size_t slot = pendingIndex[pendingSlot(pendingIndex, pendingIndexSize, dev, ino)];
+    return slot ? &pending[slot - 1] : NULL;
+}
+
+static PendingRecord* pendingFor(dev_t dev, ino_t ino) {
+    PendingRecord *found = pendingLookup(dev, ino);
+    if (found != NULL) return found;
+
+    // the index stays at most half full
+    if ((pendingCount + 1) * 2 > pendingIndexSize) {
+        reindexPending(pendingIndexSize ? pendingIndexSize * 2 : INITIAL_CACHE_SIZE);
+        if ((pendingCount + 1) * 2 > pendingIndexSize) return NULL;
+    }
+
+    if (pendingCount == pendingCapacity) {
+        size_t capacity = pendingCapacity ? pendingCapacity * 2 : 64;
+        PendingRecord *grown = realloc(pending, capacity * sizeof(PendingRecord));
+        if (grown == NULL) return NULL;
+        pending = grown;
+        pendingCapacity = capacity;
+    }
+
+    PendingRecord *record = &pending[pendingCount++];
+    memset(record, 0, sizeof(PendingRecord));
+    record->record.dev = dev;
+    record->record.ino = ino;
+    pendingIndex[pendingSlot(pendingIndex, pendingIndexSize, dev, ino)] = pendingCount;
+    return record;
+}
+
+static void replaceString(char** field, const char* value) {
+    free(*field);
+    *field = value ? strdup(value) : NULL;
+}
+
+
+static int probeRepo(int fd, const char* name, GitRepo* repo, int64_t* gitMtime) {
+    struct stat sb;
+    repo->kind = GIT_REPO_NONE;
+    *gitMtime = 0;
+
+    TRACE_COUNT(TRACE_STAT);
+    if (fstatat(fd, ".git", &sb, 0) == 0) {
+        if (S_ISDIR(sb.st_mode)) {
+            strcpy(repo->gitDir, ".git");
+            strcpy(repo->commonDir, ".git");
+            repo->kind = GIT_REPO_DIR;
+        } else if (S_ISREG(sb.st_mode)) {
+            char gitfile[GIT_PATH_MAX];
+            if (readSmallFile(fd, ".git", gitfile, sizeof(gitfile)) > 8
+                    && strncmp(gitfile, "gitdir: ", 8) == 0) {
+                joinPath(repo->gitDir, "", gitfile + 8);
+                resolveCommonDir(fd, repo);
+                repo->kind = GIT_REPO_FILE;
+                *gitMtime = mtimeNs(&sb);
+            }
+        }
+        return repo->kind;
+    }
+
+    // only directories named like a bare repository pay for the extra checks
+    if (errno == ENOENT && endsWithGit(name)
+            && fstatat(fd, "HEAD", &sb, 0) == 0 && S_ISREG(sb.st_mode)
+            && fstatat(fd, "objects", &sb, 0) == 0 && S_ISDIR(sb.st_mode)) {
+        strcpy(repo->gitDir, ".");
+        strcpy(repo->commonDir, ".");
+        repo->kind = GIT_REPO_BARE;
+    }
+    return repo->kind;
+}
+
+
+// Looks the directory up in the on-disk cache. A record is still valid if
+// the directory's mtime, and for gitdir files the .git file's mtime, are
+// unchanged.
+static int diskProbe(int fd, const struct stat* sb, GitRepo* repo) {
+    const DiskCacheRecord *record = diskLookup(sb->st_dev, sb->st_ino);
+    if (record == NULL) {
+        diskStats.dirMisses++;
+        return 0;
+    }
+
+    struct stat gitSb;
+    if (record->kind == GIT_REPO_FILE) TRACE_COUNT(TRACE_STAT);
+    if (record->dirMtime != mtimeNs(sb) || (record->kind == GIT_REPO_FILE
+            && (fstatat(fd, ".git", &gitSb, 0) != 0 || record->gitMtime != mtimeNs(&gitSb)))) {
+        diskStats.dirStale++;
+        return 0;
+    }
+
+    repo->kind = record->kind;
+    snprintf(repo->gitDir, GIT_PATH_MAX, "%s", diskString(record->gitDir));
+    snprintf(repo->commonDir, GIT_PATH_MAX, "%s", diskString(record->commonDir));
+    diskStats.dirHits++;
+    return 1;
+}
+
+
+int gitProbeAt(int dirfd, const char* name, int* fdOut, GitRepo* repo) {
+    if (!envLoaded) loadGitDirEnv();
+
+    TRACE_COUNT(TRACE_OPEN);
+    int fd = openat(dirfd, name[0] ? name : "/", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) return -1;
+
+    struct stat sb;
+    int kind = GIT_REPO_NONE;
+    TRACE_COUNT(TRACE_STAT);
+    if (fstat(fd, &sb) != 0) {
+        close(fd);
+        return -1;
+    }
+    repo->dev = sb.st_dev;
+    repo->ino = sb.st_ino;
+
+    RepoCacheEntry *cached = repoCacheLookup(sb.st_dev, sb.st_ino);
+    if (cached != NULL) {
+        kind = cached->kind - 1;
+        repo->kind = kind;
+        if (kind != GIT_REPO_NONE) {
+            snprintf(repo->gitDir, GIT_PATH_MAX, "%s", cached->gitDir);
+            snprintf(repo->commonDir, GIT_PATH_MAX, "%s", cached->commonDir);
+        }
+    } else if (envRepo.kind == GIT_REPO_ENV && sb.st_dev == envDev && sb.st_ino == envIno) {
+        *repo = envRepo;
+        repo->dev = sb.st_dev;
+        repo->ino = sb.st_ino;
+        kind = GIT_REPO_ENV;
+        repoCacheInsert(sb.st_dev, sb.st_ino, repo);
+    } else if (diskProbe(fd, &sb, repo)) {
+        kind = repo->kind;
+        repoCacheInsert(sb.st_dev, sb.st_ino, repo);
+    } else {
+        int64_t gitMtime;
+        kind = probeRepo(fd, name, repo, &gitMtime);
+        repoCacheInsert(sb.st_dev, sb.st_ino, repo);
+
+        PendingRecord *record = pendingFor(sb.st_dev, sb.st_ino);
+        if (record != NULL) {
+            record->record.kind = kind;
+            record->record.dirMtime = mtimeNs(&sb);
+            record->record.gitMtime = gitMtime;
+            record->record.headMtime = 0;
+            replaceString(&record->gitDir, kind ? repo->gitDir : NULL);
+            replaceString(&record->commonDir, kind ? repo->commonDir : NULL);
+            replaceString(&record->head, NULL);
+        }
+    }
+
+    if (fdOut != NULL) {
+        *fdOut = fd;
+    } else {
+        close(fd);
+    }
+    return kind;
+}
+
+
+int gitIsRepoAt(int dirfd, const char* path) {
+    if (!envLoaded) loadGitDirEnv();
+
+    char file[GIT_PATH_MAX];
+    struct stat sb;
+    if (envRepo.kind == GIT_REPO_ENV) {
+        TRACE_COUNT(TRACE_STAT);
+        if (fstatat(dirfd, path, &sb, 0) == 0 && sb.st_dev == envDev && sb.st_ino == envIno) {
+            return GIT_REPO_ENV;
+        }
+    }
+
+    joinPath(file, path, ".git");
+    TRACE_COUNT(TRACE_STAT);
+    if (fstatat(dirfd, file, &sb, 0) == 0) {
+        if (S_ISDIR(sb.st_mode)) return GIT_REPO_DIR;
+        char gitfile[GIT_PATH_MAX];
+        return S_ISREG(sb.st_mode) && readSmallFile(dirfd, file, gitfile, sizeof(gitfile)) > 8
+            && strncmp(gitfile, "gitdir: ", 8) == 0 ? GIT_REPO_FILE : GIT_REPO_NONE;
+    }
+    if (errno != ENOENT || !endsWithGit(path)) return GIT_REPO_NONE;
+
+    joinPath(file, path, "HEAD");
+    TRACE_COUNT(TRACE_STAT);
+    if (fstatat(dirfd, file, &sb, 0) != 0 || !S_ISREG(sb.st_mode)) return GIT_REPO_NONE;
+    joinPath(file, path, "objects");
+    TRACE_COUNT(TRACE_STAT);
+    if (fstatat(dirfd, file, &sb, 0) != 0 || !S_ISDIR(sb.st_mode)) return GIT_REPO_NONE;
+    return GIT_REPO_BARE;
+}
+
+
+int gitOpenAt(int dirfd, const GitRepo* repo, const char* file, int flags) {
+    char path[GIT_PATH_MAX];
+    joinPath(path, repo->gitDir, file);
+    TRACE_COUNT(TRACE_OPEN);
+    return openat(dirfd, path, flags | O_CLOEXEC);
+}
+
+int gitOpenCommonAt(int dirfd, const GitRepo* repo, const char* file, int flags) {
+    char path[GIT_PATH_MAX];
+    joinPath(path, repo->commonDir, file);
+    TRACE_COUNT(TRACE_OPEN);
+    return openat(dirfd, path, flags | O_CLOEXEC);
+}
+
+int gitStatAt(int dirfd, const GitRepo* repo, const char* file, struct stat* sb) {
+    char path[GIT_PATH_MAX];
+    joinPath(path, repo->gitDir, file);
+    TRACE_COUNT(TRACE_STAT);
+    return fstatat(dirfd, path, sb, 0);
+}
+
+
+int gitReadHead(int dirfd, const GitRepo* repo, char* head, size_t size) {
+    struct stat sb;
+    if (gitStatAt(dirfd, repo, "HEAD", &sb) != 0) return -1;
+
+    // $GIT_DIR is not tied to the directory, so it is never cached
+    int cacheable = repo->kind != GIT_REPO_ENV;
+    PendingRecord *record = cacheable ? pendingLookup(repo->dev, repo->ino) : NULL;
+
+    const DiskCacheRecord *cached = cacheable ? diskLookup(repo->dev, repo->ino) : NULL;
+    if (record == NULL && cached != NULL && cached->headMtime != 0) {
+        if (cached->headMtime == mtimeNs(&sb)) {
+            diskStats.headHits++;
+            return snprintf(head, size, "%s", diskString(cached->head));
+        }
+        diskStats.headStale++;
+    } else {
+        diskStats.headMisses++;
+    }
+
+    int fd = gitOpenAt(dirfd, repo, "HEAD", O_RDONLY);
+    if (fd == -1) return -1;
+    ssize_t n = read(fd, head, size - 1);
+    close(fd);
+    if (n <= 0) return -1;
+    head[n] = '\0';
+    n = strcspn(head, "\n");
+    head[n] = '\0';
+
+    if (!cacheable) return n;
+
+    // the directory itself came from the disk cache, carry it over
+    if (record == NULL && cached != NULL) {
+        record = pendingFor(repo->dev, repo->ino);
+        if (record != NULL) {
+            record->record = *cached;
+            replaceString(&record->gitDir, diskString(cached->gitDir));
+            replaceString(&record->commonDir, diskString(cached->commonDir));
+        }
+    }
+    if (record != NULL) {
+        record->record.headMtime = mtimeNs(&sb);
+        replaceString(&record->head, head);
+    }
+    return n;
+}
+
+
+static int comparePending(const void* a, const void* b) {
+    const DiskCacheRecord *recordA = &((const PendingRecord *)a)->record;
+    const DiskCacheRecord *recordB = &((const PendingRecord *)b)->record;
+    return compareKeys(recordA->dev, recordA->ino, recordB->dev, recordB->ino);
+}
+
+static uint32_t appendString(FILE* out, uint32_t* stringsSize, const char* value) {
+    if (value == NULL || value[0] == '\0') return 0;
+    uint32_t offset = *stringsSize;
+    size_t len = strlen(value) + 1;
+    fwrite(value, 1, len, out);
+    *stringsSize += len;
+    return offset;
+}
+
+static void mkdirParents(char* path) {
+    for (char *slash = strchr(path + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(path, 0700);
+        *slash = '/';
+    }
+}
+
+void gitRepoCacheSave(void) {
+    if (getenv("FILE_OPENER_REPO_CACHE_STATS") != NULL) {
+        unsigned long dirs = diskStats.dirHits + diskStats.dirStale + diskStats.dirMisses;
+        unsigned long heads = diskStats.headHits + diskStats.headStale + diskStats.headMisses;
+        fprintf(stderr, "repo cache: %lu/%lu directories hit (%lu stale), %lu/%lu HEADs hit (%lu stale), %zu updated\n",
+                diskStats.dirHits, dirs, diskStats.dirStale,
+                diskStats.headHits, heads, diskStats.headStale, pendingCount);
+    }
+
+    if (pendingCount == 0 || diskPath[0] == '\0') return;
+    qsort(pending, pendingCount, sizeof(PendingRecord), comparePending);
+    reindexPending(0);
+
+    char tempPath[GIT_PATH_MAX + 8];
+    snprintf(tempPath, sizeof(tempPath), "%s.XXXXXX", diskPath);
+    mkdirParents(tempPath);
+    int fd = mkstemp(tempPath);
+    if (fd == -1) return;
+    FILE *out = fdopen(fd, "w");
+
+    // merge the old records with this run's, which take precedence
+    size_t oldCount = diskHeader ? diskHeader->count : 0;
+    size_t total = 0;
+    DiskCacheRecord *records = malloc((oldCount + pendingCount) * sizeof(DiskCacheRecord));
+    const char **strings = malloc((oldCount + pendingCount) * 3 * sizeof(char *));
+
+    size_t i = 0, j = 0;
+    while ((i < oldCount || j < pendingCount) && total < DISK_CACHE_MAX_RECORDS) {
+        int cmp = i == oldCount ? 1 : j == pendingCount ? -1
+            : compareKeys(diskRecords[i].dev, diskRecords[i].ino, pending[j].record.dev, pending[j].record.ino);
+        if (cmp < 0) {
+            records[total] = diskRecords[i];
+            strings[total * 3] = diskString(diskRecords[i].gitDir);
+            strings[total * 3 + 1] = diskString(diskRecords[i].commonDir);
+            strings[total * 3 + 2] = diskString(diskRecords[i].head);
+            i++;
+        } else {
+            records[total] = pending[j].record;
+            strings[total * 3] = pending[j].gitDir;
+            strings[total * 3 + 1] = pending[j].commonDir;
+            strings[total * 3 + 2] = pending[j].head;
+            i += cmp == 0;
+            j++;
+        }
+        total++;
+    }
+
+    DiskCacheHeader header;
+    memcpy(header.magic, DISK_CACHE_MAGIC, sizeof(header.magic));
+    header.count = total;
+    header.stringsSize = 0;
+
+    // strings go first into a separate pass so the offsets are known
+    fseek(out, sizeof(DiskCacheHeader) + total * sizeof(DiskCacheRecord), SEEK_SET);
+    fputc('\0', out);
+    header.stringsSize = 1;
+    for (size_t k = 0; k < total; k++) {
+        records[k].gitDir = appendString(out, &header.stringsSize, strings[k * 3]);
+        records[k].commonDir = appendString(out, &header.stringsSize, strings[k * 3 + 1]);
+        records[k].head = appendString(out, &header.stringsSize, strings[k * 3 + 2]);
+    }
+
+    rewind(out);
+    fwrite(&header, sizeof(header), 1, out);
+    fwrite(records, sizeof(DiskCacheRecord), total, out);
+    free(records);
+    free(strings);
+
+    if (fclose(out) != 0 || rename(tempPath, diskPath) != 0) {
+        unlink(tempPath);
+    }
+}
+
+void gitRepoCacheReset(void) {
+    gitRepoCacheSave();
+
+    for (size_t i = 0; i < repoCacheSize; i++) {
+        free(repoCache[i].gitDir);
+        free(repoCache[i].commonDir);
+    }
+    free(repoCache);
+    repoCache = NULL;
+    repoCacheSize = 0;
+    repoCacheUsed = 0;
+
+    for (size_t i = 0; i < pendingCount; i++) {
+        free(pending[i].gitDir);
+        free(pending[i].commonDir);
+        free(pending[i].head);
+    }
+    pendingCount = 0;
+    reindexPending(0);
+
+    if (diskHeader != NULL) munmap((void *)diskHeader, diskSize);
+    diskHeader = NULL;
+    diskRecords = NULL;
+    diskStrings = NULL;
+    diskLoaded = 0;
+    memset(&diskStats, 0, sizeof(diskStats));
+
+    // GIT_DIR and a relative GIT_WORK_TREE are read again against the
+    // current directory
+    envLoaded = 0;
+}
@@ -0,0 +1,66 @@
+#ifndef GITREPO_H
+#define GITREPO_H
+
+#include <sys/stat.h>
+
+#define GIT_PATH_MAX 1024
+
+#define GIT_REPO_NONE 0
+#define GIT_REPO_DIR 1      // <dir>/.git is a directory
+#define GIT_REPO_FILE 2     // <dir>/.git is a "gitdir:" file, e.g. a worktree or submodule
+#define GIT_REPO_BARE 3     // <dir> is itself a bare repository
+#define GIT_REPO_ENV 4      // <dir> is the work tree of $GIT_DIR
+
+typedef struct GitRepo {
+    int kind;
+    // Both paths are either absolute or relative to the probed directory.
+    // gitDir holds HEAD and FETCH_HEAD, commonDir holds refs, packed-refs,
+    // config and objects; they only differ for linked worktrees.
+    char gitDir[GIT_PATH_MAX];
+    char commonDir[GIT_PATH_MAX];
+    // the probed directory, used to find its record in the repo cache
+    dev_t dev;
+    ino_t ino;
+} GitRepo;
+
+// Probes the directory `name` relative to `dirfd` (which may be AT_FDCWD).
+// Returns -1 if it is not an accessible directory, otherwise one of the
+// GIT_REPO_* kinds. If fdOut is not NULL it receives an O_PATH descriptor
+// for the directory, to be used as dirfd for the next level and closed by
+// the caller. Results are cached by (dev, ino) for the rest of the run.
+int gitProbeAt(int dirfd, const char* name, int* fdOut, GitRepo* repo);
+
+// Tells whether the directory `path` relative to `dirfd` is a repository
+// without opening it: one fstatat of <path>/.git, plus two more for
+// directories named like a bare repository. Returns one of the GIT_REPO_*
+// kinds, for walks that only need the full probe of the innermost one.
+int gitIsRepoAt(int dirfd, const char* path);
+
+// Opens a file inside the repository's gitDir, e.g. "HEAD". dirfd is the
+// descriptor of the directory the repository was probed for.
+int gitOpenAt(int dirfd, const GitRepo* repo, const char* file, int flags);
+
+// Like gitOpenAt but for files that live in the common directory.
+int gitOpenCommonAt(int dirfd, const GitRepo* repo, const char* file, int flags);
+
+int gitStatAt(int dirfd, const GitRepo* repo, const char* file, struct stat* sb);
+
+// Reads the first line of HEAD without the newline, e.g. "ref: refs/heads/main"
+// or a commit id. Served from the repo cache while HEAD's mtime is unchanged.
+// Returns the length or -1.
+int gitReadHead(int dirfd, const GitRepo* repo, char* head, size_t size);
+
+// Writes the probes of this run back to the on-disk repo cache, which is
+// shared by every program that uses gitProbeAt. The cache lives in
+// $FILE_OPENER_REPO_CACHE (an empty value disables it), defaulting to
+// $XDG_CACHE_HOME/zsh-file-opener/repos. With FILE_OPENER_REPO_CACHE_STATS
+// set, hit rates are reported on stderr.
+void gitRepoCacheSave(void);
+
+// Saves and then forgets everything probed so far, for long running
+// programs whose directories change underneath them. $GIT_DIR and the
+// work tree it belongs to are taken again from the environment and the
+// current directory on the next probe.
+void gitRepoCacheReset(void);
+
+#endif
@@ -0,0 +1,1016 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "gitrepo.h"
+#include "gitobj.h"
+#include "gitindex.h"
+#include "trace.h"
+#include "gitstatus.h"
+
+// Prints the work tree status below the current directory the way
+//
+//   git -c color.status=always status --short --untracked-files=all .
+//
+// does, for fzy-gitstatus, which runs it after every action. Between runs a
+// snapshot in $XDG_CACHE_HOME/zsh-file-opener/status keeps the listings of
+// the directories walked for untracked files and the verdicts on files
+// whose content had to be hashed, so a refresh only reads the directories
+// and hashes the files whose stat data changed since.
+//
+//   gitstatus [--touched path...]
+//
+// The paths after --touched, relative to the current directory, are what
+// the last action changed; they are looked at again whatever the snapshot
+// says. Whatever gitstatus does not handle the way git would (renames,
+// submodules, merge conflicts aside, content filters and the like) is left
+// to git itself.
+
+#define MAX_PATH_LENGTH 4096
+#define SNAPSHOT_MAGIC "ZFOSTAT1"
+#define MAX_SNAPSHOT_RECORDS (1 << 22)
+
+// git's defaults for color.status.added, .changed, .untracked and .unmerged
+static const char stagedColor[] = "\x1b[32m";
+static const char changedColor[] = "\x1b[31m";
+static const char resetColor[] = "\x1b[m";
+
+// the codes of unmerged entries by the stages present, 1 << (stage - 1)
+static const char *unmergedCodes[8] = { NULL, "DD", "AU", "UD", "UA", "DU", "AA", "UU" };
+
+
+// The snapshot file is a header followed by the entry records sorted by
+// name, the directory records sorted by path and the data they point into.
+typedef struct SnapshotHeader {
+    char magic[8];
+    int64_t taken;      // CLOCK_REALTIME in ns when the run that wrote it started
+    uint32_t entryCount;
+    uint32_t dirCount;
+    uint64_t dataSize;
+} SnapshotHeader;
+
+typedef struct SnapshotStat {
+    int64_t mtime;
+    int64_t ctime;
+    uint64_t ino;
+    uint64_t size;
+    uint32_t mode;
+    uint32_t unused;
+} SnapshotStat;
+
+// A file whose stat data did not tell whether it matches its index entry.
+typedef struct SnapshotEntry {
+    SnapshotStat stat;
+    unsigned char oid[GIT_OID_RAWSZ];   // of the index entry it was compared with
+    uint32_t mode;
+    uint32_t verdict;                   // GIT_ENTRY_*
+    uint32_t nameLen;
+    uint64_t name;
+} SnapshotEntry;
+
+// A directory listing of the untracked walk, see GitWalkCache.
+typedef struct SnapshotDir {
+    SnapshotStat stat;
+    uint64_t path;
+    uint64_t listing;
+    uint32_t pathLen;
+    uint32_t listingSize;
+} SnapshotDir;
+
+typedef struct PendingEntry {
+    SnapshotEntry record;
+    const char *name;
+} PendingEntry;
+
+typedef struct PendingDir {
+    SnapshotDir record;
+    char *path;
+    const char *listing;
+    char *owned;        // the listing when it was read this run
+} PendingDir;
+
+typedef struct Snapshot {
+    char path[MAX_PATH_LENGTH];
+    int64_t taken;
+
+    // the previous run's
+    const SnapshotHeader *header;
+    size_t mapSize;
+    const SnapshotEntry *entries;
+    const SnapshotDir *dirs;
+    const char *data;
+
+    // this run's, including what it took over from the previous one
+    PendingEntry *newEntries;
+    size_t newEntryCount, newEntryCapacity;
+    PendingDir *newDirs;
+    size_t newDirCount, newDirCapacity;
+    unsigned long misses;
+
+    // work tree paths, and the directories (ending in a slash) holding them
+    char **touched;
+    size_t touchedCount;
+    char **touchedDirs;
+    size_t touchedDirCount;
+} Snapshot;
+
+typedef struct Change {
+    char *path;
+    char staged;        // the X and Y of the short format, or 0
+    char worktree;
+    int unmerged;       // the stages present, for unmerged paths
+} Change;
+
+typedef struct Status {
+    const char *commonDir;
+    const GitIndex *index;
+    Snapshot *snapshot;
+    Change *changes;
+    size_t changeCount, changeCapacity;
+    char **untracked;
+    size_t untrackedCount, untrackedCapacity;
+    int intentToAdd;
+} Status;
+
+
+static int compareNames(const char* a, size_t aLen, const char* b, size_t bLen) {
+    int cmp = memcmp(a, b, aLen < bLen ? aLen : bLen);
+    if (cmp != 0) return cmp;
+    return aLen < bLen ? -1 : aLen > bLen;
+}
+
+static int compareStrings(const void* a, const void* b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static int64_t timeNs(const struct timespec* ts) {
+    return (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+static void fromStat(SnapshotStat* snapshotStat, const struct stat* sb) {
+    memset(snapshotStat, 0, sizeof(SnapshotStat));
+    snapshotStat->mtime = timeNs(&sb->st_mtim);
+    snapshotStat->ctime = timeNs(&sb->st_ctim);
+    snapshotStat->ino = sb->st_ino;
+    snapshotStat->size = sb->st_size;
+    snapshotStat->mode = sb->st_mode;
+}
+
+static void mkdirParents(char* path) {
+    for (char *slash = strchr(path + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(path, 0700);
+        *slash = '/';
+    }
+}
+
+
+static void loadSnapshot(Snapshot* snapshot, const char* workTree) {
+    char *cacheHome = getenv("XDG_CACHE_HOME");
+    char *home = getenv("HOME");
+    char hex[GIT_OID_HEXSZ + 1];
+    GitSha1 ctx;
+    GitOid key;
+    gitSha1Init(&ctx);
+    gitSha1Update(&ctx, workTree, strlen(workTree));
+    gitSha1Final(&ctx, key.hash);
+    gitOidToHex(&key, hex);
+
+    if (cacheHome != NULL && cacheHome[0] != '\0') {
+        snprintf(snapshot->path, sizeof(snapshot->path), "%s/zsh-file-opener/status/%s", cacheHome, hex);
+    } else if (home != NULL) {
+        snprintf(snapshot->path, sizeof(snapshot->path), "%s/.cache/zsh-file-opener/status/%s", home, hex);
+    } else {
+        return;
+    }
+
+    TRACE_COUNT(TRACE_OPEN);
+    int fd = open(snapshot->path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || (size_t)sb.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        return;
+    }
+    void *map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return;
+
+    const SnapshotHeader *header = map;
+    size_t expected = sizeof(SnapshotHeader) + (size_t)header->entryCount * sizeof(SnapshotEntry)
+        + (size_t)header->dirCount * sizeof(SnapshotDir) + header->dataSize;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0
+            || header->entryCount > MAX_SNAPSHOT_RECORDS || header->dirCount > MAX_SNAPSHOT_RECORDS
+            || expected != (size_t)sb.st_size) {
+        munmap(map, sb.st_size);
+        return;
+    }
+
+    snapshot->header = header;
+    snapshot->mapSize = sb.st_size;
+    snapshot->entries = (const SnapshotEntry *)(header + 1);
+    snapshot->dirs = (const SnapshotDir *)(snapshot->entries + header->entryCount);
+    snapshot->data = (const char *)(snapshot->dirs + header->dirCount);
+
+    // records pointing outside the data are dropped as a whole
+    for (uint32_t i = 0; i < header->entryCount; i++) {
+        if (snapshot->entries[i].name + snapshot->entries[i].nameLen > header->dataSize) goto invalid;
+    }
+    for (uint32_t i = 0; i < header->dirCount; i++) {
+        const SnapshotDir *dir = &snapshot->dirs[i];
+        if (dir->path + dir->pathLen > header->dataSize || dir->listing + dir->listingSize > header->dataSize) {
+            goto invalid;
+        }
+    }
+    return;
+
+invalid:
+    munmap(map, sb.st_size);
+    snapshot->header = NULL;
+}
+
+// Whether a record taken for stat data that is still sb can be trusted:
+// changes in the instant the previous run started may not show in it.
+static int snapshotTrusted(const Snapshot* snapshot, const SnapshotStat* recorded, const struct stat* sb) {
+    SnapshotStat current;
+    fromStat(&current, sb);
+    return memcmp(&current, recorded, sizeof(SnapshotStat)) == 0
+        && current.mtime < snapshot->header->taken && current.ctime < snapshot->header->taken;
+}
+
+static int isTouched(char** paths, size_t count, const char* path, size_t len) {
+    size_t low = 0, high = count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        int cmp = compareNames(paths[mid], strlen(paths[mid]), path, len);
+        if (cmp == 0) return 1;
+        if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return 0;
+}
+
+static void addTouched(Snapshot* snapshot, const char* prefix, const char* arg) {
+    char path[MAX_PATH_LENGTH];
+    if (strncmp(arg, "./", 2) == 0) arg += 2;
+    int len = snprintf(path, sizeof(path), "%s%s", prefix, arg);
+    if (len <= 0 || (size_t)len >= sizeof(path)) return;
+    while (len > 0 && path[len - 1] == '/') path[--len] = '\0';
+
+    snapshot->touched = realloc(snapshot->touched, (snapshot->touchedCount + 1) * sizeof(char *));
+    snapshot->touched[snapshot->touchedCount++] = strdup(path);
+
+    // the directory it is in, and itself in case it is one
+    snapshot->touchedDirs = realloc(snapshot->touchedDirs, (snapshot->touchedDirCount + 2) * sizeof(char *));
+    char *slash = strrchr(path, '/');
+    snapshot->touchedDirs[snapshot->touchedDirCount++] = strndup(path, slash ? slash + 1 - path : 0);
+    path[len] = '/';
+    path[len + 1] = '\0';
+    snapshot->touchedDirs[snapshot->touchedDirCount++] = strdup(path);
+}
+
+static const SnapshotEntry* findEntry(const Snapshot* snapshot, const char* name, size_t len) {
+    if (snapshot->header == NULL) return NULL;
+    size_t low = 0, high = snapshot->header->entryCount;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        const SnapshotEntry *entry = &snapshot->entries[mid];
+        int cmp = compareNames(snapshot->data + entry->name, entry->nameLen, name, len);
+        if (cmp == 0) return entry;
+        if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return NULL;
+}
+
+static void addEntry(Snapshot* snapshot, const SnapshotEntry* record, const char* name) {
+    if (snapshot->newEntryCount == snapshot->newEntryCapacity) {
+        snapshot->newEntryCapacity = snapshot->newEntryCapacity ? snapshot->newEntryCapacity * 2 : 64;
+        snapshot->newEntries = realloc(snapshot->newEntries, snapshot->newEntryCapacity * sizeof(PendingEntry));
+    }
+    PendingEntry *pending = &snapshot->newEntries[snapshot->newEntryCount++];
+    pending->record = *record;
+    pending->name = name;
+}
+
+// Returns the verdict the snapshot holds for an index entry whose work tree
+// file has the stat data sb, or GIT_ENTRY_UNSURE.
+static int entryVerdict(Snapshot* snapshot, const GitIndexEntry* entry, const struct stat* sb) {
+    const SnapshotEntry *record = findEntry(snapshot, entry->name, entry->nameLen);
+    if (record == NULL || record->mode != entry->mode
+            || memcmp(record->oid, entry->oid.hash, GIT_OID_RAWSZ) != 0
+            || !snapshotTrusted(snapshot, &record->stat, sb)
+            || isTouched(snapshot->touched, snapshot->touchedCount, entry->name, entry->nameLen)) {
+        return GIT_ENTRY_UNSURE;
+    }
+    addEntry(snapshot, record, entry->name);
+    return record->verdict;
+}
+
+static void storeVerdict(Snapshot* snapshot, const GitIndexEntry* entry, const struct stat* sb, int verdict) {
+    SnapshotEntry record;
+    memset(&record, 0, sizeof(record));
+    fromStat(&record.stat, sb);
+    memcpy(record.oid, entry->oid.hash, GIT_OID_RAWSZ);
+    record.mode = entry->mode;
+    record.verdict = verdict;
+    record.nameLen = entry->nameLen;
+    addEntry(snapshot, &record, entry->name);
+    snapshot->misses++;
+}
+
+static const SnapshotDir* findDir(const Snapshot* snapshot, const char* path, size_t len) {
+    if (snapshot->header == NULL) return NULL;
+    size_t low = 0, high = snapshot->header->dirCount;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        const SnapshotDir *dir = &snapshot->dirs[mid];
+        int cmp = compareNames(snapshot->data + dir->path, dir->pathLen, path, len);
+        if (cmp == 0) return dir;
+        if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return NULL;
+}
+
+static void addDir(Snapshot* snapshot, const SnapshotStat* stat, const char* path, size_t len,
+                   const char* listing, size_t size, char* owned) {
+    if (snapshot->newDirCount == snapshot->newDirCapacity) {
+        snapshot->newDirCapacity = snapshot->newDirCapacity ? snapshot->newDirCapacity * 2 : 64;
+        snapshot->newDirs = realloc(snapshot->newDirs, snapshot->newDirCapacity * sizeof(PendingDir));
+    }
+    PendingDir *pending = &snapshot->newDirs[snapshot->newDirCount++];
+    memset(pending, 0, sizeof(PendingDir));
+    pending->record.stat = *stat;
+    pending->record.pathLen = len;
+    pending->record.listingSize = size;
+    pending->path = strndup(path, len);
+    pending->listing = listing;
+    pending->owned = owned;
+}
+
+static const char* lookupDir(void* ctx, const char* path, size_t len, const struct stat* sb, size_t* size) {
+    Snapshot *snapshot = ctx;
+    const SnapshotDir *dir = findDir(snapshot, path, len);
+    if (dir == NULL || !snapshotTrusted(snapshot, &dir->stat, sb)
+            || isTouched(snapshot->touchedDirs, snapshot->touchedDirCount, path, len)) {
+        return NULL;
+    }
+    addDir(snapshot, &dir->stat, path, len, snapshot->data + dir->listing, dir->listingSize, NULL);
+    *size = dir->listingSize;
+    return snapshot->data + dir->listing;
+}
+
+static void storeDir(void* ctx, const char* path, size_t len, const struct stat* sb,
+                     const char* listing, size_t size) {
+    Snapshot *snapshot = ctx;
+    char *copy = malloc(size ? size : 1);
+    if (copy == NULL) return;
+    memcpy(copy, listing, size);
+    SnapshotStat stat;
+    fromStat(&stat, sb);
+    addDir(snapshot, &stat, path, len, copy, size, copy);
+    snapshot->misses++;
+}
+
+static int comparePendingEntries(const void* a, const void* b) {
+    const PendingEntry *x = a, *y = b;
+    return compareNames(x->name, x->record.nameLen, y->name, y->record.nameLen);
+}
+
+static int comparePendingDirs(const void* a, const void* b) {
+    const PendingDir *x = a, *y = b;
+    return compareNames(x->path, x->record.pathLen, y->path, y->record.pathLen);
+}
+
+// Writes this run's records and those of the previous run that lie outside
+// prefix, which this run did not look at.
+static void saveSnapshot(Snapshot* snapshot, const char* prefix) {
+    size_t prefixLen = strlen(prefix);
+    const SnapshotHeader *old = snapshot->header;
+    if (snapshot->path[0] == '\0') return;
+
+    if (old != NULL && prefixLen > 0) {
+        for (uint32_t i = 0; i < old->entryCount; i++) {
+            const SnapshotEntry *entry = &snapshot->entries[i];
+            const char *name = snapshot->data + entry->name;
+            if (entry->nameLen >= prefixLen && memcmp(name, prefix, prefixLen) == 0) continue;
+            addEntry(snapshot, entry, name);
+        }
+        for (uint32_t i = 0; i < old->dirCount; i++) {
+            const SnapshotDir *dir = &snapshot->dirs[i];
+            const char *path = snapshot->data + dir->path;
+            if (dir->pathLen >= prefixLen && memcmp(path, prefix, prefixLen) == 0) continue;
+            // the directories above prefix were walked again
+            if (dir->pathLen < prefixLen && memcmp(path, prefix, dir->pathLen) == 0) continue;
+            addDir(snapshot, &dir->stat, path, dir->pathLen, snapshot->data + dir->listing, dir->listingSize, NULL);
+        }
+    }
+
+    // nothing to write if every record was taken over
+    if (old != NULL && snapshot->misses == 0
+            && snapshot->newEntryCount == old->entryCount && snapshot->newDirCount == old->dirCount) {
+        return;
+    }
+    qsort(snapshot->newEntries, snapshot->newEntryCount, sizeof(PendingEntry), comparePendingEntries);
+    qsort(snapshot->newDirs, snapshot->newDirCount, sizeof(PendingDir), comparePendingDirs);
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.taken = snapshot->taken;
+    header.entryCount = snapshot->newEntryCount;
+    header.dirCount = snapshot->newDirCount;
+    for (size_t i = 0; i < snapshot->newEntryCount; i++) {
+        snapshot->newEntries[i].record.name = header.dataSize;
+        header.dataSize += snapshot->newEntries[i].record.nameLen;
+    }
+    for (size_t i = 0; i < snapshot->newDirCount; i++) {
+        SnapshotDir *record = &snapshot->newDirs[i].record;
+        record->path = header.dataSize;
+        header.dataSize += record->pathLen;
+        record->listing = header.dataSize;
+        header.dataSize += record->listingSize;
+    }
+
+    char tempPath[MAX_PATH_LENGTH + 8];
+    snprintf(tempPath, sizeof(tempPath), "%s.XXXXXX", snapshot->path);
+    mkdirParents(tempPath);
+    int fd = mkstemp(tempPath);
+    if (fd == -1) return;
+    FILE *out = fdopen(fd, "w");
+
+    fwrite(&header, sizeof(header), 1, out);
+    for (size_t i = 0; i < snapshot->newEntryCount; i++) {
+        fwrite(&snapshot->newEntries[i].record, sizeof(SnapshotEntry), 1, out);
+    }
+    for (size_t i = 0; i < snapshot->newDirCount; i++) {
+        fwrite(&snapshot->newDirs[i].record, sizeof(SnapshotDir), 1, out);
+    }
+    for (size_t i = 0; i < snapshot->newEntryCount; i++) {
+        fwrite(snapshot->newEntries[i].name, 1, snapshot->newEntries[i].record.nameLen, out);
+    }
+    for (size_t i = 0; i < snapshot->newDirCount; i++) {
+        fwrite(snapshot->newDirs[i].path, 1, snapshot->newDirs[i].record.pathLen, out);
+        fwrite(snapshot->newDirs[i].listing, 1, snapshot->newDirs[i].record.listingSize, out);
+    }
+
+    if (fclose(out) != 0 || rename(tempPath, snapshot->path) != 0) {
+        unlink(tempPath);
+    }
+}
+
+static void freeSnapshot(Snapshot* snapshot) {
+    for (size_t i = 0; i < snapshot->newDirCount; i++) {
+        free(snapshot->newDirs[i].path);
+        free(snapshot->newDirs[i].owned);
+    }
+    for (size_t i = 0; i < snapshot->touchedCount; i++) free(snapshot->touched[i]);
+    for (size_t i = 0; i < snapshot->touchedDirCount; i++) free(snapshot->touchedDirs[i]);
+    free(snapshot->newEntries);
+    free(snapshot->newDirs);
+    free(snapshot->touched);
+    free(snapshot->touchedDirs);
+    if (snapshot->header != NULL) munmap((void *)snapshot->header, snapshot->mapSize);
+}
+
+
+static Change* addChange(Status* status, const char* path, size_t len) {
+    if (status->changeCount == status->changeCapacity) {
+        status->changeCapacity = status->changeCapacity ? status->changeCapacity * 2 : 64;
+        status->changes = realloc(status->changes, status->changeCapacity * sizeof(Change));
+    }
+    Change *change = &status->changes[status->changeCount++];
+    memset(change, 0, sizeof(Change));
+    change->path = strndup(path, len);
+    return change;
+}
+
+static int compareChanges(const void* a, const void* b) {
+    return strcmp(((const Change *)a)->path, ((const Change *)b)->path);
+}
+
+static int addUntracked(void* ctx, const char* path, size_t len) {
+    Status *status = ctx;
+    if (status->untrackedCount == status->untrackedCapacity) {
+        status->untrackedCapacity = status->untrackedCapacity ? status->untrackedCapacity * 2 : 64;
+        status->untracked = realloc(status->untracked, status->untrackedCapacity * sizeof(char *));
+    }
+    status->untracked[status->untrackedCount++] = strndup(path, len);
+    return 0;
+}
+
+// The first index entry at or after lo that does not lie below dir, which
+// ends in a slash.
+static size_t rangeEnd(const GitIndex* index, const char* dir, size_t len) {
+    if (len == 0) return index->count;
+    char key[MAX_PATH_LENGTH];
+    memcpy(key, dir, len);
+    key[len - 1] = '/' + 1;
+    return gitIndexLowerBound(index, key, len);
+}
+
+static void stagedAdded(Status* status, const GitIndexEntry* entry) {
+    if (entry->stage != 0 || entry->flags & GIT_INDEX_INTENT_TO_ADD) return;
+    addChange(status, entry->name, entry->nameLen)->staged = 'A';
+}
+
+// Compares tree, the one HEAD has at path (empty or ending in a slash) or
+// NULL if HEAD has none, with the index entries [lo, hi) below path.
+// Returns 0 on success.
+static int diffTree(Status* status, const GitOid* tree, char* path, size_t len, size_t lo, size_t hi) {
+    const GitIndex *index = status->index;
+    GitOid cached;
+    if (tree != NULL && gitIndexCacheTree(index, path, len, &cached) == 0
+            && memcmp(cached.hash, tree->hash, GIT_OID_RAWSZ) == 0) {
+        return 0;
+    }
+
+    unsigned char *data = NULL;
+    size_t size = 0;
+    if (tree != NULL) {
+        int type;
+        data = gitReadObject(status->commonDir, tree, &type, &size);
+        if (data == NULL || type != GIT_OBJ_TREE) {
+            free(data);
+            return -1;
+        }
+    }
+
+    // entries are "<octal mode> <name>\0<oid>" in the order of the index,
+    // directories sorting as if their name ended in a slash
+    size_t i = lo;
+    const unsigned char *p = data, *end = data + size;
+    int result = 0;
+    while (p < end && result == 0) {
+        unsigned int mode = 0;
+        while (p < end && *p >= '0' && *p <= '7') mode = mode * 8 + *p++ - '0';
+        const unsigned char *name = p + 1;
+        const unsigned char *nul = p < end && *p == ' ' ? memchr(name, '\0', end - name) : NULL;
+        if (nul == NULL || end - nul - 1 < GIT_OID_RAWSZ || len + (nul - name) + 2 > MAX_PATH_LENGTH) {
+            result = -1;
+            break;
+        }
+        GitOid oid;
+        memcpy(oid.hash, nul + 1, GIT_OID_RAWSZ);
+        p = nul + 1 + GIT_OID_RAWSZ;
+
+        size_t keyLen = len + (nul - name);
+        memcpy(path + len, name, nul - name);
+        int isDir = S_ISDIR(mode);
+        if (isDir) path[keyLen++] = '/';
+        path[keyLen] = '\0';
+
+        // what the index has before this entry, HEAD does not
+        for (; i < hi; i++) {
+            const GitIndexEntry *entry = &index->entries[i];
+            if (compareNames(entry->name, entry->nameLen, path, keyLen) >= 0) break;
+            stagedAdded(status, entry);
+        }
+
+        if (isDir) {
+            size_t below = rangeEnd(index, path, keyLen);
+            result = diffTree(status, &oid, path, keyLen, i, below);
+            i = below;
+            continue;
+        }
+
+        const GitIndexEntry *entry = i < hi ? &index->entries[i] : NULL;
+        if (entry == NULL || entry->nameLen != keyLen || memcmp(entry->name, path, keyLen) != 0) {
+            addChange(status, path, keyLen)->staged = 'D';
+            continue;
+        }
+
+        // unmerged entries are reported by their stages instead
+        int unmerged = 0;
+        for (; i < hi && index->entries[i].nameLen == keyLen
+                && memcmp(index->entries[i].name, path, keyLen) == 0; i++) {
+            if (index->entries[i].stage != 0) unmerged = 1;
+        }
+        if (unmerged) continue;
+        if (entry->flags & GIT_INDEX_INTENT_TO_ADD) {
+            addChange(status, path, keyLen)->staged = 'D';
+        } else if ((entry->mode & S_IFMT) != (mode & S_IFMT)) {
+            addChange(status, path, keyLen)->staged = 'T';
+        } else if (entry->mode != mode || memcmp(entry->oid.hash, oid.hash, GIT_OID_RAWSZ) != 0) {
+            addChange(status, path, keyLen)->staged = 'M';
+        }
+    }
+    for (; i < hi && result == 0; i++) {
+        stagedAdded(status, &index->entries[i]);
+    }
+    path[len] = '\0';
+    free(data);
+    return result;
+}
+
+// Finds the tree HEAD has at prefix. Returns 1 if it has one, 0 if HEAD
+// is unborn or has no such directory and -1 on failure.
+static int headTree(const char* gitDir, const char* commonDir, const char* prefix, GitOid* tree) {
+    GitOid head;
+    if (gitResolveRef(gitDir, commonDir, "HEAD", &head, NULL, 0) != 0) return 0;
+    if (gitCommitTree(commonDir, &head, tree) != 0) return -1;
+
+    while (*prefix) {
+        const char *slash = strchr(prefix, '/');
+        size_t componentLen = slash - prefix;
+        int type;
+        size_t size;
+        unsigned char *data = gitReadObject(commonDir, tree, &type, &size);
+        if (data == NULL || type != GIT_OBJ_TREE) {
+            free(data);
+            return -1;
+        }
+
+        int found = 0;
+        for (const unsigned char *p = data, *end = data + size; p < end && !found;) {
+            const unsigned char *nul = memchr(p, '\0', end - p);
+            const unsigned char *space = memchr(p, ' ', end - p);
+            if (nul == NULL || space == NULL || space > nul || end - nul - 1 < GIT_OID_RAWSZ) break;
+            if (space - p == 5 && memcmp(p, "40000", 5) == 0 && (size_t)(nul - space - 1) == componentLen
+                    && memcmp(space + 1, prefix, componentLen) == 0) {
+                memcpy(tree->hash, nul + 1, GIT_OID_RAWSZ);
+                found = 1;
+            }
+            p = nul + 1 + GIT_OID_RAWSZ;
+        }
+        free(data);
+        if (!found) return 0;
+        prefix = slash + 1;
+    }
+    return 1;
+}
+
+// Compares the index entries [lo, hi) with the work tree.
+static void diffWorktree(Status* status, int workTreeFd, const unsigned char* check, int trustFilemode,
+                         size_t lo, size_t hi) {
+    const GitIndex *index = status->index;
+    for (size_t i = lo; i < hi; i++) {
+        const GitIndexEntry *entry = &index->entries[i];
+        if (entry->stage != 0) {
+            int stages = 0;
+            size_t j;
+            for (j = i; j < hi && index->entries[j].nameLen == entry->nameLen
+                    && memcmp(index->entries[j].name, entry->name, entry->nameLen) == 0; j++) {
+                if (index->entries[j].stage) stages |= 1 << (index->entries[j].stage - 1);
+            }
+            addChange(status, entry->name, entry->nameLen)->unmerged = stages;
+            i = j - 1;
+            continue;
+        }
+        if (entry->flags & (GIT_INDEX_ASSUME_VALID | GIT_INDEX_SKIP_WORKTREE)) continue;
+        if (check != NULL && !check[i]) continue;
+
+        struct stat sb;
+        int verdict;
+        TRACE_COUNT(TRACE_STAT);
+        if (fstatat(workTreeFd, entry->name, &sb, AT_SYMLINK_NOFOLLOW) != 0) {
+            verdict = errno == ENOENT || errno == ENOTDIR ? GIT_ENTRY_DELETED : GIT_ENTRY_MODIFIED;
+        } else if (entry->flags & GIT_INDEX_INTENT_TO_ADD) {
+            status->intentToAdd = 1;
+            addChange(status, entry->name, entry->nameLen)->worktree = 'A';
+            continue;
+        } else if ((verdict = gitIndexEntryStat(index, entry, trustFilemode, &sb)) == GIT_ENTRY_UNSURE
+                && (verdict = entryVerdict(status->snapshot, entry, &sb)) == GIT_ENTRY_UNSURE) {
+            verdict = gitIndexEntryChanged(workTreeFd, index, entry, trustFilemode, &sb);
+            storeVerdict(status->snapshot, entry, &sb, verdict);
+        }
+
+        switch (verdict) {
+        case GIT_ENTRY_MODIFIED:
+            addChange(status, entry->name, entry->nameLen)->worktree = 'M';
+            break;
+        case GIT_ENTRY_DELETED:
+            addChange(status, entry->name, entry->nameLen)->worktree = 'D';
+            break;
+        case GIT_ENTRY_TYPE:
+            // a directory where a file was is taken as its deletion
+            addChange(status, entry->name, entry->nameLen)->worktree = S_ISDIR(sb.st_mode) ? 'D' : 'T';
+            break;
+        }
+    }
+}
+
+
+// Whether a config value is set to something other than its default,
+// locally or globally.
+static int configSet(const char* commonDir, const char* section, const char* subsection, const char* key) {
+    char value[256];
+    return gitConfigGetGlobal(commonDir, section, subsection, key, value, sizeof(value)) >= 0;
+}
+
+static int configBool(const char* commonDir, const char* section, const char* key, int fallback) {
+    char value[64];
+    if (gitConfigGetGlobal(commonDir, section, NULL, key, value, sizeof(value)) < 0) return fallback;
+    return strcasecmp(value, "true") == 0 || strcasecmp(value, "yes") == 0
+        || strcasecmp(value, "on") == 0 || atoi(value) != 0;
+}
+
+// Whether an attributes file may ask for content to be converted, which
+// changes what the work tree files hash to.
+static int convertsContent(const char* path) {
+    TRACE_COUNT(TRACE_OPEN);
+    FILE *file = fopen(path, "re");
+    if (file == NULL) return 0;
+    static const char *attributes[] = { "text", "eol", "crlf", "filter", "ident", "encoding" };
+    char line[1024];
+    int found = 0;
+    while (!found && fgets(line, sizeof(line), file)) {
+        for (size_t i = 0; i < sizeof(attributes) / sizeof(attributes[0]) && !found; i++) {
+            found = strstr(line, attributes[i]) != NULL;
+        }
+    }
+    fclose(file);
+    return found;
+}
+
+// Whether git has to be asked instead because the repository uses what
+// gitstatus does not implement.
+static int needsGit(const char* workTree, const char* commonDir, const GitIndex* index) {
+    char value[256];
+    char path[MAX_PATH_LENGTH];
+    if (gitConfigGet(commonDir, "extensions", NULL, "objectformat", value, sizeof(value)) > 0
+            && strcasecmp(value, "sha256") == 0) {
+        return 1;
+    }
+    if (index->split || !configBool(commonDir, "status", "relativePaths", 1)
+            || configBool(commonDir, "core", "ignorecase", 0)) {
+        return 1;
+    }
+    static const char *slots[] = { "added", "updated", "changed", "untracked", "unmerged" };
+    for (size_t i = 0; i < sizeof(slots) / sizeof(slots[0]); i++) {
+        if (configSet(commonDir, "color", "status", slots[i])) return 1;
+    }
+    if (gitConfigGetGlobal(commonDir, "core", NULL, "autocrlf", value, sizeof(value)) >= 0
+            && strcasecmp(value, "false") != 0) {
+        return 1;
+    }
+    if (configSet(commonDir, "core", NULL, "attributesfile")) return 1;
+
+    snprintf(path, sizeof(path), "%s/info/attributes", commonDir);
+    if (convertsContent(path)) return 1;
+    for (size_t i = 0; i < index->count; i++) {
+        const GitIndexEntry *entry = &index->entries[i];
+        // submodules and the directories of a sparse index
+        if ((entry->mode & S_IFMT) == 0160000 || S_ISDIR(entry->mode)) return 1;
+        if (entry->nameLen >= 13 && strcmp(entry->name + entry->nameLen - 13, ".gitattributes") == 0
+                && (entry->nameLen == 13 || entry->name[entry->nameLen - 14] == '/')) {
+            snprintf(path, sizeof(path), "%s/%s", workTree, entry->name);
+            if (convertsContent(path)) return 1;
+        }
+    }
+    return 0;
+}
+
+// Whether git would pair some of the changes up as renames, which are
+// found by comparing contents: a deleted and an added file on the same side.
+static int mayRename(const Status* status, const char* commonDir) {
+    int stagedDeleted = 0, stagedAdded = 0, worktreeDeleted = 0;
+    for (size_t i = 0; i < status->changeCount; i++) {
+        stagedDeleted |= status->changes[i].staged == 'D';
+        stagedAdded |= status->changes[i].staged == 'A';
+        worktreeDeleted |= status->changes[i].worktree == 'D';
+    }
+    if (!(stagedDeleted && stagedAdded) && !(worktreeDeleted && status->intentToAdd)) return 0;
+    return configBool(commonDir, "status", "renames", configBool(commonDir, "diff", "renames", 1));
+}
+
+
+// Writes a path the way git's short format does: in double quotes with C
+// escapes if it holds a space, a quote, a backslash, control characters
+// or, with core.quotePath, bytes above 0x7f.
+static void writePath(FILE* out, const char* path, int quotePath) {
+    const unsigned char *p;
+    for (p = (const unsigned char *)path; *p; p++) {
+        if (*p == ' ' || *p == '"' || *p == '\\' || *p < 0x20 || *p == 0x7f || (*p >= 0x80 && quotePath)) break;
+    }
+    if (*p == '\0') {
+        fputs(path, out);
+        return;
+    }
+
+    putc('"', out);
+    for (p = (const unsigned char *)path; *p; p++) {
+        const char *escape = strchr("\a\b\t\n\v\f\r\"\\", *p);
+        if (escape != NULL) {
+            putc('\\', out);
+            putc("abtnvfr\"\\"[escape - "\a\b\t\n\v\f\r\"\\"], out);
+        } else if (*p < 0x20 || *p == 0x7f || (*p >= 0x80 && quotePath)) {
+            fprintf(out, "\\%03o", *p);
+        } else {
+            putc(*p, out);
+        }
+    }
+    putc('"', out);
+}
+
+static void writeStatus(const Status* status, size_t prefixLen, int quotePath) {
+    for (size_t i = 0; i < status->changeCount; i++) {
+        const Change *change = &status->changes[i];
+        if (change->unmerged) {
+            printf("%s%s%s", changedColor, unmergedCodes[change->unmerged], resetColor);
+        } else {
+            if (change->staged) {
+                printf("%s%c%s", stagedColor, change->staged, resetColor);
+            } else {
+                putchar(' ');
+            }
+            if (change->worktree) {
+                printf("%s%c%s", changedColor, change->worktree, resetColor);
+            } else {
+                putchar(' ');
+            }
+        }
+        putchar(' ');
+        writePath(stdout, change->path + prefixLen, quotePath);
+        putchar('\n');
+    }
+    for (size_t i = 0; i < status->untrackedCount; i++) {
+        printf("%s??%s ", changedColor, resetColor);
+        writePath(stdout, status->untracked[i] + prefixLen, quotePath);
+        putchar('\n');
+    }
+}
+
+
+static int runGit(void) {
+    fflush(stdout);
+    execlp("git", "git", "-c", "color.status=always", "status", "--short", "--untracked-files=all", ".",
+           (char *)NULL);
+    perror("gitstatus: git");
+    return 127;
+}
+
+// Finds the work tree holding cwd. Returns the length of its path in cwd,
+// or -1 if there is none or it is not one gitstatus handles.
+static int findWorkTree(const char* cwd, GitRepo* repo) {
+    char dir[MAX_PATH_LENGTH];
+    size_t len = strlen(cwd);
+    if (len >= sizeof(dir)) return -1;
+    memcpy(dir, cwd, len + 1);
+
+    for (;;) {
+        int kind = gitProbeAt(AT_FDCWD, dir, NULL, repo);
+        if (kind == GIT_REPO_DIR || kind == GIT_REPO_FILE) return len;
+        if (kind != GIT_REPO_NONE || len == 0) return -1;
+        char *slash = strrchr(dir, '/');
+        if (slash == NULL) return -1;
+        len = slash - dir;
+        dir[len] = '\0';
+    }
+}
+
+static void absolutePath(char* out, size_t size, const char* workTree, const char* path) {
+    if (path[0] == '/') {
+        snprintf(out, size, "%s", path);
+    } else {
+        snprintf(out, size, "%s/%s", workTree, path);
+    }
+}
+
+int gitstatusMain(int argc, char** argv) {
+    TRACE_INIT("gitstatus");
+
+    // the environment can point git elsewhere
+    if (getenv("GIT_DIR") || getenv("GIT_WORK_TREE") || getenv("GIT_INDEX_FILE")
+            || getenv("GIT_OBJECT_DIRECTORY") || getenv("GIT_CONFIG_PARAMETERS")) {
+        return runGit();
+    }
+
+    char cwd[MAX_PATH_LENGTH];
+    GitRepo repo;
+    if (getcwd(cwd, sizeof(cwd)) == NULL) return runGit();
+    int workTreeLen = findWorkTree(cwd, &repo);
+    if (workTreeLen < 0) return runGit();
+
+    char workTree[MAX_PATH_LENGTH];
+    char prefix[MAX_PATH_LENGTH];
+    char gitDir[MAX_PATH_LENGTH];
+    char commonDir[MAX_PATH_LENGTH];
+    snprintf(workTree, sizeof(workTree), "%.*s", workTreeLen ? workTreeLen : 1, workTreeLen ? cwd : "/");
+    snprintf(prefix, sizeof(prefix), "%s%s", cwd[workTreeLen] ? cwd + workTreeLen + 1 : "",
+             cwd[workTreeLen] ? "/" : "");
+    absolutePath(gitDir, sizeof(gitDir), workTree, repo.gitDir);
+    absolutePath(commonDir, sizeof(commonDir), workTree, repo.commonDir);
+    size_t prefixLen = strlen(prefix);
+
+    GitIndex index;
+    TRACE_BEGIN("index");
+    int loaded = gitIndexLoad(gitDir, &index);
+    TRACE_END("index");
+    if (loaded != 0) return runGit();
+    if (needsGit(workTree, commonDir, &index)) {
+        gitIndexFree(&index);
+        return runGit();
+    }
+    int workTreeFd = open(workTree, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (workTreeFd == -1) {
+        gitIndexFree(&index);
+        return runGit();
+    }
+
+    Snapshot snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    snapshot.taken = timeNs(&now);
+    loadSnapshot(&snapshot, workTree);
+    if (argc > 1 && strcmp(argv[1], "--touched") == 0) {
+        for (int i = 2; i < argc; i++) addTouched(&snapshot, prefix, argv[i]);
+        qsort(snapshot.touched, snapshot.touchedCount, sizeof(char *), compareStrings);
+        qsort(snapshot.touchedDirs, snapshot.touchedDirCount, sizeof(char *), compareStrings);
+    }
+
+    Status status;
+    memset(&status, 0, sizeof(status));
+    status.commonDir = commonDir;
+    status.index = &index;
+    status.snapshot = &snapshot;
+    size_t lo = gitIndexLowerBound(&index, prefix, prefixLen);
+    size_t hi = rangeEnd(&index, prefix, prefixLen);
+
+    TRACE_BEGIN("staged");
+    GitOid tree;
+    char path[MAX_PATH_LENGTH];
+    memcpy(path, prefix, prefixLen + 1);
+    int hasTree = headTree(gitDir, commonDir, prefix, &tree);
+    int failed = hasTree < 0 || diffTree(&status, hasTree ? &tree : NULL, path, prefixLen, lo, hi) != 0;
+    TRACE_END("staged");
+
+    if (!failed) {
+        TRACE_BEGIN("dirty");
+        unsigned char *check = gitIndexFsmonitor(&index, gitDir, commonDir);
+        diffWorktree(&status, workTreeFd, check, gitConfigBool(commonDir, "core", "filemode", 1), lo, hi);
+        free(check);
+        TRACE_END("dirty");
+    }
+
+    if (!failed) {
+        TRACE_BEGIN("untracked");
+        GitWalkCache cache = { lookupDir, storeDir, &snapshot };
+        failed = gitUntrackedWalk(workTreeFd, workTree, &index, commonDir, prefix, 0,
+                                  &cache, addUntracked, &status) != 0;
+        TRACE_END("untracked");
+    }
+
+    if (!failed && !mayRename(&status, commonDir)) {
+        // changes to the same path from both comparisons share a line
+        qsort(status.changes, status.changeCount, sizeof(Change), compareChanges);
+        size_t merged = 0;
+        for (size_t i = 0; i < status.changeCount; i++) {
+            Change *change = &status.changes[i];
+            Change *last = merged ? &status.changes[merged - 1] : NULL;
+            if (last != NULL && strcmp(last->path, change->path) == 0) {
+                if (change->staged) last->staged = change->staged;
+                if (change->worktree) last->worktree = change->worktree;
+                if (change->unmerged) last->unmerged = change->unmerged;
+                free(change->path);
+                continue;
+            }
+            status.changes[merged++] = *change;
+        }
+        status.changeCount = merged;
+        qsort(status.untracked, status.untrackedCount, sizeof(char *), compareStrings);
+
+        writeStatus(&status, prefixLen, configBool(commonDir, "core", "quotepath", 1));
+
+        TRACE_BEGIN("snapshot");
+        saveSnapshot(&snapshot, prefix);
+        TRACE_END("snapshot");
+    } else {
+        failed = 1;
+    }
+
+    for (size_t i = 0; i < status.changeCount; i++) free(status.changes[i].path);
+    for (size_t i = 0; i < status.untrackedCount; i++) free(status.untracked[i]);
+    free(status.changes);
+    free(status.untracked);
+    freeSnapshot(&snapshot);
+    close(workTreeFd);
+    gitIndexFree(&index);
+    return failed ? runGit() : 0;
+}
+
+#ifndef FILEOPENER_MULTICALL
+int main(int argc, char **argv) {
+    return gitstatusMain(argc, argv);
+}
+#endif
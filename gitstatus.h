@@ -0,0 +1,10 @@
+#ifndef GITSTATUS_H
+#define GITSTATUS_H
+
+// The gitstatus program, called by main or by the multi-call binary. It
+// prints what `git -c color.status=always status --short
+// --untracked-files=all .` would, keeping a snapshot of what it looked at
+// so the next run only re-reads what changed.
+int gitstatusMain(int argc, char** argv);
+
+#endif
@@ -0,0 +1,337 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "trace.h"
+#include "histidx.h"
+
+// Lists a zsh history file for fzy-history-widget the way
+//
+//   fc -rlit "%d-%m %H.%M" 0 | sed -r "s/^(.{19})./ \1│/"
+//
+// does, reading the file itself instead of the shell's history, newest first
+// and with every command only where it was last run. The number in front
+// of each line is not the event number but the line's position, which
+//
+//   histidx --get <number> [--key <key>] histfile
+//
+// turns back into the command, with its newlines, using the offsets the
+// listing left in $XDG_CACHE_HOME/zsh-file-opener/history (or
+// $FILE_OPENER_HISTIDX_CACHE, empty to keep none, which leaves --get
+// failing). Shells sharing a history file share its index too, so each
+// passes its own key, e.g. its pid, to the listing and to --get, and --get
+// fails rather than use the offsets of a listing made with another key.
+//
+// Entries are in the extended format, ": <start>:<elapsed>;<command>",
+// or plain commands. zsh writes them metafied, a 0x83 byte before every
+// byte it xors with 32, and ends every line of a multi-line command but the
+// last with a backslash.
+
+#define MAX_PATH_LENGTH 4096
+#define INDEX_MAGIC "ZFOHIST2"
+#define META 0x83
+
+typedef struct HistoryEntry {
+    size_t offset;      // of the line in the file
+    size_t command;     // of the command
+    size_t length;      // of the command, up to the final newline
+    time_t time;
+    uint64_t hash;
+} HistoryEntry;
+
+typedef struct IndexHeader {
+    char magic[8];
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;      // of the history file when it was listed
+    uint64_t key;       // hash of the --key of the listing
+    uint64_t count;
+} IndexHeader;
+
+
+static uint64_t hashBytes(const char* data, size_t len) {
+    uint64_t hash = 14695981039346656037u;
+    for (size_t i = 0; i < len; i++) hash = (hash ^ (unsigned char)data[i]) * 1099511628211u;
+    return hash;
+}
+
+// Parses the entry at p. Returns the start of the next one.
+static const char* parseEntry(const char* start, const char* p, const char* end, HistoryEntry* entry) {
+    entry->offset = p - start;
+    entry->time = 0;
+
+    // ": 1700000000:0;" and nothing else counts as the extended header
+    const char *q = p;
+    if (end - q > 2 && q[0] == ':' && q[1] == ' ') {
+        q += 2;
+        time_t time = 0;
+        while (q < end && *q >= '0' && *q <= '9') time = time * 10 + *q++ - '0';
+        if (q < end && *q == ':') {
+            q++;
+            while (q < end && *q >= '0' && *q <= '9') q++;
+            if (q < end && *q == ';') {
+                entry->time = time;
+                p = q + 1;
+            }
+        }
+    }
+    entry->command = p - start;
+
+    // a backslash before the newline continues the command, unless it is
+    // itself escaped
+    for (;;) {
+        const char *newline = memchr(p, '\n', end - p);
+        if (newline == NULL) {
+            p = end;
+            break;
+        }
+        int continued = newline > p && newline[-1] == '\\' && (newline - 1 == p || newline[-2] != '\\');
+        p = newline + 1;
+        if (!continued) {
+            p = newline;
+            break;
+        }
+    }
+    entry->length = p - (start + entry->command);
+    entry->hash = hashBytes(start + entry->command, entry->length);
+    return p < end ? p + 1 : end;
+}
+
+// Writes a command unmetafied, with its line breaks as "\n" for a listing
+// or as they were for --get.
+static void writeCommand(FILE* out, const char* command, size_t length, int escapeNewlines) {
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = command[i];
+        if (c == META && i + 1 < length) {
+            putc(command[++i] ^ 32, out);
+        } else if (c == '\\' && i + 1 < length && command[i + 1] == '\n') {
+            if (escapeNewlines) {
+                fputs("\\n", out);
+            } else {
+                putc('\n', out);
+            }
+            i++;
+        } else {
+            putc(c, out);
+        }
+    }
+}
+
+
+// The index of a history file, named after its path. Returns 0 on success.
+static int indexPath(char* path, size_t size, const char* histfile) {
+    char *override = getenv("FILE_OPENER_HISTIDX_CACHE");
+    char *cacheHome = getenv("XDG_CACHE_HOME");
+    char *home = getenv("HOME");
+    char dir[MAX_PATH_LENGTH];
+    if (override != NULL) {
+        if (override[0] == '\0') return -1;
+        snprintf(dir, sizeof(dir), "%s", override);
+    } else if (cacheHome != NULL && cacheHome[0] != '\0') {
+        snprintf(dir, sizeof(dir), "%s/zsh-file-opener/history", cacheHome);
+    } else if (home != NULL) {
+        snprintf(dir, sizeof(dir), "%s/.cache/zsh-file-opener/history", home);
+    } else {
+        return -1;
+    }
+
+    uint64_t hash = hashBytes(histfile, strlen(histfile));
+    int len = snprintf(path, size, "%s/%016llx", dir, (unsigned long long)hash);
+    return len > 0 && (size_t)len < size ? 0 : -1;
+}
+
+static void mkdirParents(char* path) {
+    for (char *slash = strchr(path + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(path, 0700);
+        *slash = '/';
+    }
+}
+
+static void saveIndex(const char* path, const struct stat* sb, uint64_t key, const uint64_t* offsets,
+                      size_t count) {
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.dev = sb->st_dev;
+    header.ino = sb->st_ino;
+    header.size = sb->st_size;
+    header.key = key;
+    header.count = count;
+
+    char tempPath[MAX_PATH_LENGTH + 8];
+    snprintf(tempPath, sizeof(tempPath), "%s.XXXXXX", path);
+    mkdirParents(tempPath);
+    int fd = mkstemp(tempPath);
+    if (fd == -1) return;
+    FILE *file = fdopen(fd, "w");
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(offsets, sizeof(uint64_t), count, file);
+    if (fclose(file) != 0 || rename(tempPath, path) != 0) {
+        unlink(tempPath);
+    }
+}
+
+// Looks up the offset of the entry listed at position. zsh only appends to
+// the file it keeps, and writes a new one when it trims it, so the offsets
+// hold while the file is the same one and no shorter. Returns 0 on success.
+static int indexOffset(const char* path, const struct stat* sb, uint64_t key, uint64_t position,
+                       uint64_t* offset) {
+    TRACE_COUNT(TRACE_OPEN);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+    IndexHeader header;
+    int found = pread(fd, &header, sizeof(header), 0) == sizeof(header)
+        && memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) == 0
+        && header.dev == (uint64_t)sb->st_dev && header.ino == (uint64_t)sb->st_ino
+        && header.size <= (uint64_t)sb->st_size && header.key == key && position < header.count
+        && pread(fd, offset, sizeof(uint64_t), sizeof(header) + position * sizeof(uint64_t)) == sizeof(uint64_t)
+        && *offset < header.size;
+    close(fd);
+    return found ? 0 : -1;
+}
+
+
+static int list(const char* start, size_t size, const struct stat* sb, const char* index, uint64_t key) {
+    HistoryEntry *entries = NULL;
+    size_t count = 0, capacity = 0;
+    TRACE_BEGIN("parse");
+    for (const char *p = start, *end = start + size; p < end; ) {
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 4096;
+            HistoryEntry *grown = realloc(entries, capacity * sizeof(HistoryEntry));
+            if (grown == NULL) {
+                free(entries);
+                return 1;
+            }
+            TRACE_COUNT(TRACE_ALLOC);
+            entries = grown;
+        }
+        p = parseEntry(start, p, end, &entries[count]);
+        if (entries[count].length > 0) count++;
+    }
+    TRACE_END("parse");
+
+    // an open addressing set of the commands listed so far, newest first
+    size_t slots = 16;
+    while (slots < 2 * count) slots *= 2;
+    const HistoryEntry **seen = calloc(slots, sizeof(HistoryEntry *));
+    uint64_t *offsets = malloc((count ? count : 1) * sizeof(uint64_t));
+    if (seen == NULL || offsets == NULL) {
+        free(entries);
+        free(seen);
+        free(offsets);
+        return 1;
+    }
+
+    TRACE_BEGIN("list");
+    static char buffer[1 << 16];
+    setvbuf(stdout, buffer, _IOFBF, sizeof(buffer));
+    size_t listed = 0;
+    for (size_t i = count; i-- > 0; ) {
+        const HistoryEntry *entry = &entries[i];
+        const char *command = start + entry->command;
+        size_t slot = entry->hash & (slots - 1);
+        int duplicate = 0;
+        while (seen[slot] != NULL && !duplicate) {
+            duplicate = seen[slot]->hash == entry->hash && seen[slot]->length == entry->length
+                && memcmp(start + seen[slot]->command, command, entry->length) == 0;
+            slot = (slot + 1) & (slots - 1);
+        }
+        if (duplicate) continue;
+        seen[slot] = entry;
+
+        char date[16] = "           ";
+        struct tm tm;
+        if (entry->time && localtime_r(&entry->time, &tm)) strftime(date, sizeof(date), "%d-%m %H.%M", &tm);
+        printf(" %5zu  %s │", listed, date);
+        writeCommand(stdout, command, entry->length, 1);
+        putchar('\n');
+        offsets[listed++] = entry->offset;
+    }
+    int failed = fflush(stdout) != 0;
+    TRACE_END("list");
+
+    if (index != NULL) saveIndex(index, sb, key, offsets, listed);
+    free(entries);
+    free(seen);
+    free(offsets);
+    return failed;
+}
+
+int histidxMain(int argc, char** argv) {
+    TRACE_INIT("histidx");
+
+    const char *histfile = NULL;
+    const char *key = "";
+    long long position = -1;
+    int usage = 0;
+    int i = 1;
+    for (; i + 1 < argc && !usage; i += 2) {
+        if (strcmp(argv[i], "--get") == 0 && position < 0) {
+            char *end;
+            position = strtoll(argv[i + 1], &end, 10);
+            usage = *end != '\0' || position < 0;
+        } else if (strcmp(argv[i], "--key") == 0) {
+            key = argv[i + 1];
+        } else {
+            usage = 1;
+        }
+    }
+    if (!usage && i == argc - 1) histfile = argv[i];
+    if (histfile == NULL) {
+        fprintf(stderr, "usage: histidx [--get number] [--key key] histfile\n");
+        return 2;
+    }
+    uint64_t keyHash = hashBytes(key, strlen(key));
+
+    TRACE_COUNT(TRACE_OPEN);
+    int fd = open(histfile, O_RDONLY | O_CLOEXEC);
+    struct stat sb;
+    if (fd == -1 || fstat(fd, &sb) != 0) {
+        perror(histfile);
+        return 1;
+    }
+    char *start = NULL;
+    if (sb.st_size > 0) {
+        start = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (start == MAP_FAILED) {
+            perror(histfile);
+            close(fd);
+            return 1;
+        }
+    }
+    close(fd);
+
+    char path[MAX_PATH_LENGTH];
+    int hasIndex = indexPath(path, sizeof(path), histfile) == 0;
+    int status = 0;
+    if (position >= 0) {
+        uint64_t offset;
+        if (!hasIndex || indexOffset(path, &sb, keyHash, position, &offset) != 0) {
+            status = 1;
+        } else {
+            HistoryEntry entry;
+            parseEntry(start, start + offset, start + sb.st_size, &entry);
+            writeCommand(stdout, start + entry.command, entry.length, 0);
+        }
+    } else {
+        status = list(start ? start : "", sb.st_size, &sb, hasIndex ? path : NULL, keyHash);
+    }
+
+    if (start != NULL) munmap(start, sb.st_size);
+    return status;
+}
+
+#ifndef FILEOPENER_MULTICALL
+int main(int argc, char **argv) {
+    return histidxMain(argc, argv);
+}
+#endif
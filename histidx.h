@@ -0,0 +1,9 @@
+#ifndef HISTIDX_H
+#define HISTIDX_H
+
+// The histidx program, called by main or by the multi-call binary. It lists
+// a zsh history file newest first for fzy-history-widget and prints the
+// entry picked from that list.
+int histidxMain(int argc, char** argv);
+
+#endif
@@ -0,0 +1,243 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+#include "lscolors.h"
+
+// LS_COLORS the way GNU ls 9 reads and applies it, for lsdir and dlindex.
+
+static const char *colorKeys[LS_COLOR_TYPES] = {
+    "lc", "rc", "ec", "rs", "fi", "di", "ln", "pi", "so", "bd", "cd", "or", "ex", "do",
+    "su", "sg", "st", "ow", "tw", "mh"
+};
+
+// GNU ls's defaults, which LS_COLORS overrides key by key
+static const char *defaultColors[LS_COLOR_TYPES] = {
+    "\x1b[", "m", NULL, "0", NULL, "01;34", "01;36", "33", "01;35", "01;33", "01;33", NULL, "01;32",
+    "01;35", "37;41", "30;43", "37;44", "34;42", "30;42", NULL
+};
+
+struct LsExtension {
+    char *suffix;
+    size_t len;
+    char *color;
+    int order;          // later definitions win
+    LsExtension *next;
+};
+
+
+static int isColored(const char* color) {
+    return color != NULL && color[0] != '\0' && strcmp(color, "0") != 0 && strcmp(color, "00") != 0;
+}
+
+// Decodes the escapes LS_COLORS values may hold: \e, \NNN, \xHH, ^X and the
+// usual C ones. The value is rewritten in place.
+static void unescape(char* value) {
+    char *out = value;
+    for (char *p = value; *p; ) {
+        if (*p == '^' && p[1]) {
+            *out++ = p[1] == '?' ? 127 : p[1] & 31;
+            p += 2;
+        } else if (*p == '\\' && p[1]) {
+            p++;
+            const char *escape = strchr("abefnrtv", *p);
+            if (escape != NULL) {
+                *out++ = "\a\b\x1b\f\n\r\t\v"[escape - "abefnrtv"];
+                p++;
+            } else if (*p >= '0' && *p <= '7') {
+                int value = 0;
+                for (int i = 0; i < 3 && *p >= '0' && *p <= '7'; i++) value = value * 8 + *p++ - '0';
+                *out++ = value;
+            } else if (*p == 'x' && isxdigit((unsigned char)p[1])) {
+                *out++ = strtol(p + 1, &p, 16);
+            } else if (*p == '_') {
+                *out++ = ' ';
+                p++;
+            } else {
+                *out++ = *p++;
+            }
+        } else {
+            *out++ = *p++;
+        }
+    }
+    *out = '\0';
+}
+
+static unsigned int extensionHash(const char* ext, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) hash = (hash ^ (unsigned char)tolower((unsigned char)ext[i])) * 16777619u;
+    return hash % LS_EXTENSION_BUCKETS;
+}
+
+void lsColorsCompile(LsColors* table, const char* spec) {
+    memset(table, 0, sizeof(LsColors));
+    memcpy(table->colors, defaultColors, sizeof(defaultColors));
+    if (spec == NULL) return;
+
+    char *copy = strdup(spec);
+    if (copy == NULL) return;
+    int order = 0;
+    for (char *save = NULL, *item = strtok_r(copy, ":", &save); item; item = strtok_r(NULL, ":", &save)) {
+        char *equals = strchr(item, '=');
+        if (equals == NULL) continue;
+        *equals = '\0';
+        char *value = equals + 1;
+        unescape(value);
+
+        if (item[0] == '*') {
+            LsExtension *ext = malloc(sizeof(LsExtension));
+            if (ext == NULL) continue;
+            unescape(item + 1);
+            *ext = (LsExtension){ item + 1, strlen(item + 1), value, order++, NULL };
+            if (ext->suffix[0] == '.') {
+                unsigned int bucket = extensionHash(ext->suffix, ext->len);
+                ext->next = table->buckets[bucket];
+                table->buckets[bucket] = ext;
+            } else {
+                ext->next = table->suffixes;
+                table->suffixes = ext;
+            }
+            continue;
+        }
+        if (strcmp(item, "ln") == 0 && strcmp(value, "target") == 0) {
+            table->linkAsTarget = 1;
+            continue;
+        }
+        for (int type = 0; type < LS_COLOR_TYPES; type++) {
+            if (strcmp(item, colorKeys[type]) == 0) table->colors[type] = value;
+        }
+    }
+    // copy is left to the patterns and colors that point into it
+}
+
+// The color of the last defined pattern name ends with, ignoring case.
+static const char* extensionColor(const LsColors* table, const char* name, size_t len) {
+    const LsExtension *best = NULL;
+    for (const char *dot = strchr(name, '.'); dot != NULL; dot = strchr(dot + 1, '.')) {
+        size_t extLen = name + len - dot;
+        for (const LsExtension *ext = table->buckets[extensionHash(dot, extLen)]; ext; ext = ext->next) {
+            if (ext->len == extLen && strcasecmp(ext->suffix, dot) == 0 && (!best || ext->order > best->order)) {
+                best = ext;
+            }
+        }
+    }
+    for (const LsExtension *ext = table->suffixes; ext; ext = ext->next) {
+        if (ext->len <= len && strcasecmp(name + len - ext->len, ext->suffix) == 0
+                && (!best || ext->order > best->order)) {
+            best = ext;
+        }
+    }
+    return best ? best->color : NULL;
+}
+
+// The color type of a file of mode, as GNU ls picks it.
+static int colorType(const LsColors* table, mode_t mode, nlink_t links) {
+    const char *const *colors = table->colors;
+    if (S_ISREG(mode)) {
+        if (mode & S_ISUID && isColored(colors[LS_COLOR_SETUID])) return LS_COLOR_SETUID;
+        if (mode & S_ISGID && isColored(colors[LS_COLOR_SETGID])) return LS_COLOR_SETGID;
+        if (mode & 0111 && isColored(colors[LS_COLOR_EXEC])) return LS_COLOR_EXEC;
+        if (links > 1 && isColored(colors[LS_COLOR_MULTIHARDLINK])) return LS_COLOR_MULTIHARDLINK;
+        return LS_COLOR_FILE;
+    }
+    if (S_ISDIR(mode)) {
+        if (mode & S_ISVTX && mode & S_IWOTH && isColored(colors[LS_COLOR_STICKY_OTHER_WRITABLE])) {
+            return LS_COLOR_STICKY_OTHER_WRITABLE;
+        }
+        if (mode & S_IWOTH && isColored(colors[LS_COLOR_OTHER_WRITABLE])) return LS_COLOR_OTHER_WRITABLE;
+        if (mode & S_ISVTX && isColored(colors[LS_COLOR_STICKY])) return LS_COLOR_STICKY;
+        return LS_COLOR_DIR;
+    }
+    if (S_ISLNK(mode)) return LS_COLOR_LINK;
+    if (S_ISFIFO(mode)) return LS_COLOR_FIFO;
+    if (S_ISSOCK(mode)) return LS_COLOR_SOCK;
+    if (S_ISBLK(mode)) return LS_COLOR_BLK;
+    if (S_ISCHR(mode)) return LS_COLOR_CHR;
+    return LS_COLOR_ORPHAN;
+}
+
+static const char* entryColor(const LsColors* table, int type, const char* name, size_t len) {
+    if (type == LS_COLOR_FILE) {
+        const char *color = extensionColor(table, name, len);
+        if (color != NULL) return color;
+    }
+    return table->colors[type];
+}
+
+// Whether the mode of a file of this d_type decides its color.
+static int needsMode(const LsColors* table, unsigned char dtype) {
+    const char *const *colors = table->colors;
+    if (dtype == DT_REG) {
+        return isColored(colors[LS_COLOR_SETUID]) || isColored(colors[LS_COLOR_SETGID])
+            || isColored(colors[LS_COLOR_EXEC]) || isColored(colors[LS_COLOR_MULTIHARDLINK]);
+    }
+    if (dtype == DT_DIR) {
+        return isColored(colors[LS_COLOR_STICKY]) || isColored(colors[LS_COLOR_OTHER_WRITABLE])
+            || isColored(colors[LS_COLOR_STICKY_OTHER_WRITABLE]);
+    }
+    return dtype == DT_UNKNOWN || dtype == DT_LNK;
+}
+
+static mode_t typeMode(unsigned char dtype) {
+    switch (dtype) {
+    case DT_REG: return S_IFREG;
+    case DT_DIR: return S_IFDIR;
+    case DT_LNK: return S_IFLNK;
+    case DT_FIFO: return S_IFIFO;
+    case DT_SOCK: return S_IFSOCK;
+    case DT_BLK: return S_IFBLK;
+    case DT_CHR: return S_IFCHR;
+    default: return 0;
+    }
+}
+
+int lsColorsFile(const LsColors* table, int dirfd, const char* name, unsigned char dtype,
+                 int wantCtime, LsFile* file) {
+    mode_t mode = typeMode(dtype);
+    nlink_t links = 1;
+    int64_t ctime = 0;
+    int linkOk = 1;
+    mode_t targetMode = 0;
+    int gone = 0;
+    if (wantCtime || needsMode(table, dtype)) {
+        struct statx sx;
+        unsigned int mask = STATX_TYPE | STATX_MODE | STATX_NLINK | (wantCtime ? STATX_CTIME : 0);
+        TRACE_COUNT(TRACE_STAT);
+        if (statx(dirfd, name, AT_SYMLINK_NOFOLLOW, mask, &sx) == 0) {
+            mode = sx.stx_mode;
+            links = sx.stx_nlink;
+            ctime = (int64_t)sx.stx_ctime.tv_sec * 1000000000 + sx.stx_ctime.tv_nsec;
+        } else {
+            gone = 1;
+        }
+    }
+    if (S_ISLNK(mode)) {
+        // the target tells whether it is grouped with the directories and
+        // whether it is an orphan
+        struct statx sx;
+        TRACE_COUNT(TRACE_STAT);
+        linkOk = statx(dirfd, name, 0, STATX_TYPE | STATX_MODE | STATX_NLINK, &sx) == 0;
+        targetMode = linkOk ? sx.stx_mode : 0;
+        if (linkOk) links = sx.stx_nlink;
+    }
+
+    int type;
+    if (S_ISLNK(mode) && !linkOk && (table->linkAsTarget || isColored(table->colors[LS_COLOR_ORPHAN]))) {
+        type = LS_COLOR_ORPHAN;
+    } else if (S_ISLNK(mode) && linkOk && table->linkAsTarget) {
+        type = colorType(table, targetMode, links);
+    } else {
+        type = colorType(table, mode, links);
+    }
+    file->color = entryColor(table, type, name, strlen(name));
+    file->ctime = ctime;
+    file->isDir = S_ISDIR(mode) || S_ISDIR(targetMode);
+    return gone ? -1 : 0;
+}
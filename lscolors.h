@@ -0,0 +1,44 @@
+#ifndef LSCOLORS_H
+#define LSCOLORS_H
+
+#include <stdint.h>
+
+#define LS_EXTENSION_BUCKETS 1024
+
+enum {
+    LS_COLOR_LEFT, LS_COLOR_RIGHT, LS_COLOR_END, LS_COLOR_RESET, LS_COLOR_FILE, LS_COLOR_DIR,
+    LS_COLOR_LINK, LS_COLOR_FIFO, LS_COLOR_SOCK, LS_COLOR_BLK, LS_COLOR_CHR, LS_COLOR_ORPHAN,
+    LS_COLOR_EXEC, LS_COLOR_DOOR, LS_COLOR_SETUID, LS_COLOR_SETGID, LS_COLOR_STICKY,
+    LS_COLOR_OTHER_WRITABLE, LS_COLOR_STICKY_OTHER_WRITABLE, LS_COLOR_MULTIHARDLINK, LS_COLOR_TYPES
+};
+
+typedef struct LsExtension LsExtension;
+
+// LS_COLORS compiled once: the colors by type and the "*.ext" patterns by
+// a hash of their lowercased extension, other "*suffix" patterns aside.
+typedef struct LsColors {
+    const char *colors[LS_COLOR_TYPES];
+    LsExtension *buckets[LS_EXTENSION_BUCKETS];
+    LsExtension *suffixes;
+    int linkAsTarget;   // ln=target
+} LsColors;
+
+// What GNU ls needs to know about a directory entry to color and sort it.
+typedef struct LsFile {
+    const char *color;  // NULL if it is written uncolored
+    int64_t ctime;      // in ns, only when asked for
+    int isDir;          // a directory or a link to one
+} LsFile;
+
+// Compiles spec, usually $LS_COLORS or NULL, over GNU ls's defaults. The
+// table keeps pointing into a copy of spec for the rest of the run.
+void lsColorsCompile(LsColors* table, const char* spec);
+
+// Colors the entry name of dirfd as ls would. dtype is its d_type or
+// DT_UNKNOWN; the entry is only stat'ed if its color depends on its mode,
+// it is a link, or wantCtime asks for its ctime. Returns -1 if it had to be
+// stat'ed and is gone, in which case file is filled in from dtype alone.
+int lsColorsFile(const LsColors* table, int dirfd, const char* name, unsigned char dtype,
+                 int wantCtime, LsFile* file);
+
+#endif
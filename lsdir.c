@@ -0,0 +1,400 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <locale.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "lscolors.h"
+#include "trace.h"
+#include "lsdir.h"
+
+// Lists a directory the way
+//
+//   ls -A --color=always --group-directories-first -1     (lsdir -A)
+//   ls --color=always -ct1                                (lsdir -c)
+//
+// do, optionally with every name preceded by --prefix, e.g. "~/dl/". Entries
+// are read with getdents64 and their type taken from d_type; only what the
+// colors or the order depend on (modes, symlink targets, ctimes) is asked
+// for with statx.
+//
+//   lsdir [-A] [-c] [--prefix prefix] [dir]
+//
+// A listing is kept in $XDG_CACHE_HOME/zsh-file-opener/lsdir (or
+// $FILE_OPENER_LSDIR_CACHE, empty to disable it) for as long as the
+// directory's mtime does not change, so listing it again costs one stat.
+// Changes that leave the directory's mtime alone, a chmod or a file growing,
+// are not seen until then.
+
+#define MAX_PATH_LENGTH 4096
+#define DENTS_BUFFER (64 * 1024)
+#define CACHE_MAGIC "ZFOLSDR1"
+
+typedef struct Entry {
+    const char *name;
+    const char *key;    // strxfrm'd name
+    const char *color;
+    int64_t ctime;
+    int isDir;
+} Entry;
+
+typedef struct Listing {
+    Entry *entries;
+    size_t count, capacity;
+    char *arena;        // names and sort keys
+    size_t arenaSize, arenaCapacity;
+} Listing;
+
+typedef struct Buffer {
+    char *data;
+    size_t size, capacity;
+} Buffer;
+
+typedef struct CacheHeader {
+    char magic[8];
+    int64_t mtime;
+    int64_t taken;      // CLOCK_REALTIME in ns when the listing was read
+    uint64_t dev;
+    uint64_t ino;
+    uint32_t keyLen;
+    uint32_t unused;
+    uint64_t dataSize;
+} CacheHeader;
+
+
+static char* arenaAdd(Listing* listing, size_t size) {
+    if (listing->arenaSize + size > listing->arenaCapacity) {
+        size_t capacity = listing->arenaCapacity ? listing->arenaCapacity * 2 : 65536;
+        while (capacity < listing->arenaSize + size) capacity *= 2;
+        char *arena = realloc(listing->arena, capacity);
+        if (arena == NULL) return NULL;
+        TRACE_COUNT(TRACE_ALLOC);
+        // entries point into the arena by offset until it is complete
+        listing->arena = arena;
+        listing->arenaCapacity = capacity;
+    }
+    char *at = listing->arena + listing->arenaSize;
+    listing->arenaSize += size;
+    return at;
+}
+
+static int addEntry(Listing* listing, const LsColors* table, int dirfd, const char* name,
+                    unsigned char dtype, int wantCtime) {
+    if (listing->count == listing->capacity) {
+        size_t capacity = listing->capacity ? listing->capacity * 2 : 1024;
+        Entry *entries = realloc(listing->entries, capacity * sizeof(Entry));
+        if (entries == NULL) return -1;
+        TRACE_COUNT(TRACE_ALLOC);
+        listing->entries = entries;
+        listing->capacity = capacity;
+    }
+
+    LsFile file;
+    lsColorsFile(table, dirfd, name, dtype, wantCtime, &file);
+    size_t len = strlen(name);
+
+    // names and keys are stored as offsets while the arena may still move
+    size_t keyLen = strxfrm(NULL, name, 0) + 1;
+    size_t nameOffset = listing->arenaSize;
+    char *at = arenaAdd(listing, len + 1 + keyLen);
+    if (at == NULL) return -1;
+    memcpy(at, name, len + 1);
+    strxfrm(at + len + 1, name, keyLen);
+
+    Entry *entry = &listing->entries[listing->count++];
+    entry->name = (const char *)(uintptr_t)nameOffset;
+    entry->key = (const char *)(uintptr_t)(nameOffset + len + 1);
+    entry->color = file.color;
+    entry->ctime = file.ctime;
+    entry->isDir = file.isDir;
+    return 0;
+}
+
+static int readListing(Listing* listing, const LsColors* table, int dirfd, int all, int wantCtime) {
+    char *buffer = malloc(DENTS_BUFFER);
+    if (buffer == NULL) return -1;
+    for (;;) {
+        ssize_t n = getdents64(dirfd, buffer, DENTS_BUFFER);
+        if (n < 0) {
+            free(buffer);
+            return -1;
+        }
+        if (n == 0) break;
+        for (ssize_t offset = 0; offset < n; ) {
+            struct dirent64 *entry = (struct dirent64 *)(buffer + offset);
+            offset += entry->d_reclen;
+            const char *name = entry->d_name;
+            if (name[0] == '.' && (!all || name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+            if (addEntry(listing, table, dirfd, name, entry->d_type, wantCtime) != 0) {
+                free(buffer);
+                return -1;
+            }
+        }
+    }
+    free(buffer);
+
+    for (size_t i = 0; i < listing->count; i++) {
+        listing->entries[i].name = listing->arena + (uintptr_t)listing->entries[i].name;
+        listing->entries[i].key = listing->arena + (uintptr_t)listing->entries[i].key;
+    }
+    return 0;
+}
+
+static int compareDirsFirst(const void* a, const void* b) {
+    const Entry *x = a, *y = b;
+    if (x->isDir != y->isDir) return y->isDir - x->isDir;
+    return strcmp(x->key, y->key);
+}
+
+static int compareCtime(const void* a, const void* b) {
+    const Entry *x = a, *y = b;
+    if (x->ctime != y->ctime) return x->ctime < y->ctime ? 1 : -1;
+    return strcmp(x->key, y->key);
+}
+
+
+static int bufferAdd(Buffer* buffer, const char* data, size_t len) {
+    if (buffer->size + len > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity * 2 : 65536;
+        while (capacity < buffer->size + len) capacity *= 2;
+        char *grown = realloc(buffer->data, capacity);
+        if (grown == NULL) return -1;
+        TRACE_COUNT(TRACE_ALLOC);
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->size, data, len);
+    buffer->size += len;
+    return 0;
+}
+
+static void bufferColor(Buffer* buffer, const LsColors* table, const char* color) {
+    bufferAdd(buffer, table->colors[LS_COLOR_LEFT], strlen(table->colors[LS_COLOR_LEFT]));
+    bufferAdd(buffer, color, strlen(color));
+    bufferAdd(buffer, table->colors[LS_COLOR_RIGHT], strlen(table->colors[LS_COLOR_RIGHT]));
+}
+
+static void bufferReset(Buffer* buffer, const LsColors* table) {
+    if (table->colors[LS_COLOR_END] != NULL) {
+        bufferAdd(buffer, table->colors[LS_COLOR_END], strlen(table->colors[LS_COLOR_END]));
+    } else {
+        bufferColor(buffer, table, table->colors[LS_COLOR_RESET]);
+    }
+}
+
+// Renders the listing like ls, which resets the terminal once before the
+// first color and writes every color that is set, even "00".
+static void render(Buffer* out, const Listing* listing, const LsColors* table, const char* prefix) {
+    size_t prefixLen = strlen(prefix);
+    int reset = 0;
+    for (size_t i = 0; i < listing->count; i++) {
+        const Entry *entry = &listing->entries[i];
+        if (entry->color != NULL && !reset) {
+            bufferReset(out, table);
+            reset = 1;
+        }
+        bufferAdd(out, prefix, prefixLen);
+        if (entry->color != NULL) {
+            bufferColor(out, table, entry->color);
+            bufferAdd(out, entry->name, strlen(entry->name));
+            bufferReset(out, table);
+        } else {
+            bufferAdd(out, entry->name, strlen(entry->name));
+        }
+        bufferAdd(out, "\n", 1);
+    }
+}
+
+
+static int64_t timeNs(const struct timespec* ts) {
+    return (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+static void mkdirParents(char* path) {
+    for (char *slash = strchr(path + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(path, 0700);
+        *slash = '/';
+    }
+}
+
+// The cache file of a listing, named after everything the listing depends
+// on, which the file repeats in full as its key. Returns 0 on success.
+static int cachePath(char* path, size_t size, const char* key, size_t keyLen) {
+    char *override = getenv("FILE_OPENER_LSDIR_CACHE");
+    char *cacheHome = getenv("XDG_CACHE_HOME");
+    char *home = getenv("HOME");
+    char dir[MAX_PATH_LENGTH];
+    if (override != NULL) {
+        if (override[0] == '\0') return -1;
+        snprintf(dir, sizeof(dir), "%s", override);
+    } else if (cacheHome != NULL && cacheHome[0] != '\0') {
+        snprintf(dir, sizeof(dir), "%s/zsh-file-opener/lsdir", cacheHome);
+    } else if (home != NULL) {
+        snprintf(dir, sizeof(dir), "%s/.cache/zsh-file-opener/lsdir", home);
+    } else {
+        return -1;
+    }
+
+    uint64_t hash = 14695981039346656037u;
+    for (size_t i = 0; i < keyLen; i++) hash = (hash ^ (unsigned char)key[i]) * 1099511628211u;
+    int len = snprintf(path, size, "%s/%016llx", dir, (unsigned long long)hash);
+    return len > 0 && (size_t)len < size ? 0 : -1;
+}
+
+// Writes the cached listing to stdout if it was taken after the directory
+// last changed. Returns 0 if it did.
+static int writeCached(const char* path, const char* key, size_t keyLen, const struct stat* sb) {
+    TRACE_COUNT(TRACE_OPEN);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+
+    struct stat cacheStat;
+    CacheHeader header;
+    char *data = NULL;
+    int64_t mtime = timeNs(&sb->st_mtim);
+    int found = fstat(fd, &cacheStat) == 0 && (size_t)cacheStat.st_size >= sizeof(header)
+        && read(fd, &header, sizeof(header)) == sizeof(header)
+        && memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) == 0
+        && header.mtime == mtime && mtime < header.taken
+        && header.dev == (uint64_t)sb->st_dev && header.ino == (uint64_t)sb->st_ino
+        && header.keyLen == keyLen
+        && (size_t)cacheStat.st_size == sizeof(header) + keyLen + header.dataSize
+        && (data = malloc(keyLen + header.dataSize)) != NULL
+        && read(fd, data, keyLen + header.dataSize) == (ssize_t)(keyLen + header.dataSize)
+        && memcmp(data, key, keyLen) == 0;
+    close(fd);
+
+    if (found) {
+        fwrite(data + keyLen, 1, header.dataSize, stdout);
+    }
+    free(data);
+    return found ? 0 : -1;
+}
+
+static void saveCache(const char* path, const char* key, size_t keyLen, const struct stat* sb,
+                      int64_t taken, const Buffer* out) {
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.mtime = timeNs(&sb->st_mtim);
+    header.taken = taken;
+    header.dev = sb->st_dev;
+    header.ino = sb->st_ino;
+    header.keyLen = keyLen;
+    header.dataSize = out->size;
+
+    char tempPath[MAX_PATH_LENGTH + 8];
+    snprintf(tempPath, sizeof(tempPath), "%s.XXXXXX", path);
+    mkdirParents(tempPath);
+    int fd = mkstemp(tempPath);
+    if (fd == -1) return;
+    FILE *file = fdopen(fd, "w");
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(key, 1, keyLen, file);
+    fwrite(out->data, 1, out->size, file);
+    if (fclose(file) != 0 || rename(tempPath, path) != 0) {
+        unlink(tempPath);
+    }
+}
+
+// Everything a listing depends on besides the directory's content.
+static size_t cacheKey(char* key, size_t size, const char* dir, int all, int byCtime, const char* prefix) {
+    char cwd[MAX_PATH_LENGTH];
+    if (dir[0] != '/' && getcwd(cwd, sizeof(cwd)) == NULL) return 0;
+    const char *colors = getenv("LS_COLORS");
+    const char *collate = setlocale(LC_COLLATE, NULL);
+    int len = snprintf(key, size, "%s%s%s%c%d%d%c%s%c%s%c%s", dir[0] == '/' ? "" : cwd,
+                       dir[0] == '/' ? "" : "/", dir, '\0', all, byCtime, '\0', prefix, '\0',
+                       colors ? colors : "", '\0', collate ? collate : "");
+    return len > 0 && (size_t)len < size ? (size_t)len : 0;
+}
+
+int lsdirMain(int argc, char** argv) {
+    TRACE_INIT("lsdir");
+    setlocale(LC_COLLATE, "");
+
+    int all = 0, byCtime = 0;
+    const char *prefix = "";
+    const char *dir = ".";
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-A") == 0) {
+            all = 1;
+        } else if (strcmp(argv[i], "-c") == 0) {
+            byCtime = 1;
+        } else if (strcmp(argv[i], "--prefix") == 0 && i + 1 < argc) {
+            prefix = argv[++i];
+        } else if (argv[i][0] != '-' || strcmp(argv[i], "-") == 0) {
+            dir = argv[i];
+        } else {
+            fprintf(stderr, "usage: lsdir [-A] [-c] [--prefix prefix] [dir]\n");
+            return 2;
+        }
+    }
+
+    TRACE_COUNT(TRACE_OPEN);
+    int dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    struct stat sb;
+    if (dirfd == -1 || fstat(dirfd, &sb) != 0) {
+        fprintf(stderr, "lsdir: %s: %s\n", dir, strerror(errno));
+        return 2;
+    }
+
+    static char key[3 * MAX_PATH_LENGTH + 16384];
+    char path[MAX_PATH_LENGTH];
+    size_t keyLen = cacheKey(key, sizeof(key), dir, all, byCtime, prefix);
+    int cached = keyLen > 0 && cachePath(path, sizeof(path), key, keyLen) == 0;
+    if (cached && writeCached(path, key, keyLen, &sb) == 0) {
+        close(dirfd);
+        return fflush(stdout) == 0 ? 0 : 1;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    LsColors table;
+    lsColorsCompile(&table, getenv("LS_COLORS"));
+    Listing listing;
+    memset(&listing, 0, sizeof(listing));
+    TRACE_BEGIN("read");
+    int failed = readListing(&listing, &table, dirfd, all, byCtime);
+    TRACE_END("read");
+    close(dirfd);
+    if (failed) {
+        fprintf(stderr, "lsdir: %s: %s\n", dir, strerror(errno));
+        return 2;
+    }
+
+    TRACE_BEGIN("sort");
+    qsort(listing.entries, listing.count, sizeof(Entry), byCtime ? compareCtime : compareDirsFirst);
+    TRACE_END("sort");
+
+    Buffer out = { NULL, 0, 0 };
+    render(&out, &listing, &table, prefix);
+    fwrite(out.data, 1, out.size, stdout);
+    if (cached) {
+        TRACE_BEGIN("cache");
+        saveCache(path, key, keyLen, &sb, timeNs(&now), &out);
+        TRACE_END("cache");
+    }
+
+    free(out.data);
+    free(listing.entries);
+    free(listing.arena);
+    return fflush(stdout) == 0 ? 0 : 1;
+}
+
+#ifndef FILEOPENER_MULTICALL
+int main(int argc, char **argv) {
+    return lsdirMain(argc, argv);
+}
+#endif
@@ -0,0 +1,9 @@
+#ifndef LSDIR_H
+#define LSDIR_H
+
+// The lsdir program, called by main or by the multi-call binary. It lists a
+// directory in color, directories first or newest first, the way ls-widget
+// and fzy-downloads-widget show it.
+int lsdirMain(int argc, char** argv);
+
+#endif
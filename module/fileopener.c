@@ -0,0 +1,138 @@
+/*
+ * zsh/fileopener: colorpath, z and open's classification inside the shell,
+ * so the prompt and the widgets don't pay for a fork and exec each time.
+ *
+ *   $colorpath              the prompt colorpath would print for $PWD
+ *   zlist [datafile]        z's listing of $ZSHZ_LOCATION or datafile
+ *   zopen-classify [-f] input ...
+ *                           what open would do with each input, printed as
+ *                           "<category>\t<path>" like `open --classify`;
+ *                           -f treats directories like --only-files does
+ */
+
+#include "fileopener.mdh"
+#include "fileopener.pro"
+
+#include "colorpath.h"
+#include "z.h"
+#include "open.h"
+
+/* The shell's value of a parameter, unmetafied, on the heap. */
+
+/**/
+static char *
+getunmeta(char *name)
+{
+    char *value = getsparam(name);
+    return value ? dupstring(unmeta(value)) : NULL;
+}
+
+/**/
+static char *
+colorpathgetfn(UNUSED(Param pm))
+{
+    char *pwd_ = getunmeta("PWD");
+    char *home_ = getunmeta("HOME");
+    if (!pwd_ || !home_)
+        return dupstring("");
+
+    char *output = zhalloc(COLORPATH_MAX_OUTPUT);
+    size_t len = colorpathRender(pwd_, home_, output);
+    return metafy(output, len, META_HEAPDUP);
+}
+
+/**/
+static int
+bin_zlist(char *nam, char **args, UNUSED(Options ops), UNUSED(int func))
+{
+    char *datafile = *args ? dupstring(unmeta(*args)) : getunmeta("ZSHZ_LOCATION");
+    char *home_ = getunmeta("HOME");
+    if (!datafile) {
+        zwarnnam(nam, "ZSHZ_LOCATION is not set");
+        return 1;
+    }
+    if (!home_) {
+        zwarnnam(nam, "HOME is not set");
+        return 1;
+    }
+    return zListDirectories(datafile, home_, stdout) ? 1 : 0;
+}
+
+/**/
+static int
+bin_zopen_classify(UNUSED(char *nam), char **args, Options ops, UNUSED(int func))
+{
+    int onlyfiles = OPT_ISSET(ops, 'f');
+    for (; *args; args++) {
+        char *path;
+        int category = openClassify(unmeta(*args), onlyfiles, &path);
+        if (category != OPEN_NONE)
+            printf("%s\t%s\n", openCategoryName(category), path);
+        free(path);
+    }
+    fflush(stdout);
+    return 0;
+}
+
+static const struct gsu_scalar colorpath_gsu =
+{ colorpathgetfn, nullstrsetfn, stdunsetfn };
+
+static struct builtin bintab[] = {
+    BUILTIN("zlist", 0, bin_zlist, 0, 1, 0, NULL, NULL),
+    BUILTIN("zopen-classify", 0, bin_zopen_classify, 1, -1, 0, "f", NULL),
+};
+
+static struct paramdef partab[] = {
+    SPECIALPMDEF("colorpath", PM_READONLY_SPECIAL, &colorpath_gsu, NULL, NULL),
+};
+
+static struct features module_features = {
+    bintab, sizeof(bintab)/sizeof(*bintab),
+    NULL, 0,
+    NULL, 0,
+    partab, sizeof(partab)/sizeof(*partab),
+    0
+};
+
+/**/
+int
+setup_(UNUSED(Module m))
+{
+    return 0;
+}
+
+/**/
+int
+features_(Module m, char ***features)
+{
+    *features = featuresarray(m, &module_features);
+    return 0;
+}
+
+/**/
+int
+enables_(Module m, int **enables)
+{
+    return handlefeatures(m, &module_features, enables);
+}
+
+/**/
+int
+boot_(UNUSED(Module m))
+{
+    return 0;
+}
+
+/**/
+int
+cleanup_(Module m)
+{
+    return setfeatureenables(m, &module_features, NULL);
+}
+
+/**/
+int
+finish_(UNUSED(Module m))
+{
+    return 0;
+}
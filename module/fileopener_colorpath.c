@@ -0,0 +1,3 @@
+// colorpath.c without its main(), for the zsh/fileopener module.
+#define FILEOPENER_MODULE
+#include "colorpath.c"
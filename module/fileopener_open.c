@@ -0,0 +1,3 @@
+// open.c without its main(), for the zsh/fileopener module.
+#define FILEOPENER_MODULE
+#include "open.c"
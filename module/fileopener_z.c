@@ -0,0 +1,3 @@
+// z.c without its main(), for the zsh/fileopener module.
+#define FILEOPENER_MODULE
+#include "z.c"
@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "colorpath.h"
+#include "dlindex.h"
+#include "fzymux.h"
+#include "gitlog.h"
+#include "gitstatus.h"
+#include "histidx.h"
+#include "lsdir.h"
+#include "open.h"
+#include "z.h"
+
+// A single binary for open, z, colorpath, gitstatus, gitlog, fzymux, lsdir,
+// histidx and dlindex that runs the program it is called as, so the shell
+// links it into ~/.local/bin under each name.
+// `file-opener <program> [args]` works as well.
+
+typedef struct Program {
+    const char *name;
+    int (*main)(int argc, char **argv);
+} Program;
+
+static const Program programs[] = {
+    { "open",      openMain },
+    { "z",         zMain },
+    { "colorpath", colorpathMain },
+    { "gitstatus", gitstatusMain },
+    { "gitlog",    gitlogMain },
+    { "fzymux",    fzymuxMain },
+    { "lsdir",     lsdirMain },
+    { "histidx",   histidxMain },
+    { "dlindex",   dlindexMain },
+};
+
+
+static const Program* findProgram(const char* path) {
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+
+    for (size_t i = 0; i < sizeof(programs) / sizeof(programs[0]); i++) {
+        if (strcmp(name, programs[i].name) == 0) {
+            return &programs[i];
+        }
+    }
+    return NULL;
+}
+
+
+int main(int argc, char **argv) {
+    const Program *program = findProgram(argv[0]);
+    if (program == NULL && argc > 1) {
+        program = findProgram(argv[1]);
+        argc--;
+        argv++;
+    }
+
+    if (program == NULL) {
+        fprintf(stderr, "usage: file-opener open|z|colorpath|gitstatus|gitlog|fzymux|lsdir|histidx|dlindex [args]\n");
+        return 1;
+    }
+    return program->main(argc, argv);
+}
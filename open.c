@@ -5,7 +5,9 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <libgen.h>
+#ifndef FILEOPENER_STATIC
 #include <pwd.h>
+#endif
 #include <signal.h>
 #include <fcntl.h>
 #include <sys/socket.h>
@@ -13,61 +15,18 @@
 #include <ctype.h>
 #include <sys/stat.h>
 
+#include "extract.h"
+#include "open.h"
+#include "trace.h"
+#include "transmission.h"
+
 #define MAX_ARGS 256
 #define MAX_EXT_LENGTH 10
 #define MAX_PATH_LENGTH 1024
 #define MAX_INPUTS 1024
 #define ERROR_RETURN 128
 
-void mpv_message(const char *socket_path, const char *path) {
-    char message[1024];
-    snprintf(message, sizeof(message), "loadfile \"%s\" append\n", path);
-
-    // Create a socket
-    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (sock == -1) {
-        perror("socket error");
-        exit(1);
-    }
-
-    // Set up the address structure
-    struct sockaddr_un addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sun_family = AF_UNIX;
-    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
-
-    // Connect to the socket
-    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
-        perror("connect error");
-        close(sock);  // Ensure the socket is properly closed
-        exit(1);
-    }
-
-    // Write the message to the socket
-    if (write(sock, message, strlen(message)) == -1) {
-        perror("write error");
-        close(sock);  // Ensure the socket is properly closed
-        exit(1);
-    }
-
-    // Close the socket
-    close(sock);
-}
-
-char* get_basename(char *path) {
-    // Find the last occurrence of '/'
-    char *last_slash = strrchr(path, '/');
-    if (last_slash != NULL) {
-        // Return the substring after the last '/'
-        return last_slash + 1;
-    } else {
-        // The path doesn't contain '/', return the original path
-        return path;
-    }
-}
-
-
-const char *get_file_extension(const char *fullname) {
+static const char *get_file_extension(const char *fullname) {
     const char *filename_with_slash = strrchr(fullname, '/');
     if (!filename_with_slash) return "";
     int length = strlen(filename_with_slash);
@@ -75,26 +34,19 @@ const char *get_file_extension(const char *fullname) {
         return "";
     }
 
-    char *filename = strdup(filename_with_slash + 1); // remove possibly leading .
-    if (!filename) return ""; // Check strdup succeeded
-
+    const char *filename = filename_with_slash + 1;
     const char *dot = strrchr(filename, '.');
     if (!dot || dot == filename) { // Check dot exists and is not the first character
-        free(filename);
         return "";
     }
-
-    char *extension = strdup(dot + 1); // Duplicate the extension part
-    free(filename); // Now we can free filename safely
-
-    if (!extension) return ""; // Check strdup succeeded
-    return extension;
+    return dot + 1;
 }
 
 
 // Function to convert a string to lower case
-char* str_to_lower(const char* str) {
+static char* str_to_lower(const char* str) {
     if (str == NULL) return NULL;
+    TRACE_COUNT(TRACE_ALLOC);
     char* lower_str = strdup(str);
     for (int i = 0; lower_str[i]; i++) {
         lower_str[i] = tolower(lower_str[i]);
@@ -103,7 +55,7 @@ char* str_to_lower(const char* str) {
 }
 
 // Function to check if the extension is in the list
-int is_extension_in_list(const char *ext, const char *list) {
+static int is_extension_in_list(const char *ext, const char *list) {
     if (ext == NULL || list == NULL) return 0;
 
     // Convert ext to lower case
@@ -111,6 +63,7 @@ int is_extension_in_list(const char *ext, const char *list) {
     if (lower_ext == NULL) return 0;
 
     // Duplicate list for strtok
+    TRACE_COUNT(TRACE_ALLOC);
     char *ext_dup = strdup(list);
     if (ext_dup == NULL) {
         free(lower_ext);
@@ -139,14 +92,21 @@ int is_extension_in_list(const char *ext, const char *list) {
     return 0;
 }
 
-// Function to expand tilde to HOME
-char* expand_tilde(const char *path) {
+// Function to expand tilde to HOME. The static build has no NSS to ask for
+// home directories, so it relies on $HOME and leaves ~user as it is.
+static char* expand_tilde(const char *path) {
     if(path[0] == '~') {
         const char *home_dir = NULL;
 
         if(path[1] == '/' || path[1] == '\0') {
             // If the path is just "~" or "~/...", use the HOME environment variable
             home_dir = getenv("HOME");
+#ifdef FILEOPENER_STATIC
+            if (!home_dir) {
+                fprintf(stderr, "Couldn't find home directory: HOME is not set\n");
+                return NULL;
+            }
+#else
             if (!home_dir) {
                 struct passwd *pwd = getpwuid(getuid());
                 if (pwd) {
@@ -156,7 +116,9 @@ char* expand_tilde(const char *path) {
                     return NULL;
                 }
             }
+#endif
         } else {
+#ifndef FILEOPENER_STATIC
             // If the path is "~username/...", get the home directory of "username"
             const char *username = path + 1;
             const char *slash = strchr(username, '/');
@@ -171,6 +133,7 @@ char* expand_tilde(const char *path) {
                     return NULL;
                 }
             }
+#endif
         }
 
         if (home_dir) {
@@ -188,7 +151,7 @@ char* expand_tilde(const char *path) {
 
 
 // Modified function to build absolute path or URL
-char* build_absolute_path_or_url(const char *path) {
+static char* build_absolute_path_or_url(const char *path) {
 
     char *expanded_path = expand_tilde(path);
     if (!expanded_path) {
@@ -213,15 +176,152 @@ char* build_absolute_path_or_url(const char *path) {
     return abs_path;
 }
 
+static void replace_percent20_with_space(char *str) {
+    char *read_ptr = str;
+    char *write_ptr = str;
+
+    // Loop through the string
+    while (*read_ptr != '\0') {
+        if (strncmp(read_ptr, "%20", 3) == 0) {  // Check for "%20"
+            *write_ptr++ = ' '; // Replace with space
+            read_ptr += 3; // Move past "%20"
+        } else {
+            *write_ptr++ = *read_ptr++; // Copy other characters
+        }
+    }
+    *write_ptr = '\0'; // Null-terminate the modified string
+}
+
+static int is_directory(const char *path) {
+    struct stat path_stat;
+    TRACE_COUNT(TRACE_STAT);
+    if (stat(path, &path_stat) != 0) {
+        // perror("stat"); // Handle error, e.g., file doesn't exist or no access
+        return -1; // Indicate error
+    }
+
+    return S_ISDIR(path_stat.st_mode);
+}
+
+const char* openCategoryName(int category) {
+    static const char *names[] = {
+        "none", "url", "magnet", "directory", "multimedia", "book",
+        "web", "picture", "libreoffice", "archive", "disabled", "other",
+    };
+    return category >= 0 && category <= OPEN_OTHER ? names[category] : "none";
+}
+
+int openClassify(const char* input, int only_files, char** path) {
+    *path = NULL;
+    if (!input || input[0] == '\0') {
+        return OPEN_NONE;
+    }
+
+    if (strncmp(input, "https://", 8) == 0 || strncmp(input, "http://", 7) == 0) {
+        *path = strdup(input);
+        return OPEN_URL;
+    }
+
+    if (strncmp(input, "magnet:", 7) == 0) {
+        *path = strdup(input);
+        return OPEN_MAGNET;
+    }
+
+    char local[MAX_PATH_LENGTH];
+    snprintf(local, sizeof(local), "%s", input);
+    char *file = local;
+    if (strncmp(file, "file://", 7) == 0) {
+        file += 7;  // Skip the "file://" part
+        char *host_end = strchr(file, '/');
+        if (host_end) {
+            // If there's a host part in the URL, skip it. Otherwise, input is already the path
+            file = host_end;
+        }
+        replace_percent20_with_space(file); // Replace "%20" with spaces for file paths
+    }
+
+    *path = build_absolute_path_or_url(file);
+    if (!*path) {
+        return OPEN_NONE;
+    }
+
+    if (only_files && is_directory(*path) == 1) {
+        return OPEN_DIRECTORY;
+    }
+
+    const char *ext = get_file_extension(*path);
+
+    if (is_extension_in_list(ext, getenv("_FILE_OPENER_MULTIMEDIA_FORMATS"))) return OPEN_MULTIMEDIA;
+    if (is_extension_in_list(ext, getenv("_FILE_OPENER_BOOK_FORMATS"))) return OPEN_BOOK;
+    if (is_extension_in_list(ext, getenv("_FILE_OPENER_WEB_FORMATS"))) return OPEN_WEB;
+    if (is_extension_in_list(ext, getenv("_FILE_OPENER_PICTURE_FORMATS"))) return OPEN_PICTURE;
+    if (is_extension_in_list(ext, getenv("_FILE_OPENER_LIBREOFFICE_FORMATS"))) return OPEN_LIBREOFFICE;
+    if (is_extension_in_list(ext, getenv("_FILE_OPENER_ARCHIVE_FORMATS"))) return OPEN_ARCHIVE;
+    if (is_extension_in_list(ext, getenv("_FILE_OPENER_EXCLUDE_SUFFIXES"))) return OPEN_DISABLED;
+    return OPEN_OTHER;
+}
+
+
+#ifndef FILEOPENER_MODULE
+static void mpv_message(const char *socket_path, const char *path) {
+    char message[1024];
+    snprintf(message, sizeof(message), "loadfile \"%s\" append\n", path);
+    TRACE_COUNT(TRACE_IPC);
+
+    // Create a socket
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock == -1) {
+        perror("socket error");
+        exit(1);
+    }
+
+    // Set up the address structure
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+
+    // Connect to the socket
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        perror("connect error");
+        close(sock);  // Ensure the socket is properly closed
+        exit(1);
+    }
+
+    // Write the message to the socket
+    if (write(sock, message, strlen(message)) == -1) {
+        perror("write error");
+        close(sock);  // Ensure the socket is properly closed
+        exit(1);
+    }
+
+    // Close the socket
+    close(sock);
+}
+
+static char* get_basename(char *path) {
+    // Find the last occurrence of '/'
+    char *last_slash = strrchr(path, '/');
+    if (last_slash != NULL) {
+        // Return the substring after the last '/'
+        return last_slash + 1;
+    } else {
+        // The path doesn't contain '/', return the original path
+        return path;
+    }
+}
+
+
 typedef struct {
     char **command; // The command and its arguments
     char **criteria; // The criteria for swaymsg
 } Opener;
 
 
-int run_cmd(char **cmd_args, int wait) {
+static int run_cmd(char **cmd_args, int wait) {
     signal(SIGCHLD, wait ? SIG_DFL: SIG_IGN);
 
+    TRACE_COUNT(TRACE_FORK);
     pid_t pid = fork();
     if (pid == 0) {
         execvp(cmd_args[0], cmd_args);
@@ -248,7 +348,7 @@ int run_cmd(char **cmd_args, int wait) {
 }
 
 
-int run_sway(char **cmd_args) {
+static int run_sway(char **cmd_args) {
     if (getenv("WAYLAND_DISPLAY") == NULL) {
         return 1;
     }
@@ -264,10 +364,19 @@ int run_sway(char **cmd_args) {
         swaymsg[i + 2] = cmd_args[i];
     }
     swaymsg[arg_count + 2] = NULL; // Correct index for NULL terminator
-    return run_cmd(swaymsg, 1); // Assume this function runs the command
+    TRACE_BEGIN("swaymsg");
+    int result = run_cmd(swaymsg, 1); // Assume this function runs the command
+    TRACE_END("swaymsg");
+    return result;
 }
 
-void launch_opener_with_files(char **command, char **file_paths, int wait) {
+static void launch_opener_with_files(char **command, char **file_paths, int wait) {
+    // FILE_OPENER_OVERRIDE_COMMAND replaces every opener, e.g. with /bin/true
+    char *override[] = {getenv("FILE_OPENER_OVERRIDE_COMMAND"), NULL};
+    if (override[0] != NULL && override[0][0] != '\0') {
+        command = override;
+    }
+
     int arg_count;
     for (arg_count = 0; command[arg_count] != NULL; arg_count++); // Count the number of opener arguments
 
@@ -292,16 +401,17 @@ void launch_opener_with_files(char **command, char **file_paths, int wait) {
 }
 
 
-char** process_argv(int argc, char **argv, int *count);
-char** process_stdin(int *count);
+static char** process_argv(int argc, char **argv, int *count);
+static char** process_stdin(int *count);
 
 
-char** process_argv(int argc, char **argv, int *count) {
+static char** process_argv(int argc, char **argv, int *count) {
     char **inputs = (char**)malloc(MAX_INPUTS * sizeof(char*));
     *count = 0; // Initialize count to 0
 
     // Start from i = 1 to skip the program name
     for (int i = 1; i < argc && *count < MAX_INPUTS; i++) {
+        TRACE_COUNT(TRACE_ALLOC);
         inputs[*count] = strdup(argv[i]); // Duplicate and store the input
         (*count)++;
     }
@@ -310,29 +420,14 @@ char** process_argv(int argc, char **argv, int *count) {
 }
 
 
-void replace_percent20_with_space(char *str) {
-    char *read_ptr = str;
-    char *write_ptr = str;
-
-    // Loop through the string
-    while (*read_ptr != '\0') {
-        if (strncmp(read_ptr, "%20", 3) == 0) {  // Check for "%20"
-            *write_ptr++ = ' '; // Replace with space
-            read_ptr += 3; // Move past "%20"
-        } else {
-            *write_ptr++ = *read_ptr++; // Copy other characters
-        }
-    }
-    *write_ptr = '\0'; // Null-terminate the modified string
-}
-
-char** process_stdin(int *count) {
+static char** process_stdin(int *count) {
     char **inputs = (char**)malloc(MAX_INPUTS * sizeof(char*));
     *count = 0; // Initialize count to 0
 
     char line[MAX_PATH_LENGTH];
     while (fgets(line, sizeof(line), stdin) && *count < MAX_INPUTS) {
         line[strcspn(line, "\n")] = 0; // Remove newline character
+        TRACE_COUNT(TRACE_ALLOC);
         inputs[*count] = strdup(line); // Duplicate and store the input
         (*count)++;
     }
@@ -341,25 +436,24 @@ char** process_stdin(int *count) {
 }
 
 
-int is_directory(const char *path) {
-    struct stat path_stat;
-    if (stat(path, &path_stat) != 0) {
-        // perror("stat"); // Handle error, e.g., file doesn't exist or no access
-        return -1; // Indicate error
-    }
-
-    return S_ISDIR(path_stat.st_mode);
-}
-
-int main(int argc, char **argv) {
+int openMain(int argc, char **argv) {
+    TRACE_INIT("open");
     int attach_mode = 0;
     int only_files = 0;
+    int classify = 0;
     int error_return = 0;
 
     if (getenv("WAYLAND_DISPLAY") == NULL) {
         attach_mode = 1;
     }
 
+    // Only print what each input would be opened as
+    if (argc > 1 && strcmp(argv[1], "--classify") == 0) {
+        classify = 1;
+        argc--;
+        argv++;
+    }
+
     // Check if the first argument is --attach
     if (argc > 1 && strcmp(argv[1], "--attach") == 0) {
         attach_mode = 1;
@@ -389,7 +483,7 @@ int main(int argc, char **argv) {
         argv++;
     }
 
-    if (!attach_mode) {
+    if (!attach_mode && !classify) {
         // Redirect stdout and stderr to /dev/null
         int dev_null_fd = open("/dev/null", O_WRONLY);
         if (dev_null_fd == -1) {
@@ -428,43 +522,53 @@ int main(int argc, char **argv) {
         inputs[argv_input_count + i] = stdin_inputs[i];
     }
 
-    // Define your opener environment variables
-    const char *exclude_suffixes = getenv("_FILE_OPENER_EXCLUDE_SUFFIXES") ? : "";
+    if (classify) {
+        TRACE_BEGIN("classify");
+        for (int i = 0; i < total_count; i++) {
+            char *path;
+            int category = openClassify(inputs[i], only_files, &path);
+            if (category != OPEN_NONE) {
+                printf("%s\t%s\n", openCategoryName(category), path);
+            }
+            free(path);
+            free(inputs[i]);
+        }
+        TRACE_END("classify");
+        free(inputs);
+        return 0;
+    }
+
+    // Define your openers
     char *disabled_files[total_count];
 
 
-    const char *multimedia_formats = getenv("_FILE_OPENER_MULTIMEDIA_FORMATS") ? : "";
     char *multimedia_command[] = {"mpv", NULL};
     char *multimedia_criteria[] = {"[app_id=^mpv$]", "focus", NULL};
     Opener multimedia_opener = {multimedia_command, multimedia_criteria};
     char *multimedia_files[total_count];
 
-    const char *book_formats = getenv("_FILE_OPENER_BOOK_FORMATS") ? : "";
     char *book_command[] = {"/usr/bin/zathura", NULL};
     char *book_criteria[] = {"[app_id=^org.pwmt.zathura$]", "focus", NULL};
     Opener book_opener = {book_command, book_criteria};
     char *book_files[total_count];
 
-    const char *picture_formats = getenv("_FILE_OPENER_PICTURE_FORMATS") ? : "";
     char *picture_command[] = {"eog", NULL};
     char *picture_criteria[] = {"[app_id=^eog$]", "focus", NULL};
     Opener picture_opener = {picture_command, picture_criteria};
     char *picture_files[total_count];
 
-    const char *libreoffice_formats = getenv("_FILE_OPENER_LIBREOFFICE_FORMATS") ? : "";
     char *libreoffice_command[] = {"/usr/bin/libreoffice", "--norestore", NULL};
     char *libreoffice_criteria[] = {"[app_id=^libreoffice$]", "focus", NULL};
     Opener libreoffice_opener = {libreoffice_command, libreoffice_criteria};
     char *libreoffice_files[total_count];
 
-    const char *web_formats = getenv("_FILE_OPENER_WEB_FORMATS") ? : "";
     char *firefox_command[] = {"firefox", NULL};
     char *firefox_criteria[] = {"app_id=^firefox$","focus", NULL};
     Opener firefox_opener = {firefox_command, firefox_criteria};
     char *web_files[total_count];
     char *url_files[total_count];
 
-    const char *archive_formats = getenv("_FILE_OPENER_ARCHIVE_FORMATS") ? : "";
+    char *archive_files[total_count];
 
     char *editor_command[3];  // Fixed size array, large enough to hold all possible arguments
     char *editor_criteria[] = {"[app_id=^sublime_text$]","focus", NULL};
@@ -484,63 +588,76 @@ int main(int argc, char **argv) {
 
     char *magnet_files[total_count];
 
-    int multimedia_count = 0, book_count = 0, picture_count = 0, other_count = 0, web_count = 0, url_count = 0, disabled_count = 0, magnet_count = 0, libreoffice_count = 0;
+    int multimedia_count = 0, book_count = 0, picture_count = 0, other_count = 0, web_count = 0, url_count = 0, disabled_count = 0, magnet_count = 0, libreoffice_count = 0, archive_count = 0;
 
+    TRACE_BEGIN("classify");
     for (int i = 0; i < total_count; i++) {
-        char *input = inputs[i];
-
-        if (!input || input[0] == '\0') {
-            continue;
-        }
-
-        if (strncmp(input, "https://", 8) == 0 || strncmp(input, "http://", 7) == 0) {
-            url_files[url_count++] = strdup(input);
-            continue;
-        }
-
-        if (strncmp(input, "magnet:", 7) == 0) {
-            magnet_files[magnet_count++] = strdup(input);
-            continue;
-        }
-
-        if (strncmp(input, "file://", 7) == 0) {
-            input += 7;  // Skip the "file://" part
-            char *host_end = strchr(input, '/');
-            if (host_end) {
-                // If there's a host part in the URL, skip it. Otherwise, input is already the path
-                input = host_end;
-            }
-            replace_percent20_with_space(input); // Replace "%20" with spaces for file paths
-        }
-
-        input = build_absolute_path_or_url(input);
-
-        if(!input) {
-            continue;
-        }
-
-        if (only_files && is_directory(input) == 1) {
-            disabled_files[disabled_count++] = input;
-            continue;
-        }
-
-        const char *ext = get_file_extension(input);
-
-
-        if (is_extension_in_list(ext, multimedia_formats)) {
+        char *input;
+        switch (openClassify(inputs[i], only_files, &input)) {
+        case OPEN_URL:
+            url_files[url_count++] = input;
+            break;
+        case OPEN_MAGNET:
+            magnet_files[magnet_count++] = input;
+            break;
+        case OPEN_MULTIMEDIA:
             multimedia_files[multimedia_count++] = input;
-        } else if(is_extension_in_list(ext, book_formats)) {
+            break;
+        case OPEN_BOOK:
             book_files[book_count++] = input;
-        } else if(is_extension_in_list(ext, web_formats)) {
+            break;
+        case OPEN_WEB:
             web_files[web_count++] = input;
-        } else if(is_extension_in_list(ext, picture_formats)) {
+            break;
+        case OPEN_PICTURE:
             picture_files[picture_count++] = input;
-        } else if(is_extension_in_list(ext, libreoffice_formats)) {
+            break;
+        case OPEN_LIBREOFFICE:
             libreoffice_files[libreoffice_count++] = input;
-        } else if(is_extension_in_list(ext, exclude_suffixes)) {
+            break;
+        case OPEN_ARCHIVE:
+            archive_files[archive_count++] = input;
+            break;
+        case OPEN_DIRECTORY:
+        case OPEN_DISABLED:
             disabled_files[disabled_count++] = input;
-        } else {
+            break;
+        case OPEN_OTHER:
             other_files[other_count++] = input;
+            break;
+        }
+    }
+    TRACE_END("classify");
+
+    // Archives are reported with the disabled files by where they were
+    // extracted to, or as themselves for extract.sh if they could not be.
+    if (archive_count > 0) {
+        TRACE_BEGIN("extract");
+        char *destinations[archive_count];
+        const char *into = getenv("FILE_OPENER_EXTRACT_TO");
+        extractArchives(archive_files, archive_count, into && *into ? into : NULL, destinations);
+        for (int i = 0; i < archive_count; i++) {
+            if (destinations[i] != NULL) {
+                free(archive_files[i]);
+                disabled_files[disabled_count++] = destinations[i];
+            } else {
+                disabled_files[disabled_count++] = archive_files[i];
+            }
+        }
+        TRACE_END("extract");
+    }
+
+    // Transmission's RPC takes the magnets over one connection before stderr
+    // is dropped, so the links it turns down are reported with the disabled
+    // files; the script is left for when it is not running or an override
+    // is in place
+    int magnets_submitted = 0;
+    if (magnet_count > 0) {
+        const char *override = getenv("FILE_OPENER_OVERRIDE_COMMAND");
+        int rejected = override && override[0] ? -1 : transmissionAddMagnets(magnet_files, magnet_count);
+        if (rejected != -1) {
+            error_return += rejected;
+            magnets_submitted = 1;
         }
     }
 
@@ -572,8 +689,9 @@ int main(int argc, char **argv) {
         close(dev_null_fd);
     }
 
+    TRACE_BEGIN("launch");
     magnet_files[magnet_count] = NULL;
-    if(magnet_count > 0) {
+    if(magnet_count > 0 && !magnets_submitted) {
         char *torrent_command[] = {"transmission.sh", NULL};
         launch_opener_with_files(torrent_command, magnet_files, attach_mode);
     }
@@ -582,7 +700,7 @@ int main(int argc, char **argv) {
     multimedia_files[multimedia_count] = NULL;
     if (multimedia_count > 0) {
         if (run_sway(multimedia_opener.criteria)) {
-            const char *socket_path = "/tmp/mpvsocket";
+            const char *socket_path = getenv("FILE_OPENER_MPV_SOCKET") ? : "/tmp/mpvsocket";
             for (int i = 0; i < multimedia_count; i++) {
                 mpv_message(socket_path, multimedia_files[i]);
             }
@@ -656,6 +774,7 @@ int main(int argc, char **argv) {
     for (int i = 0; i < other_count; i++) {
         free(other_files[i]);
     }
+    TRACE_END("launch");
 
     for (int i = 0; i < total_count; i++) {
         free(inputs[i]);
@@ -674,3 +793,10 @@ int main(int argc, char **argv) {
 
     return disabled_count + error_return;
 }
+
+#ifndef FILEOPENER_MULTICALL
+int main(int argc, char **argv) {
+    return openMain(argc, argv);
+}
+#endif
+#endif
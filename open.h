@@ -0,0 +1,28 @@
+#ifndef OPEN_H
+#define OPEN_H
+
+// What open does with an input, in the order the checks are made.
+#define OPEN_NONE        0  // empty or unresolvable
+#define OPEN_URL         1
+#define OPEN_MAGNET      2
+#define OPEN_DIRECTORY   3  // only with --only-files, reported back like disabled files
+#define OPEN_MULTIMEDIA  4
+#define OPEN_BOOK        5
+#define OPEN_WEB         6
+#define OPEN_PICTURE     7
+#define OPEN_LIBREOFFICE 8
+#define OPEN_ARCHIVE     9  // extracted, reported back by where it went
+#define OPEN_DISABLED    10 // _FILE_OPENER_EXCLUDE_SUFFIXES
+#define OPEN_OTHER       11
+
+// Sorts an input into one of the OPEN_* categories using the
+// _FILE_OPENER_*_FORMATS lists. *path receives the malloc'd URL or absolute
+// path the opener would be given, or NULL.
+int openClassify(const char* input, int only_files, char** path);
+
+const char* openCategoryName(int category);
+
+// The open program itself, called by main or by the multi-call binary.
+int openMain(int argc, char** argv);
+
+#endif
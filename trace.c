@@ -0,0 +1,160 @@
+#ifdef FILEOPENER_TRACE
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+// events beyond this are dropped, and the drop is reported
+#define MAX_EVENTS 65536
+#define MAX_PHASES 64
+#define MAX_DEPTH 32
+
+typedef struct TraceEvent {
+    const char *phase;
+    uint64_t ns;
+    int begin;
+} TraceEvent;
+
+int traceFd = -1;
+unsigned long traceCounts[TRACE_COUNTERS];
+
+static const char *counterNames[TRACE_COUNTERS] = { "stat", "open", "fork", "ipc", "alloc" };
+
+static const char *traceProgram;
+static int traceChrome;
+static pid_t tracePid;
+static uint64_t traceStart;
+static TraceEvent *events;
+static size_t eventCount;
+static size_t dropped;
+
+
+static uint64_t traceNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static void record(const char* phase, int begin) {
+    if (eventCount == MAX_EVENTS) {
+        dropped++;
+        return;
+    }
+    events[eventCount++] = (TraceEvent){ phase, traceNs(), begin };
+}
+
+void traceBegin(const char* phase) {
+    record(phase, 1);
+}
+
+void traceEnd(const char* phase) {
+    record(phase, 0);
+}
+
+
+static void writeChrome(FILE* out, uint64_t end) {
+    fprintf(out, "{\"traceEvents\": [\n");
+    fprintf(out, "{\"name\": \"%s\", \"ph\": \"X\", \"ts\": 0, \"dur\": %.3f, \"pid\": %d, \"tid\": %d}",
+            traceProgram, (end - traceStart) / 1e3, tracePid, tracePid);
+    for (size_t i = 0; i < eventCount; i++) {
+        fprintf(out, ",\n{\"name\": \"%s\", \"ph\": \"%s\", \"ts\": %.3f, \"pid\": %d, \"tid\": %d}",
+                events[i].phase, events[i].begin ? "B" : "E",
+                (events[i].ns - traceStart) / 1e3, tracePid, tracePid);
+    }
+    fprintf(out, ",\n{\"name\": \"counts\", \"ph\": \"C\", \"ts\": %.3f, \"pid\": %d, \"args\": {",
+            (end - traceStart) / 1e3, tracePid);
+    for (int i = 0; i < TRACE_COUNTERS; i++) {
+        fprintf(out, "%s\"%s\": %lu", i ? ", " : "", counterNames[i], traceCounts[i]);
+    }
+    fprintf(out, "}}\n], \"otherData\": {\"dropped\": %zu}}\n", dropped);
+}
+
+
+// One line: the total time, every counter and for each phase its time
+// summed over all calls and the number of calls, in order of appearance.
+static void writeSummary(FILE* out, uint64_t end) {
+    struct { const char *phase; uint64_t ns; unsigned long calls; } phases[MAX_PHASES];
+    size_t phaseCount = 0;
+    const TraceEvent *open[MAX_DEPTH];
+    size_t depth = 0;
+
+    for (size_t i = 0; i < eventCount; i++) {
+        if (events[i].begin) {
+            if (depth < MAX_DEPTH) open[depth++] = &events[i];
+            continue;
+        }
+        if (depth == 0 || strcmp(open[depth - 1]->phase, events[i].phase) != 0) continue;
+
+        const TraceEvent *begin = open[--depth];
+        size_t p = 0;
+        while (p < phaseCount && strcmp(phases[p].phase, begin->phase) != 0) p++;
+        if (p == phaseCount) {
+            if (phaseCount == MAX_PHASES) continue;
+            phases[phaseCount++] = (typeof(phases[0])){ begin->phase, 0, 0 };
+        }
+        phases[p].ns += events[i].ns - begin->ns;
+        phases[p].calls++;
+    }
+
+    fprintf(out, "%s %.3fms", traceProgram, (end - traceStart) / 1e6);
+    for (int i = 0; i < TRACE_COUNTERS; i++) {
+        fprintf(out, " %s=%lu", counterNames[i], traceCounts[i]);
+    }
+    for (size_t p = 0; p < phaseCount; p++) {
+        fprintf(out, " %s=%.3fms/%lu", phases[p].phase, phases[p].ns / 1e6, phases[p].calls);
+    }
+    if (dropped) {
+        fprintf(out, " dropped=%zu", dropped);
+    }
+    fprintf(out, "\n");
+}
+
+
+static void traceFlush(void) {
+    // children that exit without exec'ing leave the trace to their parent
+    if (traceFd == -1 || getpid() != tracePid) return;
+
+    uint64_t end = traceNs();
+    FILE *out = fdopen(dup(traceFd), "w");
+    if (out != NULL) {
+        if (traceChrome) {
+            writeChrome(out, end);
+        } else {
+            writeSummary(out, end);
+        }
+        fclose(out);
+    }
+    free(events);
+    traceFd = -1;
+}
+
+
+void traceInit(const char* program) {
+    const char *spec = getenv("FILE_OPENER_TRACE");
+    if (spec == NULL || spec[0] == '\0') return;
+
+    if (strncmp(spec, "chrome", 6) == 0) {
+        traceChrome = 1;
+        spec += 6;
+    } else if (strncmp(spec, "summary", 7) == 0) {
+        spec += 7;
+    } else {
+        return;
+    }
+    int fd = spec[0] == ':' ? atoi(spec + 1) : STDERR_FILENO;
+
+    events = malloc(sizeof(TraceEvent) * MAX_EVENTS);
+    if (events == NULL) return;
+    traceProgram = program;
+    tracePid = getpid();
+    traceStart = traceNs();
+    traceFd = fd;
+    atexit(traceFlush);
+}
+#endif
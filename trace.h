@@ -0,0 +1,45 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Phase timings and counts of the expensive operations on the hot paths of
+// open, z and colorpath. Compiled in only with -DFILEOPENER_TRACE; without
+// it every macro below expands to nothing.
+//
+// A traced build records only when FILE_OPENER_TRACE is set in the
+// environment, to "summary" or "chrome" optionally followed by ":<fd>"
+// (stderr by default). At exit it writes either a one-line summary or the
+// phases as Chrome trace-event JSON for chrome://tracing or Perfetto, e.g.
+//
+//   FILE_OPENER_TRACE=chrome:9 colorpath 9>trace.json
+
+#define TRACE_STAT   0  // stat and fstatat calls
+#define TRACE_OPEN   1  // files and directories opened
+#define TRACE_FORK   2  // processes started
+#define TRACE_IPC    3  // round trips to another process
+#define TRACE_ALLOC  4  // heap allocations
+#define TRACE_COUNTERS 5
+
+#ifdef FILEOPENER_TRACE
+
+extern int traceFd;
+extern unsigned long traceCounts[TRACE_COUNTERS];
+
+void traceInit(const char* program);
+void traceBegin(const char* phase);
+void traceEnd(const char* phase);
+
+#define TRACE_INIT(program)  traceInit(program)
+#define TRACE_BEGIN(phase)   do { if (traceFd != -1) traceBegin(phase); } while (0)
+#define TRACE_END(phase)     do { if (traceFd != -1) traceEnd(phase); } while (0)
+#define TRACE_COUNT(counter) ((void)traceCounts[counter]++)
+
+#else
+
+#define TRACE_INIT(program)  ((void)0)
+#define TRACE_BEGIN(phase)   ((void)0)
+#define TRACE_END(phase)     ((void)0)
+#define TRACE_COUNT(counter) ((void)0)
+
+#endif
+
+#endif
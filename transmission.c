@@ -0,0 +1,418 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "trace.h"
+#include "transmission.h"
+
+// Only as much HTTP/1.1 as Transmission's RPC server speaks: plain http,
+// bodies of a known Content-Length or ending with the connection.
+
+#define PIPELINE_DEPTH 32
+#define IO_TIMEOUT_SECONDS 5
+#define MAX_STALLS 3
+#define SESSION_ID_MAX 128
+#define HEADER_LINE_MAX 1024
+#define READ_BUFFER 16384
+
+typedef struct Endpoint {
+    char authority[256];    // host[:port] for the Host header
+    char host[256];
+    char port[8];
+    char path[1024];
+    char authorization[512];    // base64 of user:password, empty without
+} Endpoint;
+
+typedef struct Connection {
+    int fd;
+    char buffer[READ_BUFFER];
+    size_t start, end;
+} Connection;
+
+typedef struct Response {
+    int status;
+    int closes;         // the server hangs up after it
+    char sessionId[SESSION_ID_MAX];
+    char *body;
+    size_t bodySize;
+} Response;
+
+typedef struct Buffer {
+    char *data;
+    size_t size, capacity;
+} Buffer;
+
+
+static int bufferAdd(Buffer* buffer, const char* data, size_t len) {
+    if (buffer->size + len > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity * 2 : 4096;
+        while (capacity < buffer->size + len) capacity *= 2;
+        char *grown = realloc(buffer->data, capacity);
+        if (grown == NULL) return -1;
+        TRACE_COUNT(TRACE_ALLOC);
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->size, data, len);
+    buffer->size += len;
+    return 0;
+}
+
+static int bufferPrintf(Buffer* buffer, const char* format, ...) __attribute__((format(printf, 2, 3)));
+static int bufferPrintf(Buffer* buffer, const char* format, ...) {
+    char line[HEADER_LINE_MAX + 64];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (len < 0 || (size_t)len >= sizeof(line)) return -1;
+    return bufferAdd(buffer, line, len);
+}
+
+static void base64(const char* in, size_t len, char* out, size_t size) {
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t o = 0;
+    for (size_t i = 0; i < len && o + 5 <= size; i += 3) {
+        unsigned int group = (unsigned char)in[i] << 16;
+        if (i + 1 < len) group |= (unsigned char)in[i + 1] << 8;
+        if (i + 2 < len) group |= (unsigned char)in[i + 2];
+        out[o++] = digits[group >> 18 & 63];
+        out[o++] = digits[group >> 12 & 63];
+        out[o++] = i + 1 < len ? digits[group >> 6 & 63] : '=';
+        out[o++] = i + 2 < len ? digits[group & 63] : '=';
+    }
+    out[o] = '\0';
+}
+
+// Splits http://[user:password@]host[:port][/path]. Returns 0 on success.
+static int parseEndpoint(const char* url, Endpoint* endpoint) {
+    memset(endpoint, 0, sizeof(Endpoint));
+    if (strncmp(url, "http://", 7) != 0) return -1;
+    const char *authority = url + 7;
+    const char *slash = strchr(authority, '/');
+    size_t authorityLen = slash ? (size_t)(slash - authority) : strlen(authority);
+    snprintf(endpoint->path, sizeof(endpoint->path), "%s", slash ? slash : "/transmission/rpc");
+
+    const char *at = memrchr(authority, '@', authorityLen);
+    if (at != NULL) {
+        base64(authority, at - authority, endpoint->authorization, sizeof(endpoint->authorization));
+        authorityLen -= at + 1 - authority;
+        authority = at + 1;
+    }
+    if (authorityLen == 0 || authorityLen >= sizeof(endpoint->authority)) return -1;
+    memcpy(endpoint->authority, authority, authorityLen);
+
+    // [v6 address]:port or host:port
+    const char *hostEnd = authority + authorityLen;
+    const char *host = authority;
+    if (*host == '[') {
+        host++;
+        hostEnd = memchr(host, ']', authorityLen - 1);
+        if (hostEnd == NULL) return -1;
+    } else {
+        const char *colon = memchr(authority, ':', authorityLen);
+        if (colon != NULL) hostEnd = colon;
+    }
+    snprintf(endpoint->host, sizeof(endpoint->host), "%.*s", (int)(hostEnd - host), host);
+    const char *colon = memchr(hostEnd, ':', authority + authorityLen - hostEnd);
+    snprintf(endpoint->port, sizeof(endpoint->port), "%.*s",
+             colon ? (int)(authority + authorityLen - colon - 1) : 2, colon ? colon + 1 : "80");
+    return endpoint->host[0] && endpoint->port[0] ? 0 : -1;
+}
+
+static int connectAddress(const struct sockaddr* address, socklen_t length) {
+    int fd = socket(address->sa_family, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
+    if (fd == -1) return -1;
+    struct timeval timeout = { IO_TIMEOUT_SECONDS, 0 };
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    if (connect(fd, address, length) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Literal addresses and localhost are connected to without a lookup. The
+// static build has no NSS for getaddrinfo, so it takes nothing else and
+// open falls back to transmission.sh for other host names.
+static int connectTo(const Endpoint* endpoint, Connection* connection) {
+    connection->start = connection->end = 0;
+    char *end;
+    unsigned long port = strtoul(endpoint->port, &end, 10);
+    int numericPort = *end == '\0' && port > 0 && port <= 65535;
+
+    struct sockaddr_in v4 = { .sin_family = AF_INET, .sin_port = htons(port) };
+    struct sockaddr_in6 v6 = { .sin6_family = AF_INET6, .sin6_port = htons(port) };
+    const char *host = strcmp(endpoint->host, "localhost") == 0 ? "127.0.0.1" : endpoint->host;
+    if (numericPort && inet_pton(AF_INET, host, &v4.sin_addr) == 1) {
+        connection->fd = connectAddress((struct sockaddr*)&v4, sizeof(v4));
+        return connection->fd == -1 ? -1 : 0;
+    }
+    if (numericPort && inet_pton(AF_INET6, host, &v6.sin6_addr) == 1) {
+        connection->fd = connectAddress((struct sockaddr*)&v6, sizeof(v6));
+        return connection->fd == -1 ? -1 : 0;
+    }
+
+#ifdef FILEOPENER_STATIC
+    connection->fd = -1;
+    return -1;
+#else
+    struct addrinfo hints, *addresses;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(endpoint->host, endpoint->port, &hints, &addresses) != 0) return -1;
+
+    int fd = -1;
+    for (struct addrinfo *address = addresses; address != NULL && fd == -1; address = address->ai_next) {
+        fd = connectAddress(address->ai_addr, address->ai_addrlen);
+    }
+    freeaddrinfo(addresses);
+    connection->fd = fd;
+    return fd == -1 ? -1 : 0;
+#endif
+}
+
+static void disconnect(Connection* connection) {
+    if (connection->fd != -1) close(connection->fd);
+    connection->fd = -1;
+}
+
+static int writeAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        data += n;
+        size -= n;
+    }
+    return 0;
+}
+
+// Reads more into the connection's buffer. Returns the bytes read, 0 at
+// the end of the stream or -1.
+static ssize_t fill(Connection* connection) {
+    if (connection->start > 0) {
+        memmove(connection->buffer, connection->buffer + connection->start, connection->end - connection->start);
+        connection->end -= connection->start;
+        connection->start = 0;
+    }
+    if (connection->end == sizeof(connection->buffer)) return -1;
+    ssize_t n;
+    do {
+        n = read(connection->fd, connection->buffer + connection->end, sizeof(connection->buffer) - connection->end);
+    } while (n == -1 && errno == EINTR);
+    if (n > 0) connection->end += n;
+    return n;
+}
+
+// Reads a line without its CRLF. Returns 0 on success.
+static int readLine(Connection* connection, char* line, size_t size) {
+    for (;;) {
+        char *start = connection->buffer + connection->start;
+        char *newline = memchr(start, '\n', connection->end - connection->start);
+        if (newline != NULL) {
+            size_t len = newline - start;
+            if (len > 0 && start[len - 1] == '\r') len--;
+            snprintf(line, size, "%.*s", (int)len, start);
+            connection->start += newline + 1 - start;
+            return 0;
+        }
+        if (fill(connection) <= 0) return -1;
+    }
+}
+
+static int readResponse(Connection* connection, Response* response) {
+    char line[HEADER_LINE_MAX];
+    memset(response, 0, sizeof(Response));
+    int minor;
+    if (readLine(connection, line, sizeof(line)) != 0
+            || sscanf(line, "HTTP/1.%d %d", &minor, &response->status) != 2) {
+        return -1;
+    }
+    response->closes = minor == 0;
+
+    long long length = -1;
+    for (;;) {
+        if (readLine(connection, line, sizeof(line)) != 0) return -1;
+        if (line[0] == '\0') break;
+        char *colon = strchr(line, ':');
+        if (colon == NULL) continue;
+        *colon = '\0';
+        char *value = colon + 1;
+        while (*value == ' ' || *value == '\t') value++;
+        if (strcasecmp(line, "Content-Length") == 0) {
+            length = strtoll(value, NULL, 10);
+        } else if (strcasecmp(line, "Connection") == 0) {
+            response->closes = strcasecmp(value, "close") == 0 || (minor == 0 && strcasecmp(value, "keep-alive") != 0);
+        } else if (strcasecmp(line, "X-Transmission-Session-Id") == 0) {
+            snprintf(response->sessionId, sizeof(response->sessionId), "%s", value);
+        } else if (strcasecmp(line, "Transfer-Encoding") == 0 && strcasecmp(value, "identity") != 0) {
+            return -1;
+        }
+    }
+    if (length < 0) response->closes = 1;
+
+    Buffer body = { NULL, 0, 0 };
+    for (;;) {
+        size_t available = connection->end - connection->start;
+        size_t wanted = length < 0 || (size_t)length - body.size > available ? available : (size_t)length - body.size;
+        if (bufferAdd(&body, connection->buffer + connection->start, wanted) != 0) break;
+        connection->start += wanted;
+        if (length >= 0 && body.size == (size_t)length) break;
+        ssize_t n = fill(connection);
+        if (n == 0 && length < 0) break;
+        if (n <= 0) {
+            free(body.data);
+            return -1;
+        }
+    }
+    bufferAdd(&body, "", 1);
+    if (body.data == NULL) return -1;
+    response->body = body.data;
+    response->bodySize = body.size - 1;
+    return 0;
+}
+
+
+static int addJsonString(Buffer* buffer, const char* value) {
+    int failed = bufferAdd(buffer, "\"", 1);
+    for (const char *p = value; *p; p++) {
+        unsigned char c = *p;
+        if (c == '"' || c == '\\') {
+            char escaped[2] = { '\\', c };
+            failed |= bufferAdd(buffer, escaped, 2);
+        } else if (c < 0x20) {
+            failed |= bufferPrintf(buffer, "\\u%04x", c);
+        } else {
+            failed |= bufferAdd(buffer, p, 1);
+        }
+    }
+    return failed | bufferAdd(buffer, "\"", 1);
+}
+
+static int addRequest(Buffer* buffer, const Endpoint* endpoint, const char* sessionId, const char* magnet, int tag) {
+    static const char method[] = "{\"method\":\"torrent-add\",\"arguments\":{\"filename\":";
+    Buffer body = { NULL, 0, 0 };
+    int failed = bufferAdd(&body, method, sizeof(method) - 1)
+        | addJsonString(&body, magnet)
+        | bufferPrintf(&body, "},\"tag\":%d}", tag);
+
+    failed |= bufferPrintf(buffer, "POST %s HTTP/1.1\r\nHost: %s\r\n", endpoint->path, endpoint->authority)
+        | bufferPrintf(buffer, "Content-Type: application/json\r\nContent-Length: %zu\r\n", body.size);
+    if (endpoint->authorization[0]) failed |= bufferPrintf(buffer, "Authorization: Basic %s\r\n", endpoint->authorization);
+    if (sessionId[0]) failed |= bufferPrintf(buffer, "X-Transmission-Session-Id: %s\r\n", sessionId);
+    failed |= bufferAdd(buffer, "\r\n", 2) | (body.data ? bufferAdd(buffer, body.data, body.size) : -1);
+    free(body.data);
+    return failed ? -1 : 0;
+}
+
+// Whether a reply says "result": "success", duplicates included.
+static int succeeded(const char* body) {
+    const char *key = strstr(body, "\"result\"");
+    if (key == NULL) return 0;
+    const char *p = key + 8;
+    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') p++;
+    if (*p++ != ':') return 0;
+    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') p++;
+    return strncmp(p, "\"success\"", 9) == 0;
+}
+
+// Sends the magnets [first, end) back to back and reads their replies in
+// order, stopping at a 409, which carries the session id to use instead, or
+// at any status Transmission does not answer requests with. Returns the
+// index of the first magnet left unanswered.
+static int exchange(Connection* connection, const Endpoint* endpoint, char* sessionId,
+                    char** magnets, int first, int end, int* failed, int* refused) {
+    Buffer requests = { NULL, 0, 0 };
+    int ok = 1;
+    for (int i = first; i < end && ok; i++) ok = addRequest(&requests, endpoint, sessionId, magnets[i], i) == 0;
+    TRACE_COUNT(TRACE_IPC);
+    ok = ok && writeAll(connection->fd, requests.data, requests.size) == 0;
+    free(requests.data);
+
+    int next = first, closes = !ok;
+    while (next < end && !closes) {
+        Response response;
+        if (readResponse(connection, &response) != 0) {
+            closes = 1;
+            break;
+        }
+        closes = response.closes;
+        if (response.status == 409) {
+            snprintf(sessionId, SESSION_ID_MAX, "%s", response.sessionId);
+            free(response.body);
+            // the requests after it carried the old id as well
+            closes |= next + 1 < end;
+            break;
+        }
+        if (response.status != 200) {
+            fprintf(stderr, "transmission: HTTP %d\n", response.status);
+            free(response.body);
+            *refused = 1;
+            closes = 1;
+            break;
+        }
+        if (!succeeded(response.body)) {
+            fprintf(stderr, "%s\n", magnets[next]);
+            (*failed)++;
+        }
+        free(response.body);
+        next++;
+    }
+    if (closes) disconnect(connection);
+    return next;
+}
+
+int transmissionAddMagnets(char** magnets, int count) {
+    const char *url = getenv("FILE_OPENER_TRANSMISSION_RPC");
+    Endpoint endpoint;
+    if (parseEndpoint(url && url[0] ? url : TRANSMISSION_DEFAULT_RPC, &endpoint) != 0) {
+        fprintf(stderr, "transmission: %s: not an http:// URL\n", url);
+        return -1;
+    }
+    Connection *connection = malloc(sizeof(Connection));
+    if (connection == NULL) return -1;
+    connection->fd = -1;
+
+    TRACE_BEGIN("transmission");
+    char sessionId[SESSION_ID_MAX] = "";
+    int next = 0, failed = 0, refused = 0, stalls = 0, answered = 0;
+    while (next < count && !refused && stalls < MAX_STALLS) {
+        if (connection->fd == -1 && connectTo(&endpoint, connection) != 0) break;
+        // one request at a time until one got through with the session id
+        int end = answered && next + PIPELINE_DEPTH < count ? next + PIPELINE_DEPTH : answered ? count : next + 1;
+        int reached = exchange(connection, &endpoint, sessionId, magnets, next, end, &failed, &refused);
+        if (reached > next) {
+            answered = 1;
+            stalls = 0;
+        } else {
+            stalls++;
+        }
+        next = reached;
+    }
+    disconnect(connection);
+    free(connection);
+    TRACE_END("transmission");
+
+    if (next == 0) return -1;
+    for (int i = next; i < count; i++) {
+        fprintf(stderr, "%s\n", magnets[i]);
+        failed++;
+    }
+    return failed;
+}
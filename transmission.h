@@ -0,0 +1,17 @@
+#ifndef TRANSMISSION_H
+#define TRANSMISSION_H
+
+// Where torrent-add requests go unless FILE_OPENER_TRANSMISSION_RPC names
+// another http://[user:password@]host[:port][/path] endpoint.
+#define TRANSMISSION_DEFAULT_RPC "http://127.0.0.1:9091/transmission/rpc"
+
+// Hands magnet links to Transmission as torrent-add requests over its
+// JSON-RPC, all on one keep-alive connection: the first request settles the
+// X-Transmission-Session-Id handshake and the others are pipelined after
+// it. Links Transmission turns down are written to stderr, and what went
+// wrong with the endpoint as a line starting with "transmission: ". Returns
+// how many it did not take, or -1 if it could not be reached at all and
+// none were submitted.
+int transmissionAddMagnets(char** magnets, int count);
+
+#endif
@@ -1,60 +1,67 @@
+#define _GNU_SOURCE
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "gitrepo.h"
+#include "trace.h"
+#include "z.h"
 
 #define MAX_HASH 8179
 #define MAX_ENTRIES 10000
 
+// entries must stay dead this long before they are pruned, so that
+// briefly unmounted volumes survive; override with ZSHZ_PRUNE_AFTER
+#define PRUNE_AFTER (7 * 24 * 60 * 60)
+#define LOCK_ATTEMPTS 50
 
-const char resetColor[] = "\x1b[0m";
-const size_t resetColorLen = sizeof(resetColor) - 1;
 
-const char pathString[] = "/\x1b[36m";
-const size_t pathStringLen = sizeof(pathString) - 1;
+static const char resetColor[] = "\x1b[0m";
+static const size_t resetColorLen = sizeof(resetColor) - 1;
 
-const char gitString[] = "/\x1b[36;1m";
-const size_t gitStringLen = sizeof(gitString) - 1;
+static const char pathString[] = "/\x1b[36m";
+static const size_t pathStringLen = sizeof(pathString) - 1;
 
-const char homePathString[] = "\x1b[36m~";
-const size_t homePathStringLen = sizeof(homePathString) - 1;
+static const char gitString[] = "/\x1b[36;1m";
+static const size_t gitStringLen = sizeof(gitString) - 1;
 
+static const char homePathString[] = "\x1b[36m~";
+static const size_t homePathStringLen = sizeof(homePathString) - 1;
 
-int directoryHasGit(const char* path) {
-    struct stat sb;
-    char gitPath[1024];
 
-    // Construct the .git path
-    snprintf(gitPath, sizeof(gitPath), "%s/.git", path);
+// Returns 0 if path does not exist, 1 for a plain directory and 2 for the
+// root of a git repository. The directory is probed relative to parentFd
+// when the parent's descriptor is still open; its own descriptor is stored
+// in fdOut for the children.
+static int directoryHasGit(int parentFd, const char* path, int* fdOut) {
+    GitRepo repo;
+    int kind;
 
-    // Check the .git subdirectory
-    if (stat(gitPath, &sb) == 0) {
-        // Successfully got info about .git, check if it's a directory
-        if (S_ISDIR(sb.st_mode)) {
-            return 2; // Is a directory and has a .git subdirectory
-        }
+    if (parentFd != -1) {
+        kind = gitProbeAt(parentFd, strrchr(path, '/') + 1, fdOut, &repo);
     } else {
-        // stat failed, check the error code
-        if (errno == ENOENT) {
-            // .git subdirectory does not exist
-            // Need to check if the parent is a directory
-            if (stat(path, &sb) == 0 && S_ISDIR(sb.st_mode)) {
-                return 1; // Parent is a directory, but no .git subdirectory
-            }
-        } else if (errno == ENOTDIR) {
-            // A part of the path is not a directory, could be any part
-            return 0; // Not a directory
-        }
+        kind = gitProbeAt(AT_FDCWD, path, fdOut, &repo);
     }
 
-    // Default case: if none of the above conditions are met
-    return 0;
+    // out of descriptors, fall back to resolving the full path
+    if (kind == -1 && errno == EMFILE) {
+        *fdOut = -1;
+        kind = gitProbeAt(AT_FDCWD, path, NULL, &repo);
+    }
+
+    if (kind == -1) return 0;
+    return kind == GIT_REPO_NONE ? 1 : 2;
 }
 
 
-unsigned long hashFunction(const char* str) {
+static unsigned long hashFunction(const char* str) {
     unsigned long hash = 5381;
     int c;
 
@@ -71,13 +78,15 @@ typedef struct Node {
     char *path;
     char *prettyPath;
     int prettyPathLen;
+    int fd;
     struct Node *prev, *next;
     struct Node *lruNext, *lruPrev; // For LRU cache's ordering
     struct Node *parent;
 } Node;
 
 
-Node* createNode(unsigned long hashIndex, char* path, char* prettyPath, Node *parent) {
+static Node* createNode(unsigned long hashIndex, char* path, char* prettyPath, Node *parent) {
+    TRACE_COUNT(TRACE_ALLOC);
     Node* node = (Node*) malloc(sizeof(Node));
     node->path = strdup(path);
 
@@ -85,6 +94,7 @@ Node* createNode(unsigned long hashIndex, char* path, char* prettyPath, Node *pa
     node->prettyPathLen = strlen(prettyPath);
 
     node->key = hashIndex;
+    node->fd = -1;
 
     node->prev = node->next = NULL;
     node->parent = parent;
@@ -102,7 +112,7 @@ typedef struct {
 
 
 
-LRUCache* createCache(unsigned long capacity) {
+static LRUCache* createCache(unsigned long capacity) {
     LRUCache *cache = (LRUCache*) malloc(sizeof(LRUCache));
     memset(cache, 0, sizeof(LRUCache));
 
@@ -120,7 +130,7 @@ LRUCache* createCache(unsigned long capacity) {
 }
 
 
-void addToFront(LRUCache *cache, Node *node) {
+static void addToFront(LRUCache *cache, Node *node) {
     node->lruNext = cache->head;
     node->lruPrev = NULL;
     if (cache->head != NULL) {
@@ -133,7 +143,7 @@ void addToFront(LRUCache *cache, Node *node) {
     cache->size++;
 }
 
-void removeFromList(LRUCache *cache, Node *node) {
+static void removeFromList(LRUCache *cache, Node *node) {
     if (node->lruPrev != NULL) {
         node->lruPrev->lruNext = node->lruNext;
     } else {
@@ -149,7 +159,7 @@ void removeFromList(LRUCache *cache, Node *node) {
     cache->size--;
 }
 
-void evictIfNecessary(LRUCache *cache) {
+static void evictIfNecessary(LRUCache *cache) {
     if (cache->size < cache->capacity) {
         return;
     }
@@ -166,12 +176,13 @@ void evictIfNecessary(LRUCache *cache) {
         last->next->prev = last->prev;
     }
 
+    if (last->fd != -1) close(last->fd);
     free(last->path);
     free(last->prettyPath);
     free(last);
 }
 
-void put(LRUCache *cache, unsigned long hashIndex, Node* newNode) {
+static void put(LRUCache *cache, unsigned long hashIndex, Node* newNode) {
     newNode->next = cache->array[hashIndex];
     if (cache->array[hashIndex] != NULL) {
         cache->array[hashIndex]->prev = newNode;
@@ -183,7 +194,7 @@ void put(LRUCache *cache, unsigned long hashIndex, Node* newNode) {
 }
 
 
-Node* get(LRUCache *cache, unsigned long hashIndex, char *path) {
+static Node* get(LRUCache *cache, unsigned long hashIndex, char *path) {
     Node *node = cache->array[hashIndex];
     while (node != NULL) {
         if (strcmp(node->path, path) == 0) {
@@ -198,7 +209,23 @@ Node* get(LRUCache *cache, unsigned long hashIndex, char *path) {
 
 
 
-Node* formatNode(LRUCache *cache, unsigned long homeHash, char* path) {
+// Closes the descriptors the cached directories hold.
+static void freeCache(LRUCache *cache) {
+    Node *node = cache->head;
+    while (node != NULL) {
+        Node *next = node->lruNext;
+        if (node->fd != -1) close(node->fd);
+        free(node->path);
+        free(node->prettyPath);
+        free(node);
+        node = next;
+    }
+    free(cache->array);
+    free(cache);
+}
+
+
+static Node* formatNode(LRUCache *cache, unsigned long homeHash, char* path) {
     if (!path) return NULL;
     unsigned long hashIndex = hashFunction(path);
 
@@ -212,6 +239,9 @@ Node* formatNode(LRUCache *cache, unsigned long homeHash, char* path) {
     // root special case
     if (lastSlash == NULL) {
         node = createNode(hashIndex, path, "", NULL);
+        if (path[0] == '\0') {
+            node->fd = open("/", O_PATH | O_DIRECTORY | O_CLOEXEC);
+        }
         put(cache, hashIndex, node);
         return node;
     }
@@ -225,7 +255,8 @@ Node* formatNode(LRUCache *cache, unsigned long homeHash, char* path) {
     Node* parentNode = formatNode(cache, homeHash, parentPath);
     if (parentNode == NULL ) return NULL; // does not exist
 
-    int dirresult = directoryHasGit(path);
+    int fd = -1;
+    int dirresult = directoryHasGit(parentNode->fd, path, &fd);
     if (dirresult == 0) return NULL; // does not exist
 
     if (homeHash == hashIndex) {
@@ -262,6 +293,7 @@ Node* formatNode(LRUCache *cache, unsigned long homeHash, char* path) {
     prettyPath[idx] = '\0';
 
     node = createNode(hashIndex, path, prettyPath, parentNode);
+    node->fd = fd;
     put(cache, hashIndex, node);
 
     return node;
@@ -273,42 +305,221 @@ typedef struct Entry {
     double score;
 } Entry;
 
-int compareEntries(const void* a, const void* b) {
+static int compareEntries(const void* a, const void* b) {
     Entry *entryA = (Entry *)a;
     Entry *entryB = (Entry *)b;
     return (entryB->score - entryA->score); // For descending order
 }
 
-int main() {
-    char *zPath = getenv("ZSHZ_LOCATION");
-    if (zPath == NULL) {
-        printf("pleas set ZSHZ_LOCATION in you env\n");
-        exit(1);
+typedef struct DeadEntry {
+    char *path;
+    time_t since;
+} DeadEntry;
+
+static int compareDeadEntries(const void* a, const void* b) {
+    return strcmp(((DeadEntry *)a)->path, ((DeadEntry *)b)->path);
+}
+
+
+// Reads the "path|since" sidecar that remembers when each entry was first
+// seen dead. Returns the number of entries read into deadSince.
+static int readDeadSince(const char* deadPath, DeadEntry* deadSince, int max) {
+    FILE *file = fopen(deadPath, "r");
+    if (file == NULL) return 0;
+
+    char line[1024];
+    int count = 0;
+    while (fgets(line, sizeof(line), file) && count < max) {
+        char *sep = strrchr(line, '|');
+        if (sep == NULL) continue;
+        *sep = '\0';
+        deadSince[count].path = strdup(line);
+        deadSince[count].since = atol(sep + 1);
+        count++;
     }
-    char *home = getenv("HOME");
-    if (home == NULL) {
-        exit(1);
+    fclose(file);
+
+    qsort(deadSince, count, sizeof(DeadEntry), compareDeadEntries);
+    return count;
+}
+
+
+// Writes the datafile without the expired entries. Runs with the datafile
+// locked so that a concurrent `z` update from the shell is not lost: zsh-z
+// takes its lock with `zsystem flock`, an fcntl lock, which flock(2) would
+// not see.
+static void rewriteDatafile(const char* zPath, DeadEntry* expired, int expiredCount) {
+    int fd = open(zPath, O_RDWR | O_CLOEXEC);
+    if (fd == -1) return;
+
+    struct flock lock = { .l_type = F_WRLCK, .l_whence = SEEK_SET };
+    int locked = 0;
+    for (int i = 0; i < LOCK_ATTEMPTS && !locked; i++) {
+        if (fcntl(fd, F_SETLK, &lock) == 0) {
+            locked = 1;
+        } else {
+            usleep(20000);
+        }
     }
 
-    unsigned long homeHash = hashFunction(home);
-    LRUCache* cache = createCache(MAX_HASH);
+    // give up if the lock is contended or the datafile has been replaced
+    // while we were waiting for it
+    struct stat locked_sb, current_sb;
+    if (!locked || fstat(fd, &locked_sb) != 0 || stat(zPath, &current_sb) != 0
+            || locked_sb.st_ino != current_sb.st_ino || locked_sb.st_dev != current_sb.st_dev) {
+        close(fd);
+        return;
+    }
 
-    FILE *file = fopen(zPath, "r");
+    char tempPath[1024];
+    snprintf(tempPath, sizeof(tempPath), "%s.XXXXXX", zPath);
+    int tempFd = mkstemp(tempPath);
+    if (tempFd == -1) {
+        close(fd);
+        return;
+    }
+    fchmod(tempFd, locked_sb.st_mode & 07777);
+
+    FILE *in = fdopen(fd, "r");
+    FILE *out = fdopen(tempFd, "w");
     char line[1024];
-    Entry entries[MAX_ENTRIES];
-    int count = 0;
+    char path[1024];
+    int removed = 0;
+
+    while (fgets(line, sizeof(line), in)) {
+        size_t pathLen = strcspn(line, "|");
+        memcpy(path, line, pathLen);
+        path[pathLen] = '\0';
+
+        DeadEntry key = { path, 0 };
+        if (bsearch(&key, expired, expiredCount, sizeof(DeadEntry), compareDeadEntries)) {
+            removed++;
+            continue;
+        }
+        fputs(line, out);
+    }
+
+    int failed = ferror(in) || fflush(out) != 0 || fsync(tempFd) != 0;
+    if (failed || removed == 0 || rename(tempPath, zPath) != 0) {
+        unlink(tempPath);
+    }
+
+    fclose(out);
+    fclose(in); // releases the lock
+}
+
+
+// Remembers when each dead entry was first seen and drops the ones that
+// have been dead for longer than the threshold from the datafile. Runs in a
+// detached, low-priority child after the listing has been flushed, so the
+// caller never waits for it. In the zsh/fileopener module that child is a
+// copy of the shell, which is why it lets go of every descriptor first.
+static void pruneDeadEntries(const char* zPath, char** dead, int deadCount) {
+    TRACE_COUNT(TRACE_FORK);
+    pid_t pid = fork();
+    if (pid != 0) return;
+
+    // don't keep the pipe to fzy open, nor the shell's terminal, history
+    // file and coprocesses
+    setsid();
+    int devNull = open("/dev/null", O_RDWR);
+    if (devNull != -1) {
+        dup2(devNull, STDIN_FILENO);
+        dup2(devNull, STDOUT_FILENO);
+        dup2(devNull, STDERR_FILENO);
+        close(devNull);
+    }
+#ifdef SYS_close_range
+    if (syscall(SYS_close_range, 3, ~0U, 0) != 0)
+#endif
+    {
+        for (int fd = 3; fd < 1024; fd++) close(fd);
+    }
+    setpriority(PRIO_PROCESS, 0, 19);
+#ifdef SYS_ioprio_set
+    // IOPRIO_WHO_PROCESS, IOPRIO_CLASS_IDLE
+    syscall(SYS_ioprio_set, 1, 0, 3 << 13);
+#endif
+
+    time_t now = time(NULL);
+    time_t pruneAfter = PRUNE_AFTER;
+    char *pruneAfterEnv = getenv("ZSHZ_PRUNE_AFTER");
+    if (pruneAfterEnv != NULL) {
+        pruneAfter = atol(pruneAfterEnv);
+    }
+
+    char deadPath[1024];
+    snprintf(deadPath, sizeof(deadPath), "%s.dead", zPath);
+    DeadEntry *deadSince = malloc(sizeof(DeadEntry) * MAX_ENTRIES);
+    int deadSinceCount = readDeadSince(deadPath, deadSince, MAX_ENTRIES);
+
+    DeadEntry *expired = malloc(sizeof(DeadEntry) * deadCount);
+    DeadEntry *pending = malloc(sizeof(DeadEntry) * deadCount);
+    int expiredCount = 0, pendingCount = 0;
+
+    for (int i = 0; i < deadCount; i++) {
+        DeadEntry key = { dead[i], now };
+        DeadEntry *known = bsearch(&key, deadSince, deadSinceCount, sizeof(DeadEntry), compareDeadEntries);
+        if (known != NULL) {
+            key.since = known->since;
+        }
+
+        if (now - key.since >= pruneAfter) {
+            expired[expiredCount++] = key;
+        } else {
+            pending[pendingCount++] = key;
+        }
+    }
+
+    if (expiredCount > 0) {
+        qsort(expired, expiredCount, sizeof(DeadEntry), compareDeadEntries);
+        rewriteDatafile(zPath, expired, expiredCount);
+    }
+
+    // entries that came back to life are simply not written again
+    char tempPath[1024];
+    snprintf(tempPath, sizeof(tempPath), "%s.XXXXXX", deadPath);
+    int tempFd = mkstemp(tempPath);
+    if (tempFd != -1) {
+        FILE *out = fdopen(tempFd, "w");
+        for (int i = 0; i < pendingCount; i++) {
+            fprintf(out, "%s|%ld\n", pending[i].path, (long)pending[i].since);
+        }
+        if (fclose(out) != 0 || rename(tempPath, deadPath) != 0) {
+            unlink(tempPath);
+        }
+    }
 
+    _exit(0);
+}
+
+
+int zListDirectories(const char* zPath, const char* home, FILE* out) {
+    unsigned long homeHash = hashFunction(home);
+
+    FILE *file = fopen(zPath, "r");
     if (file == NULL) {
         perror("Error opening file");
         return -1;
     }
 
+    LRUCache* cache = createCache(MAX_HASH);
+    char line[1024];
+    Entry *entries = malloc(sizeof(Entry) * MAX_ENTRIES);
+    int count = 0;
+    char **dead = malloc(sizeof(char*) * MAX_ENTRIES);
+    int deadCount = 0;
+
+    TRACE_BEGIN("read");
     while (fgets(line, sizeof(line), file) && count < MAX_ENTRIES) {
         char *token = strtok(line, "|");
         if (token != NULL) {
 
             Node* result = formatNode(cache, homeHash, token);
-            if (result == NULL ) continue; // does not exist
+            if (result == NULL ) { // does not exist
+                if (deadCount < MAX_ENTRIES) dead[deadCount++] = strdup(token);
+                continue;
+            }
 
             strcpy(entries[count].path, result->prettyPath);
             token = strtok(NULL, "|");
@@ -320,13 +531,65 @@ int main() {
     }
 
     fclose(file);
+    freeCache(cache);
+    TRACE_END("read");
 
+    TRACE_BEGIN("sort");
     qsort(entries, count, sizeof(Entry), compareEntries);
+    TRACE_END("sort");
 
-    printf("%s", resetColor);
+    TRACE_BEGIN("write");
+    fprintf(out, "%s", resetColor);
     for (int i = 0; i < count; i++) {
-        printf("%s\n", entries[i].path);
+        fprintf(out, "%s\n", entries[i].path);
+    }
+    fflush(out);
+    TRACE_END("write");
+
+    if (deadCount > 0) {
+        TRACE_BEGIN("prune");
+        pruneDeadEntries(zPath, dead, deadCount);
+        TRACE_END("prune");
     }
 
+    for (int i = 0; i < deadCount; i++) {
+        free(dead[i]);
+    }
+    free(dead);
+    free(entries);
+    gitRepoCacheReset();
     return 0;
 }
+
+
+#ifndef FILEOPENER_MODULE
+int zMain(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    TRACE_INIT("z");
+    char *zPath = getenv("ZSHZ_LOCATION");
+    if (zPath == NULL) {
+        printf("pleas set ZSHZ_LOCATION in you env\n");
+        exit(1);
+    }
+    char *home = getenv("HOME");
+    if (home == NULL) {
+        exit(1);
+    }
+
+    // every cached directory holds a descriptor for its children
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    return zListDirectories(zPath, home, stdout);
+}
+
+#ifndef FILEOPENER_MULTICALL
+int main(int argc, char **argv) {
+    return zMain(argc, argv);
+}
+#endif
+#endif
@@ -0,0 +1,14 @@
+#ifndef Z_H
+#define Z_H
+
+#include <stdio.h>
+
+// Writes the directories of the z datafile at zPath to out, most frecent
+// first and colorized like colorpath, and prunes the ones that have been
+// gone for a while in the background. Returns 0 on success.
+int zListDirectories(const char* zPath, const char* home, FILE* out);
+
+// The z program itself, called by main or by the multi-call binary.
+int zMain(int argc, char** argv);
+
+#endif